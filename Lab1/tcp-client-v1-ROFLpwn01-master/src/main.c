@@ -4,7 +4,7 @@
 int main(int argc, char *argv[]) {
 
     log_set_level(LOG_WARN);
-    Config defaultValues = {TCP_CLIENT_DEFAULT_PORT, TCP_CLIENT_DEFAULT_HOST, "", ""};
+    Config defaultValues = {TCP_CLIENT_DEFAULT_PORT, TCP_CLIENT_DEFAULT_HOST, "", "", 0, NULL, NULL, 0};
 
     if (tcp_client_parse_arguments(argc, argv, &defaultValues))
         exit(EXIT_FAILURE);
@@ -15,6 +15,16 @@ int main(int argc, char *argv[]) {
     if (sockfd == -1)
         exit(EXIT_FAILURE);
 
+    // Batch mode reuses this connection for every request
+    if (defaultValues.batch) {
+        int result = defaultValues.control != NULL
+                         ? tcp_client_serve_control(sockfd, defaultValues)
+                         : tcp_client_run_batch(sockfd, defaultValues);
+        if (tcp_client_close(sockfd) || result)
+            exit(EXIT_FAILURE);
+        exit(EXIT_SUCCESS);
+    }
+
     if (tcp_client_send_request(sockfd, defaultValues))
         exit(EXIT_FAILURE);
 
@@ -1,10 +1,13 @@
 #include "tcp_client.h"
 #include "log.h"
 #include <ctype.h>
+#include <signal.h>
 
 #define ARG_ERROR 1
 #define MAX_PORT_NUMBER 65535
 #define ARGUMENTS 2
+#define MAX_LENGTH_DIGITS 10
+#define HEADER_SIZE 32
 
 /*
 Description:
@@ -15,7 +18,9 @@ Return value:
     None.
 */
 void printInfoMenu() {
-    fprintf(stderr, "\nUsage: tcp_client [--help] [-v] [-h HOST] [-p PORT] ACTION MESSAGE\n\n"
+    fprintf(stderr, "\nUsage: tcp_client [--help] [-v] [-h HOST] [-p PORT] ACTION MESSAGE\n"
+                    "       tcp_client [-v] [-h HOST] [-p PORT] -b [ACTION MESSAGE]...\n"
+                    "       tcp_client [-v] [-h HOST] [-p PORT] -C PATH\n\n"
                     "Arguments:\n"
                     "ACTION   Must be uppercase, lowercase, rreverse,\n"
                     "\t   shuffle, or random.\n"
@@ -24,7 +29,26 @@ void printInfoMenu() {
                     "  --help\n"
                     "  -v, --verbose\n"
                     "  --host HOSTNAME, -h HOSTNAME\n"
-                    "  --port PORT, -p PORT\n");
+                    "  --port PORT, -p PORT\n"
+                    "  -b, --batch           Send every ACTION MESSAGE pair over one connection,\n"
+                    "                        reading \"ACTION MESSAGE\" lines from stdin if none\n"
+                    "                        are given. The server must length-prefix responses.\n"
+                    "  --control PATH, -C PATH\n"
+                    "                        Keep one connection open and serve requests written\n"
+                    "                        to the Unix socket PATH\n");
+}
+
+/*
+Description:
+    Checks that an action is one the server understands.
+Arguments:
+    const char *action: The action
+Return value:
+    Returns a 1 if the action is valid, 0 otherwise
+*/
+static int isValidAction(const char *action) {
+    return !strcmp(action, "uppercase") || !strcmp(action, "lowercase") ||
+           !strcmp(action, "reverse") || !strcmp(action, "shuffle") || !strcmp(action, "random");
 }
 
 /*
@@ -51,13 +75,15 @@ int tcp_client_parse_arguments(int argc, char *argv[], Config *config) {
     static struct option longOptions[] = {{"verbose", no_argument, NULL, 'v'},
                                           {"host", required_argument, NULL, 'h'},
                                           {"port", required_argument, NULL, 'p'},
+                                          {"batch", no_argument, NULL, 'b'},
+                                          {"control", required_argument, NULL, 'C'},
                                           {0, 0, 0, 0}};
 
     int opt;
 
     // Loops through until a valid combination of aguments is made
     while (1) {
-        opt = getopt_long(argc, argv, "vh:p:", longOptions, &optionIndex);
+        opt = getopt_long(argc, argv, "vh:p:bC:", longOptions, &optionIndex);
 
         if (opt == -1)
             break;
@@ -91,6 +117,14 @@ int tcp_client_parse_arguments(int argc, char *argv[], Config *config) {
             log_debug("Port: %s", optarg);
             config->port = optarg;
             break;
+        case 'b':
+            config->batch = 1;
+            break;
+        case 'C':
+            log_debug("Control socket: %s", optarg);
+            config->control = optarg;
+            config->batch = 1;
+            break;
         case ':': // Missing option argument
             log_error("Missing option argument\n\n");
             printInfoMenu();
@@ -109,15 +143,38 @@ int tcp_client_parse_arguments(int argc, char *argv[], Config *config) {
         }
     }
 
+    // Batch mode takes any number of action and message pairs
+    if (config->batch) {
+        if (config->control != NULL && optind < argc) {
+            log_error("\"action\" and \"message\" arguments can't be used with a control socket.");
+            printInfoMenu();
+            return ARG_ERROR;
+        }
+        if ((argc - optind) % ARGUMENTS != 0) {
+            log_error("Every \"action\" needs a \"message\".");
+            printInfoMenu();
+            return ARG_ERROR;
+        }
+        for (int i = optind; i < argc; i += ARGUMENTS) {
+            if (!isValidAction(argv[i])) {
+                log_error("Unknown argument provided");
+                printInfoMenu();
+                return ARG_ERROR;
+            }
+        }
+        config->pairs = argv + optind;
+        config->pairCount = (argc - optind) / ARGUMENTS;
+        log_debug("\tPairs: %d", config->pairCount);
+        return 0;
+    }
+
     // Must have action and message
     if ((argc - optind) != ARGUMENTS) {
         log_error("\"action\" and \"message\" arguments are required.");
         printInfoMenu();
         return ARG_ERROR;
     } else {
-        if (strcmp(argv[optind], "uppercase") && strcmp(argv[optind], "lowercase") &&
-            strcmp(argv[optind], "reverse") && strcmp(argv[optind], "shuffle") &&
-            strcmp(argv[optind], "random")) {
+        if (!isValidAction(argv[optind])) {
             log_error("Unknown argument provided");
             printInfoMenu();
             return ARG_ERROR;
@@ -183,6 +240,44 @@ int tcp_client_connect(Config config) {
     return sockfd;
 }
 
+/*
+Description:
+    Sends every byte described by an array of buffers, continuing after partial writes.
+Arguments:
+    int sockfd: Socket file descriptor
+    struct iovec *iov: The buffers to send, updated as they are sent
+    int iovCount: The number of buffers
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int sendAll(int sockfd, struct iovec *iov, int iovCount) {
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovCount;
+    while (msg.msg_iovlen > 0) {
+        ssize_t bytesSent = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+        if (bytesSent == -1) {
+            if (errno == EINTR)
+                continue;
+            log_error("Error with sending.");
+            return 1;
+        }
+        log_debug("Bytes sent: %zd", bytesSent);
+        while (msg.msg_iovlen > 0 && (size_t)bytesSent >= msg.msg_iov->iov_len) {
+            bytesSent -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + bytesSent;
+            msg.msg_iov->iov_len -= bytesSent;
+        }
+    }
+    return 0;
+}
+
 /*
 Description:
     Creates and sends request to server using the socket and configuration.
@@ -193,26 +288,25 @@ Return value:
     Returns a 1 on failure, 0 on success
 */
 int tcp_client_send_request(int sockfd, Config config) {
-    int messageLength, bytesSent, sendLength;
-    char request[TCP_CLIENT_MAX_INPUT_SIZE];
+    char header[HEADER_SIZE];
+    size_t messageLength;
+    int headerLength;
 
     // Find message length
     messageLength = strlen(config.message);
     log_info("Configuring message...");
 
-    // Create request
-    sprintf(request, "%s %d %s", config.action, messageLength, config.message);
-    sendLength = strlen(request);
-    log_debug("Sending message... \"%s\"", request);
-
-    // Send message
-    bytesSent = send(sockfd, request, sendLength, 0);
-    if (bytesSent < (ssize_t)strlen(request)) {
-        log_error("Error with sending.");
+    // Create request header; the message is sent straight from where it is
+    headerLength = snprintf(header, sizeof(header), "%s %zu ", config.action, messageLength);
+    if (headerLength < 0 || headerLength >= HEADER_SIZE) {
+        log_error("Action is too long: %s", config.action);
         return 1;
     }
-    log_debug("Bytes sent: %d", bytesSent);
-    return 0;
+    log_debug("Sending message... \"%s%s\"", header, config.message);
+
+    // Send message
+    struct iovec iov[2] = {{header, headerLength}, {config.message, messageLength}};
+    return sendAll(sockfd, iov, 2);
 }
 
 /*
@@ -228,7 +322,7 @@ Return value:
 int tcp_client_receive_response(int sockfd, char *buf, int buf_size) {
     int returnValue;
     log_info("Receiving response...");
-    if ((returnValue = recv(sockfd, buf, buf_size, 0)) <= 0) {
+    if ((returnValue = recv(sockfd, buf, buf_size - 1, 0)) <= 0) {
         log_error("Receive failed :( Bytes read: %d", returnValue);
         return 1;
     }
@@ -237,6 +331,338 @@ int tcp_client_receive_response(int sockfd, char *buf, int buf_size) {
     return 0;
 }
 
+/*
+Description:
+    Prepares a reader for the responses of a persistent connection.
+Arguments:
+    ResponseReader *reader: The reader to initialize
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_reader_init(ResponseReader *reader) {
+    reader->capacity = TCP_CLIENT_READER_SIZE;
+    reader->start = 0;
+    reader->end = 0;
+    reader->buffer = malloc(reader->capacity);
+    if (reader->buffer == NULL) {
+        log_error("Unable to allocate the response buffer");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Frees a reader's buffer.
+Arguments:
+    ResponseReader *reader: The reader to free
+Return value:
+    None.
+*/
+void tcp_client_reader_free(ResponseReader *reader) {
+    free(reader->buffer);
+    reader->buffer = NULL;
+}
+
+/*
+Description:
+    Receives until the reader holds at least the given number of unread bytes. Unread bytes are
+    moved to the front of the buffer, and the buffer grows, only when they would not fit otherwise.
+Arguments:
+    int sockfd: Socket file descriptor
+    ResponseReader *reader: The reader
+    size_t needed: The number of unread bytes needed
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int fillReader(int sockfd, ResponseReader *reader, size_t needed) {
+    while (reader->end - reader->start < needed) {
+        if (reader->start + needed > reader->capacity) {
+            memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+            reader->end -= reader->start;
+            reader->start = 0;
+        }
+        if (needed > reader->capacity) {
+            size_t capacity = reader->capacity * 2 > needed ? reader->capacity * 2 : needed;
+            char *buffer = realloc(reader->buffer, capacity);
+            if (buffer == NULL) {
+                log_error("Unable to grow the response buffer to %zu bytes", capacity);
+                return 1;
+            }
+            reader->buffer = buffer;
+            reader->capacity = capacity;
+        }
+
+        ssize_t bytesReceived =
+            recv(sockfd, reader->buffer + reader->end, reader->capacity - reader->end, 0);
+        if (bytesReceived == -1) {
+            if (errno == EINTR)
+                continue;
+            log_error("Receive failed :( %s", strerror(errno));
+            return 1;
+        }
+        if (bytesReceived == 0) {
+            log_error("Server closed the connection");
+            return 1;
+        }
+        reader->end += bytesReceived;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Receives one length-delimited "<len> <payload>" response from a persistent connection. The
+    response can be any size; the reader's buffer grows to hold it.
+Arguments:
+    int sockfd: Socket file descriptor
+    ResponseReader *reader: The reader holding bytes already received
+    char **response: Set to the response, which is not null terminated and is only valid until
+                     the next call
+    size_t *length: Set to the length of the response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_read_response(int sockfd, ResponseReader *reader, char **response, size_t *length) {
+    size_t digits = 0;
+    size_t responseLength = 0;
+
+    // The length can arrive split over several reads, so it is parsed a byte at a time
+    while (1) {
+        if (fillReader(sockfd, reader, digits + 1))
+            return 1;
+        char c = reader->buffer[reader->start + digits];
+        if (c == ' ' && digits > 0)
+            break;
+        if (!isdigit((unsigned char)c) || digits == MAX_LENGTH_DIGITS) {
+            log_error("Malformed response length");
+            return 1;
+        }
+        responseLength = responseLength * 10 + (c - '0');
+        digits++;
+    }
+
+    if (fillReader(sockfd, reader, digits + 1 + responseLength))
+        return 1;
+    *response = reader->buffer + reader->start + digits + 1;
+    *length = responseLength;
+    reader->start += digits + 1 + responseLength;
+    log_debug("Receive successful :D Response length: %zu", responseLength);
+    return 0;
+}
+
+/*
+Description:
+    Splits an "ACTION MESSAGE" line in place, dropping the newline.
+Arguments:
+    char *line: The line
+    ssize_t lineLength: The length of the line
+    Config *config: Its action and message are pointed into the line
+Return value:
+    Returns a 1 if the line is not a valid request, 0 otherwise
+*/
+static int splitLine(char *line, ssize_t lineLength, Config *config) {
+    if (lineLength > 0 && line[lineLength - 1] == '\n')
+        line[--lineLength] = '\0';
+
+    char *space = strchr(line, ' ');
+    if (space == NULL) {
+        log_error("\"action\" and \"message\" are required, skipping line: %s", line);
+        return 1;
+    }
+    *space = '\0';
+    if (!isValidAction(line)) {
+        log_error("Unknown action, skipping line: %s", line);
+        return 1;
+    }
+    config->action = line;
+    config->message = space + 1;
+    return 0;
+}
+
+/*
+Description:
+    Sends one request and waits for its response.
+Arguments:
+    int sockfd: Socket file descriptor
+    ResponseReader *reader: The reader for the connection
+    Config config: Holds the action and message to send
+    char **response: Set to the response, valid until the reader is used again
+    size_t *length: Set to the length of the response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int exchange(int sockfd, ResponseReader *reader, Config config, char **response,
+                    size_t *length) {
+    if (tcp_client_send_request(sockfd, config))
+        return 1;
+    return tcp_client_read_response(sockfd, reader, response, length);
+}
+
+/*
+Description:
+    Sends every action/message pair over one connection, printing each response as it arrives.
+    The pairs come from config.pairs, or from "ACTION MESSAGE" lines on stdin when there are none.
+Arguments:
+    int sockfd: Socket file descriptor
+    Config config: A config struct with the necessary information.
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_run_batch(int sockfd, Config config) {
+    ResponseReader reader;
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    int result = 0;
+
+    if (tcp_client_reader_init(&reader))
+        return 1;
+
+    for (int i = 0;; i++) {
+        if (config.pairCount > 0) {
+            if (i == config.pairCount)
+                break;
+            config.action = config.pairs[i * ARGUMENTS];
+            config.message = config.pairs[i * ARGUMENTS + 1];
+        } else {
+            ssize_t lineLength = getline(&line, &lineCapacity, stdin);
+            if (lineLength == -1)
+                break;
+            if (splitLine(line, lineLength, &config))
+                continue;
+        }
+
+        char *response;
+        size_t length;
+        if (exchange(sockfd, &reader, config, &response, &length)) {
+            result = 1;
+            break;
+        }
+        fwrite(response, 1, length, stdout);
+        putchar('\n');
+        // Whoever is writing to stdin may be waiting for this response before sending the next
+        if (config.pairCount == 0)
+            fflush(stdout);
+    }
+
+    free(line);
+    tcp_client_reader_free(&reader);
+    return result;
+}
+
+/*
+Description:
+    Answers the requests of one control socket client until it disconnects.
+Arguments:
+    int sockfd: Socket file descriptor of the server connection
+    ResponseReader *reader: The reader for the server connection
+    int clientfd: Socket file descriptor of the control client
+    Config config: A config struct with the necessary information.
+Return value:
+    Returns a 1 if the server connection failed, 0 otherwise
+*/
+static int serveClient(int sockfd, ResponseReader *reader, int clientfd, Config config) {
+    FILE *stream = fdopen(clientfd, "r");
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    ssize_t lineLength;
+    int result = 0;
+
+    if (stream == NULL) {
+        log_error("Unable to read from the control client");
+        close(clientfd);
+        return 0;
+    }
+
+    log_info("Control client connected");
+    while ((lineLength = getline(&line, &lineCapacity, stream)) != -1) {
+        char header[HEADER_SIZE];
+        char *response = "";
+        size_t length = 0;
+
+        if (!splitLine(line, lineLength, &config) &&
+            exchange(sockfd, reader, config, &response, &length)) {
+            result = 1;
+            break;
+        }
+
+        int headerLength = snprintf(header, sizeof(header), "%zu ", length);
+        struct iovec iov[2] = {{header, headerLength}, {response, length}};
+        if (sendAll(clientfd, iov, 2)) {
+            log_warn("Control client went away before reading its response");
+            break;
+        }
+    }
+    log_info("Control client disconnected");
+
+    free(line);
+    fclose(stream);
+    return result;
+}
+
+/*
+Description:
+    Listens on the Unix socket at config.control and forwards every "ACTION MESSAGE" line its
+    clients write over the one server connection. Each line is answered with the server's
+    "<len> <payload>" response; lines with an unknown action get an empty one. Only returns on
+    failure.
+Arguments:
+    int sockfd: Socket file descriptor
+    Config config: A config struct with the necessary information.
+Return value:
+    Returns a 1 on failure
+*/
+int tcp_client_serve_control(int sockfd, Config config) {
+    struct sockaddr_un address;
+    ResponseReader reader;
+    int listener;
+
+    if (strlen(config.control) >= sizeof(address.sun_path)) {
+        log_error("Control socket path is too long: %s", config.control);
+        return 1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, config.control);
+
+    if ((listener = socket(AF_UNIX, SOCK_STREAM, 0)) == TCP_CLIENT_BAD_SOCKET) {
+        log_error("control: socket failed to create");
+        return 1;
+    }
+    // A socket file left behind by an earlier run would make bind fail
+    unlink(config.control);
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+        listen(listener, SOMAXCONN) == -1) {
+        log_error("control: unable to listen on %s: %s", config.control, strerror(errno));
+        close(listener);
+        return 1;
+    }
+    if (tcp_client_reader_init(&reader)) {
+        close(listener);
+        unlink(config.control);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    log_info("Listening for requests on %s", config.control);
+    while (1) {
+        int clientfd = accept(listener, NULL, NULL);
+        if (clientfd == -1) {
+            if (errno == EINTR)
+                continue;
+            log_error("control: accept failed: %s", strerror(errno));
+            break;
+        }
+        if (serveClient(sockfd, &reader, clientfd, config))
+            break;
+    }
+
+    tcp_client_reader_free(&reader);
+    close(listener);
+    unlink(config.control);
+    return 1;
+}
+
 /*
 Description:
     Closes the given socket.
@@ -12,12 +12,15 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #define TCP_CLIENT_BAD_SOCKET -1
 #define TCP_CLIENT_DEFAULT_PORT "8080"
 #define TCP_CLIENT_DEFAULT_HOST "localhost"
 #define TCP_CLIENT_MAX_INPUT_SIZE 1024
+#define TCP_CLIENT_READER_SIZE 65536
 
 /*
 Contains all of the information needed to create to connect to the server and send it a message.
@@ -27,8 +30,23 @@ typedef struct Config {
     char *host;
     char *action;
     char *message;
+    int batch;
+    char *control;
+    char **pairs;
+    int pairCount;
 } Config;
 
+/*
+Buffers length-delimited "<len> <payload>" responses read from a persistent connection. Bytes
+between start and end have been received but not yet returned.
+*/
+typedef struct ResponseReader {
+    char *buffer;
+    size_t capacity;
+    size_t start;
+    size_t end;
+} ResponseReader;
+
 /*
 Description:
     Parses the commandline arguments and options given to the program.
@@ -78,6 +96,66 @@ Return value:
 */
 int tcp_client_receive_response(int sockfd, char *buf, int buf_size);
 
+/*
+Description:
+    Prepares a reader for the responses of a persistent connection.
+Arguments:
+    ResponseReader *reader: The reader to initialize
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_reader_init(ResponseReader *reader);
+
+/*
+Description:
+    Frees a reader's buffer.
+Arguments:
+    ResponseReader *reader: The reader to free
+Return value:
+    None.
+*/
+void tcp_client_reader_free(ResponseReader *reader);
+
+/*
+Description:
+    Receives one length-delimited "<len> <payload>" response from a persistent connection. The
+    response can be any size; the reader's buffer grows to hold it.
+Arguments:
+    int sockfd: Socket file descriptor
+    ResponseReader *reader: The reader holding bytes already received
+    char **response: Set to the null terminated response, valid until the next call
+    size_t *length: Set to the length of the response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_read_response(int sockfd, ResponseReader *reader, char **response, size_t *length);
+
+/*
+Description:
+    Sends every action/message pair over one connection, printing each response as it arrives.
+    The pairs come from config.pairs, or from "ACTION MESSAGE" lines on stdin when there are none.
+Arguments:
+    int sockfd: Socket file descriptor
+    Config config: A config struct with the necessary information.
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_run_batch(int sockfd, Config config);
+
+/*
+Description:
+    Listens on the Unix socket at config.control and forwards every "ACTION MESSAGE" line its
+    clients write over the one server connection. Each line is answered with the server's
+    "<len> <payload>" response; lines with an unknown action get an empty one. Only returns on
+    failure.
+Arguments:
+    int sockfd: Socket file descriptor
+    Config config: A config struct with the necessary information.
+Return value:
+    Returns a 1 on failure
+*/
+int tcp_client_serve_control(int sockfd, Config config);
+
 /*
 Description:
     Closes the given socket.
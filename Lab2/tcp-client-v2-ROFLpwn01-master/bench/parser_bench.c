@@ -0,0 +1,229 @@
+/*
+Microbenchmark for the v2 receive parser, through both tcp_client_receive_response and
+tcp_client_receive_response_view. recv is wrapped at link time to serve the "<len> <payload>"
+response stream from memory in chunks of 1 to 4096 bytes, so reads split lengths and payloads at
+arbitrary points and only the parser's own work is timed. malloc, calloc and realloc are interposed
+to count allocations.
+
+Message lengths follow a mix of mostly short lines with a tail of long ones: 70% are 8-64 bytes,
+25% are 64-1024 bytes and 5% are 1-8 KiB.
+
+Usage: parser_bench [MESSAGES]
+*/
+#include <time.h>
+
+#include "log.h"
+#include "tcp_client.h"
+
+#define DEFAULT_MESSAGES 20000
+#define MIN_BENCH_NS 200000000ULL
+#define MAX_CHUNK 4096
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long allocations;
+
+// Results are stored here so the compiler cannot drop the work that produced them
+volatile size_t benchSink;
+
+void *malloc(size_t size) {
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+/*
+Responses as the server sends them, and the sizes of the chunks recv returns them in.
+*/
+static char *responseData;
+static size_t responseLength;
+static size_t *chunks;
+static size_t chunkCount;
+static size_t responseCount;
+static size_t payloadBytes;
+static size_t nextChunk;
+static size_t chunkRemaining;
+static size_t responseOffset;
+static size_t messagesHandled;
+static size_t bytesHandled;
+
+ssize_t __wrap_recv(int sockfd, void *buf, size_t len, int flags) {
+    (void)sockfd;
+    (void)flags;
+    if (chunkRemaining == 0) {
+        if (nextChunk == chunkCount)
+            return 0;
+        chunkRemaining = chunks[nextChunk++];
+    }
+    // The rest of a chunk that does not fit is handed out on the next call
+    size_t length = chunkRemaining < len ? chunkRemaining : len;
+    chunkRemaining -= length;
+    memcpy(buf, responseData + responseOffset, length);
+    responseOffset += length;
+    return length;
+}
+
+/*
+Description:
+    Returns a message length drawn from the size mix.
+Arguments:
+    unsigned *seed: State of the random number generator
+Return value:
+    The length.
+*/
+static size_t drawLength(unsigned *seed) {
+    unsigned pick = rand_r(seed) % 100;
+    if (pick < 70)
+        return 8 + rand_r(seed) % 57;
+    if (pick < 95)
+        return 64 + rand_r(seed) % 961;
+    return 1024 + rand_r(seed) % 7169;
+}
+
+/*
+Description:
+    Builds the response stream and splits it into chunks.
+Arguments:
+    size_t count: The number of responses
+Return value:
+    None.
+*/
+static void buildResponses(size_t count) {
+    unsigned seed = 426;
+    size_t offset = 0;
+
+    responseData = __libc_malloc(count * 8212);
+    responseCount = count;
+    payloadBytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t length = drawLength(&seed);
+        offset += sprintf(responseData + offset, "%zu ", length);
+        for (size_t j = 0; j < length; j++)
+            responseData[offset + j] = 'a' + rand_r(&seed) % 26;
+        offset += length;
+        payloadBytes += length;
+    }
+    responseLength = offset;
+
+    chunks = __libc_malloc(responseLength * sizeof(size_t));
+    chunkCount = 0;
+    for (offset = 0; offset < responseLength; chunkCount++) {
+        size_t length = 1 + rand_r(&seed) % MAX_CHUNK;
+        if (length > responseLength - offset)
+            length = responseLength - offset;
+        chunks[chunkCount] = length;
+        offset += length;
+    }
+}
+
+static int handleString(char *response) {
+    bytesHandled += strlen(response);
+    messagesHandled++;
+    return messagesHandled == responseCount;
+}
+
+static int handleView(const char *response, size_t length, void *context) {
+    (void)context;
+    benchSink = response[0];
+    bytesHandled += length;
+    messagesHandled++;
+    return messagesHandled == responseCount;
+}
+
+/*
+Description:
+    Returns the monotonic clock in nanoseconds.
+Arguments:
+    None.
+Return value:
+    The current time in nanoseconds.
+*/
+static unsigned long long nowNs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+Description:
+    Starts serving the response stream again from the beginning.
+Arguments:
+    None.
+Return value:
+    None.
+*/
+static void restartStream(void) {
+    nextChunk = 0;
+    chunkRemaining = 0;
+    responseOffset = 0;
+    messagesHandled = 0;
+    bytesHandled = 0;
+}
+
+/*
+Description:
+    Runs a benchmark until at least MIN_BENCH_NS have passed, then prints ns/op, bytes/sec and
+    allocations/op. Every pass must hand back exactly the payloads that were sent.
+Arguments:
+    const char *name: The name of the benchmark
+    void (*pass)(void): Receives every response once
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int runBench(const char *name, void (*pass)(void)) {
+    size_t operations = 0;
+    size_t passes = 0;
+
+    restartStream();
+    pass(); // Warm up
+    unsigned long startAllocations = allocations;
+    unsigned long long start = nowNs();
+    unsigned long long elapsed;
+    do {
+        restartStream();
+        pass();
+        if (messagesHandled != responseCount || bytesHandled != payloadBytes) {
+            fprintf(stderr, "%s: got %zu responses and %zu bytes, expected %zu and %zu\n", name,
+                    messagesHandled, bytesHandled, responseCount, payloadBytes);
+            return 1;
+        }
+        operations += messagesHandled;
+        passes++;
+        elapsed = nowNs() - start;
+    } while (elapsed < MIN_BENCH_NS);
+    unsigned long allocationCount = allocations - startAllocations;
+
+    printf("%-16s %12zu %10.1f %12.1f %10.2f\n", name, operations, (double)elapsed / operations,
+           payloadBytes * passes / (elapsed / 1e9) / 1e6, (double)allocationCount / operations);
+    return 0;
+}
+
+static void benchReceiveResponse(void) { tcp_client_receive_response(-1, handleString); }
+
+static void benchReceiveView(void) { tcp_client_receive_response_view(-1, handleView, NULL); }
+
+int main(int argc, char *argv[]) {
+    size_t messages = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_MESSAGES;
+
+    log_set_level(LOG_ERROR);
+    buildResponses(messages);
+
+    printf("%zu messages, %.1f bytes on average\n\n", responseCount,
+           (double)payloadBytes / responseCount);
+    printf("%-16s %12s %10s %12s %10s\n", "benchmark", "ops", "ns/op", "MB/s", "allocs/op");
+    if (runBench("receive_response", benchReceiveResponse) ||
+        runBench("receive_view", benchReceiveView))
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -3,8 +3,13 @@
 #include "log.h"
 #include "tcp_client.h"
 
-static size_t messagesSent = 0;
-static size_t messagesReceived = 0;
+/*
+The requests sent and the responses received so far, handed to handle_response.
+*/
+typedef struct MessageCounts {
+    size_t sent;
+    size_t received;
+} MessageCounts;
 
 void printInfoMenuMain() {
     fprintf(stderr, "\nUsage: tcp_client [--help] [-v] [-h HOST] [-p PORT] ACTION MESSAGE\n\n"
@@ -19,10 +24,12 @@ void printInfoMenuMain() {
                     "  --port PORT, -p PORT\n");
 }
 
-int handle_response(char *response) {
-    printf("%s\n", response);
-    messagesReceived++;
-    if (messagesSent > messagesReceived)
+int handle_response(const char *response, size_t length, void *context) {
+    MessageCounts *counts = context;
+    fwrite(response, 1, length, stdout);
+    putchar('\n');
+    counts->received++;
+    if (counts->sent > counts->received)
         return 0;
     else
         return 1;
@@ -31,6 +38,7 @@ int handle_response(char *response) {
 int main(int argc, char *argv[]) {
 
     Config defaultValues = {TCP_CLIENT_DEFAULT_PORT, TCP_CLIENT_DEFAULT_HOST, ""};
+    MessageCounts counts = {0, 0};
     int socket;
 
     log_set_level(LOG_ERROR);
@@ -74,15 +82,15 @@ int main(int argc, char *argv[]) {
             log_warn("Message was not sent successfully to the server");
             exit(EXIT_FAILURE);
         } else {
-            messagesSent++;
+            counts.sent++;
         }
     }
-    if ((c == -1) && (messagesSent == 0)) {
+    if ((c == -1) && (counts.sent == 0)) {
         log_warn("No messages were sent.");
     }
 
-    log_info("Messages sent: %d, messages received: %d.", messagesSent, messagesReceived);
-    tcp_client_receive_response(socket, handle_response);
+    log_info("Messages sent: %zu, messages received: %zu.", counts.sent, counts.received);
+    tcp_client_receive_response_view(socket, handle_response, &counts);
 
     if (tcp_client_close_file(file))
         log_error("Error closing gile");
@@ -9,6 +9,8 @@
 #define MAX_PORT_NUMBER 65535
 #define ARGUMENTS 2
 #define LINE_ASCII_LIMIT 1024
+#define RECEIVE_BUFFER_SIZE 65536
+#define MAX_RESPONSE_LENGTH 0x7fffffff
 
 /*
 Description:
@@ -206,8 +208,9 @@ int tcp_client_send_request(int sockfd, char *action, char *message) {
 
     log_info("Sending data to the server");
     int messageLength, sent;
-    char *request = malloc(strlen(action) + 4 + strlen(message));
-    char str[5];
+    // Room for the action, the length's digits, both spaces and the terminator
+    char *request = malloc(strlen(action) + strlen(message) + 24);
+    char str[21];
 
     sprintf(str, "%lu", strlen(message));
     log_info("Configuring message...");
@@ -221,6 +224,7 @@ int tcp_client_send_request(int sockfd, char *action, char *message) {
 
     log_info("Sending message...");
     sent = send(sockfd, request, messageLength, 0);
+    free(request);
     if (sent == -1) {
         log_error("Error with sending.");
         return -1;
@@ -228,6 +232,170 @@ int tcp_client_send_request(int sockfd, char *action, char *message) {
     return 0;
 }
 
+/*
+Incremental parser for the "<len> <payload>" response stream. Bytes between start and end have been
+received but not parsed. The length is accumulated digit by digit, so it can be split across any
+number of recv calls, and a payload is handed to the callback straight out of the buffer once all of
+it has arrived.
+*/
+typedef struct ResponseParser {
+    char *buffer;
+    size_t capacity;
+    size_t start;
+    size_t end;
+    int readingPayload;
+    size_t length;
+    size_t digits;
+} ResponseParser;
+
+/*
+Description:
+    Makes room in the parser's buffer for the next recv. Unparsed bytes are only moved to the front
+    when the free space at the back runs low, and the buffer grows when a payload will not fit, so
+    every payload ends up contiguous.
+Arguments:
+    ResponseParser *parser: The parser
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int prepareReceive(ResponseParser *parser) {
+    if (parser->start == parser->end) {
+        parser->start = 0;
+        parser->end = 0;
+    }
+
+    size_t needed = parser->readingPayload ? parser->length : 1;
+    if (parser->start > 0 &&
+        (parser->start + needed > parser->capacity || parser->end == parser->capacity)) {
+        memmove(parser->buffer, parser->buffer + parser->start, parser->end - parser->start);
+        parser->end -= parser->start;
+        parser->start = 0;
+    }
+
+    if (needed > parser->capacity) {
+        size_t capacity = parser->capacity * 2 > needed ? parser->capacity * 2 : needed;
+        // One extra byte so a payload that fills the buffer can still be null terminated
+        char *buffer = realloc(parser->buffer, capacity + 1);
+        if (buffer == NULL) {
+            log_error("Unable to grow the receive buffer to %zu bytes", capacity);
+            return 1;
+        }
+        parser->buffer = buffer;
+        parser->capacity = capacity;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Parses and handles every complete response in the parser's buffer.
+Arguments:
+    ResponseParser *parser: The parser
+    int (*handleView)(const char *, size_t, void *): Gets each response without a terminator, or
+                                                     NULL
+    int (*handleString)(char *): Gets each response null terminated, or NULL
+    void *context: Passed to handleView
+    int *finished: Set once a callback reports that all responses have been handled
+Return value:
+    Returns -1 on a malformed response, 0 otherwise
+*/
+static int parseResponses(ResponseParser *parser, int (*handleView)(const char *, size_t, void *),
+                          int (*handleString)(char *), void *context, int *finished) {
+    while (!*finished) {
+        while (!parser->readingPayload && parser->start < parser->end) {
+            char c = parser->buffer[parser->start++];
+            if (c >= '0' && c <= '9') {
+                if (parser->length > (size_t)(MAX_RESPONSE_LENGTH - (c - '0')) / 10) {
+                    log_error("Response length is larger than %d bytes", MAX_RESPONSE_LENGTH);
+                    return -1;
+                }
+                parser->length = parser->length * 10 + (c - '0');
+                parser->digits++;
+            } else if (c == ' ' && parser->digits > 0) {
+                parser->readingPayload = 1;
+            } else if (!isspace((unsigned char)c) || parser->digits > 0) {
+                log_error("Malformed response length");
+                return -1;
+            }
+        }
+        if (!parser->readingPayload || parser->end - parser->start < parser->length)
+            return 0;
+
+        char *response = parser->buffer + parser->start;
+        log_debug("Message length is: %zu", parser->length);
+        if (handleView != NULL) {
+            *finished = handleView(response, parser->length, context);
+        } else {
+            char saved = response[parser->length];
+            response[parser->length] = '\0';
+            *finished = handleString(response);
+            response[parser->length] = saved;
+        }
+        parser->start += parser->length;
+        parser->readingPayload = 0;
+        parser->length = 0;
+        parser->digits = 0;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Receives and parses responses until a callback reports that all of them have been handled.
+    Exactly one of the callbacks is used.
+Arguments:
+    int sockfd: Socket file descriptor
+    int (*handleView)(const char *, size_t, void *): Gets each response without a terminator, or
+                                                     NULL
+    int (*handleString)(char *): Gets each response null terminated, or NULL
+    void *context: Passed to handleView
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int receiveResponses(int sockfd, int (*handleView)(const char *, size_t, void *),
+                            int (*handleString)(char *), void *context) {
+    ResponseParser parser = {NULL, RECEIVE_BUFFER_SIZE, 0, 0, 0, 0, 0};
+    int finished = 0;
+    int result = 0;
+
+    parser.buffer = malloc(parser.capacity + 1);
+    if (parser.buffer == NULL) {
+        log_error("Unable to allocate the receive buffer");
+        return 1;
+    }
+
+    log_info("Beginning to receive messages.");
+    while (!finished) {
+        if (prepareReceive(&parser)) {
+            result = 1;
+            break;
+        }
+        ssize_t numbytes =
+            recv(sockfd, parser.buffer + parser.end, parser.capacity - parser.end, 0);
+        if (numbytes == -1) {
+            if (errno == EINTR)
+                continue;
+            log_error("Error receiving data");
+            result = 1;
+            break;
+        }
+        if (numbytes == 0) {
+            log_error("Server closed the connection before all responses were received");
+            result = 1;
+            break;
+        }
+        parser.end += numbytes;
+        log_debug("Number of bytes in the buffer: %zu", parser.end - parser.start);
+
+        if (parseResponses(&parser, handleView, handleString, context, &finished) == -1) {
+            result = 1;
+            break;
+        }
+    }
+    free(parser.buffer);
+    return result;
+}
+
 /*
 Description:
     Receives the response from the server. The caller must provide a function pointer that handles
@@ -241,58 +409,27 @@ Return value:
     Returns a 1 on failure, 0 on success
 */
 int tcp_client_receive_response(int sockfd, int (*handle_response)(char *)) {
-    char *index = 0;
-    int lastMessage = 0;
-    size_t numBytesInBuffer = 0;
-    size_t bufferSize = 1024;
-    char *buffer;
-    int messageLength = 0;
-
-    char *response = NULL;
-
-    buffer = malloc(sizeof(char) * bufferSize);
-    buffer[0] = '\0';
+    return receiveResponses(sockfd, NULL, handle_response, NULL);
+}
 
-    // Continues to receive messages until the last one is received
-    log_info("Beginning to receive messages.");
-    while (!lastMessage) {
-        // Allocate space for buffer
-        if (numBytesInBuffer > bufferSize / 2) {
-            bufferSize *= 2;
-            buffer = realloc(buffer, bufferSize);
-        }
-        log_info("Continue receiving data %d", sockfd);
-
-        int numbytes =
-            recv(sockfd, buffer + numBytesInBuffer, bufferSize - numBytesInBuffer - 1, 0);
-        numBytesInBuffer += numbytes;
-        buffer[numBytesInBuffer] = '\0';
-        log_debug("Number of bytes in the buffer: %zu", numBytesInBuffer);
-
-        // Scans and processes the buffer and determines if there are more messages
-        while ((index = strchr(buffer, ' ')) != NULL) {
-            log_debug("Contents of buffer: %s", buffer);
-            sscanf(buffer, "%d", &messageLength);
-            log_debug("Message length is: %zu", messageLength);
-            if (numBytesInBuffer - (index + 1 - buffer)) {
-                response = malloc(sizeof(char) * (messageLength + 1));
-                strncpy(response, index + 1, messageLength);
-                response[messageLength] = '\0';
-                lastMessage = handle_response(response);
-                free(response);
-                numBytesInBuffer -= (index - buffer) + 1 + messageLength;
-                log_debug("New number of bytes in buffer: %zu", numBytesInBuffer);
-                log_debug("Buffer: %s, New buffer: %s", buffer, index + 1 + messageLength);
-                char *tempString = malloc(sizeof(char) * (numBytesInBuffer + 1));
-                strcpy(tempString, index + 1 + messageLength);
-                strcpy(buffer, tempString);
-                free(tempString);
-                log_info("Receive successful");
-            }
-        }
-    }
-    free(buffer);
-    return 0;
+/*
+Description:
+    Receives the response from the server without copying it. The callback gets a pointer into the
+    receive buffer, the length of the response and the caller's context, and returns a true value
+    once all responses have been handled. The response is not null terminated, may contain null
+    bytes and is only valid during the callback.
+Arguments:
+    int sockfd: Socket file descriptor
+    int (*handle_response)(const char *, size_t, void *): A callback function that handles a
+                                                          response
+    void *context: Passed to handle_response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_receive_response_view(int sockfd,
+                                     int (*handle_response)(const char *, size_t, void *),
+                                     void *context) {
+    return receiveResponses(sockfd, handle_response, NULL, context);
 }
 
 /*
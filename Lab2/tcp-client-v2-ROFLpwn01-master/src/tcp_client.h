@@ -79,6 +79,24 @@ Return value:
 */
 int tcp_client_receive_response(int sockfd, int (*handle_response)(char *));
 
+/*
+Description:
+    Receives the response from the server without copying it. The callback gets a pointer into the
+    receive buffer, the length of the response and the caller's context, and returns a true value
+    once all responses have been handled. The response is not null terminated, may contain null
+    bytes and is only valid during the callback.
+Arguments:
+    int sockfd: Socket file descriptor
+    int (*handle_response)(const char *, size_t, void *): A callback function that handles a
+                                                          response
+    void *context: Passed to handle_response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_receive_response_view(int sockfd,
+                                     int (*handle_response)(const char *, size_t, void *),
+                                     void *context);
+
 /*
 Description:
     Closes the given socket.
@@ -0,0 +1,146 @@
+/*
+Compares the blocking and io_uring socket backends, the blocking backend with send batching turned
+off (one frame per sendmsg) and the io_uring backend with single-shot recv, the path taken on
+kernels without multishot recv. A loopback server thread answers every request with its message,
+and the client pipelines MESSAGES requests of SIZE bytes through each backend. Socket system calls
+made by the client are counted by wrapping send, sendmsg, recv, poll and syscall (which is how
+io_uring_enter is called) at link time; the server uses read and write so it is not counted.
+
+Usage: backend_bench [MESSAGES] [SIZE]
+*/
+#include <stdarg.h>
+
+#include "bench_server.h"
+#include "clock.h"
+#include "log.h"
+#include "tcp_client.h"
+
+#define DEFAULT_MESSAGES 100000
+#define DEFAULT_SIZE 64
+#define MAX_IN_FLIGHT 64
+
+static unsigned long socketSyscalls;
+static size_t responses;
+
+ssize_t __real_send(int sockfd, const void *buf, size_t len, int flags);
+ssize_t __real_sendmsg(int sockfd, const struct msghdr *msg, int flags);
+ssize_t __real_recv(int sockfd, void *buf, size_t len, int flags);
+int __real_poll(struct pollfd *fds, nfds_t nfds, int timeout);
+long __real_syscall(long number, ...);
+
+ssize_t __wrap_send(int sockfd, const void *buf, size_t len, int flags) {
+    socketSyscalls++;
+    return __real_send(sockfd, buf, len, flags);
+}
+
+ssize_t __wrap_sendmsg(int sockfd, const struct msghdr *msg, int flags) {
+    socketSyscalls++;
+    return __real_sendmsg(sockfd, msg, flags);
+}
+
+ssize_t __wrap_recv(int sockfd, void *buf, size_t len, int flags) {
+    socketSyscalls++;
+    return __real_recv(sockfd, buf, len, flags);
+}
+
+int __wrap_poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+    socketSyscalls++;
+    return __real_poll(fds, nfds, timeout);
+}
+
+long __wrap_syscall(long number, ...) {
+    va_list ap;
+    long args[6];
+
+    va_start(ap, number);
+    for (int i = 0; i < 6; i++)
+        args[i] = va_arg(ap, long);
+    va_end(ap);
+    socketSyscalls++;
+    return __real_syscall(number, args[0], args[1], args[2], args[3], args[4], args[5]);
+}
+
+static int handleResponse(TcpClientSession *session, const char *response, size_t length) {
+    (void)session;
+    (void)response;
+    (void)length;
+    responses++;
+    return 0;
+}
+
+/*
+Description:
+    Pipelines the requests through one backend and prints the results.
+Arguments:
+    const char *name: The name of the backend
+    Config config: Config used to connect
+    const char *input: The request file contents
+    size_t inputLength: The length of the request file
+    size_t messages: The number of requests in the file
+Return value:
+    None.
+*/
+static void runBackend(const char *name, Config config, char *input, size_t inputLength,
+                       size_t messages) {
+    TcpClientSession session;
+
+    FILE *file = fmemopen(input, inputLength, "r");
+    if (file == NULL || tcp_client_session_init(&session, config, handleResponse, NULL)) {
+        fprintf(stderr, "%s: unable to set up\n", name);
+        return;
+    }
+    if (tcp_client_session_connect(&session)) {
+        fprintf(stderr, "%s: unable to connect\n", name);
+        tcp_client_session_close(&session);
+        fclose(file);
+        return;
+    }
+
+    responses = 0;
+    socketSyscalls = 0;
+    uint64_t start = clock_now_ns();
+    int failed = tcp_client_session_pipeline(&session, file);
+    double seconds = (clock_now_ns() - start) / 1e9;
+    if (failed || responses != messages)
+        printf("%-10s failed (%zu of %zu responses)\n", name, responses, messages);
+    else
+        printf("%-10s %10zu %14.0f %14.3f\n", name, messages, messages / seconds,
+               (double)socketSyscalls / messages);
+    fclose(file);
+    tcp_client_session_close(&session);
+}
+
+int main(int argc, char *argv[]) {
+    size_t messages = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_MESSAGES;
+    size_t size = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_SIZE;
+    BenchServer server = {0};
+    size_t inputLength;
+
+    log_set_level(LOG_ERROR);
+    if (bench_server_start(&server, NULL)) {
+        perror("server");
+        return EXIT_FAILURE;
+    }
+    char *input = bench_server_build_input(messages, size, &inputLength);
+    if (input == NULL) {
+        fprintf(stderr, "Unable to set up\n");
+        return EXIT_FAILURE;
+    }
+
+    Config config = {.port = server.port, .host = "127.0.0.1", .file = "", .pipeline = 1,
+                     .maxInFlight = MAX_IN_FLIGHT, .connections = 1, .batchFrames = 1,
+                     .batchBytes = SEND_BATCH_DEFAULT_BYTES,
+                     .batchDelayUs = SEND_BATCH_DEFAULT_DELAY_US};
+    printf("%zu messages of %zu bytes, %d in flight\n\n", messages, size, MAX_IN_FLIGHT);
+    printf("%-10s %10s %14s %14s\n", "backend", "messages", "msgs/sec", "syscalls/msg");
+    runBackend("unbatched", config, input, inputLength, messages);
+    config.batchFrames = SEND_BATCH_DEFAULT_FRAMES;
+    runBackend("blocking", config, input, inputLength, messages);
+    config.ioUring = TCP_CLIENT_URING_MULTISHOT;
+    runBackend("io_uring", config, input, inputLength, messages);
+    config.ioUring = TCP_CLIENT_URING_SINGLE_SHOT;
+    runBackend("single", config, input, inputLength, messages);
+
+    free(input);
+    return EXIT_SUCCESS;
+}
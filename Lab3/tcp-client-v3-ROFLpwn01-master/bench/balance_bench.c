@@ -0,0 +1,114 @@
+/*
+Measures how the load balancing policies (--endpoints, --balance) spread requests over servers of
+different speeds. Three servers answer over loopback TCP with a thread per connection; two answer
+right away and one sleeps SLOW_US microseconds before every response, like an overloaded replica.
+The same pipelined requests go through each policy, and the counts of every endpoint are printed
+after the run.
+
+Usage: balance_bench [REQUESTS]
+*/
+#include "balancer.h"
+#include "bench_server.h"
+#include "clock.h"
+#include "log.h"
+#include "tcp_client.h"
+
+#define DEFAULT_REQUESTS 50000
+#define MESSAGE_SIZE 32
+#define SERVERS 3
+#define SLOW_US 200
+#define MAX_IN_FLIGHT 64
+
+static size_t responses;
+
+static int handleResponse(TcpClientSession *session, const char *response, size_t length) {
+    (void)session;
+    (void)response;
+    (void)length;
+    responses++;
+    return 0;
+}
+
+/*
+Description:
+    Balances the requests over the endpoints with one policy and prints the rate and the counts of
+    every endpoint.
+Arguments:
+    Config config: Config with the endpoints and policy set
+    const char *name: The name of the run
+    const char *input: The request file
+    size_t inputLength: The length of the request file
+    size_t requests: The number of requests in it
+Return value:
+    None.
+*/
+static void runBalance(Config config, const char *name, const char *input, size_t inputLength,
+                       size_t requests) {
+    TcpClientSession session;
+
+    FILE *file = fmemopen((char *)input, inputLength, "r");
+    if (file == NULL || tcp_client_session_init(&session, config, handleResponse, NULL)) {
+        printf("%s: unable to set up\n", name);
+        return;
+    }
+    printf("%s\n", name);
+    responses = 0;
+    uint64_t start = clock_now_ns();
+    int failed = balancer_run(&session, file, stdout);
+    double seconds = (clock_now_ns() - start) / 1e9;
+    if (failed || responses != requests)
+        printf("failed (%zu of %zu responses)\n\n", responses, requests);
+    else
+        printf("%.0f requests/s\n\n", requests / seconds);
+    tcp_client_session_close(&session);
+    fclose(file);
+}
+
+int main(int argc, char *argv[]) {
+    size_t requests = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_REQUESTS;
+    // The requests read together are answered with one write, the way a pipelining server answers
+    BenchServer servers[SERVERS] = {{.coalesce = 1, .noDelay = 1},
+                                    {.coalesce = 1, .noDelay = 1},
+                                    {.coalesce = 1, .noDelay = 1, .delayUs = SLOW_US}};
+    char fastEndpoints[64];
+    char allEndpoints[96];
+    size_t inputLength;
+
+    log_set_level(LOG_ERROR);
+    if (requests == 0)
+        requests = DEFAULT_REQUESTS;
+    for (int i = 0; i < SERVERS; i++) {
+        if (bench_server_start(&servers[i], NULL)) {
+            perror("server");
+            return EXIT_FAILURE;
+        }
+    }
+    snprintf(fastEndpoints, sizeof(fastEndpoints), "127.0.0.1:%s,127.0.0.1:%s", servers[0].port,
+             servers[1].port);
+    snprintf(allEndpoints, sizeof(allEndpoints), "%s,127.0.0.1:%s", fastEndpoints,
+             servers[2].port);
+
+    char *input = bench_server_build_input(requests, MESSAGE_SIZE, &inputLength);
+    if (input == NULL) {
+        fprintf(stderr, "Unable to set up\n");
+        return EXIT_FAILURE;
+    }
+
+    Config config = {.port = "0", .host = "127.0.0.1", .file = "", .pipeline = 1,
+                     .maxInFlight = MAX_IN_FLIGHT, .connections = 1,
+                     .batchFrames = SEND_BATCH_DEFAULT_FRAMES,
+                     .batchBytes = SEND_BATCH_DEFAULT_BYTES,
+                     .batchDelayUs = SEND_BATCH_DEFAULT_DELAY_US};
+
+    printf("%zu pipelined requests, %d in flight, the third server stalls %d us per response\n\n",
+           requests, MAX_IN_FLIGHT, SLOW_US);
+    config.endpoints = fastEndpoints;
+    config.balance = TCP_CLIENT_BALANCE_LEAST;
+    runBalance(config, "fast servers only, least outstanding", input, inputLength, requests);
+    config.endpoints = allEndpoints;
+    runBalance(config, "all servers, least outstanding", input, inputLength, requests);
+    config.balance = TCP_CLIENT_BALANCE_EWMA;
+    runBalance(config, "all servers, ewma", input, inputLength, requests);
+    free(input);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+/*
+Measures what batch frames (--batch-frames) gain on small messages. A server thread answers over
+loopback TCP the way the reference servers do, with one write per response, except that a batch
+frame is answered with one write for the whole batch. The same request file is pipelined with
+ordinary frames and with batch frames, for a few message sizes.
+
+Usage: batch_bench [MESSAGES]
+*/
+#include "bench_server.h"
+#include "clock.h"
+#include "log.h"
+#include "tcp_client.h"
+
+#define DEFAULT_MESSAGES 200000
+#define MAX_IN_FLIGHT 256
+#define FRAME_LENGTH_MASK ((1u << 27) - 1)
+
+static size_t responses;
+
+/*
+Description:
+    Builds the response to one request: "batch" for the hello, one batch response for a batch frame
+    and the message for any other request.
+Arguments:
+    uint32_t header: The request header, in host byte order
+    const char *message: The message of the request
+    char *out: Where to write the response frame
+    size_t capacity: The space left at out
+Return value:
+    The length of the response frame, or 0 if it needs more than capacity bytes.
+*/
+static size_t answerBatch(uint32_t header, const char *message, char *out, size_t capacity) {
+    uint32_t length = header & FRAME_LENGTH_MASK;
+
+    if (header >> 27 == 0) {
+        uint32_t helloHeader = htonl(strlen(TCP_CLIENT_BATCH_FEATURE));
+        if (capacity < sizeof(helloHeader) + strlen(TCP_CLIENT_BATCH_FEATURE))
+            return 0;
+        memcpy(out, &helloHeader, sizeof(helloHeader));
+        memcpy(out + sizeof(helloHeader), TCP_CLIENT_BATCH_FEATURE,
+               strlen(TCP_CLIENT_BATCH_FEATURE));
+        return sizeof(helloHeader) + strlen(TCP_CLIENT_BATCH_FEATURE);
+    }
+    if (header >> 27 != TCP_CLIENT_BATCH_ACTION)
+        return bench_server_echo(header, message, out, capacity);
+
+    size_t outLength = TCP_CLIENT_RESPONSE_HEADER_SIZE;
+    if (capacity < outLength)
+        return 0;
+    for (size_t inner = 0; inner < length;) {
+        uint32_t innerHeader;
+        memcpy(&innerHeader, message + inner, sizeof(innerHeader));
+        innerHeader = ntohl(innerHeader);
+        const char *innerMessage = message + inner + sizeof(innerHeader);
+        size_t responseLength =
+            bench_server_echo(innerHeader, innerMessage, out + outLength, capacity - outLength);
+        if (responseLength == 0)
+            return 0;
+        outLength += responseLength;
+        inner += sizeof(innerHeader) + (innerHeader & FRAME_LENGTH_MASK);
+    }
+    uint32_t batchHeader = htonl(TCP_CLIENT_BATCH_RESPONSE |
+                                 (uint32_t)(outLength - TCP_CLIENT_RESPONSE_HEADER_SIZE));
+    memcpy(out, &batchHeader, sizeof(batchHeader));
+    return outLength;
+}
+
+int handle_response(const char *response, size_t length) {
+    (void)response;
+    (void)length;
+    responses++;
+    return 0;
+}
+
+/*
+Description:
+    Pipelines a request file with or without batch frames and prints the results.
+Arguments:
+    const char *name: The name of the run
+    BenchServer *server: The server, whose writes are counted
+    Config config: Config used to connect
+    size_t messages: The number of requests
+    size_t size: The length of each message
+Return value:
+    None.
+*/
+static void runBatch(const char *name, BenchServer *server, Config config, size_t messages,
+                     size_t size) {
+    size_t inputLength;
+    size_t sent = 0;
+    char *input = bench_server_build_input(messages, size, &inputLength);
+
+    int sockfd = tcp_client_connect(config);
+    FILE *file = input != NULL ? fmemopen(input, inputLength, "r") : NULL;
+    if (sockfd == TCP_CLIENT_BAD_SOCKET || file == NULL) {
+        fprintf(stderr, "%s: unable to set up\n", name);
+        return;
+    }
+
+    responses = 0;
+    __atomic_store_n(&server->writes, 0, __ATOMIC_RELAXED);
+    uint64_t start = clock_now_ns();
+    int failed = tcp_client_pipeline(sockfd, file, config, handle_response, &sent);
+    double seconds = (clock_now_ns() - start) / 1e9;
+
+    if (failed || responses != messages)
+        printf("%-22s failed (%zu of %zu responses)\n", name, responses, messages);
+    else
+        printf("%-22s %12.0f %10.1f %16.3f\n", name, messages / seconds,
+               messages * size / seconds / 1e6,
+               (double)__atomic_load_n(&server->writes, __ATOMIC_RELAXED) / messages);
+    fclose(file);
+    free(input);
+    tcp_client_close(sockfd);
+}
+
+int main(int argc, char *argv[]) {
+    static const size_t sizes[] = {8, 32, 128};
+    size_t messages = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_MESSAGES;
+    BenchServer server = {.answer = answerBatch};
+
+    log_set_level(LOG_ERROR);
+    if (bench_server_start(&server, NULL)) {
+        perror("server");
+        return EXIT_FAILURE;
+    }
+
+    Config config = {.port = server.port, .host = "127.0.0.1", .file = "", .pipeline = 1,
+                     .maxInFlight = MAX_IN_FLIGHT, .connections = 1,
+                     .batchFrames = SEND_BATCH_DEFAULT_FRAMES,
+                     .batchBytes = SEND_BATCH_DEFAULT_BYTES,
+                     .batchDelayUs = SEND_BATCH_DEFAULT_DELAY_US};
+
+    printf("%zu messages per run, %d in flight, batches of up to %d frames\n\n", messages,
+           MAX_IN_FLIGHT, SEND_BATCH_DEFAULT_FRAMES);
+    printf("%-22s %12s %10s %16s\n", "run", "msgs/sec", "MB/s", "server writes/msg");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        char name[32];
+        config.batchEnvelope = 0;
+        snprintf(name, sizeof(name), "%zuB frames", sizes[i]);
+        runBatch(name, &server, config, messages, sizes[i]);
+        config.batchEnvelope = 1;
+        snprintf(name, sizeof(name), "%zuB batch frames", sizes[i]);
+        runBatch(name, &server, config, messages, sizes[i]);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,263 @@
+#include "bench_server.h"
+#include "tcp_client.h"
+
+#include <netinet/tcp.h>
+#include <pthread.h>
+
+#define FRAME_LENGTH_MASK ((1u << 27) - 1)
+
+/*
+An accepted connection and the server it belongs to.
+*/
+typedef struct BenchConnection {
+    BenchServer *server;
+    int conn;
+} BenchConnection;
+
+/*
+Description:
+    Writes every byte of a buffer, counting the write.
+Arguments:
+    BenchServer *server: The server
+    int fd: The file descriptor to write to
+    const char *buf: The bytes to write
+    size_t length: The number of bytes
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int writeAll(BenchServer *server, int fd, const char *buf, size_t length) {
+    __atomic_add_fetch(&server->writes, 1, __ATOMIC_RELAXED);
+    while (length > 0) {
+        ssize_t written = write(fd, buf, length);
+        if (written <= 0)
+            return 1;
+        buf += written;
+        length -= written;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Answers the requests of one connection until it closes.
+Arguments:
+    BenchServer *server: The server
+    int conn: The connection
+    char *in: A buffer of BENCH_SERVER_BUFFER_SIZE bytes for requests
+    char *out: A buffer of BENCH_SERVER_BUFFER_SIZE bytes for responses
+Return value:
+    None.
+*/
+static void serveConnection(BenchServer *server, int conn, char *in, char *out) {
+    BenchServerAnswer answer = server->answer != NULL ? server->answer : bench_server_echo;
+    unsigned seed = conn;
+    size_t buffered = 0;
+
+    while (1) {
+        ssize_t bytesRead = read(conn, in + buffered, BENCH_SERVER_BUFFER_SIZE - buffered);
+        if (bytesRead <= 0)
+            return;
+        buffered += bytesRead;
+
+        size_t offset = 0;
+        size_t outLength = 0;
+        while (buffered - offset >= TCP_CLIENT_REQUEST_HEADER_SIZE) {
+            uint32_t header;
+            memcpy(&header, in + offset, sizeof(header));
+            header = ntohl(header);
+            uint32_t length = header & FRAME_LENGTH_MASK;
+            if (buffered - offset - sizeof(header) < length)
+                break;
+            const char *message = in + offset + sizeof(header);
+            if (server->delayUs > 0 &&
+                (server->slowOneIn == 0 || rand_r(&seed) % server->slowOneIn == 0))
+                usleep(server->delayUs);
+
+            size_t responseLength =
+                answer(header, message, out + outLength, BENCH_SERVER_BUFFER_SIZE - outLength);
+            if (responseLength == 0 && outLength > 0) {
+                if (writeAll(server, conn, out, outLength))
+                    return;
+                outLength = 0;
+                responseLength = answer(header, message, out, BENCH_SERVER_BUFFER_SIZE);
+            }
+            if (responseLength == 0)
+                return;
+            outLength += responseLength;
+            offset += sizeof(header) + length;
+            if (!server->coalesce) {
+                if (writeAll(server, conn, out, outLength))
+                    return;
+                outLength = 0;
+            }
+        }
+        if (outLength > 0 && writeAll(server, conn, out, outLength))
+            return;
+        memmove(in, in + offset, buffered - offset);
+        buffered -= offset;
+    }
+}
+
+/*
+Description:
+    Connection thread. Serves one connection and closes it.
+Arguments:
+    void *arg: The BenchConnection, which the thread frees
+Return value:
+    NULL
+*/
+static void *connectionMain(void *arg) {
+    BenchConnection connection = *(BenchConnection *)arg;
+    char *in = malloc(BENCH_SERVER_BUFFER_SIZE);
+    char *out = malloc(BENCH_SERVER_BUFFER_SIZE);
+
+    free(arg);
+    if (in != NULL && out != NULL)
+        serveConnection(connection.server, connection.conn, in, out);
+    close(connection.conn);
+    free(in);
+    free(out);
+    return NULL;
+}
+
+/*
+Description:
+    Server thread. Hands every connection to a thread of its own.
+Arguments:
+    void *arg: The BenchServer
+Return value:
+    NULL
+*/
+static void *serverMain(void *arg) {
+    BenchServer *server = arg;
+
+    while (1) {
+        int conn = accept(server->listenfd, NULL, NULL);
+        int one = 1;
+        if (conn == -1)
+            break;
+        if (server->noDelay)
+            setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        BenchConnection *connection = malloc(sizeof(BenchConnection));
+        pthread_t thread;
+        if (connection == NULL) {
+            close(conn);
+            continue;
+        }
+        connection->server = server;
+        connection->conn = conn;
+        if (pthread_create(&thread, NULL, connectionMain, connection) != 0) {
+            close(conn);
+            free(connection);
+        } else {
+            pthread_detach(thread);
+        }
+    }
+    return NULL;
+}
+
+/*
+Description:
+    Opens a listening socket and starts the server thread. The socket is on an ephemeral loopback
+    TCP port, or a Unix socket at path when one is given.
+Arguments:
+    BenchServer *server: The server, with its options set
+    const char *path: The path of the Unix socket, or NULL for TCP
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int bench_server_start(BenchServer *server, const char *path) {
+    pthread_t thread;
+
+    if (path != NULL) {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        if (strlen(path) >= sizeof(addr.sun_path))
+            return 1;
+        strcpy(addr.sun_path, path);
+        unlink(path);
+        server->listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (server->listenfd == -1 ||
+            bind(server->listenfd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+            return 1;
+    } else {
+        struct sockaddr_in addr = {.sin_family = AF_INET,
+                                   .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+        socklen_t addrLength = sizeof(addr);
+        server->listenfd = socket(AF_INET, SOCK_STREAM, 0);
+        if (server->listenfd == -1 ||
+            bind(server->listenfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+            getsockname(server->listenfd, (struct sockaddr *)&addr, &addrLength) == -1)
+            return 1;
+        snprintf(server->port, sizeof(server->port), "%d", ntohs(addr.sin_port));
+        // Only logged: without Fast Open the server still answers, just after the handshake
+        if (server->fastOpen > 0 && setsockopt(server->listenfd, IPPROTO_TCP, TCP_FASTOPEN,
+                                               &server->fastOpen, sizeof(server->fastOpen)) == -1)
+            perror("TCP_FASTOPEN");
+    }
+    if (listen(server->listenfd, 128) == -1 ||
+        pthread_create(&thread, NULL, serverMain, server) != 0)
+        return 1;
+    pthread_detach(thread);
+    return 0;
+}
+
+/*
+Description:
+    Builds the response to one request: a response frame with the request's message.
+Arguments:
+    uint32_t header: The request header, in host byte order
+    const char *message: The message of the request
+    char *out: Where to write the response frame
+    size_t capacity: The space left at out
+Return value:
+    The length of the response frame, or 0 if it needs more than capacity bytes.
+*/
+size_t bench_server_echo(uint32_t header, const char *message, char *out, size_t capacity) {
+    uint32_t length = header & FRAME_LENGTH_MASK;
+    uint32_t responseHeader = htonl(length);
+
+    if (capacity < sizeof(responseHeader) + length)
+        return 0;
+    memcpy(out, &responseHeader, sizeof(responseHeader));
+    memcpy(out + sizeof(responseHeader), message, length);
+    return sizeof(responseHeader) + length;
+}
+
+/*
+Description:
+    Builds a request file in memory: "uppercase xxxx...\n" per message.
+Arguments:
+    size_t messages: The number of requests
+    size_t size: The length of each message
+    size_t *inputLength: Set to the length of the file
+Return value:
+    The file contents, or NULL if out of memory.
+*/
+char *bench_server_build_input(size_t messages, size_t size, size_t *inputLength) {
+    size_t lineLength = strlen("uppercase ") + size + 1;
+    char *input = malloc(messages * lineLength);
+
+    for (size_t i = 0; input != NULL && i < messages; i++) {
+        char *line = input + i * lineLength;
+        memcpy(line, "uppercase ", strlen("uppercase "));
+        memset(line + strlen("uppercase "), 'a' + i % 26, size);
+        line[lineLength - 1] = '\n';
+    }
+    *inputLength = messages * lineLength;
+    return input;
+}
+
+/*
+Description:
+    Orders two durations in nanoseconds, for qsort.
+Arguments:
+    const void *a: The first uint64_t
+    const void *b: The second uint64_t
+Return value:
+    Less than, equal to or greater than 0 as a is shorter than, as long as or longer than b.
+*/
+int bench_server_compare_ns(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
@@ -0,0 +1,89 @@
+#ifndef BENCH_SERVER_H_
+#define BENCH_SERVER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BENCH_SERVER_BUFFER_SIZE (1 << 20)
+
+/*
+Builds the response to one request, as bench_server_echo does, for servers that answer some
+requests differently.
+*/
+typedef size_t (*BenchServerAnswer)(uint32_t header, const char *message, char *out,
+                                    size_t capacity);
+
+/*
+Echo server for the benches, run on threads of the bench process itself. Every connection gets a
+thread of its own that answers each request with its message, with one write per response the way
+the reference servers answer, or, with coalesce set, one write for all the requests of a read the
+way a pipelining server answers. answer, when set, builds the responses in place of the echo, and
+writes counts the writes made so far. fastOpen is the TCP Fast Open queue of the listening socket,
+or 0 to leave Fast Open off. With delayUs set the server stalls that many microseconds before a
+response, like a worker that is briefly stuck: before one response in slowOneIn, picked at random,
+or before every response when slowOneIn is 0. noDelay turns Nagle's algorithm off on accepted TCP
+connections, so an answer never waits for the client to acknowledge the one before. Requests must
+fit in BENCH_SERVER_BUFFER_SIZE bytes. Set the options before bench_server_start; port is filled in
+for a TCP server.
+*/
+typedef struct BenchServer {
+    int listenfd;
+    char port[16];
+    int coalesce;
+    BenchServerAnswer answer;
+    unsigned long writes;
+    int fastOpen;
+    unsigned delayUs;
+    unsigned slowOneIn;
+    int noDelay;
+} BenchServer;
+
+/*
+Description:
+    Opens a listening socket and starts the server thread. The socket is on an ephemeral loopback
+    TCP port, or a Unix socket at path when one is given.
+Arguments:
+    BenchServer *server: The server, with its options set
+    const char *path: The path of the Unix socket, or NULL for TCP
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int bench_server_start(BenchServer *server, const char *path);
+
+/*
+Description:
+    Builds the response to one request: a response frame with the request's message.
+Arguments:
+    uint32_t header: The request header, in host byte order
+    const char *message: The message of the request
+    char *out: Where to write the response frame
+    size_t capacity: The space left at out
+Return value:
+    The length of the response frame, or 0 if it needs more than capacity bytes.
+*/
+size_t bench_server_echo(uint32_t header, const char *message, char *out, size_t capacity);
+
+/*
+Description:
+    Builds a request file in memory: "uppercase xxxx...\n" per message.
+Arguments:
+    size_t messages: The number of requests
+    size_t size: The length of each message
+    size_t *inputLength: Set to the length of the file
+Return value:
+    The file contents, or NULL if out of memory.
+*/
+char *bench_server_build_input(size_t messages, size_t size, size_t *inputLength);
+
+/*
+Description:
+    Orders two durations in nanoseconds, for qsort.
+Arguments:
+    const void *a: The first uint64_t
+    const void *b: The second uint64_t
+Return value:
+    Less than, equal to or greater than 0 as a is shorter than, as long as or longer than b.
+*/
+int bench_server_compare_ns(const void *a, const void *b);
+
+#endif
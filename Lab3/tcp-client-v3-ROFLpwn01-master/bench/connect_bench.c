@@ -0,0 +1,115 @@
+/*
+Measures time to first response for short-lived connections over loopback TCP: from the start of
+tcp_client_connect (or of taking a pooled connection) until the response to one request has been
+received. A server thread answers each connection on a thread of its own and accepts TCP Fast Open,
+which the kernel only allows when bit 2 of net.ipv4.tcp_fastopen is set (3 enables both sides).
+
+Usage: connect_bench [ROUNDS]
+*/
+#include <netinet/tcp.h>
+
+#include "bench_server.h"
+#include "clock.h"
+#include "connection_pool.h"
+#include "log.h"
+#include "tcp_client.h"
+
+#define DEFAULT_ROUNDS 500
+#define POOL_SIZE 4
+#define ROUND_GAP_US 1000
+#define FASTOPEN_QUEUE 64
+#define MESSAGE "first response"
+
+static int handle_response(const char *response, size_t length) {
+    (void)response;
+    (void)length;
+    return 1;
+}
+
+/*
+Description:
+    Times connections that each send one request and wait for its response, then prints the
+    median and 99th percentile and how many requests went out in the SYN.
+Arguments:
+    const char *name: The name of the run
+    Config config: Config used to connect
+    ConnectionPool *pool: The pool to take connections from, or NULL to connect each time
+    size_t rounds: The number of connections
+Return value:
+    None.
+*/
+static void runConnect(const char *name, Config config, ConnectionPool *pool, size_t rounds) {
+    uint64_t *times = malloc(rounds * sizeof(uint64_t));
+    uint32_t header;
+    size_t synData = 0;
+
+    tcp_client_encode_header("uppercase", strlen("uppercase"), strlen(MESSAGE), &header);
+    for (size_t i = 0; times != NULL && i < rounds; i++) {
+        uint64_t start = clock_now_ns();
+        int sockfd = pool != NULL ? connection_pool_take(pool) : tcp_client_connect(config);
+        if (sockfd == TCP_CLIENT_BAD_SOCKET ||
+            tcp_client_send_frame(sockfd, header, MESSAGE, strlen(MESSAGE)) ||
+            tcp_client_receive_response_view(sockfd, handle_response)) {
+            printf("%-12s failed\n", name);
+            free(times);
+            return;
+        }
+        times[i] = clock_now_ns() - start;
+
+        struct tcp_info info;
+        socklen_t length = sizeof(info);
+        if (getsockopt(sockfd, IPPROTO_TCP, TCP_INFO, &info, &length) == 0 &&
+            (info.tcpi_options & TCPI_OPT_SYN_DATA))
+            synData++;
+        tcp_client_close(sockfd);
+        usleep(ROUND_GAP_US);
+    }
+    if (times == NULL)
+        return;
+
+    qsort(times, rounds, sizeof(uint64_t), bench_server_compare_ns);
+    printf("%-12s %10.1f %10.1f %10zu\n", name, times[rounds / 2] / 1e3,
+           times[rounds * 99 / 100] / 1e3, synData);
+    free(times);
+}
+
+int main(int argc, char *argv[]) {
+    size_t rounds = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ROUNDS;
+    BenchServer server = {.fastOpen = FASTOPEN_QUEUE};
+
+    log_set_level(LOG_ERROR);
+    if (rounds == 0)
+        rounds = DEFAULT_ROUNDS;
+    if (bench_server_start(&server, NULL)) {
+        perror("server");
+        return EXIT_FAILURE;
+    }
+
+    Config config = {.port = server.port, .host = "127.0.0.1", .file = "", .maxInFlight = 1,
+                     .connections = 1, .batchFrames = SEND_BATCH_DEFAULT_FRAMES,
+                     .batchBytes = SEND_BATCH_DEFAULT_BYTES,
+                     .batchDelayUs = SEND_BATCH_DEFAULT_DELAY_US};
+
+    FILE *sysctl = fopen("/proc/sys/net/ipv4/tcp_fastopen", "r");
+    int fastOpenMode = -1;
+    if (sysctl != NULL) {
+        if (fscanf(sysctl, "%d", &fastOpenMode) != 1)
+            fastOpenMode = -1;
+        fclose(sysctl);
+    }
+    printf("%zu connections per run, one request each, net.ipv4.tcp_fastopen = %d\n\n", rounds,
+           fastOpenMode);
+    printf("%-12s %10s %10s %10s\n", "run", "p50 us", "p99 us", "SYN data");
+    runConnect("connect", config, NULL, rounds);
+    config.fastOpen = 1;
+    runConnect("fast open", config, NULL, rounds);
+    config.fastOpen = 0;
+
+    ConnectionPool pool;
+    if (connection_pool_init(&pool, config, POOL_SIZE) == 0) {
+        usleep(100000);
+        runConnect("pool", config, &pool, rounds);
+        connection_pool_free(&pool);
+    }
+    return EXIT_SUCCESS;
+}
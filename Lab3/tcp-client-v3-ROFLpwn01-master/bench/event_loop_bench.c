@@ -0,0 +1,120 @@
+/*
+Drives many sessions from one thread with the event loop. Each session keeps DEPTH requests in
+flight, sending the next one from its response handler, until it has sent REQUESTS. Needs a server
+that handles many connections at once, such as bin/v4_server.
+
+Usage: event_loop_bench HOST PORT [SESSIONS] [REQUESTS]
+*/
+#include <sys/resource.h>
+
+#include "clock.h"
+#include "event_loop.h"
+#include "log.h"
+#include "tcp_client.h"
+
+#define DEFAULT_SESSIONS 1000
+#define DEFAULT_REQUESTS 200
+#define DEPTH 4
+#define SESSION_BATCH_FRAMES 16
+#define SESSION_BATCH_BYTES 4096
+#define MESSAGE "event loop"
+
+static uint32_t requestHeader;
+static size_t responses;
+
+/*
+Description:
+    Counts a response and sends the session's next request, if it has one left.
+Arguments:
+    TcpClientSession *session: The session, whose userData is its number of requests left
+    const char *response: The response
+    size_t length: The length of the response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int handleResponse(TcpClientSession *session, const char *response, size_t length) {
+    size_t *left = session->userData;
+    (void)response;
+    (void)length;
+
+    responses++;
+    if (*left == 0)
+        return 0;
+    (*left)--;
+    return tcp_client_session_submit(session, requestHeader, MESSAGE, strlen(MESSAGE)) != 1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: event_loop_bench HOST PORT [SESSIONS] [REQUESTS]\n");
+        return EXIT_FAILURE;
+    }
+    size_t sessionCount = argc > 3 ? strtoul(argv[3], NULL, 10) : DEFAULT_SESSIONS;
+    size_t requests = argc > 4 ? strtoul(argv[4], NULL, 10) : DEFAULT_REQUESTS;
+
+    log_set_level(LOG_ERROR);
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+    tcp_client_encode_header("uppercase", strlen("uppercase"), strlen(MESSAGE), &requestHeader);
+
+    Config config = {.port = argv[2], .host = argv[1], .file = "", .pipeline = 1,
+                     .maxInFlight = DEPTH, .connections = 1, .batchFrames = SESSION_BATCH_FRAMES,
+                     .batchBytes = SESSION_BATCH_BYTES};
+    TcpClientSession *sessions = calloc(sessionCount, sizeof(TcpClientSession));
+    size_t *left = calloc(sessionCount, sizeof(size_t));
+    EventLoop loop;
+    size_t opened = 0;
+    int result = EXIT_FAILURE;
+
+    if (sessions == NULL || left == NULL || event_loop_init(&loop)) {
+        fprintf(stderr, "Unable to set up\n");
+        return EXIT_FAILURE;
+    }
+    for (opened = 0; opened < sessionCount; opened++) {
+        TcpClientSession *session = &sessions[opened];
+        if (tcp_client_session_init(session, config, handleResponse, &left[opened]))
+            goto done;
+        if (tcp_client_session_connect(session)) {
+            tcp_client_session_close(session);
+            goto done;
+        }
+        left[opened] = requests;
+        if (event_loop_add(&loop, session)) {
+            tcp_client_session_close(session);
+            goto done;
+        }
+    }
+
+    uint64_t start = clock_now_ns();
+    for (size_t i = 0; i < sessionCount; i++) {
+        for (size_t j = 0; j < DEPTH && left[i] > 0; j++) {
+            left[i]--;
+            if (tcp_client_session_submit(&sessions[i], requestHeader, MESSAGE,
+                                          strlen(MESSAGE)) != 1)
+                goto done;
+        }
+        if (event_loop_update(&loop, &sessions[i]))
+            goto done;
+    }
+    int failed = event_loop_run(&loop);
+    double seconds = (clock_now_ns() - start) / 1e9;
+
+    printf("%zu sessions on one thread, %d in flight each\n", sessionCount, DEPTH);
+    printf("%zu of %zu responses in %.3f seconds: %.0f msgs/sec, %zu sessions failed\n",
+           responses, sessionCount * requests, seconds, responses / seconds, loop.failures);
+    if (!failed && responses == sessionCount * requests)
+        result = EXIT_SUCCESS;
+
+done:
+    if (opened < sessionCount)
+        fprintf(stderr, "Unable to open session %zu\n", opened);
+    for (size_t i = 0; i < opened; i++)
+        tcp_client_session_close(&sessions[i]);
+    event_loop_free(&loop);
+    free(sessions);
+    free(left);
+    return result;
+}
@@ -0,0 +1,146 @@
+/*
+Measures what hedged requests (--hedge) do to tail latency. A server thread per connection answers
+over loopback TCP, but one response in SLOW_ONE_IN stalls for SLOW_US microseconds first, like a
+worker that is briefly stuck. The same requests are sent one at a time without hedging and then
+hedged at a few percentiles.
+
+Usage: hedge_bench [REQUESTS]
+*/
+#include "bench_server.h"
+#include "clock.h"
+#include "hedge.h"
+#include "log.h"
+#include "tcp_client.h"
+
+#define DEFAULT_REQUESTS 5000
+#define MESSAGE_SIZE 32
+#define SLOW_ONE_IN 100
+#define SLOW_US 5000
+
+static uint64_t *latencies;
+static size_t responses;
+static uint64_t lastResponse;
+
+/*
+Description:
+    Records the time since the previous response. Requests go out one at a time, right after the
+    previous response, so that is the latency of the request.
+Arguments:
+    TcpClientSession *session: The session
+    const char *response: The response
+    size_t length: The length of the response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int handleResponse(TcpClientSession *session, const char *response, size_t length) {
+    uint64_t now = clock_now_ns();
+    (void)session;
+    (void)response;
+    (void)length;
+
+    latencies[responses++] = now - lastResponse;
+    lastResponse = now;
+    return 0;
+}
+
+/*
+Description:
+    Sends the requests one at a time, hedged at a percentile or not at all, and prints the latency
+    percentiles and the hedging counts.
+Arguments:
+    Config config: Config used to connect
+    const char *input: The request file
+    size_t inputLength: The length of the request file
+    size_t requests: The number of requests in it
+    unsigned percentile: The hedge percentile, or 0 for no hedging
+Return value:
+    None.
+*/
+static void runHedge(Config config, const char *input, size_t inputLength, size_t requests,
+                     unsigned percentile) {
+    TcpClientSession session;
+    HedgeStats stats = {0};
+    char name[32];
+    int failed = 1;
+
+    if (percentile > 0)
+        snprintf(name, sizeof(name), "hedge at p%u", percentile);
+    else
+        snprintf(name, sizeof(name), "no hedging");
+    config.hedgePercentile = percentile;
+    FILE *file = fmemopen((char *)input, inputLength, "r");
+    if (file == NULL || tcp_client_session_init(&session, config, handleResponse, NULL)) {
+        printf("%-14s unable to set up\n", name);
+        return;
+    }
+
+    responses = 0;
+    if (tcp_client_session_connect(&session) == 0) {
+        lastResponse = clock_now_ns();
+        if (percentile > 0) {
+            failed = hedge_run(&session, file, &stats);
+        } else {
+            InputReader reader;
+            InputLine line;
+            uint32_t header;
+            if (input_reader_open(&reader, file) == 0) {
+                failed = 0;
+                while (!failed && tcp_client_next_request(&reader, &header, &line) == 1) {
+                    failed = tcp_client_session_send(&session, header, line.message,
+                                                     line.messageLength) ||
+                             tcp_client_session_receive(&session);
+                }
+                input_reader_close(&reader);
+            }
+        }
+    }
+
+    if (failed || responses != requests) {
+        printf("%-14s failed (%zu of %zu responses)\n", name, responses, requests);
+    } else {
+        qsort(latencies, responses, sizeof(uint64_t), bench_server_compare_ns);
+        printf("%-14s %9.1f %9.1f %9.1f %9.1f %9.2f %9zu %9zu %9zu\n", name,
+               latencies[responses / 2] / 1e3, latencies[responses * 99 / 100] / 1e3,
+               latencies[responses * 999 / 1000] / 1e3, stats.delayNs / 1e3,
+               100.0 * stats.hedged / requests, stats.hedgesWon, stats.dropped, stats.reconnects);
+    }
+    tcp_client_session_close(&session);
+    fclose(file);
+}
+
+int main(int argc, char *argv[]) {
+    static const unsigned percentiles[] = {0, 50, 90, 95, 99};
+    size_t requests = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_REQUESTS;
+    BenchServer server = {.delayUs = SLOW_US, .slowOneIn = SLOW_ONE_IN};
+    size_t inputLength;
+
+    log_set_level(LOG_ERROR);
+    if (requests == 0)
+        requests = DEFAULT_REQUESTS;
+    if (bench_server_start(&server, NULL)) {
+        perror("server");
+        return EXIT_FAILURE;
+    }
+
+    char *input = bench_server_build_input(requests, MESSAGE_SIZE, &inputLength);
+    latencies = malloc(requests * sizeof(uint64_t));
+    if (input == NULL || latencies == NULL) {
+        fprintf(stderr, "Unable to set up\n");
+        return EXIT_FAILURE;
+    }
+
+    Config config = {.port = server.port, .host = "127.0.0.1", .file = "", .maxInFlight = 1,
+                     .connections = 1, .batchFrames = SEND_BATCH_DEFAULT_FRAMES,
+                     .batchBytes = SEND_BATCH_DEFAULT_BYTES,
+                     .batchDelayUs = SEND_BATCH_DEFAULT_DELAY_US};
+
+    printf("%zu requests one at a time, 1 in %d stalls for %d us\n\n", requests, SLOW_ONE_IN,
+           SLOW_US);
+    printf("%-14s %9s %9s %9s %9s %9s %9s %9s %9s\n", "run", "p50 us", "p99 us", "p99.9 us",
+           "delay us", "hedged %", "won", "dropped", "reopened");
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+        runHedge(config, input, inputLength, requests, percentiles[i]);
+    free(input);
+    free(latencies);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,259 @@
+/*
+Microbenchmarks for the per-message hot paths of the v3 client: request encoding, response framing
+and input line parsing. Everything runs in memory. sendmsg is wrapped at link time to swallow the
+bytes, responses are parsed from a prefilled ring buffer and input comes from fmemopen. malloc,
+calloc and realloc are interposed to count allocations, including the ones libc makes for getline.
+
+Message lengths follow a mix of mostly short lines with a tail of long ones: 70% are 8-64 bytes,
+25% are 64-1024 bytes and 5% are 1-8 KiB.
+
+Usage: micro_bench [MESSAGES]
+*/
+
+#include "clock.h"
+#include "input_reader.h"
+#include "log.h"
+#include "tcp_client.h"
+
+#define DEFAULT_MESSAGES 20000
+#define MIN_BENCH_NS 200000000ULL
+
+size_t getMessageLength(const char *message, size_t totalBytes);
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long allocations;
+static size_t bytesSwallowed;
+
+// Results are stored here so the compiler cannot drop the work that produced them
+volatile size_t benchSink;
+
+void *malloc(size_t size) {
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+ssize_t __wrap_sendmsg(int sockfd, const struct msghdr *msg, int flags) {
+    size_t total = 0;
+    (void)sockfd;
+    (void)flags;
+    for (size_t i = 0; i < msg->msg_iovlen; i++)
+        total += msg->msg_iov[i].iov_len;
+    bytesSwallowed += total;
+    return total;
+}
+
+/*
+Messages shared by every benchmark, with their actions.
+*/
+typedef struct Corpus {
+    size_t count;
+    char **actions;
+    char **messages;
+    size_t *lengths;
+    size_t totalBytes;
+} Corpus;
+
+/*
+Description:
+    Returns a message length drawn from the size mix.
+Arguments:
+    unsigned *seed: State of the random number generator
+Return value:
+    The length.
+*/
+static size_t drawLength(unsigned *seed) {
+    unsigned pick = rand_r(seed) % 100;
+    if (pick < 70)
+        return 8 + rand_r(seed) % 57;
+    if (pick < 95)
+        return 64 + rand_r(seed) % 961;
+    return 1024 + rand_r(seed) % 7169;
+}
+
+/*
+Description:
+    Builds the corpus.
+Arguments:
+    Corpus *corpus: The corpus to fill in
+    size_t count: The number of messages
+Return value:
+    None.
+*/
+static void buildCorpus(Corpus *corpus, size_t count) {
+    static char *actions[] = {"uppercase", "lowercase", "reverse", "shuffle", "random"};
+    unsigned seed = 426;
+
+    corpus->count = count;
+    corpus->actions = __libc_malloc(count * sizeof(char *));
+    corpus->messages = __libc_malloc(count * sizeof(char *));
+    corpus->lengths = __libc_malloc(count * sizeof(size_t));
+    corpus->totalBytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t length = drawLength(&seed);
+        char *message = __libc_malloc(length + 1);
+        for (size_t j = 0; j < length; j++)
+            message[j] = 'a' + rand_r(&seed) % 26;
+        message[length] = '\0';
+        corpus->actions[i] = actions[rand_r(&seed) % 5];
+        corpus->messages[i] = message;
+        corpus->lengths[i] = length;
+        corpus->totalBytes += length;
+    }
+}
+
+/*
+Description:
+    Runs one pass of a benchmark over the corpus until at least MIN_BENCH_NS have passed, then
+    prints ns/op, bytes/sec and allocations/op.
+Arguments:
+    const char *name: The name of the benchmark
+    const Corpus *corpus: The corpus
+    size_t (*pass)(const Corpus *): Runs once over the corpus, returns the operations done
+Return value:
+    None.
+*/
+static void runBench(const char *name, const Corpus *corpus, size_t (*pass)(const Corpus *)) {
+    size_t operations = 0;
+    size_t passes = 0;
+
+    pass(corpus); // Warm up
+    unsigned long startAllocations = allocations;
+    uint64_t start = clock_now_ns();
+    uint64_t elapsed;
+    do {
+        operations += pass(corpus);
+        passes++;
+        elapsed = clock_now_ns() - start;
+    } while (elapsed < MIN_BENCH_NS);
+    unsigned long allocationCount = allocations - startAllocations;
+
+    double seconds = elapsed / 1e9;
+    printf("%-16s %12zu %10.1f %12.1f %10.2f\n", name, operations, (double)elapsed / operations,
+           corpus->totalBytes * passes / seconds / 1e6, (double)allocationCount / operations);
+}
+
+static size_t benchEncodeHeader(const Corpus *corpus) {
+    for (size_t i = 0; i < corpus->count; i++) {
+        uint32_t header;
+        tcp_client_encode_header(corpus->actions[i], strlen(corpus->actions[i]),
+                                 corpus->lengths[i], &header);
+        benchSink = header;
+    }
+    return corpus->count;
+}
+
+static size_t benchSendRequest(const Corpus *corpus) {
+    for (size_t i = 0; i < corpus->count; i++)
+        tcp_client_send_request(-1, corpus->actions[i], corpus->messages[i]);
+    return corpus->count;
+}
+
+static char *responseData;
+static size_t responseLength;
+
+static size_t benchGetMessageLength(const Corpus *corpus) {
+    size_t offset = 0;
+    for (size_t i = 0; i < corpus->count; i++) {
+        size_t frameLength = getMessageLength(responseData + offset, responseLength - offset);
+        benchSink = frameLength;
+        offset += frameLength;
+    }
+    return corpus->count;
+}
+
+static size_t benchNextResponse(const Corpus *corpus) {
+    RingBuffer ring = {responseData, responseLength + 1, 0, responseLength};
+    char *response;
+    size_t length;
+    size_t found = 0;
+    (void)corpus;
+    while (tcp_client_next_response(&ring, 0, &response, &length) == 1) {
+        benchSink = length;
+        found++;
+    }
+    return found;
+}
+
+static char *inputData;
+static size_t inputLength;
+
+static size_t benchGetLine(const Corpus *corpus) {
+    FILE *file = fmemopen(inputData, inputLength, "r");
+    char *action;
+    char *message;
+    size_t lines = 0;
+    (void)corpus;
+    while (tcp_client_get_line(file, &action, &message) != -1) {
+        free(action);
+        free(message);
+        lines++;
+    }
+    fclose(file);
+    return lines;
+}
+
+static size_t benchInputReader(const Corpus *corpus) {
+    FILE *file = fmemopen(inputData, inputLength, "r");
+    InputReader reader;
+    InputLine line;
+    size_t lines = 0;
+    (void)corpus;
+    input_reader_open(&reader, file);
+    while (input_reader_next(&reader, &line) == 1) {
+        benchSink = line.messageLength;
+        lines++;
+    }
+    input_reader_close(&reader);
+    fclose(file);
+    return lines;
+}
+
+int main(int argc, char *argv[]) {
+    size_t messages = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_MESSAGES;
+    Corpus corpus;
+
+    log_set_level(LOG_ERROR);
+    buildCorpus(&corpus, messages);
+
+    // Responses as the server sends them, and the request file
+    responseLength = corpus.totalBytes + corpus.count * TCP_CLIENT_RESPONSE_HEADER_SIZE;
+    responseData = __libc_malloc(responseLength + 1);
+    inputLength = corpus.totalBytes + corpus.count * (strlen("uppercase") + 2);
+    inputData = __libc_malloc(inputLength);
+    size_t responseOffset = 0;
+    size_t inputOffset = 0;
+    for (size_t i = 0; i < corpus.count; i++) {
+        uint32_t header = htonl(corpus.lengths[i]);
+        memcpy(responseData + responseOffset, &header, sizeof(header));
+        memcpy(responseData + responseOffset + sizeof(header), corpus.messages[i],
+               corpus.lengths[i]);
+        responseOffset += sizeof(header) + corpus.lengths[i];
+        inputOffset += sprintf(inputData + inputOffset, "%s %s\n", corpus.actions[i],
+                               corpus.messages[i]);
+    }
+    inputLength = inputOffset;
+
+    printf("%zu messages, %.1f bytes on average\n\n", corpus.count,
+           (double)corpus.totalBytes / corpus.count);
+    printf("%-16s %12s %10s %12s %10s\n", "benchmark", "ops", "ns/op", "MB/s", "allocs/op");
+    runBench("encode_header", &corpus, benchEncodeHeader);
+    runBench("send_request", &corpus, benchSendRequest);
+    runBench("getMessageLength", &corpus, benchGetMessageLength);
+    runBench("next_response", &corpus, benchNextResponse);
+    runBench("get_line", &corpus, benchGetLine);
+    runBench("input_reader", &corpus, benchInputReader);
+    return EXIT_SUCCESS;
+}
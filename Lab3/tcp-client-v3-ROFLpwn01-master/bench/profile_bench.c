@@ -0,0 +1,149 @@
+/*
+Measures what the socket profiles (--profile) do over loopback TCP. A server thread answers the way
+the reference servers do, with one write per response. Each profile runs two workloads: one small
+request at a time, for round trip latency, and a pipelined file of large requests, for bulk
+throughput.
+
+Usage: profile_bench [ROUNDS] [MESSAGES]
+*/
+#include "bench_server.h"
+#include "clock.h"
+#include "log.h"
+#include "tcp_client.h"
+
+#define DEFAULT_ROUNDS 20000
+#define DEFAULT_MESSAGES 100000
+#define PING_SIZE 64
+#define BULK_SIZE 1024
+#define MAX_IN_FLIGHT 256
+
+static size_t responses;
+
+static int handle_response(const char *response, size_t length) {
+    (void)response;
+    (void)length;
+    responses++;
+    return 0;
+}
+
+static int handle_one_response(const char *response, size_t length) {
+    (void)response;
+    (void)length;
+    return 1;
+}
+
+/*
+Description:
+    Sends one small request at a time and times each round trip.
+Arguments:
+    Config config: Config used to connect
+    size_t rounds: The number of round trips
+    double *p50: Set to the median in microseconds
+    double *p99: Set to the 99th percentile in microseconds
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int runPing(Config config, size_t rounds, double *p50, double *p99) {
+    uint64_t *times = malloc(rounds * sizeof(uint64_t));
+    char message[PING_SIZE];
+    uint32_t header;
+    int failed = 1;
+
+    memset(message, 'a', sizeof(message));
+    tcp_client_encode_header("uppercase", strlen("uppercase"), sizeof(message), &header);
+    int sockfd = tcp_client_connect(config);
+    if (times == NULL || sockfd == TCP_CLIENT_BAD_SOCKET)
+        goto done;
+    for (size_t i = 0; i < rounds; i++) {
+        uint64_t start = clock_now_ns();
+        if (tcp_client_send_frame(sockfd, header, message, sizeof(message)) ||
+            tcp_client_receive_response_view(sockfd, handle_one_response))
+            goto done;
+        times[i] = clock_now_ns() - start;
+    }
+    qsort(times, rounds, sizeof(uint64_t), bench_server_compare_ns);
+    *p50 = times[rounds / 2] / 1e3;
+    *p99 = times[rounds * 99 / 100] / 1e3;
+    failed = 0;
+
+done:
+    if (sockfd != TCP_CLIENT_BAD_SOCKET)
+        tcp_client_close(sockfd);
+    free(times);
+    return failed;
+}
+
+/*
+Description:
+    Pipelines a file of large requests and measures how fast their bytes go through.
+Arguments:
+    Config config: Config used to connect
+    size_t messages: The number of requests
+    double *megabytes: Set to the request bytes per second, in megabytes
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int runBulk(Config config, size_t messages, double *megabytes) {
+    size_t inputLength;
+    char *input = bench_server_build_input(messages, BULK_SIZE, &inputLength);
+    size_t sent = 0;
+    int failed = 1;
+
+    FILE *file = input != NULL ? fmemopen(input, inputLength, "r") : NULL;
+    int sockfd = tcp_client_connect(config);
+    if (file != NULL && sockfd != TCP_CLIENT_BAD_SOCKET) {
+        responses = 0;
+        uint64_t start = clock_now_ns();
+        failed = tcp_client_pipeline(sockfd, file, config, handle_response, &sent) ||
+                 responses != messages;
+        *megabytes = (double)messages * BULK_SIZE / ((clock_now_ns() - start) / 1e9) / 1e6;
+    }
+
+    if (sockfd != TCP_CLIENT_BAD_SOCKET)
+        tcp_client_close(sockfd);
+    if (file != NULL)
+        fclose(file);
+    free(input);
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    static const struct {
+        const char *name;
+        int profile;
+    } profiles[] = {{"default", TCP_CLIENT_PROFILE_DEFAULT},
+                    {"latency", TCP_CLIENT_PROFILE_LATENCY},
+                    {"throughput", TCP_CLIENT_PROFILE_THROUGHPUT}};
+    size_t rounds = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ROUNDS;
+    size_t messages = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_MESSAGES;
+    BenchServer server = {0};
+
+    log_set_level(LOG_ERROR);
+    if (rounds == 0)
+        rounds = DEFAULT_ROUNDS;
+    if (bench_server_start(&server, NULL)) {
+        perror("server");
+        return EXIT_FAILURE;
+    }
+
+    Config config = {.port = server.port, .host = "127.0.0.1", .file = "", .pipeline = 1,
+                     .maxInFlight = MAX_IN_FLIGHT, .connections = 1,
+                     .batchFrames = SEND_BATCH_DEFAULT_FRAMES,
+                     .batchBytes = SEND_BATCH_DEFAULT_BYTES,
+                     .batchDelayUs = SEND_BATCH_DEFAULT_DELAY_US};
+
+    printf("%zu round trips of %dB, then %zu pipelined %dB requests, %d in flight\n\n", rounds,
+           PING_SIZE, messages, BULK_SIZE, MAX_IN_FLIGHT);
+    printf("%-12s %10s %10s %10s\n", "profile", "p50 us", "p99 us", "bulk MB/s");
+    for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+        double p50 = 0;
+        double p99 = 0;
+        double megabytes = 0;
+        config.profile = profiles[i].profile;
+        if (runPing(config, rounds, &p50, &p99) || runBulk(config, messages, &megabytes))
+            printf("%-12s failed\n", profiles[i].name);
+        else
+            printf("%-12s %10.1f %10.1f %10.1f\n", profiles[i].name, p50, p99, megabytes);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,186 @@
+/*
+Compares loopback TCP with a Unix stream socket (--host unix:PATH) and the shared memory transport
+(--host shm:NAME). A server thread answers every request with its message over each transport, and
+the client runs the same request file through tcp_client_session_pipeline on each. Latency is
+measured with one request in flight, as the time between consecutive responses; throughput is
+measured with MAX_IN_FLIGHT requests in flight, for small and large messages.
+
+Usage: transport_bench [MESSAGES]
+*/
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "bench_server.h"
+#include "clock.h"
+#include "histogram.h"
+#include "log.h"
+#include "shm_transport.h"
+#include "tcp_client.h"
+
+#define DEFAULT_MESSAGES 50000
+#define MAX_IN_FLIGHT 64
+#define SMALL_SIZE 64
+#define LARGE_SIZE 4096
+#define FRAME_LENGTH_MASK ((1u << 27) - 1)
+
+static Histogram latency;
+static uint64_t lastResponse;
+static size_t responses;
+
+/*
+Description:
+    Shared memory server thread. Serves one client at a time and answers each request with its
+    message, until the transport is closed.
+Arguments:
+    void *arg: The transport returned by shm_transport_listen
+Return value:
+    NULL
+*/
+static void *shmServerMain(void *arg) {
+    ShmTransport *shm = arg;
+    RingBuffer *ring = shm_transport_ring(shm);
+
+    while (shm_transport_accept(shm) == 0) {
+        while (shm_transport_recv(shm) > 0) {
+            while (ring_buffer_length(ring) >= TCP_CLIENT_REQUEST_HEADER_SIZE) {
+                uint32_t header;
+                memcpy(&header, ring->data + ring->head, sizeof(header));
+                uint32_t length = ntohl(header) & FRAME_LENGTH_MASK;
+                if (ring_buffer_length(ring) - sizeof(header) < length)
+                    break;
+                uint32_t responseHeader = htonl(length);
+                shm_transport_send(shm, (char *)&responseHeader, sizeof(responseHeader));
+                shm_transport_send(shm, ring->data + ring->head + sizeof(header), length);
+                ring_buffer_consume(ring, sizeof(header) + length);
+            }
+        }
+    }
+    return NULL;
+}
+
+static int handleResponse(TcpClientSession *session, const char *response, size_t length) {
+    uint64_t now = clock_now_ns();
+    (void)session;
+    (void)response;
+    (void)length;
+    histogram_record(&latency, now - lastResponse);
+    lastResponse = now;
+    responses++;
+    return 0;
+}
+
+/*
+Description:
+    Pipelines a request file through one transport and prints the results.
+Arguments:
+    const char *name: The name of the run
+    Config config: Config used to connect
+    size_t messages: The number of requests
+    size_t size: The length of each message
+Return value:
+    None.
+*/
+static void runTransport(const char *name, Config config, size_t messages, size_t size) {
+    size_t inputLength;
+    TcpClientSession session;
+    char *input = bench_server_build_input(messages, size, &inputLength);
+
+    FILE *file = input != NULL ? fmemopen(input, inputLength, "r") : NULL;
+    if (file == NULL || tcp_client_session_init(&session, config, handleResponse, NULL)) {
+        fprintf(stderr, "%s: unable to set up\n", name);
+        return;
+    }
+    if (tcp_client_session_connect(&session) || histogram_init(&latency)) {
+        fprintf(stderr, "%s: unable to set up\n", name);
+        tcp_client_session_close(&session);
+        fclose(file);
+        free(input);
+        return;
+    }
+
+    responses = 0;
+    uint64_t start = clock_now_ns();
+    lastResponse = start;
+    int failed = tcp_client_session_pipeline(&session, file);
+    double seconds = (clock_now_ns() - start) / 1e9;
+
+    if (failed || responses != messages)
+        printf("%-22s failed (%zu of %zu responses)\n", name, responses, messages);
+    else if (config.maxInFlight > 1)
+        // The gaps between pipelined responses are not round trips
+        printf("%-22s %12.0f %10.1f %10s %10s %10s\n", name, messages / seconds,
+               messages * size / seconds / 1e6, "-", "-", "-");
+    else
+        printf("%-22s %12.0f %10.1f %10.1f %10.1f %10.1f\n", name, messages / seconds,
+               messages * size / seconds / 1e6, histogram_mean(&latency) / 1e3,
+               histogram_value_at_percentile(&latency, 50) / 1e3,
+               histogram_value_at_percentile(&latency, 99) / 1e3);
+    histogram_free(&latency);
+    fclose(file);
+    free(input);
+    tcp_client_session_close(&session);
+}
+
+int main(int argc, char *argv[]) {
+    size_t messages = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_MESSAGES;
+    BenchServer tcpServer = {.coalesce = 1};
+    BenchServer unixServer = {.coalesce = 1};
+    char unixHost[sizeof(TCP_CLIENT_UNIX_PREFIX) + 64];
+    char *path = unixHost + strlen(TCP_CLIENT_UNIX_PREFIX);
+
+    log_set_level(LOG_ERROR);
+
+    // Loopback TCP on an ephemeral port, and a Unix socket in the temporary directory
+    snprintf(unixHost, sizeof(unixHost), "%s/tmp/transport_bench.%d.sock", TCP_CLIENT_UNIX_PREFIX,
+             (int)getpid());
+    if (bench_server_start(&tcpServer, NULL) || bench_server_start(&unixServer, path)) {
+        perror("server");
+        return EXIT_FAILURE;
+    }
+
+    // Shared memory region named after the process
+    char shmHost[sizeof(TCP_CLIENT_SHM_PREFIX) + 64];
+    char *shmName = shmHost + strlen(TCP_CLIENT_SHM_PREFIX);
+    snprintf(shmHost, sizeof(shmHost), "%s/transport_bench.%d", TCP_CLIENT_SHM_PREFIX,
+             (int)getpid());
+    ShmTransport *shm = shm_transport_listen(shmName, SHM_TRANSPORT_DEFAULT_CAPACITY);
+    if (shm == NULL) {
+        fprintf(stderr, "shm server: unable to create the region\n");
+        return EXIT_FAILURE;
+    }
+
+    pthread_t shmServer;
+    pthread_create(&shmServer, NULL, shmServerMain, shm);
+
+    Config tcpConfig = {.port = tcpServer.port, .host = "127.0.0.1", .file = "", .pipeline = 1,
+                        .maxInFlight = 1, .connections = 1,
+                        .batchFrames = SEND_BATCH_DEFAULT_FRAMES,
+                        .batchBytes = SEND_BATCH_DEFAULT_BYTES,
+                        .batchDelayUs = SEND_BATCH_DEFAULT_DELAY_US};
+    Config unixConfig = tcpConfig;
+    unixConfig.host = unixHost;
+    Config shmConfig = tcpConfig;
+    shmConfig.host = shmHost;
+
+    printf("%zu messages per run; latency with 1 in flight, throughput with %d in flight\n\n",
+           messages, MAX_IN_FLIGHT);
+    printf("%-22s %12s %10s %10s %10s %10s\n", "run", "msgs/sec", "MB/s", "mean us", "p50 us",
+           "p99 us");
+    runTransport("tcp latency", tcpConfig, messages, SMALL_SIZE);
+    runTransport("unix latency", unixConfig, messages, SMALL_SIZE);
+    runTransport("shm latency", shmConfig, messages, SMALL_SIZE);
+
+    tcpConfig.maxInFlight = MAX_IN_FLIGHT;
+    unixConfig.maxInFlight = MAX_IN_FLIGHT;
+    shmConfig.maxInFlight = MAX_IN_FLIGHT;
+    runTransport("tcp 64B pipelined", tcpConfig, messages, SMALL_SIZE);
+    runTransport("unix 64B pipelined", unixConfig, messages, SMALL_SIZE);
+    runTransport("shm 64B pipelined", shmConfig, messages, SMALL_SIZE);
+    runTransport("tcp 4KiB pipelined", tcpConfig, messages, LARGE_SIZE);
+    runTransport("unix 4KiB pipelined", unixConfig, messages, LARGE_SIZE);
+    runTransport("shm 4KiB pipelined", shmConfig, messages, LARGE_SIZE);
+
+    unlink(path);
+    shm_unlink(shmName);
+    return EXIT_SUCCESS;
+}
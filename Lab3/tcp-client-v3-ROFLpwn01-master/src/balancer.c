@@ -0,0 +1,632 @@
+#include "balancer.h"
+#include "clock.h"
+#include "connection_pool.h"
+#include "histogram.h"
+#include "input_reader.h"
+#include "log.h"
+#include "reorder_buffer.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+
+#define NS_PER_MS 1000000ULL
+
+/*
+A request that has been read and not yet answered. Its message points into the reader's mapping,
+or at copy when the reader cannot keep lines alive.
+*/
+typedef struct BalancerSlot {
+    uint64_t sequence;
+    uint32_t header;
+    const char *message;
+    size_t length;
+    char *copy;
+} BalancerSlot;
+
+/*
+A request sent to an endpoint. Responses come back in the order the requests were sent, so each
+endpoint keeps these in a FIFO and matches them to its responses as they arrive.
+*/
+typedef struct BalancerSent {
+    size_t slot;
+    uint64_t sentAt;
+} BalancerSent;
+
+typedef struct BalancerEndpoint {
+    char *host;
+    char *port;
+    TcpClientSession session;
+    ConnectionPool pool;
+    int poolStarted;
+    BalancerSent *sent;
+    size_t sentHead;
+    size_t outstanding;
+    double ewmaNs;
+    int up;
+    unsigned failuresInARow;
+    uint64_t retryAt;
+    size_t requests;
+    size_t responses;
+    size_t requeued;
+    size_t ejections;
+    Histogram latency;
+} BalancerEndpoint;
+
+typedef struct Balancer {
+    TcpClientSession *session;
+    BalancerEndpoint *endpoints;
+    size_t count;
+    size_t nextStart;
+    size_t window;
+    BalancerSlot *slots;
+    size_t *freeSlots;
+    size_t freeCount;
+    size_t *requeue;
+    size_t requeueHead;
+    size_t requeueCount;
+    size_t inFlight;
+    int ordered;
+    ReorderBuffer reorder;
+} Balancer;
+
+/*
+Description:
+    Splits one entry of the endpoint list into its host and port, in place.
+Arguments:
+    char *entry: The entry, which is modified
+    char *defaultPort: The port of an entry that does not name one
+    char **host: Set to the host
+    char **port: Set to the port
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int parseEndpoint(char *entry, char *defaultPort, char **host, char **port) {
+    char *colon;
+
+    *host = entry;
+    *port = defaultPort;
+    if (strncmp(entry, TCP_CLIENT_SHM_PREFIX, strlen(TCP_CLIENT_SHM_PREFIX)) == 0) {
+        log_error("Load balancing needs sockets, not shared memory");
+        return 1;
+    }
+    if (strncmp(entry, TCP_CLIENT_UNIX_PREFIX, strlen(TCP_CLIENT_UNIX_PREFIX)) == 0)
+        return 0;
+
+    if (entry[0] == '[') {
+        char *close = strchr(entry, ']');
+        if (close == NULL || (close[1] != 0 && close[1] != ':')) {
+            log_error("Incorrect endpoint %s", entry);
+            return 1;
+        }
+        *host = entry + 1;
+        colon = close[1] == ':' ? close + 1 : NULL;
+        *close = 0;
+    } else {
+        // A bare IPv6 address has more than one colon and no port
+        colon = strchr(entry, ':');
+        if (colon != NULL && strchr(colon + 1, ':') != NULL)
+            colon = NULL;
+    }
+    if (colon != NULL) {
+        *colon = 0;
+        *port = colon + 1;
+    }
+
+    if (**host == 0 || **port == 0) {
+        log_error("Incorrect endpoint, expected HOST:PORT");
+        return 1;
+    }
+    for (int i = 0; (*port)[i] != 0; i++) {
+        if (!isdigit((unsigned char)(*port)[i])) {
+            log_error("Incorrect endpoint port %s", *port);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+Description:
+    Takes a connection for an endpoint from its pool and puts the endpoint back in rotation.
+Arguments:
+    BalancerEndpoint *endpoint: The endpoint
+    unsigned waitMs: How long to wait for the pool to open a connection
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int connectEndpoint(BalancerEndpoint *endpoint, unsigned waitMs) {
+    int sockfd = connection_pool_try_take(&endpoint->pool, waitMs);
+    if (sockfd == TCP_CLIENT_BAD_SOCKET)
+        return 1;
+    int flags = fcntl(sockfd, F_GETFL);
+    if (flags == -1 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        log_error("Unable to set up the connection to %s", endpoint->host);
+        tcp_client_close(sockfd);
+        return 1;
+    }
+    endpoint->session.sockfd = sockfd;
+    endpoint->up = 1;
+    return 0;
+}
+
+/*
+Description:
+    Notes a failure of an endpoint and schedules its next connection attempt, backing off
+    exponentially with the failures in a row. After BALANCER_MAX_FAILURES in a row the endpoint is
+    given up on.
+Arguments:
+    BalancerEndpoint *endpoint: The endpoint
+    uint64_t now: The current time in nanoseconds
+Return value:
+    None.
+*/
+static void backOff(BalancerEndpoint *endpoint, uint64_t now) {
+    uint64_t backoff = BALANCER_BACKOFF_MS;
+
+    endpoint->failuresInARow++;
+    if (endpoint->failuresInARow >= BALANCER_MAX_FAILURES) {
+        log_warn("Giving up on %s:%s after %u failures in a row", endpoint->host, endpoint->port,
+                 endpoint->failuresInARow);
+        endpoint->retryAt = UINT64_MAX;
+        return;
+    }
+    for (unsigned i = 1; i < endpoint->failuresInARow && backoff < BALANCER_MAX_BACKOFF_MS; i++)
+        backoff *= 2;
+    if (backoff > BALANCER_MAX_BACKOFF_MS)
+        backoff = BALANCER_MAX_BACKOFF_MS;
+    endpoint->retryAt = now + backoff * NS_PER_MS;
+    log_warn("Retrying %s:%s in %llu ms", endpoint->host, endpoint->port,
+             (unsigned long long)backoff);
+}
+
+/*
+Description:
+    Takes a failed endpoint out of rotation. Its connection is closed, its unsent frames are
+    dropped and its unanswered requests are queued again, ahead of new ones, for the others.
+Arguments:
+    Balancer *balancer: The balancer
+    BalancerEndpoint *endpoint: The endpoint
+    uint64_t now: The current time in nanoseconds
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int eject(Balancer *balancer, BalancerEndpoint *endpoint, uint64_t now) {
+    TcpClientSession *session = &endpoint->session;
+    Config config = session->config;
+
+    log_warn("Ejecting %s:%s with %zu requests unanswered", endpoint->host, endpoint->port,
+             endpoint->outstanding);
+    for (size_t i = 0; i < endpoint->outstanding; i++) {
+        size_t position = (balancer->requeueHead + balancer->requeueCount) % balancer->window;
+        balancer->requeue[position] =
+            endpoint->sent[(endpoint->sentHead + i) % balancer->window].slot;
+        balancer->requeueCount++;
+    }
+    balancer->inFlight -= endpoint->outstanding;
+    endpoint->requeued += endpoint->outstanding;
+    endpoint->outstanding = 0;
+    endpoint->sentHead = 0;
+    endpoint->up = 0;
+    endpoint->ejections++;
+    backOff(endpoint, now);
+
+    tcp_client_close(session->sockfd);
+    session->sockfd = TCP_CLIENT_BAD_SOCKET;
+    ring_buffer_consume(&session->ring, ring_buffer_length(&session->ring));
+    send_batch_free(&session->batch);
+    return send_batch_init(&session->batch, config.batchFrames, config.batchBytes,
+                           config.batchDelayUs);
+}
+
+/*
+Description:
+    Picks the endpoint for a request: the one with the fewest outstanding requests, or the
+    lowest expected wait under the EWMA policy. Ties go to the endpoint after the one that started
+    the previous search, so idle endpoints take turns.
+Arguments:
+    Balancer *balancer: The balancer
+    size_t length: The length of the request's message
+Return value:
+    The endpoint, or NULL if no endpoint in rotation has room in its send batch.
+*/
+static BalancerEndpoint *pickEndpoint(Balancer *balancer, size_t length) {
+    int ewma = balancer->session->config.balance == TCP_CLIENT_BALANCE_EWMA;
+    BalancerEndpoint *best = NULL;
+    double bestCost = 0;
+    double measuredSum = 0;
+    size_t measured = 0;
+
+    if (ewma) {
+        for (size_t i = 0; i < balancer->count; i++) {
+            if (balancer->endpoints[i].ewmaNs > 0) {
+                measuredSum += balancer->endpoints[i].ewmaNs;
+                measured++;
+            }
+        }
+    }
+    double unmeasured = measured > 0 ? measuredSum / measured : 1;
+
+    for (size_t i = 0; i < balancer->count; i++) {
+        BalancerEndpoint *endpoint =
+            &balancer->endpoints[(balancer->nextStart + i) % balancer->count];
+        if (!endpoint->up || !send_batch_has_room(&endpoint->session.batch, length, 0))
+            continue;
+        double cost = endpoint->outstanding;
+        if (ewma)
+            cost = (endpoint->ewmaNs > 0 ? endpoint->ewmaNs : unmeasured) *
+                   (endpoint->outstanding + 1);
+        if (best == NULL || cost < bestCost) {
+            best = endpoint;
+            bestCost = cost;
+        }
+    }
+    balancer->nextStart = (balancer->nextStart + 1) % balancer->count;
+    return best;
+}
+
+/*
+Description:
+    Hands a response to the session, through the reorder buffer with ordered output.
+Arguments:
+    Balancer *balancer: The balancer
+    uint64_t sequence: The sequence number of the request being answered
+    const char *response: The response
+    size_t length: The length of the response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int deliver(Balancer *balancer, uint64_t sequence, const char *response, size_t length) {
+    if (balancer->ordered)
+        return reorder_buffer_deliver(&balancer->reorder, sequence, response, length);
+    return tcp_client_session_deliver(balancer->session, response, length);
+}
+
+/*
+Description:
+    Matches the responses buffered for an endpoint to its requests, times them and delivers them.
+Arguments:
+    Balancer *balancer: The balancer
+    BalancerEndpoint *endpoint: The endpoint
+    uint64_t now: The current time in nanoseconds
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int completeResponses(Balancer *balancer, BalancerEndpoint *endpoint, uint64_t now) {
+    char *response;
+    size_t length;
+    int found = 0;
+
+    TcpClientSession *session = &endpoint->session;
+
+    while (endpoint->outstanding > 0 &&
+           (found = tcp_client_next_response(&session->ring, session->batchAccepted, &response,
+                                             &length)) == 1) {
+        BalancerSent *sent = &endpoint->sent[endpoint->sentHead];
+        BalancerSlot *slot = &balancer->slots[sent->slot];
+        uint64_t latency = now - sent->sentAt;
+
+        histogram_record(&endpoint->latency, latency);
+        if (endpoint->ewmaNs == 0)
+            endpoint->ewmaNs = latency;
+        else
+            endpoint->ewmaNs += BALANCER_EWMA_WEIGHT * ((double)latency - endpoint->ewmaNs);
+        endpoint->sentHead = (endpoint->sentHead + 1) % balancer->window;
+        endpoint->outstanding--;
+        endpoint->responses++;
+        endpoint->failuresInARow = 0;
+        balancer->inFlight--;
+
+        if (deliver(balancer, slot->sequence, response, length))
+            return 1;
+        free(slot->copy);
+        slot->copy = NULL;
+        balancer->freeSlots[balancer->freeCount++] = sent->slot;
+    }
+    return found == -1;
+}
+
+/*
+Description:
+    Writes one line of counts per endpoint.
+Arguments:
+    const Balancer *balancer: The balancer
+    FILE *report: Where to write them
+Return value:
+    None.
+*/
+static void printReport(const Balancer *balancer, FILE *report) {
+    fprintf(report, "%-28s %9s %9s %9s %9s %9s %9s %9s\n", "endpoint", "requests", "responses",
+            "requeued", "ejections", "ewma us", "mean us", "p99 us");
+    for (size_t i = 0; i < balancer->count; i++) {
+        const BalancerEndpoint *endpoint = &balancer->endpoints[i];
+        char name[64];
+        if (strncmp(endpoint->host, TCP_CLIENT_UNIX_PREFIX, strlen(TCP_CLIENT_UNIX_PREFIX)) == 0)
+            snprintf(name, sizeof(name), "%s", endpoint->host);
+        else
+            snprintf(name, sizeof(name), "%s:%s", endpoint->host, endpoint->port);
+        fprintf(report, "%-28s %9zu %9zu %9zu %9zu %9.1f %9.1f %9.1f\n", name,
+                endpoint->requests, endpoint->responses, endpoint->requeued,
+                endpoint->ejections, endpoint->ewmaNs / 1e3,
+                histogram_mean(&endpoint->latency) / 1e3,
+                histogram_value_at_percentile(&endpoint->latency, 99.0) / 1e3);
+    }
+}
+
+/*
+Description:
+    Sends every line of the file across the endpoints in config.endpoints and hands the responses
+    to the session as they arrive, or in the order of the file if config.ordered is set. At most
+    config.maxInFlight requests are unanswered (or, when ordered, not yet handed over) at once.
+    When the run ends, one line of counts per endpoint is written to the report.
+Arguments:
+    TcpClientSession *session: The session the responses are handed to; it is not connected
+    FILE *fd: The file pointer to read requests from
+    FILE *report: Where the endpoint counts are written, or NULL
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int balancer_run(TcpClientSession *session, FILE *fd, FILE *report) {
+    Config config = session->config;
+    Balancer balancer = {
+        .session = session, .window = config.maxInFlight, .ordered = config.ordered};
+    struct pollfd pfds[BALANCER_MAX_ENDPOINTS];
+    InputReader reader;
+    InputLine line;
+    char *list = NULL;
+    size_t holding = 0;
+    int isHolding = 0;
+    uint64_t sequence = 0;
+    int endOfFile = 0;
+    int readerOpen = 0;
+    int result = 1;
+
+    if (config.endpoints == NULL || (list = strdup(config.endpoints)) == NULL) {
+        log_error("Unable to read the endpoint list");
+        return 1;
+    }
+    balancer.endpoints = calloc(BALANCER_MAX_ENDPOINTS, sizeof(BalancerEndpoint));
+    balancer.slots = calloc(balancer.window, sizeof(BalancerSlot));
+    balancer.freeSlots = malloc(balancer.window * sizeof(size_t));
+    balancer.requeue = malloc(balancer.window * sizeof(size_t));
+    if (balancer.endpoints == NULL || balancer.slots == NULL || balancer.freeSlots == NULL ||
+        balancer.requeue == NULL) {
+        log_error("Unable to allocate the balancer");
+        goto done;
+    }
+    if (config.ordered && reorder_buffer_init(&balancer.reorder, session, balancer.window))
+        goto done;
+    for (size_t i = 0; i < balancer.window; i++)
+        balancer.freeSlots[balancer.freeCount++] = balancer.window - 1 - i;
+
+    char *save = NULL;
+    for (char *entry = strtok_r(list, ",", &save); entry != NULL;
+         entry = strtok_r(NULL, ",", &save)) {
+        if (balancer.count == BALANCER_MAX_ENDPOINTS) {
+            log_error("At most %d endpoints can be balanced", BALANCER_MAX_ENDPOINTS);
+            goto done;
+        }
+        BalancerEndpoint *endpoint = &balancer.endpoints[balancer.count];
+        if (parseEndpoint(entry, config.port, &endpoint->host, &endpoint->port))
+            goto done;
+        Config endpointConfig = config;
+        endpointConfig.host = endpoint->host;
+        endpointConfig.port = endpoint->port;
+        endpointConfig.ioUring = 0;
+        // A response held back by Nagle or a delayed ACK stalls the window for every endpoint
+        if (endpointConfig.profile == TCP_CLIENT_PROFILE_DEFAULT &&
+            strncmp(endpoint->host, TCP_CLIENT_UNIX_PREFIX, strlen(TCP_CLIENT_UNIX_PREFIX)) != 0)
+            endpointConfig.profile = TCP_CLIENT_PROFILE_LATENCY;
+        if (tcp_client_session_init(&endpoint->session, endpointConfig, NULL, NULL))
+            goto done;
+        balancer.count++;
+        endpoint->sent = malloc(balancer.window * sizeof(BalancerSent));
+        if (endpoint->sent == NULL || histogram_init(&endpoint->latency)) {
+            log_error("Unable to allocate the endpoint %s", entry);
+            goto done;
+        }
+        if (connection_pool_init(&endpoint->pool, endpointConfig, 1))
+            goto done;
+        endpoint->poolStarted = 1;
+    }
+    if (balancer.count == 0) {
+        log_error("No endpoints to balance across");
+        goto done;
+    }
+
+    // The pools connect at the same time, so the first connections share one wait
+    uint64_t now = clock_now_ns();
+    uint64_t connectDeadline = now + BALANCER_CONNECT_WAIT_MS * NS_PER_MS;
+    for (size_t i = 0; i < balancer.count; i++) {
+        uint64_t left = connectDeadline > now ? connectDeadline - now : 0;
+        if (connectEndpoint(&balancer.endpoints[i], left / NS_PER_MS))
+            backOff(&balancer.endpoints[i], clock_now_ns());
+        now = clock_now_ns();
+    }
+    if (input_reader_open(&reader, fd))
+        goto done;
+    readerOpen = 1;
+
+    log_info("Balancing across %zu endpoints with at most %zu requests in flight", balancer.count,
+             balancer.window);
+    while (1) {
+        now = clock_now_ns();
+        int working = !endOfFile || isHolding || balancer.requeueCount > 0 || balancer.inFlight > 0;
+        size_t exhausted = 0;
+        uint64_t nextRetry = 0;
+        for (size_t i = 0; i < balancer.count; i++) {
+            BalancerEndpoint *endpoint = &balancer.endpoints[i];
+            if (!endpoint->up && working && endpoint->retryAt <= now) {
+                if (connectEndpoint(endpoint, 0) == 0)
+                    log_info("Endpoint %s:%s is back", endpoint->host, endpoint->port);
+                else
+                    backOff(endpoint, now);
+            }
+            if (endpoint->up)
+                continue;
+            if (endpoint->retryAt == UINT64_MAX)
+                exhausted++;
+            else if (nextRetry == 0 || endpoint->retryAt < nextRetry)
+                nextRetry = endpoint->retryAt;
+        }
+        if (working && exhausted == balancer.count) {
+            log_error("Every endpoint has been given up on");
+            goto done;
+        }
+
+        // Requests taken back from ejected endpoints go first, then new ones
+        while (1) {
+            size_t index;
+            int requeued = balancer.requeueCount > 0;
+            if (requeued) {
+                index = balancer.requeue[balancer.requeueHead];
+            } else if (isHolding) {
+                index = holding;
+            } else {
+                if (endOfFile || balancer.freeCount == 0 ||
+                    (balancer.ordered && !reorder_buffer_has_room(&balancer.reorder, sequence)))
+                    break;
+                uint32_t header;
+                int found = tcp_client_next_request(&reader, &header, &line);
+                if (found == -1)
+                    goto done;
+                if (found == 0) {
+                    endOfFile = 1;
+                    break;
+                }
+                index = balancer.freeSlots[--balancer.freeCount];
+                BalancerSlot *slot = &balancer.slots[index];
+                slot->sequence = sequence++;
+                slot->header = header;
+                slot->length = line.messageLength;
+                slot->message = line.message;
+                if (!reader.mapped) {
+                    slot->copy = malloc(line.messageLength > 0 ? line.messageLength : 1);
+                    if (slot->copy == NULL) {
+                        log_error("Unable to allocate a request");
+                        goto done;
+                    }
+                    memcpy(slot->copy, line.message, line.messageLength);
+                    slot->message = slot->copy;
+                }
+                session->messagesSent++;
+                holding = index;
+                isHolding = 1;
+            }
+
+            BalancerSlot *slot = &balancer.slots[index];
+            BalancerEndpoint *endpoint = pickEndpoint(&balancer, slot->length);
+            if (endpoint == NULL)
+                break;
+            if (send_batch_add(&endpoint->session.batch, slot->header, slot->message,
+                               slot->length, 0))
+                goto done;
+            BalancerSent *sent =
+                &endpoint->sent[(endpoint->sentHead + endpoint->outstanding) % balancer.window];
+            sent->slot = index;
+            sent->sentAt = now;
+            endpoint->outstanding++;
+            endpoint->requests++;
+            balancer.inFlight++;
+            if (requeued) {
+                balancer.requeueHead = (balancer.requeueHead + 1) % balancer.window;
+                balancer.requeueCount--;
+            } else {
+                isHolding = 0;
+            }
+        }
+
+        // Writes as much as each socket takes right away; the rest waits for POLLOUT
+        for (size_t i = 0; i < balancer.count; i++) {
+            BalancerEndpoint *endpoint = &balancer.endpoints[i];
+            if (endpoint->up && send_batch_pending(&endpoint->session.batch) > 0 &&
+                tcp_client_flush_batch(&endpoint->session.batch, endpoint->session.sockfd,
+                                       endpoint->session.profile, 0) &&
+                eject(&balancer, endpoint, now))
+                goto done;
+        }
+        if (endOfFile && !isHolding && balancer.requeueCount == 0 && balancer.inFlight == 0)
+            break;
+
+        size_t polled = 0;
+        for (size_t i = 0; i < balancer.count; i++) {
+            BalancerEndpoint *endpoint = &balancer.endpoints[i];
+            pfds[i].fd = endpoint->up ? endpoint->session.sockfd : -1;
+            pfds[i].events = POLLIN;
+            if (endpoint->up && send_batch_pending(&endpoint->session.batch) > 0)
+                pfds[i].events |= POLLOUT;
+            pfds[i].revents = 0;
+            polled += endpoint->up;
+        }
+        int timeout = -1;
+        if (nextRetry > 0) {
+            uint64_t wait = nextRetry > now ? nextRetry - now : 0;
+            timeout = (int)((wait + NS_PER_MS - 1) / NS_PER_MS);
+        } else if (polled == 0) {
+            continue;
+        }
+        if (poll(pfds, balancer.count, timeout) == -1) {
+            if (errno == EINTR)
+                continue;
+            log_error("poll failed: %s", strerror(errno));
+            goto done;
+        }
+
+        now = clock_now_ns();
+        for (size_t i = 0; i < balancer.count; i++) {
+            BalancerEndpoint *endpoint = &balancer.endpoints[i];
+            TcpClientSession *endpointSession = &endpoint->session;
+            if (!endpoint->up || pfds[i].revents == 0)
+                continue;
+            if ((pfds[i].revents & POLLOUT) &&
+                tcp_client_flush_batch(&endpointSession->batch, endpointSession->sockfd,
+                                       endpointSession->profile, 0)) {
+                if (eject(&balancer, endpoint, now))
+                    goto done;
+                continue;
+            }
+            if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+
+            ssize_t bytesReceived = ring_buffer_recv(&endpointSession->ring,
+                                                     endpointSession->sockfd, 0);
+            if (bytesReceived == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                continue;
+            if (bytesReceived <= 0) {
+                if (bytesReceived == 0)
+                    log_warn("%s:%s closed the connection", endpoint->host, endpoint->port);
+                else
+                    log_warn("Error receiving from %s:%s: %s", endpoint->host, endpoint->port,
+                             strerror(errno));
+                if (eject(&balancer, endpoint, now))
+                    goto done;
+                continue;
+            }
+            if (completeResponses(&balancer, endpoint, now))
+                goto done;
+        }
+    }
+    result = 0;
+
+done:
+    if (report != NULL && readerOpen)
+        printReport(&balancer, report);
+    for (size_t i = 0; i < balancer.count; i++) {
+        if (balancer.endpoints[i].poolStarted)
+            connection_pool_free(&balancer.endpoints[i].pool);
+        tcp_client_session_close(&balancer.endpoints[i].session);
+        free(balancer.endpoints[i].sent);
+        histogram_free(&balancer.endpoints[i].latency);
+    }
+    reorder_buffer_free(&balancer.reorder);
+    if (balancer.slots != NULL)
+        for (size_t i = 0; i < balancer.window; i++)
+            free(balancer.slots[i].copy);
+    if (readerOpen)
+        input_reader_close(&reader);
+    free(balancer.slots);
+    free(balancer.freeSlots);
+    free(balancer.requeue);
+    free(balancer.endpoints);
+    free(list);
+    return result;
+}
@@ -0,0 +1,48 @@
+#ifndef BALANCER_H_
+#define BALANCER_H_
+
+#include <stdio.h>
+
+#include "tcp_client.h"
+
+#define BALANCER_MAX_ENDPOINTS 64
+#define BALANCER_EWMA_WEIGHT 0.1
+#define BALANCER_BACKOFF_MS 100
+#define BALANCER_MAX_BACKOFF_MS 5000
+#define BALANCER_MAX_FAILURES 6
+#define BALANCER_CONNECT_WAIT_MS 1000
+
+/*
+Client-side load balancing over several identical servers. config.endpoints is a comma separated
+list of HOST:PORT, [IPV6]:PORT or unix:PATH entries; an entry without a port uses config.port. Every
+endpoint gets one pipelined connection, with a spare kept open by a connection pool (see
+connection_pool.h), and each request goes to the endpoint with the fewest requests outstanding or,
+with TCP_CLIENT_BALANCE_EWMA, the lowest EWMA response time multiplied by its outstanding requests
+plus one. Endpoints that have not answered yet are costed at the average of the others.
+
+An endpoint whose connection fails is ejected: its unanswered requests go back to the front of the
+queue for the other endpoints, so a request may reach more than one server but is answered once.
+The endpoint takes a connection from its pool again after BALANCER_BACKOFF_MS, doubling after every
+failure in a row up to BALANCER_MAX_BACKOFF_MS, and is given up on after BALANCER_MAX_FAILURES in a
+row; the run fails once every endpoint has been. Only the pool's thread connects, so an endpoint
+that does not answer never holds up the others. At the start every endpoint gets
+BALANCER_CONNECT_WAIT_MS to connect. TCP endpoints are tuned with TCP_CLIENT_PROFILE_LATENCY unless
+config.profile asks for another profile.
+*/
+
+/*
+Description:
+    Sends every line of the file across the endpoints in config.endpoints and hands the responses
+    to the session as they arrive, or in the order of the file if config.ordered is set. At most
+    config.maxInFlight requests are unanswered (or, when ordered, not yet handed over) at once.
+    When the run ends, one line of counts per endpoint is written to the report.
+Arguments:
+    TcpClientSession *session: The session the responses are handed to; it is not connected
+    FILE *fd: The file pointer to read requests from
+    FILE *report: Where the endpoint counts are written, or NULL
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int balancer_run(TcpClientSession *session, FILE *fd, FILE *report);
+
+#endif
@@ -0,0 +1,17 @@
+#include "clock.h"
+
+#include <time.h>
+
+/*
+Description:
+    Returns the monotonic clock in nanoseconds.
+Arguments:
+    None.
+Return value:
+    The current time in nanoseconds.
+*/
+uint64_t clock_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * CLOCK_NS_PER_SEC + now.tv_nsec;
+}
@@ -0,0 +1,18 @@
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+#include <stdint.h>
+
+#define CLOCK_NS_PER_SEC 1000000000ULL
+
+/*
+Description:
+    Returns the monotonic clock in nanoseconds.
+Arguments:
+    None.
+Return value:
+    The current time in nanoseconds.
+*/
+uint64_t clock_now_ns(void);
+
+#endif
@@ -0,0 +1,161 @@
+#include "connection_pool.h"
+#include "log.h"
+
+#include <time.h>
+
+/*
+Description:
+    Background thread. Opens connections whenever the pool has fewer than size idle ones, waiting
+    CONNECTION_POOL_RETRY_MS after a failed attempt, doubling with every failure in a row up to
+    CONNECTION_POOL_MAX_RETRY_MS.
+Arguments:
+    void *arg: The pool
+Return value:
+    NULL
+*/
+static void *fillerMain(void *arg) {
+    ConnectionPool *pool = arg;
+    long retryMs = CONNECTION_POOL_RETRY_MS;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stopping) {
+        if (pool->count >= pool->size) {
+            pthread_cond_wait(&pool->changed, &pool->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        int sockfd = tcp_client_connect(pool->config);
+        pthread_mutex_lock(&pool->lock);
+
+        if (sockfd == TCP_CLIENT_BAD_SOCKET) {
+            struct timespec retry;
+            clock_gettime(CLOCK_REALTIME, &retry);
+            retry.tv_sec += retryMs / 1000;
+            retry.tv_nsec += (retryMs % 1000) * 1000000L;
+            retry.tv_sec += retry.tv_nsec / 1000000000L;
+            retry.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&pool->changed, &pool->lock, &retry);
+            if (retryMs < CONNECTION_POOL_MAX_RETRY_MS)
+                retryMs *= 2;
+            if (retryMs > CONNECTION_POOL_MAX_RETRY_MS)
+                retryMs = CONNECTION_POOL_MAX_RETRY_MS;
+        } else if (pool->stopping) {
+            tcp_client_close(sockfd);
+        } else {
+            retryMs = CONNECTION_POOL_RETRY_MS;
+            pool->idle[pool->count++] = sockfd;
+            pthread_cond_broadcast(&pool->changed);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/*
+Description:
+    Starts filling a pool in the background.
+Arguments:
+    ConnectionPool *pool: The pool to initialize
+    Config config: The configuration used to connect
+    size_t size: The number of idle connections to keep, at most CONNECTION_POOL_MAX_SIZE
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int connection_pool_init(ConnectionPool *pool, Config config, size_t size) {
+    memset(pool, 0, sizeof(ConnectionPool));
+    if (size < 1 || size > CONNECTION_POOL_MAX_SIZE) {
+        log_error("A pool holds between 1 and %d connections", CONNECTION_POOL_MAX_SIZE);
+        return 1;
+    }
+    pool->config = config;
+    pool->size = size;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->changed, NULL);
+    if (pthread_create(&pool->filler, NULL, fillerMain, pool) != 0) {
+        log_error("Unable to start the connection pool");
+        pthread_cond_destroy(&pool->changed);
+        pthread_mutex_destroy(&pool->lock);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Takes a connection out of the pool, or connects a new one if the pool has none ready.
+Arguments:
+    ConnectionPool *pool: The pool
+Return value:
+    Returns the socket file descriptor or -1 if an error occurs.
+*/
+int connection_pool_take(ConnectionPool *pool) {
+    int sockfd = connection_pool_try_take(pool, 0);
+    if (sockfd != TCP_CLIENT_BAD_SOCKET)
+        return sockfd;
+    return tcp_client_connect(pool->config);
+}
+
+/*
+Description:
+    Takes a connection out of the pool, waiting up to waitMs milliseconds for the background thread
+    to open one if none is ready. It never connects on the calling thread.
+Arguments:
+    ConnectionPool *pool: The pool
+    unsigned waitMs: How long to wait for a connection (0 means not at all)
+Return value:
+    Returns the socket file descriptor or -1 if no connection was ready in time.
+*/
+int connection_pool_try_take(ConnectionPool *pool, unsigned waitMs) {
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += waitMs / 1000;
+    deadline.tv_nsec += (waitMs % 1000) * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->count > 0) {
+            int sockfd = pool->idle[--pool->count];
+            pthread_cond_broadcast(&pool->changed);
+
+            // An idle connection should have nothing to read; end of file means the server left
+            char byte;
+            ssize_t peeked = recv(sockfd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+            if (peeked == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                pthread_mutex_unlock(&pool->lock);
+                return sockfd;
+            }
+            log_info("Dropping a pooled connection the server closed");
+            tcp_client_close(sockfd);
+        }
+        if (waitMs == 0 || pool->stopping ||
+            pthread_cond_timedwait(&pool->changed, &pool->lock, &deadline) == ETIMEDOUT)
+            break;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return TCP_CLIENT_BAD_SOCKET;
+}
+
+/*
+Description:
+    Stops the background thread and closes the idle connections. Connections that were taken are
+    left to their owners.
+Arguments:
+    ConnectionPool *pool: The pool
+Return value:
+    None.
+*/
+void connection_pool_free(ConnectionPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+    pthread_join(pool->filler, NULL);
+
+    while (pool->count > 0)
+        tcp_client_close(pool->idle[--pool->count]);
+    pthread_cond_destroy(&pool->changed);
+    pthread_mutex_destroy(&pool->lock);
+}
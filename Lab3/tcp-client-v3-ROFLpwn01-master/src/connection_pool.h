@@ -0,0 +1,76 @@
+#ifndef CONNECTION_POOL_H_
+#define CONNECTION_POOL_H_
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "tcp_client.h"
+
+#define CONNECTION_POOL_MAX_SIZE 64
+#define CONNECTION_POOL_RETRY_MS 100
+#define CONNECTION_POOL_MAX_RETRY_MS 5000
+
+/*
+Connections opened ahead of demand. A background thread keeps size idle connections open to the
+server in config, so taking one costs no handshake; each one taken is replaced right away, and
+failed attempts are retried with exponential backoff. If none is ready, connection_pool_take
+connects on the spot, while connection_pool_try_take only waits for the background thread. Idle
+connections the server has closed are dropped when they are taken.
+*/
+typedef struct ConnectionPool {
+    Config config;
+    int idle[CONNECTION_POOL_MAX_SIZE];
+    size_t count;
+    size_t size;
+    int stopping;
+    pthread_t filler;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} ConnectionPool;
+
+/*
+Description:
+    Starts filling a pool in the background.
+Arguments:
+    ConnectionPool *pool: The pool to initialize
+    Config config: The configuration used to connect
+    size_t size: The number of idle connections to keep, at most CONNECTION_POOL_MAX_SIZE
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int connection_pool_init(ConnectionPool *pool, Config config, size_t size);
+
+/*
+Description:
+    Takes a connection out of the pool, or connects a new one if the pool has none ready.
+Arguments:
+    ConnectionPool *pool: The pool
+Return value:
+    Returns the socket file descriptor or -1 if an error occurs.
+*/
+int connection_pool_take(ConnectionPool *pool);
+
+/*
+Description:
+    Takes a connection out of the pool, waiting up to waitMs milliseconds for the background thread
+    to open one if none is ready. It never connects on the calling thread.
+Arguments:
+    ConnectionPool *pool: The pool
+    unsigned waitMs: How long to wait for a connection (0 means not at all)
+Return value:
+    Returns the socket file descriptor or -1 if no connection was ready in time.
+*/
+int connection_pool_try_take(ConnectionPool *pool, unsigned waitMs);
+
+/*
+Description:
+    Stops the background thread and closes the idle connections. Connections that were taken are
+    left to their owners.
+Arguments:
+    ConnectionPool *pool: The pool
+Return value:
+    None.
+*/
+void connection_pool_free(ConnectionPool *pool);
+
+#endif
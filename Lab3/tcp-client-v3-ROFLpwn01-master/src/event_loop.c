@@ -0,0 +1,160 @@
+#include "event_loop.h"
+#include "log.h"
+
+#include <sys/epoll.h>
+
+/*
+Description:
+    Creates the epoll instance.
+Arguments:
+    EventLoop *loop: The loop to initialize
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int event_loop_init(EventLoop *loop) {
+    memset(loop, 0, sizeof(EventLoop));
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd == -1) {
+        log_error("Unable to create the event loop: %s", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Adds a connected session to the loop.
+Arguments:
+    EventLoop *loop: The loop
+    TcpClientSession *session: The session, connected with a plain socket
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int event_loop_add(EventLoop *loop, TcpClientSession *session) {
+    int sockfd = tcp_client_session_fd(session);
+    if (sockfd == TCP_CLIENT_BAD_SOCKET)
+        return 1;
+
+    struct epoll_event event = {.events = tcp_client_session_events(session), .data.ptr = session};
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, sockfd, &event) == -1) {
+        log_error("Unable to add a session to the event loop: %s", strerror(errno));
+        return 1;
+    }
+    session->registered = event.events;
+    loop->sessions++;
+    if (session->registered != 0)
+        loop->busy++;
+    return 0;
+}
+
+/*
+Description:
+    Re-registers a session for the events it now waits for. The loop does this itself after the
+    session's own callbacks; call it after submitting on a session from anywhere else.
+Arguments:
+    EventLoop *loop: The loop
+    TcpClientSession *session: The session
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int event_loop_update(EventLoop *loop, TcpClientSession *session) {
+    short events = tcp_client_session_events(session);
+    if (events == session->registered)
+        return 0;
+
+    struct epoll_event event = {.events = events, .data.ptr = session};
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, session->sockfd, &event) == -1) {
+        log_error("Unable to update a session in the event loop: %s", strerror(errno));
+        return 1;
+    }
+    if (session->registered == 0)
+        loop->busy++;
+    else if (events == 0)
+        loop->busy--;
+    session->registered = events;
+    return 0;
+}
+
+/*
+Description:
+    Takes a session out of the loop. The session is not closed.
+Arguments:
+    EventLoop *loop: The loop
+    TcpClientSession *session: The session
+Return value:
+    None.
+*/
+void event_loop_remove(EventLoop *loop, TcpClientSession *session) {
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, session->sockfd, NULL);
+    if (session->registered != 0)
+        loop->busy--;
+    session->registered = 0;
+    loop->sessions--;
+}
+
+/*
+Description:
+    Waits once for ready sessions and makes progress on each of them.
+Arguments:
+    EventLoop *loop: The loop
+    int timeoutMs: The longest to wait in milliseconds, or -1 to wait until a session is ready
+Return value:
+    Returns a 1 on failure, 0 on success. A session failing is not a failure of the loop.
+*/
+int event_loop_run_once(EventLoop *loop, int timeoutMs) {
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+    int ready = epoll_wait(loop->epfd, events, EVENT_LOOP_MAX_EVENTS, timeoutMs);
+    if (ready == -1) {
+        if (errno == EINTR)
+            return 0;
+        log_error("epoll_wait failed: %s", strerror(errno));
+        return 1;
+    }
+
+    for (int i = 0; i < ready; i++) {
+        TcpClientSession *session = events[i].data.ptr;
+        uint32_t revents = events[i].events;
+
+        // Writing first lets a response to the requests just written be read in the same round
+        if (((revents & (EPOLLOUT | EPOLLERR)) && tcp_client_session_on_writable(session)) ||
+            ((revents & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+             tcp_client_session_on_readable(session)) ||
+            event_loop_update(loop, session)) {
+            session->failed = 1;
+            event_loop_remove(loop, session);
+            loop->failures++;
+        }
+    }
+    return 0;
+}
+
+/*
+Description:
+    Runs the loop until no session is waiting for anything.
+Arguments:
+    EventLoop *loop: The loop
+Return value:
+    Returns a 1 on failure or if any session failed, 0 on success
+*/
+int event_loop_run(EventLoop *loop) {
+    while (loop->busy > 0) {
+        if (event_loop_run_once(loop, -1))
+            return 1;
+    }
+    return loop->failures > 0;
+}
+
+/*
+Description:
+    Closes the epoll instance. The sessions are not closed.
+Arguments:
+    EventLoop *loop: The loop
+Return value:
+    None.
+*/
+void event_loop_free(EventLoop *loop) {
+    if (loop->epfd != -1)
+        close(loop->epfd);
+    loop->epfd = -1;
+}
@@ -0,0 +1,99 @@
+#ifndef EVENT_LOOP_H_
+#define EVENT_LOOP_H_
+
+#include <stddef.h>
+
+#include "tcp_client.h"
+
+#define EVENT_LOOP_MAX_EVENTS 256
+
+/*
+A single threaded epoll loop that drives any number of non-blocking sessions. Each session's socket
+is registered for the events it is waiting for (tcp_client_session_events) and re-registered only
+when those change. busy counts the sessions that are waiting for anything; event_loop_run returns
+once it drops to zero. A session that fails is taken out of the loop with its failed flag set and
+the loop carries on with the others.
+*/
+typedef struct EventLoop {
+    int epfd;
+    size_t sessions;
+    size_t busy;
+    size_t failures;
+} EventLoop;
+
+/*
+Description:
+    Creates the epoll instance.
+Arguments:
+    EventLoop *loop: The loop to initialize
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int event_loop_init(EventLoop *loop);
+
+/*
+Description:
+    Adds a connected session to the loop.
+Arguments:
+    EventLoop *loop: The loop
+    TcpClientSession *session: The session, connected with a plain socket
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int event_loop_add(EventLoop *loop, TcpClientSession *session);
+
+/*
+Description:
+    Re-registers a session for the events it now waits for. The loop does this itself after the
+    session's own callbacks; call it after submitting on a session from anywhere else.
+Arguments:
+    EventLoop *loop: The loop
+    TcpClientSession *session: The session
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int event_loop_update(EventLoop *loop, TcpClientSession *session);
+
+/*
+Description:
+    Takes a session out of the loop. The session is not closed.
+Arguments:
+    EventLoop *loop: The loop
+    TcpClientSession *session: The session
+Return value:
+    None.
+*/
+void event_loop_remove(EventLoop *loop, TcpClientSession *session);
+
+/*
+Description:
+    Waits once for ready sessions and makes progress on each of them.
+Arguments:
+    EventLoop *loop: The loop
+    int timeoutMs: The longest to wait in milliseconds, or -1 to wait until a session is ready
+Return value:
+    Returns a 1 on failure, 0 on success. A session failing is not a failure of the loop.
+*/
+int event_loop_run_once(EventLoop *loop, int timeoutMs);
+
+/*
+Description:
+    Runs the loop until no session is waiting for anything.
+Arguments:
+    EventLoop *loop: The loop
+Return value:
+    Returns a 1 on failure or if any session failed, 0 on success
+*/
+int event_loop_run(EventLoop *loop);
+
+/*
+Description:
+    Closes the epoll instance. The sessions are not closed.
+Arguments:
+    EventLoop *loop: The loop
+Return value:
+    None.
+*/
+void event_loop_free(EventLoop *loop);
+
+#endif
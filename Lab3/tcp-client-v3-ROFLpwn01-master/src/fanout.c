@@ -0,0 +1,554 @@
+#define _GNU_SOURCE
+#include "fanout.h"
+#include "log.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+/*
+A request (header and message) waiting in a worker's queue. The message points into the mapped
+input when there is one, otherwise at a copy stored after the struct.
+*/
+typedef struct Request {
+    struct Request *next;
+    size_t seq;
+    uint32_t header;
+    size_t length;
+    const char *message;
+    char storage[];
+} Request;
+
+/*
+A response that arrived before the responses to earlier lines and is waiting to be printed.
+*/
+typedef struct ReorderSlot {
+    char *data;
+    size_t length;
+    int ready;
+} ReorderSlot;
+
+struct FanOut;
+
+/*
+One connection and the thread that drives it. The queue is filled by the dispatcher and drained by
+the worker; outstanding counts requests that are queued or in flight on this connection.
+*/
+typedef struct Worker {
+    pthread_t thread;
+    int index;
+    int sockfd;
+    int wakefd;
+    pthread_mutex_t lock;
+    Request *head;
+    Request *tail;
+    int closed;
+    size_t outstanding;
+    struct FanOut *fanout;
+} Worker;
+
+/*
+State shared between the dispatcher and the workers. Sequence numbers are handed out in input-line
+order and at most window of them are unprinted at once, which bounds the reorder buffer.
+*/
+typedef struct FanOut {
+    Worker *workers;
+    int connections;
+    size_t maxInFlight;
+    size_t batchFrames;
+    size_t batchBytes;
+    int pinCpus;
+    TcpClientSession *session;
+    pthread_mutex_t lock;
+    pthread_cond_t windowOpen;
+    ReorderSlot *slots;
+    size_t window;
+    size_t nextSeq;
+    size_t nextToPrint;
+    int failed;
+} FanOut;
+
+static pthread_mutex_t logMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+Description:
+    Lock function for log.c so workers can log at the same time.
+Arguments:
+    bool lock: Whether to lock or unlock
+    void *udata: The mutex
+Return value:
+    None.
+*/
+static void logLock(bool lock, void *udata) {
+    if (lock)
+        pthread_mutex_lock(udata);
+    else
+        pthread_mutex_unlock(udata);
+}
+
+/*
+Description:
+    Marks the fan-out as failed and wakes the dispatcher.
+Arguments:
+    FanOut *fanout: The shared fan-out state
+Return value:
+    None.
+*/
+static void setFailed(FanOut *fanout) {
+    pthread_mutex_lock(&fanout->lock);
+    fanout->failed = 1;
+    pthread_cond_broadcast(&fanout->windowOpen);
+    pthread_mutex_unlock(&fanout->lock);
+}
+
+/*
+Description:
+    Passes a response to the session if it is the next one in input order, along with any
+    buffered responses that follow it. Otherwise the response is copied into the reorder buffer.
+Arguments:
+    FanOut *fanout: The shared fan-out state
+    size_t seq: The sequence number of the request that was answered
+    const char *response: The response
+    size_t length: The length of the response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int deliverResponse(FanOut *fanout, size_t seq, const char *response, size_t length) {
+    int result = 0;
+
+    pthread_mutex_lock(&fanout->lock);
+    if (seq == fanout->nextToPrint) {
+        result = tcp_client_session_deliver(fanout->session, response, length);
+        fanout->nextToPrint++;
+
+        ReorderSlot *slot;
+        while ((slot = &fanout->slots[fanout->nextToPrint % fanout->window])->ready) {
+            result |= tcp_client_session_deliver(fanout->session, slot->data, slot->length);
+            free(slot->data);
+            slot->data = NULL;
+            slot->ready = 0;
+            fanout->nextToPrint++;
+        }
+        pthread_cond_broadcast(&fanout->windowOpen);
+    } else {
+        ReorderSlot *slot = &fanout->slots[seq % fanout->window];
+        slot->data = malloc(length > 0 ? length : 1);
+        if (slot->data == NULL) {
+            log_error("Unable to buffer an out of order response");
+            result = 1;
+        } else {
+            memcpy(slot->data, response, length);
+            slot->length = length;
+            slot->ready = 1;
+        }
+    }
+    pthread_mutex_unlock(&fanout->lock);
+    return result;
+}
+
+/*
+Description:
+    Pins the calling worker thread to a CPU, round-robin over the online CPUs.
+Arguments:
+    int index: The index of the worker
+Return value:
+    None.
+*/
+static void pinWorker(int index) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (cpus < 1)
+        cpus = 1;
+    CPU_ZERO(&set);
+    CPU_SET(index % cpus, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        log_warn("Unable to pin worker %d to CPU %ld", index, index % cpus);
+}
+
+/*
+Description:
+    Frees a list of requests.
+Arguments:
+    Request *request: The first request in the list
+Return value:
+    None.
+*/
+static void freeRequests(Request *request) {
+    while (request != NULL) {
+        Request *next = request->next;
+        free(request);
+        request = next;
+    }
+}
+
+/*
+Description:
+    Worker thread. Pipelines the requests from its queue over its own socket and delivers the
+    responses, which come back in the order they were sent on this connection. Queued requests are
+    written in batches with one sendmsg; the batch points at the requests themselves, which are
+    kept in the sent list until the whole batch has been written.
+Arguments:
+    void *arg: The Worker to run
+Return value:
+    NULL
+*/
+static void *workerMain(void *arg) {
+    Worker *worker = arg;
+    FanOut *fanout = worker->fanout;
+    size_t maxInFlight = fanout->maxInFlight;
+    int profile = fanout->session->profile;
+    size_t *seqs = malloc(maxInFlight * sizeof(size_t));
+    size_t seqHead = 0;
+    size_t inFlight = 0;
+    Request *sent = NULL;
+    Request *sentTail = NULL;
+    int closed = 0;
+    SendBatch batch;
+    RingBuffer ring;
+
+    if (fanout->pinCpus)
+        pinWorker(worker->index);
+
+    if (seqs == NULL || ring_buffer_init(&ring, RING_BUFFER_DEFAULT_CAPACITY)) {
+        log_error("Worker %d unable to allocate buffers", worker->index);
+        free(seqs);
+        setFailed(fanout);
+        return NULL;
+    }
+    // Every pass sends what the queue holds, so no frame waits for a deadline
+    if (send_batch_init(&batch, fanout->batchFrames, fanout->batchBytes, 0)) {
+        free(seqs);
+        ring_buffer_free(&ring);
+        setFailed(fanout);
+        return NULL;
+    }
+
+    while (!__atomic_load_n(&fanout->failed, __ATOMIC_ACQUIRE)) {
+        if (send_batch_pending(&batch) == 0 && inFlight < maxInFlight) {
+            freeRequests(sent);
+            sent = NULL;
+            sentTail = NULL;
+
+            pthread_mutex_lock(&worker->lock);
+            while (worker->head != NULL && inFlight < maxInFlight &&
+                   !send_batch_should_flush(&batch) &&
+                   send_batch_has_room(&batch, worker->head->length, 0)) {
+                Request *request = worker->head;
+                worker->head = request->next;
+                if (worker->head == NULL)
+                    worker->tail = NULL;
+                request->next = NULL;
+
+                // Cannot fail: messages are referenced, not copied
+                send_batch_add(&batch, request->header, request->message, request->length, 0);
+                if (sentTail == NULL)
+                    sent = request;
+                else
+                    sentTail->next = request;
+                sentTail = request;
+                seqs[(seqHead + inFlight) % maxInFlight] = request->seq;
+                inFlight++;
+            }
+            closed = worker->closed;
+            pthread_mutex_unlock(&worker->lock);
+
+            if (send_batch_pending(&batch) > 0 &&
+                tcp_client_flush_batch(&batch, worker->sockfd, profile, 0)) {
+                log_error("Worker %d unable to send", worker->index);
+                goto fail;
+            }
+        }
+        int sending = send_batch_pending(&batch) > 0;
+        if (!sending && inFlight == 0 && closed)
+            break;
+
+        struct pollfd pfds[2] = {{.fd = worker->sockfd, .events = POLLIN},
+                                 {.fd = worker->wakefd, .events = POLLIN}};
+        if (sending)
+            pfds[0].events |= POLLOUT;
+        if (sending || inFlight == maxInFlight)
+            pfds[1].fd = -1;
+
+        if (poll(pfds, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            log_error("Worker %d poll failed: %s", worker->index, strerror(errno));
+            goto fail;
+        }
+
+        if (pfds[1].revents & POLLIN) {
+            uint64_t count;
+            if (read(worker->wakefd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+                log_error("Worker %d unable to read wake event", worker->index);
+                goto fail;
+            }
+        }
+
+        if ((pfds[0].revents & POLLOUT) &&
+            tcp_client_flush_batch(&batch, worker->sockfd, profile, 0)) {
+            log_error("Worker %d unable to send", worker->index);
+            goto fail;
+        }
+
+        if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t bytesReceived = ring_buffer_recv(&ring, worker->sockfd, 0);
+            if (bytesReceived == 0) {
+                log_error("Worker %d: server closed the connection", worker->index);
+                goto fail;
+            }
+            if (bytesReceived == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    continue;
+                log_error("Worker %d error receiving data: %s", worker->index, strerror(errno));
+                goto fail;
+            }
+
+            char *response;
+            size_t length;
+            int found;
+            while ((found = tcp_client_next_response(&ring, 0, &response, &length)) > 0) {
+                if (inFlight == 0) {
+                    log_error("Worker %d received a response with no request in flight",
+                              worker->index);
+                    goto fail;
+                }
+                size_t seq = seqs[seqHead];
+                seqHead = (seqHead + 1) % maxInFlight;
+                inFlight--;
+                __atomic_sub_fetch(&worker->outstanding, 1, __ATOMIC_RELAXED);
+                if (deliverResponse(fanout, seq, response, length))
+                    goto fail;
+            }
+            if (found == -1)
+                goto fail;
+        }
+    }
+
+    freeRequests(sent);
+    free(seqs);
+    send_batch_free(&batch);
+    ring_buffer_free(&ring);
+    return NULL;
+
+fail:
+    setFailed(fanout);
+    freeRequests(sent);
+    free(seqs);
+    send_batch_free(&batch);
+    ring_buffer_free(&ring);
+    return NULL;
+}
+
+/*
+Description:
+    Reads the next valid line of the input into a newly allocated request.
+Arguments:
+    InputReader *reader: The reader to read from
+    int *failed: Set to true on failure
+Return value:
+    Returns the request, or NULL at the end of the input or on failure (failed is set to true)
+*/
+static Request *readRequest(InputReader *reader, int *failed) {
+    uint32_t header;
+    InputLine line;
+
+    int found = tcp_client_next_request(reader, &header, &line);
+    if (found != 1) {
+        *failed = found == -1;
+        return NULL;
+    }
+
+    size_t storage = reader->mapped ? 0 : line.messageLength;
+    Request *request = malloc(sizeof(Request) + storage);
+    if (request == NULL) {
+        log_error("Unable to allocate a request");
+        *failed = 1;
+        return NULL;
+    }
+    request->next = NULL;
+    request->header = header;
+    request->length = line.messageLength;
+    request->message = line.message;
+    if (!reader->mapped) {
+        memcpy(request->storage, line.message, line.messageLength);
+        request->message = request->storage;
+    }
+    return request;
+}
+
+/*
+Description:
+    Appends a request to the queue of the worker with the fewest outstanding requests and wakes it.
+Arguments:
+    FanOut *fanout: The shared fan-out state
+    Request *request: The request to queue
+Return value:
+    None.
+*/
+static void dispatchRequest(FanOut *fanout, Request *request) {
+    Worker *worker = &fanout->workers[0];
+
+    for (int i = 1; i < fanout->connections; i++) {
+        if (__atomic_load_n(&fanout->workers[i].outstanding, __ATOMIC_RELAXED) <
+            __atomic_load_n(&worker->outstanding, __ATOMIC_RELAXED))
+            worker = &fanout->workers[i];
+    }
+    __atomic_add_fetch(&worker->outstanding, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->tail != NULL)
+        worker->tail->next = request;
+    else
+        worker->head = request;
+    worker->tail = request;
+    pthread_mutex_unlock(&worker->lock);
+
+    uint64_t one = 1;
+    if (write(worker->wakefd, &one, sizeof(one)) == -1)
+        log_warn("Unable to wake worker %d", worker->index);
+}
+
+/*
+Description:
+    Closes every worker queue and waits for the workers to finish.
+Arguments:
+    FanOut *fanout: The shared fan-out state
+    int started: The number of worker threads that were started
+Return value:
+    None.
+*/
+static void stopWorkers(FanOut *fanout, int started) {
+    uint64_t one = 1;
+
+    for (int i = 0; i < started; i++) {
+        Worker *worker = &fanout->workers[i];
+        pthread_mutex_lock(&worker->lock);
+        worker->closed = 1;
+        pthread_mutex_unlock(&worker->lock);
+        if (write(worker->wakefd, &one, sizeof(one)) == -1)
+            log_warn("Unable to wake worker %d", worker->index);
+    }
+    for (int i = 0; i < started; i++)
+        pthread_join(fanout->workers[i].thread, NULL);
+}
+
+/*
+Description:
+    Spreads the lines of the file across config.connections sockets, each driven by its own worker
+    thread that pipelines at most config.maxInFlight requests. Responses are merged back through a
+    reorder buffer so they reach the session in input-line order, one at a time. Workers are
+    pinned to CPUs round-robin when config.pinCpus is set. The session is not connected itself; it
+    holds the config, the counters and the handler for the run.
+Arguments:
+    TcpClientSession *session: The session the connections work for
+    FILE *fd: The file pointer to read requests from
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int fanout_run(TcpClientSession *session, FILE *fd) {
+    Config config = session->config;
+    FanOut fanout = {0};
+    InputReader reader;
+    log_LockFn previousLock;
+    void *previousLockData;
+    int started = 0;
+    int failed = 0;
+
+    if (strncmp(config.host, TCP_CLIENT_SHM_PREFIX, strlen(TCP_CLIENT_SHM_PREFIX)) == 0) {
+        log_error("A shared memory region serves one connection at a time");
+        return 1;
+    }
+    if (input_reader_open(&reader, fd))
+        return 1;
+    // The workers log concurrently, so the caller's lock is swapped out for the run
+    log_get_lock(&previousLock, &previousLockData);
+    log_set_lock(logLock, &logMutex);
+
+    if (config.ioUring) {
+        log_warn("The io_uring backend is not used with multiple connections");
+        config.ioUring = 0;
+    }
+
+    fanout.connections = config.connections;
+    fanout.maxInFlight = config.maxInFlight;
+    fanout.batchFrames = config.batchFrames;
+    fanout.batchBytes = config.batchBytes;
+    fanout.pinCpus = config.pinCpus;
+    fanout.session = session;
+    fanout.window = (size_t)config.connections * config.maxInFlight * 2;
+    fanout.slots = calloc(fanout.window, sizeof(ReorderSlot));
+    fanout.workers = calloc(config.connections, sizeof(Worker));
+    pthread_mutex_init(&fanout.lock, NULL);
+    pthread_cond_init(&fanout.windowOpen, NULL);
+    if (fanout.slots == NULL || fanout.workers == NULL) {
+        log_error("Unable to allocate the fan-out state");
+        failed = 1;
+        goto cleanup;
+    }
+
+    log_info("Starting %d connections", config.connections);
+    for (started = 0; started < config.connections; started++) {
+        Worker *worker = &fanout.workers[started];
+        worker->index = started;
+        worker->fanout = &fanout;
+        worker->sockfd = tcp_client_connect(config);
+        worker->wakefd = eventfd(0, EFD_NONBLOCK);
+        pthread_mutex_init(&worker->lock, NULL);
+        if (worker->sockfd == TCP_CLIENT_BAD_SOCKET || worker->wakefd == -1 ||
+            fcntl(worker->sockfd, F_SETFL, fcntl(worker->sockfd, F_GETFL) | O_NONBLOCK) == -1 ||
+            pthread_create(&worker->thread, NULL, workerMain, worker) != 0) {
+            log_error("Unable to start connection %d", started);
+            if (worker->sockfd != TCP_CLIENT_BAD_SOCKET)
+                close(worker->sockfd);
+            if (worker->wakefd != -1)
+                close(worker->wakefd);
+            pthread_mutex_destroy(&worker->lock);
+            failed = 1;
+            break;
+        }
+    }
+
+    Request *request;
+    while (!failed && (request = readRequest(&reader, &failed)) != NULL) {
+        pthread_mutex_lock(&fanout.lock);
+        while (!fanout.failed && fanout.nextSeq - fanout.nextToPrint >= fanout.window)
+            pthread_cond_wait(&fanout.windowOpen, &fanout.lock);
+        failed = fanout.failed;
+        request->seq = fanout.nextSeq++;
+        pthread_mutex_unlock(&fanout.lock);
+
+        if (failed) {
+            free(request);
+            break;
+        }
+        dispatchRequest(&fanout, request);
+        session->messagesSent++;
+    }
+
+    stopWorkers(&fanout, started);
+    failed |= fanout.failed;
+
+    for (int i = 0; i < started; i++) {
+        Worker *worker = &fanout.workers[i];
+        freeRequests(worker->head);
+        tcp_client_close(worker->sockfd);
+        close(worker->wakefd);
+        pthread_mutex_destroy(&worker->lock);
+    }
+
+cleanup:
+    if (fanout.slots != NULL) {
+        for (size_t i = 0; i < fanout.window; i++)
+            free(fanout.slots[i].data);
+    }
+    free(fanout.slots);
+    free(fanout.workers);
+    pthread_cond_destroy(&fanout.windowOpen);
+    pthread_mutex_destroy(&fanout.lock);
+    input_reader_close(&reader);
+    log_set_lock(previousLock, previousLockData);
+    return failed;
+}
@@ -0,0 +1,23 @@
+#ifndef FANOUT_H_
+#define FANOUT_H_
+
+#include "tcp_client.h"
+
+#define FANOUT_MAX_CONNECTIONS 256
+
+/*
+Description:
+    Spreads the lines of the file across config.connections sockets, each driven by its own worker
+    thread that pipelines at most config.maxInFlight requests. Responses are merged back through a
+    reorder buffer so they reach the session in input-line order, one at a time. Workers are
+    pinned to CPUs round-robin when config.pinCpus is set. The session is not connected itself; it
+    holds the config, the counters and the handler for the run.
+Arguments:
+    TcpClientSession *session: The session the connections work for
+    FILE *fd: The file pointer to read requests from
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int fanout_run(TcpClientSession *session, FILE *fd);
+
+#endif
@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+#include "hedge.h"
+#include "clock.h"
+#include "histogram.h"
+#include "input_reader.h"
+#include "log.h"
+
+#include <time.h>
+
+#define HEDGE_MAX_SENT (HEDGE_MAX_OWED + 1)
+
+/*
+One of the two connections. Responses come back in the order the requests were sent, so the send
+times of the requests in flight are kept in a FIFO and matched to the responses as they arrive.
+The first owed responses are answers to requests that were already answered on the other
+connection.
+*/
+typedef struct HedgeConnection {
+    TcpClientSession *session;
+    uint64_t sentAt[HEDGE_MAX_SENT];
+    size_t sentHead;
+    size_t sentCount;
+    size_t owed;
+} HedgeConnection;
+
+/*
+Description:
+    Sends a request on a connection and notes when it was sent.
+Arguments:
+    HedgeConnection *connection: The connection
+    uint32_t header: The request header in network byte order
+    const InputLine *line: The request
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int sendOn(HedgeConnection *connection, uint32_t header, const InputLine *line) {
+    if (tcp_client_send_frame(connection->session->sockfd, header, line->message,
+                              line->messageLength))
+        return 1;
+    connection->sentAt[(connection->sentHead + connection->sentCount) % HEDGE_MAX_SENT] =
+        clock_now_ns();
+    connection->sentCount++;
+    return 0;
+}
+
+/*
+Description:
+    Closes a connection that is stuck or owes too many responses and opens it again, dropping what
+    it owed.
+Arguments:
+    HedgeConnection *connection: The connection
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int reopen(HedgeConnection *connection) {
+    TcpClientSession *session = connection->session;
+
+    log_info("Reopening a connection %zu responses behind", connection->owed);
+    tcp_client_close(session->sockfd);
+    ring_buffer_consume(&session->ring, ring_buffer_length(&session->ring));
+    connection->sentCount = 0;
+    connection->owed = 0;
+    session->sockfd = tcp_client_connect(session->config);
+    if (session->sockfd == TCP_CLIENT_BAD_SOCKET) {
+        log_error("Unable to reopen a connection for hedging");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Sends every line of the file one request at a time, hedging idempotent requests that are slow
+    to be answered onto a second connection to config.hedgeHost (or the same host) after the
+    config.hedgePercentile percentile of the response times. Each request goes out first on
+    whichever connection owes fewer dropped responses. Responses reach the session in input-line
+    order.
+Arguments:
+    TcpClientSession *session: The session, connected with a plain socket
+    FILE *fd: The file pointer to read requests from
+    HedgeStats *stats: Filled in with the counts of the run
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int hedge_run(TcpClientSession *session, FILE *fd, HedgeStats *stats) {
+    Config config = session->config;
+    TcpClientSession second;
+    HedgeConnection connections[2] = {{.session = session}, {.session = &second}};
+    Histogram latencies;
+    InputReader reader;
+    InputLine line;
+    uint32_t header;
+    uint64_t delay = 0;
+    int readerOpen = 0;
+    int found;
+    int result = 1;
+
+    memset(stats, 0, sizeof(HedgeStats));
+    if (config.hedgeHost != NULL)
+        config.host = config.hedgeHost;
+    if (histogram_init(&latencies))
+        return 1;
+    if (tcp_client_session_init(&second, config, session->handle_response, session->userData)) {
+        histogram_free(&latencies);
+        return 1;
+    }
+    if (tcp_client_session_connect(&second)) {
+        log_error("Unable to open the connection for hedges");
+        goto done;
+    }
+    if (input_reader_open(&reader, fd))
+        goto done;
+    readerOpen = 1;
+
+    while ((found = tcp_client_next_request(&reader, &header, &line)) == 1) {
+        int idempotent = tcp_client_action_is_idempotent(line.action, line.actionLength);
+        int first = connections[1].owed < connections[0].owed;
+        int hedgedOn = -1;
+        int stuck = -1;
+        int answered = 0;
+
+        if (sendOn(&connections[first], header, &line))
+            goto done;
+        session->messagesSent++;
+        stats->requests++;
+        uint64_t deadline = idempotent && delay > 0 ? clock_now_ns() + delay : 0;
+
+        while (!answered) {
+            struct pollfd pfds[2];
+            for (int i = 0; i < 2; i++) {
+                pfds[i].fd = connections[i].sentCount > 0 ? connections[i].session->sockfd : -1;
+                pfds[i].events = POLLIN;
+                pfds[i].revents = 0;
+            }
+            struct timespec wait;
+            struct timespec *timeout = NULL;
+            if (deadline > 0) {
+                uint64_t now = clock_now_ns();
+                uint64_t left = deadline > now ? deadline - now : 0;
+                wait.tv_sec = left / CLOCK_NS_PER_SEC;
+                wait.tv_nsec = left % CLOCK_NS_PER_SEC;
+                timeout = &wait;
+            }
+            int ready = ppoll(pfds, 2, timeout, NULL);
+            if (ready == -1) {
+                if (errno == EINTR)
+                    continue;
+                log_error("poll failed: %s", strerror(errno));
+                goto done;
+            }
+            if (ready == 0) {
+                // Not answered within the delay, so a duplicate races it on the other connection
+                hedgedOn = !first;
+                deadline = 0;
+                if (sendOn(&connections[hedgedOn], header, &line))
+                    goto done;
+                stats->hedged++;
+                continue;
+            }
+
+            for (int i = 0; i < 2 && !answered; i++) {
+                HedgeConnection *connection = &connections[i];
+                if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                    continue;
+                ssize_t bytesReceived =
+                    ring_buffer_recv(&connection->session->ring, connection->session->sockfd, 0);
+                if (bytesReceived == 0) {
+                    log_error("Server closed the connection with %zu requests in flight",
+                              connection->sentCount);
+                    goto done;
+                }
+                if (bytesReceived == -1) {
+                    if (errno == EINTR)
+                        continue;
+                    log_error("Error receiving data: %s", strerror(errno));
+                    goto done;
+                }
+
+                char *response;
+                size_t length;
+                int more = 0;
+                while (connection->sentCount > 0 &&
+                       (more = tcp_client_next_response(&connection->session->ring,
+                                                        connection->session->batchAccepted,
+                                                        &response, &length)) == 1) {
+                    uint64_t sentAt = connection->sentAt[connection->sentHead];
+                    connection->sentHead = (connection->sentHead + 1) % HEDGE_MAX_SENT;
+                    connection->sentCount--;
+                    if (connection->owed > 0) {
+                        connection->owed--;
+                        stats->dropped++;
+                        continue;
+                    }
+
+                    // Only answers that are used count, so a stuck connection draining its
+                    // backlog of dropped responses does not push the hedge delay up
+                    histogram_record(&latencies, clock_now_ns() - sentAt);
+                    if (tcp_client_session_deliver(session, response, length))
+                        goto done;
+                    answered = 1;
+                    if (hedgedOn != -1) {
+                        connections[!i].owed++;
+                        if (i == hedgedOn) {
+                            stats->hedgesWon++;
+                            stuck = !i;
+                        }
+                    }
+                }
+                if (more == -1)
+                    goto done;
+            }
+        }
+
+        // A connection beaten by its hedge is likely stuck behind a slow request, and closing it is
+        // the only way to cancel that request
+        for (int i = 0; i < 2; i++) {
+            if (i != stuck && connections[i].owed < HEDGE_MAX_OWED)
+                continue;
+            if (reopen(&connections[i]))
+                goto done;
+            stats->reconnects++;
+        }
+        if (latencies.totalCount >= HEDGE_MIN_SAMPLES &&
+            (delay == 0 || stats->requests % HEDGE_RECOMPUTE_INTERVAL == 0))
+            delay = histogram_value_at_percentile(&latencies, config.hedgePercentile);
+    }
+    if (found == -1)
+        goto done;
+    stats->delayNs = delay;
+    result = 0;
+
+done:
+    if (readerOpen)
+        input_reader_close(&reader);
+    tcp_client_session_close(&second);
+    histogram_free(&latencies);
+    return result;
+}
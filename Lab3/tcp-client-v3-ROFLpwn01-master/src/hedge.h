@@ -0,0 +1,54 @@
+#ifndef HEDGE_H_
+#define HEDGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tcp_client.h"
+
+#define HEDGE_MIN_SAMPLES 20
+#define HEDGE_RECOMPUTE_INTERVAL 64
+#define HEDGE_MAX_OWED 8
+
+/*
+Hedged requests. Requests go out one at a time over two connections. When an idempotent request
+has not been answered within the configured percentile of the response times seen so far, a
+duplicate goes out on the other connection, and whichever response comes first is used. The
+protocol has no way to cancel a request, so when the hedge wins, the connection it beat is closed
+and opened again, since it is most likely stuck behind the slow request. When the first request
+wins, the hedge's response is read and dropped when it arrives. A connection that falls
+HEDGE_MAX_OWED responses behind is opened again as well. Only the responses that are used count
+toward the response times; dropped ones are the late answers of stuck connections and would push
+the delay up. No request is hedged before HEDGE_MIN_SAMPLES responses have been timed.
+*/
+
+/*
+What hedging cost and gained over a run.
+*/
+typedef struct HedgeStats {
+    size_t requests;
+    size_t hedged;
+    size_t hedgesWon;
+    size_t dropped;
+    size_t reconnects;
+    uint64_t delayNs;
+} HedgeStats;
+
+/*
+Description:
+    Sends every line of the file one request at a time, hedging idempotent requests that are slow
+    to be answered onto a second connection to config.hedgeHost (or the same host) after the
+    config.hedgePercentile percentile of the response times. Each request goes out first on
+    whichever connection owes fewer dropped responses. Responses reach the session in input-line
+    order.
+Arguments:
+    TcpClientSession *session: The session, connected with a plain socket
+    FILE *fd: The file pointer to read requests from
+    HedgeStats *stats: Filled in with the counts of the run
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int hedge_run(TcpClientSession *session, FILE *fd, HedgeStats *stats);
+
+#endif
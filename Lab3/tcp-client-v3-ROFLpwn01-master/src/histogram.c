@@ -0,0 +1,152 @@
+#include "histogram.h"
+#include "log.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HALF_BUCKETS (HISTOGRAM_SUB_BUCKETS / 2)
+#define HALF_BUCKETS_LOG2 10
+
+/*
+Description:
+    Returns the bucket that counts a value.
+Arguments:
+    uint64_t value: The value
+Return value:
+    The index of the bucket.
+*/
+static size_t bucketIndex(uint64_t value) {
+    int shift = 63 - __builtin_clzll(value | (HISTOGRAM_SUB_BUCKETS - 1)) - HALF_BUCKETS_LOG2;
+    return (size_t)shift * HALF_BUCKETS + (value >> shift);
+}
+
+/*
+Description:
+    Returns the highest value counted by a bucket.
+Arguments:
+    size_t index: The index of the bucket
+Return value:
+    The highest value that maps to the bucket.
+*/
+static uint64_t highestInBucket(size_t index) {
+    int shift = index < HISTOGRAM_SUB_BUCKETS ? 0 : (int)(index / HALF_BUCKETS) - 1;
+    uint64_t subBucket = index - (size_t)shift * HALF_BUCKETS;
+    return (subBucket << shift) + (1ULL << shift) - 1;
+}
+
+/*
+Description:
+    Allocates an empty histogram.
+Arguments:
+    Histogram *histogram: The histogram to initialize
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int histogram_init(Histogram *histogram) {
+    memset(histogram, 0, sizeof(Histogram));
+    histogram->bucketCount = bucketIndex(HISTOGRAM_MAX_VALUE - 1) + 1;
+    histogram->counts = calloc(histogram->bucketCount, sizeof(uint64_t));
+    if (histogram->counts == NULL) {
+        log_error("Unable to allocate the histogram");
+        return 1;
+    }
+    histogram->min = UINT64_MAX;
+    return 0;
+}
+
+/*
+Description:
+    Frees a histogram.
+Arguments:
+    Histogram *histogram: The histogram to free
+Return value:
+    None.
+*/
+void histogram_free(Histogram *histogram) {
+    free(histogram->counts);
+    memset(histogram, 0, sizeof(Histogram));
+}
+
+/*
+Description:
+    Records one value. Values above HISTOGRAM_MAX_VALUE are clamped to it.
+Arguments:
+    Histogram *histogram: The histogram
+    uint64_t value: The value to record
+Return value:
+    None.
+*/
+void histogram_record(Histogram *histogram, uint64_t value) {
+    if (value >= HISTOGRAM_MAX_VALUE)
+        value = HISTOGRAM_MAX_VALUE - 1;
+    histogram->counts[bucketIndex(value)]++;
+    histogram->totalCount++;
+    if (value < histogram->min)
+        histogram->min = value;
+    if (value > histogram->max)
+        histogram->max = value;
+    histogram->sum += value;
+    histogram->sumSquares += (double)value * value;
+}
+
+/*
+Description:
+    Returns the value at a percentile: the highest value equivalent to the smallest recorded value
+    that has at least percentile percent of all values at or below it.
+Arguments:
+    const Histogram *histogram: The histogram
+    double percentile: The percentile, from 0 to 100
+Return value:
+    The value, or 0 if nothing was recorded.
+*/
+uint64_t histogram_value_at_percentile(const Histogram *histogram, double percentile) {
+    if (histogram->totalCount == 0)
+        return 0;
+    if (percentile >= 100.0)
+        return histogram->max;
+
+    uint64_t target = (uint64_t)ceil(percentile / 100.0 * histogram->totalCount);
+    if (target == 0)
+        target = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < histogram->bucketCount; i++) {
+        seen += histogram->counts[i];
+        if (seen >= target) {
+            uint64_t value = highestInBucket(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+/*
+Description:
+    Returns the mean of the recorded values.
+Arguments:
+    const Histogram *histogram: The histogram
+Return value:
+    The mean, or 0 if nothing was recorded.
+*/
+double histogram_mean(const Histogram *histogram) {
+    if (histogram->totalCount == 0)
+        return 0;
+    return histogram->sum / histogram->totalCount;
+}
+
+/*
+Description:
+    Returns the standard deviation of the recorded values.
+Arguments:
+    const Histogram *histogram: The histogram
+Return value:
+    The standard deviation, or 0 if nothing was recorded.
+*/
+double histogram_stddev(const Histogram *histogram) {
+    if (histogram->totalCount == 0)
+        return 0;
+    double mean = histogram_mean(histogram);
+    double variance = histogram->sumSquares / histogram->totalCount - mean * mean;
+    return variance > 0 ? sqrt(variance) : 0;
+}
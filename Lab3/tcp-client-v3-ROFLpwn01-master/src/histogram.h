@@ -0,0 +1,88 @@
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HISTOGRAM_SUB_BUCKETS 2048
+#define HISTOGRAM_MAX_VALUE (1ULL << 40)
+
+/*
+HDR-style latency histogram. Values below HISTOGRAM_SUB_BUCKETS are counted exactly; above that,
+each power of two is split into HISTOGRAM_SUB_BUCKETS / 2 linear buckets, so every recorded value
+keeps three significant digits. Recording is a few shifts and an increment.
+*/
+typedef struct Histogram {
+    uint64_t *counts;
+    size_t bucketCount;
+    uint64_t totalCount;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+    double sumSquares;
+} Histogram;
+
+/*
+Description:
+    Allocates an empty histogram.
+Arguments:
+    Histogram *histogram: The histogram to initialize
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int histogram_init(Histogram *histogram);
+
+/*
+Description:
+    Frees a histogram.
+Arguments:
+    Histogram *histogram: The histogram to free
+Return value:
+    None.
+*/
+void histogram_free(Histogram *histogram);
+
+/*
+Description:
+    Records one value. Values above HISTOGRAM_MAX_VALUE are clamped to it.
+Arguments:
+    Histogram *histogram: The histogram
+    uint64_t value: The value to record
+Return value:
+    None.
+*/
+void histogram_record(Histogram *histogram, uint64_t value);
+
+/*
+Description:
+    Returns the value at a percentile: the highest value equivalent to the smallest recorded value
+    that has at least percentile percent of all values at or below it.
+Arguments:
+    const Histogram *histogram: The histogram
+    double percentile: The percentile, from 0 to 100
+Return value:
+    The value, or 0 if nothing was recorded.
+*/
+uint64_t histogram_value_at_percentile(const Histogram *histogram, double percentile);
+
+/*
+Description:
+    Returns the mean of the recorded values.
+Arguments:
+    const Histogram *histogram: The histogram
+Return value:
+    The mean, or 0 if nothing was recorded.
+*/
+double histogram_mean(const Histogram *histogram);
+
+/*
+Description:
+    Returns the standard deviation of the recorded values.
+Arguments:
+    const Histogram *histogram: The histogram
+Return value:
+    The standard deviation, or 0 if nothing was recorded.
+*/
+double histogram_stddev(const Histogram *histogram);
+
+#endif
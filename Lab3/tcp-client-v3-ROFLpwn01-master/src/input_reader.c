@@ -0,0 +1,233 @@
+#define _GNU_SOURCE
+#include "input_reader.h"
+#include "log.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\v' || (c) == '\f')
+
+/*
+Description:
+    Sets up a reader for the rest of the file, mapping it if it is a regular file.
+Arguments:
+    InputReader *reader: The reader to initialize
+    FILE *file: The file to read from
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int input_reader_open(InputReader *reader, FILE *file) {
+    struct stat info;
+    int fd = fileno(file);
+
+    memset(reader, 0, sizeof(InputReader));
+    reader->file = file;
+
+    if (fd != -1 && fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+        off_t position = ftello(file);
+        if (position >= 0 && position < info.st_size) {
+            void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                madvise(map, info.st_size, MADV_SEQUENTIAL);
+                reader->data = map;
+                reader->mapLength = info.st_size;
+                reader->length = info.st_size;
+                reader->offset = position;
+                reader->mapped = 1;
+                return 0;
+            }
+            log_debug("Unable to map the input, reading it instead: %s", strerror(errno));
+        }
+    }
+
+    reader->capacity = INPUT_READER_BUFFER_SIZE;
+    reader->data = malloc(reader->capacity);
+    if (reader->data == NULL) {
+        log_error("Unable to allocate the input buffer");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Moves the unread bytes to the front of the buffer and reads more after them, doubling the
+    buffer if it is already full.
+Arguments:
+    InputReader *reader: The reader
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int fill(InputReader *reader) {
+    if (reader->offset > 0) {
+        memmove(reader->data, reader->data + reader->offset, reader->length - reader->offset);
+        reader->length -= reader->offset;
+        reader->offset = 0;
+    }
+
+    if (reader->length == reader->capacity) {
+        char *data = realloc(reader->data, reader->capacity * 2);
+        if (data == NULL) {
+            log_error("Unable to grow the input buffer");
+            return 1;
+        }
+        reader->data = data;
+        reader->capacity *= 2;
+    }
+
+    // read() hands back whatever a pipe has ready; memory streams have no descriptor
+    ssize_t bytesRead;
+    int fd = fileno(reader->file);
+    if (fd != -1) {
+        do {
+            bytesRead = read(fd, reader->data + reader->length, reader->capacity - reader->length);
+        } while (bytesRead == -1 && errno == EINTR);
+    } else {
+        bytesRead = fread(reader->data + reader->length, 1, reader->capacity - reader->length,
+                          reader->file);
+        if (bytesRead == 0 && ferror(reader->file))
+            bytesRead = -1;
+    }
+
+    if (bytesRead == -1) {
+        log_error("Unable to read the input: %s", strerror(errno));
+        return 1;
+    }
+    if (bytesRead == 0)
+        reader->endOfFile = 1;
+    reader->length += bytesRead;
+    return 0;
+}
+
+/*
+Description:
+    Splits a line into its action and message.
+Arguments:
+    const char *start: The first byte of the line
+    const char *end: The end of the line (its newline, or the end of the input)
+    InputLine *line: Filled in with views of the line
+Return value:
+    None.
+*/
+void input_reader_split_line(const char *start, const char *end, InputLine *line) {
+    while (start < end && IS_SPACE(*start))
+        start++;
+    line->action = start;
+    while (start < end && !IS_SPACE(*start))
+        start++;
+    line->actionLength = start - line->action;
+    while (start < end && IS_SPACE(*start))
+        start++;
+    line->message = start;
+    line->messageLength = end - start;
+}
+
+/*
+Description:
+    Returns the next line. The action is the first whitespace separated word and the message is
+    everything after the whitespace that follows it, up to the end of the line.
+Arguments:
+    InputReader *reader: The reader
+    InputLine *line: Filled in with views of the line
+Return value:
+    Returns 1 if a line was read, 0 at the end of the file or -1 on failure.
+*/
+int input_reader_next(InputReader *reader, InputLine *line) {
+    size_t scanned = reader->offset;
+    char *newline;
+
+    // memchr is vectorized by libc, so long messages are scanned 16 or 32 bytes at a time
+    while ((newline = memchr(reader->data + scanned, '\n', reader->length - scanned)) == NULL) {
+        if (reader->mapped || reader->endOfFile) {
+            if (reader->offset == reader->length)
+                return 0;
+            // The last line has no newline
+            newline = reader->data + reader->length;
+            break;
+        }
+        size_t unread = reader->length - reader->offset;
+        if (fill(reader))
+            return -1;
+        scanned = unread;
+    }
+
+    input_reader_split_line(reader->data + reader->offset, newline, line);
+    reader->offset = newline - reader->data;
+    if (reader->offset < reader->length)
+        reader->offset++;
+    return 1;
+}
+
+/*
+Description:
+    Waits until input_reader_next can return the next line without blocking, reading whatever the
+    input has ready in the meantime. Mapped files and memory streams never block.
+Arguments:
+    InputReader *reader: The reader
+    const struct timespec *timeout: How long to wait at most
+Return value:
+    Returns 1 if the next line (or the end of the file) is ready, 0 if the timeout passed first or
+    -1 on failure.
+*/
+int input_reader_wait(InputReader *reader, const struct timespec *timeout) {
+    int fd = fileno(reader->file);
+    struct timespec now;
+    struct timespec deadline;
+
+    if (reader->mapped || fd == -1)
+        return 1;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout->tv_sec;
+    deadline.tv_nsec += timeout->tv_nsec;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    while (!reader->endOfFile &&
+           memchr(reader->data + reader->offset, '\n', reader->length - reader->offset) == NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long left = (deadline.tv_sec - now.tv_sec) * 1000000000LL +
+                         (deadline.tv_nsec - now.tv_nsec);
+        struct timespec wait = {0, 0};
+        if (left > 0) {
+            wait.tv_sec = left / 1000000000LL;
+            wait.tv_nsec = left % 1000000000LL;
+        }
+
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        int ready = ppoll(&pfd, 1, &wait, NULL);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            log_error("Unable to wait for the input: %s", strerror(errno));
+            return -1;
+        }
+        if (ready == 0)
+            return 0;
+        if (fill(reader))
+            return -1;
+    }
+    return 1;
+}
+
+/*
+Description:
+    Unmaps or frees the reader's memory. The file itself is not closed.
+Arguments:
+    InputReader *reader: The reader to close
+Return value:
+    None.
+*/
+void input_reader_close(InputReader *reader) {
+    if (reader->mapped)
+        munmap(reader->data, reader->mapLength);
+    else
+        free(reader->data);
+    memset(reader, 0, sizeof(InputReader));
+}
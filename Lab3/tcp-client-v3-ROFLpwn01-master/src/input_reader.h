@@ -0,0 +1,96 @@
+#ifndef INPUT_READER_H_
+#define INPUT_READER_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+#define INPUT_READER_BUFFER_SIZE (1 << 20)
+
+/*
+Reads request lines ("ACTION MESSAGE") from a file without allocating per line. Regular files are
+memory mapped; anything else (stdin, pipes, memory streams) is read through one large buffer that
+grows only when a single line does not fit.
+*/
+typedef struct InputReader {
+    FILE *file;
+    char *data;
+    size_t length;
+    size_t offset;
+    size_t capacity;
+    size_t mapLength;
+    int mapped;
+    int endOfFile;
+} InputReader;
+
+/*
+One line split into its action and message. The pointers refer to the reader's memory: they stay
+valid until the reader is closed if reader.mapped is set, otherwise until the next call to
+input_reader_next.
+*/
+typedef struct InputLine {
+    const char *action;
+    size_t actionLength;
+    const char *message;
+    size_t messageLength;
+} InputLine;
+
+/*
+Description:
+    Sets up a reader for the rest of the file, mapping it if it is a regular file.
+Arguments:
+    InputReader *reader: The reader to initialize
+    FILE *file: The file to read from
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int input_reader_open(InputReader *reader, FILE *file);
+
+/*
+Description:
+    Returns the next line. The action is the first whitespace separated word and the message is
+    everything after the whitespace that follows it, up to the end of the line.
+Arguments:
+    InputReader *reader: The reader
+    InputLine *line: Filled in with views of the line
+Return value:
+    Returns 1 if a line was read, 0 at the end of the file or -1 on failure.
+*/
+int input_reader_next(InputReader *reader, InputLine *line);
+
+/*
+Description:
+    Waits until input_reader_next can return the next line without blocking, reading whatever the
+    input has ready in the meantime. Mapped files and memory streams never block.
+Arguments:
+    InputReader *reader: The reader
+    const struct timespec *timeout: How long to wait at most
+Return value:
+    Returns 1 if the next line (or the end of the file) is ready, 0 if the timeout passed first or
+    -1 on failure.
+*/
+int input_reader_wait(InputReader *reader, const struct timespec *timeout);
+
+/*
+Description:
+    Splits a line into its action and message.
+Arguments:
+    const char *start: The first byte of the line
+    const char *end: The end of the line (its newline, or the end of the input)
+    InputLine *line: Filled in with views of the line
+Return value:
+    None.
+*/
+void input_reader_split_line(const char *start, const char *end, InputLine *line);
+
+/*
+Description:
+    Unmaps or frees the reader's memory. The file itself is not closed.
+Arguments:
+    InputReader *reader: The reader to close
+Return value:
+    None.
+*/
+void input_reader_close(InputReader *reader);
+
+#endif
@@ -0,0 +1,380 @@
+#define _GNU_SOURCE
+#include "loadgen.h"
+#include "clock.h"
+#include "histogram.h"
+#include "log.h"
+
+#include <fcntl.h>
+#include <time.h>
+
+#define NS_PER_USEC 1000ULL
+#define LOADGEN_BATCH_FRAMES 256
+
+/*
+A request read from the file. The message points into the mapped file, or at a copy when the
+input could not be mapped.
+*/
+typedef struct LoadRequest {
+    uint32_t header;
+    size_t length;
+    const char *message;
+} LoadRequest;
+
+/*
+One connection. Requests are answered in order, so the intended send times of the requests in
+flight are kept in a FIFO and matched to the responses as they arrive.
+*/
+typedef struct LoadConnection {
+    int sockfd;
+    RingBuffer ring;
+    SendBatch batch;
+    uint64_t *intended;
+    size_t intendedHead;
+    size_t intendedCount;
+    size_t intendedCapacity;
+    uint64_t nextSend;
+} LoadConnection;
+
+/*
+Description:
+    Reads every valid request in the file.
+Arguments:
+    InputReader *reader: The reader to read from
+    LoadRequest **requests: Set to the newly allocated requests
+    size_t *count: Set to the number of requests
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int loadRequests(InputReader *reader, LoadRequest **requests, size_t *count) {
+    size_t capacity = 1024;
+    uint32_t header;
+    InputLine line;
+    int found;
+
+    *count = 0;
+    *requests = malloc(capacity * sizeof(LoadRequest));
+    if (*requests == NULL) {
+        log_error("Unable to allocate the requests");
+        return 1;
+    }
+
+    while ((found = tcp_client_next_request(reader, &header, &line)) == 1) {
+        if (*count == capacity) {
+            LoadRequest *grown = realloc(*requests, capacity * 2 * sizeof(LoadRequest));
+            if (grown == NULL) {
+                log_error("Unable to allocate the requests");
+                return 1;
+            }
+            *requests = grown;
+            capacity *= 2;
+        }
+
+        LoadRequest *request = &(*requests)[(*count)++];
+        request->header = header;
+        request->length = line.messageLength;
+        request->message = line.message;
+        if (!reader->mapped) {
+            char *copy = malloc(line.messageLength + 1);
+            if (copy == NULL) {
+                log_error("Unable to allocate a request");
+                (*count)--;
+                return 1;
+            }
+            memcpy(copy, line.message, line.messageLength);
+            request->message = copy;
+        }
+    }
+    return found == -1;
+}
+
+/*
+Description:
+    Appends an intended send time to a connection's FIFO, growing it if needed.
+Arguments:
+    LoadConnection *connection: The connection
+    uint64_t intended: The time the request was scheduled for
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int pushIntended(LoadConnection *connection, uint64_t intended) {
+    if (connection->intendedCount == connection->intendedCapacity) {
+        size_t capacity = connection->intendedCapacity * 2;
+        uint64_t *grown = malloc(capacity * sizeof(uint64_t));
+        if (grown == NULL) {
+            log_error("Unable to grow the in-flight queue");
+            return 1;
+        }
+        for (size_t i = 0; i < connection->intendedCount; i++)
+            grown[i] = connection->intended[(connection->intendedHead + i) %
+                                            connection->intendedCapacity];
+        free(connection->intended);
+        connection->intended = grown;
+        connection->intendedHead = 0;
+        connection->intendedCapacity = capacity;
+    }
+    connection->intended[(connection->intendedHead + connection->intendedCount) %
+                         connection->intendedCapacity] = intended;
+    connection->intendedCount++;
+    return 0;
+}
+
+/*
+Description:
+    Prints a byte count scaled to KB, MB or GB like wrk does.
+Arguments:
+    double bytes: The byte count
+Return value:
+    None.
+*/
+static void printBytes(double bytes) {
+    const char *units[] = {"B", "KB", "MB", "GB"};
+    int unit = 0;
+    while (bytes >= 1024 && unit < 3) {
+        bytes /= 1024;
+        unit++;
+    }
+    printf("%.2f%s", bytes, units[unit]);
+}
+
+/*
+Description:
+    Prints the report in the same layout as wrk2.
+Arguments:
+    Config config: The config the test ran with
+    const Histogram *latency: Corrected latencies in microseconds
+    uint64_t elapsed: Length of the run in nanoseconds
+    size_t sent: Requests sent
+    size_t completed: Responses received
+    uint64_t bytesRead: Bytes received
+Return value:
+    None.
+*/
+static void printReport(Config config, const Histogram *latency, uint64_t elapsed, size_t sent,
+                        size_t completed, uint64_t bytesRead) {
+    static const double percentiles[] = {50.0, 75.0, 90.0, 99.0, 99.9, 99.99, 99.999, 100.0};
+    double seconds = (double)elapsed / CLOCK_NS_PER_SEC;
+
+    printf("  Latency Distribution (HdrHistogram - Recorded Latency)\n");
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+        printf("%7.3f%%  %8.2fms\n", percentiles[i],
+               histogram_value_at_percentile(latency, percentiles[i]) / 1000.0);
+    printf("\n#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", histogram_mean(latency) / 1000.0,
+           histogram_stddev(latency) / 1000.0);
+    printf("#[Max     = %12.3f, Total count    = %12llu]\n", latency->max / 1000.0,
+           (unsigned long long)latency->totalCount);
+    printf("----------------------------------------------------------\n");
+    printf("  %zu requests in %.2fs, ", completed, seconds);
+    printBytes(bytesRead);
+    printf(" read\n");
+    if (sent > completed)
+        printf("  %zu requests still in flight at the end\n", sent - completed);
+    printf("Requests/sec: %10.2f (target %u over %d connections)\n", completed / seconds,
+           config.rate, config.connections);
+    printf("Transfer/sec: ");
+    printBytes(bytesRead / seconds);
+    printf("\n");
+}
+
+/*
+Description:
+    Open-loop load generator. Sends the file's requests (repeating them as needed) at a constant
+    total rate of config.rate requests per second, spread over config.connections connections, for
+    config.duration seconds. Each request is scheduled ahead of time and its latency is measured
+    from when it should have been sent, not when it was sent, so a stalled server cannot hide its
+    latency by holding back the sender (coordinated omission). Prints a wrk2-style report with the
+    latency distribution and throughput to stdout.
+Arguments:
+    Config config: A config struct with the necessary information.
+    FILE *fd: The file pointer to read requests from
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int loadgen_run(Config config, FILE *fd) {
+    InputReader reader;
+    LoadRequest *requests = NULL;
+    size_t requestCount = 0;
+    LoadConnection *connections = NULL;
+    struct pollfd *pfds = NULL;
+    Histogram latency;
+    int profile = tcp_client_profile(config);
+    int opened = 0;
+    int result = 1;
+
+    if (strncmp(config.host, TCP_CLIENT_SHM_PREFIX, strlen(TCP_CLIENT_SHM_PREFIX)) == 0) {
+        log_error("The load generator needs a socket, not shared memory");
+        return 1;
+    }
+    if (config.ioUring) {
+        log_warn("The io_uring backend is not used by the load generator");
+        config.ioUring = 0;
+    }
+    if (input_reader_open(&reader, fd))
+        return 1;
+    if (histogram_init(&latency)) {
+        input_reader_close(&reader);
+        return 1;
+    }
+    if (loadRequests(&reader, &requests, &requestCount))
+        goto done;
+    if (requestCount == 0) {
+        log_error("The file has no valid requests");
+        goto done;
+    }
+
+    connections = calloc(config.connections, sizeof(LoadConnection));
+    pfds = calloc(config.connections, sizeof(struct pollfd));
+    if (connections == NULL || pfds == NULL) {
+        log_error("Unable to allocate the connections");
+        goto done;
+    }
+
+    // The connections take turns, so together they send one request every 1/rate seconds
+    uint64_t interval = CLOCK_NS_PER_SEC * config.connections / config.rate;
+    if (interval == 0)
+        interval = 1;
+    for (opened = 0; opened < config.connections; opened++) {
+        LoadConnection *connection = &connections[opened];
+        connection->sockfd = tcp_client_connect(config);
+        if (connection->sockfd == TCP_CLIENT_BAD_SOCKET) {
+            log_error("Unable to open connection %d", opened);
+            goto done;
+        }
+        connection->intendedCapacity = 1024;
+        connection->intended = malloc(connection->intendedCapacity * sizeof(uint64_t));
+        if (connection->intended == NULL ||
+            fcntl(connection->sockfd, F_SETFL,
+                  fcntl(connection->sockfd, F_GETFL) | O_NONBLOCK) == -1 ||
+            ring_buffer_init(&connection->ring, RING_BUFFER_DEFAULT_CAPACITY)) {
+            log_error("Unable to set up connection %d", opened);
+            close(connection->sockfd);
+            free(connection->intended);
+            goto done;
+        }
+        if (send_batch_init(&connection->batch, LOADGEN_BATCH_FRAMES, config.batchBytes, 0)) {
+            close(connection->sockfd);
+            free(connection->intended);
+            ring_buffer_free(&connection->ring);
+            goto done;
+        }
+    }
+
+    printf("Running %us test @ %s:%s\n", config.duration, config.host, config.port);
+    printf("  %d connections, %u requests/sec\n", config.connections, config.rate);
+    fflush(stdout);
+
+    size_t nextRequest = 0;
+    size_t sent = 0;
+    size_t completed = 0;
+    uint64_t bytesRead = 0;
+    uint64_t start = clock_now_ns();
+    uint64_t end = start + (uint64_t)config.duration * CLOCK_NS_PER_SEC;
+    for (int i = 0; i < config.connections; i++)
+        connections[i].nextSend = start + interval * i / config.connections;
+
+    uint64_t now = start;
+    while (now < end) {
+        uint64_t wakeAt = end;
+
+        // Queues every request that is due; requests that do not fit wait but keep their time
+        for (int i = 0; i < config.connections; i++) {
+            LoadConnection *connection = &connections[i];
+            while (connection->nextSend <= now) {
+                LoadRequest *request = &requests[nextRequest];
+                if (!send_batch_has_room(&connection->batch, request->length, 0))
+                    break;
+                send_batch_add(&connection->batch, request->header, request->message,
+                               request->length, 0);
+                if (pushIntended(connection, connection->nextSend))
+                    goto done;
+                connection->nextSend += interval;
+                nextRequest = (nextRequest + 1) % requestCount;
+                sent++;
+            }
+            if (send_batch_pending(&connection->batch) > 0 &&
+                tcp_client_flush_batch(&connection->batch, connection->sockfd, profile,
+                                       MSG_DONTWAIT))
+                goto done;
+
+            pfds[i].fd = connection->sockfd;
+            pfds[i].events = POLLIN;
+            if (send_batch_pending(&connection->batch) > 0)
+                pfds[i].events |= POLLOUT;
+            else if (connection->nextSend < wakeAt)
+                wakeAt = connection->nextSend;
+        }
+
+        now = clock_now_ns();
+        uint64_t wait = wakeAt > now ? wakeAt - now : 0;
+        struct timespec timeout = {wait / CLOCK_NS_PER_SEC, wait % CLOCK_NS_PER_SEC};
+        if (ppoll(pfds, config.connections, &timeout, NULL) == -1) {
+            if (errno == EINTR)
+                continue;
+            log_error("poll failed: %s", strerror(errno));
+            goto done;
+        }
+        now = clock_now_ns();
+
+        for (int i = 0; i < config.connections; i++) {
+            LoadConnection *connection = &connections[i];
+            if ((pfds[i].revents & POLLOUT) &&
+                tcp_client_flush_batch(&connection->batch, connection->sockfd, profile,
+                                       MSG_DONTWAIT))
+                goto done;
+            if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+
+            ssize_t bytesReceived = ring_buffer_recv(&connection->ring, connection->sockfd, 0);
+            if (bytesReceived == 0) {
+                log_error("Server closed connection %d", i);
+                goto done;
+            }
+            if (bytesReceived == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    continue;
+                log_error("Error receiving data: %s", strerror(errno));
+                goto done;
+            }
+
+            char *response;
+            size_t length;
+            int found;
+            while ((found = tcp_client_next_response(&connection->ring, 0, &response,
+                                                     &length)) > 0) {
+                if (connection->intendedCount == 0) {
+                    log_error("Received a response with no request in flight");
+                    goto done;
+                }
+                uint64_t intended = connection->intended[connection->intendedHead];
+                connection->intendedHead =
+                    (connection->intendedHead + 1) % connection->intendedCapacity;
+                connection->intendedCount--;
+                histogram_record(&latency, (now - intended) / NS_PER_USEC);
+                bytesRead += TCP_CLIENT_RESPONSE_HEADER_SIZE + length;
+                completed++;
+            }
+            if (found == -1)
+                goto done;
+        }
+    }
+
+    printReport(config, &latency, now - start, sent, completed, bytesRead);
+    result = 0;
+
+done:
+    for (int i = 0; i < opened; i++) {
+        tcp_client_close(connections[i].sockfd);
+        free(connections[i].intended);
+        ring_buffer_free(&connections[i].ring);
+        send_batch_free(&connections[i].batch);
+    }
+    if (!reader.mapped) {
+        for (size_t i = 0; i < requestCount; i++)
+            free((char *)requests[i].message);
+    }
+    free(requests);
+    free(connections);
+    free(pfds);
+    histogram_free(&latency);
+    input_reader_close(&reader);
+    return result;
+}
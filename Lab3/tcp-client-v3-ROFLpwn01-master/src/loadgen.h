@@ -0,0 +1,24 @@
+#ifndef LOADGEN_H_
+#define LOADGEN_H_
+
+#include "tcp_client.h"
+
+#define LOADGEN_DEFAULT_DURATION 10
+
+/*
+Description:
+    Open-loop load generator. Sends the file's requests (repeating them as needed) at a constant
+    total rate of config.rate requests per second, spread over config.connections connections, for
+    config.duration seconds. Each request is scheduled ahead of time and its latency is measured
+    from when it should have been sent, not when it was sent, so a stalled server cannot hide its
+    latency by holding back the sender (coordinated omission). Prints a wrk2-style report with the
+    latency distribution and throughput to stdout.
+Arguments:
+    Config config: A config struct with the necessary information.
+    FILE *fd: The file pointer to read requests from
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int loadgen_run(Config config, FILE *fd);
+
+#endif
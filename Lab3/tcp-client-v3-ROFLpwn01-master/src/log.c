@@ -22,7 +22,13 @@
 
 #include "log.h"
 
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
 #define MAX_CALLBACKS 32
+#define ASYNC_TEXT_SIZE 240
+#define ASYNC_IDLE_NS 1000000
 
 typedef struct {
   log_LogFn fn;
@@ -30,14 +36,45 @@ typedef struct {
   int level;
 } Callback;
 
+/* A record formatted by the calling thread, waiting for the writer thread */
+typedef struct {
+  time_t time;
+  const char *file;
+  int line;
+  int level;
+  char text[ASYNC_TEXT_SIZE];
+} Record;
+
+/* Single producer (its owning thread), single consumer (the writer thread) */
+typedef struct Ring {
+  struct Ring *next;
+  int in_use;
+  size_t head;
+  size_t tail;
+  Record records[];
+} Ring;
+
 static struct {
   void *udata;
   log_LockFn lock;
   int level;
   bool quiet;
   Callback callbacks[MAX_CALLBACKS];
+  bool async;
+  bool stopping;
+  bool batching;
+  size_t ring_size;
+  Ring *rings;
+  unsigned long dropped;
+  unsigned long reported;
+  pthread_t writer;
+  pthread_key_t ring_key;
 } L;
 
+static __thread Ring *local_ring;
+
+int log_threshold = LOG_TRACE;
+
 
 static const char *level_strings[] = {
   "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"
@@ -65,7 +102,7 @@ static void stdout_callback(log_Event *ev) {
 #endif
   vfprintf(ev->udata, ev->fmt, ev->ap);
   fprintf(ev->udata, "\n");
-  fflush(ev->udata);
+  if (!L.batching) { fflush(ev->udata); }
 }
 
 
@@ -77,7 +114,7 @@ static void file_callback(log_Event *ev) {
     buf, level_strings[ev->level], ev->file, ev->line);
   vfprintf(ev->udata, ev->fmt, ev->ap);
   fprintf(ev->udata, "\n");
-  fflush(ev->udata);
+  if (!L.batching) { fflush(ev->udata); }
 }
 
 
@@ -96,19 +133,37 @@ const char* log_level_string(int level) {
 }
 
 
+/* Recomputes the lowest level any sink accepts, checked inline by the macros */
+static void update_threshold(void) {
+  int threshold = L.quiet ? LOG_FATAL + 1 : L.level;
+  for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
+    if (L.callbacks[i].level < threshold) { threshold = L.callbacks[i].level; }
+  }
+  log_threshold = threshold;
+}
+
+
 void log_set_lock(log_LockFn fn, void *udata) {
   L.lock = fn;
   L.udata = udata;
 }
 
 
+void log_get_lock(log_LockFn *fn, void **udata) {
+  *fn = L.lock;
+  *udata = L.udata;
+}
+
+
 void log_set_level(int level) {
   L.level = level;
+  update_threshold();
 }
 
 
 void log_set_quiet(bool enable) {
   L.quiet = enable;
+  update_threshold();
 }
 
 
@@ -116,6 +171,7 @@ int log_add_callback(log_LogFn fn, void *udata, int level) {
   for (int i = 0; i < MAX_CALLBACKS; i++) {
     if (!L.callbacks[i].fn) {
       L.callbacks[i] = (Callback) { fn, udata, level };
+      update_threshold();
       return 0;
     }
   }
@@ -137,6 +193,186 @@ static void init_event(log_Event *ev, void *udata) {
 }
 
 
+/* Passes an already formatted record to the sinks, with the time it was logged */
+static void emit(const Record *r, const char *fmt, ...) {
+  struct tm tm;
+  log_Event ev = {
+    .fmt   = fmt,
+    .file  = r->file,
+    .line  = r->line,
+    .level = r->level,
+    .time  = localtime_r(&r->time, &tm),
+  };
+
+  if (!L.quiet && r->level >= L.level) {
+    init_event(&ev, stderr);
+    va_start(ev.ap, fmt);
+    stdout_callback(&ev);
+    va_end(ev.ap);
+  }
+
+  for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
+    Callback *cb = &L.callbacks[i];
+    if (r->level >= cb->level) {
+      init_event(&ev, cb->udata);
+      va_start(ev.ap, fmt);
+      cb->fn(&ev);
+      va_end(ev.ap);
+    }
+  }
+}
+
+
+/* Writes every queued record, flushing the streams once per batch */
+static int drain(void) {
+  int count = 0;
+  Record dropped = { .file = __FILE__, .line = __LINE__, .level = LOG_WARN };
+  /* Read once so a concurrent log_set_lock cannot leave the lock held */
+  log_LockFn lock_fn = L.lock;
+  void *lock_udata = L.udata;
+
+  if (lock_fn) { lock_fn(true, lock_udata); }
+  L.batching = true;
+  for (Ring *ring = __atomic_load_n(&L.rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    for (; ring->head != tail; ring->head++, count++) {
+      Record *r = &ring->records[ring->head & (L.ring_size - 1)];
+      emit(r, "%s", r->text);
+    }
+    __atomic_store_n(&ring->head, tail, __ATOMIC_RELEASE);
+  }
+
+  unsigned long total = __atomic_load_n(&L.dropped, __ATOMIC_RELAXED);
+  if (total != L.reported) {
+    dropped.time = time(NULL);
+    emit(&dropped, "%lu log records dropped (ring full)", total - L.reported);
+    L.reported = total;
+    count++;
+  }
+  L.batching = false;
+
+  if (count > 0) {
+    fflush(stderr);
+    for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
+      if (L.callbacks[i].fn == file_callback) { fflush(L.callbacks[i].udata); }
+    }
+  }
+  if (lock_fn) { lock_fn(false, lock_udata); }
+  return count;
+}
+
+
+static void *writer_main(void *arg) {
+  struct timespec idle = { 0, ASYNC_IDLE_NS };
+  (void) arg;
+
+  while (!__atomic_load_n(&L.stopping, __ATOMIC_ACQUIRE)) {
+    if (drain() == 0) { nanosleep(&idle, NULL); }
+  }
+  drain();
+  return NULL;
+}
+
+
+/* Runs when a thread exits so a later thread can take over its ring */
+static void release_ring(void *ring) {
+  __atomic_store_n(&((Ring *) ring)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+
+static Ring *get_ring(void) {
+  Ring *ring;
+  int free_ring = 0;
+
+  if (local_ring) { return local_ring; }
+
+  for (ring = __atomic_load_n(&L.rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+    if (__atomic_compare_exchange_n(&ring->in_use, &free_ring, 1, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      break;
+    }
+    free_ring = 0;
+  }
+
+  if (!ring) {
+    ring = calloc(1, sizeof(Ring) + L.ring_size * sizeof(Record));
+    if (!ring) { return NULL; }
+    ring->in_use = 1;
+    ring->next = __atomic_load_n(&L.rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&L.rings, &ring->next, ring, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  }
+
+  pthread_setspecific(L.ring_key, ring);
+  local_ring = ring;
+  return ring;
+}
+
+
+/* Formats into the calling thread's ring; drops the record if the ring is full */
+static void log_async(int level, const char *file, int line, const char *fmt, va_list ap) {
+  Ring *ring = get_ring();
+  size_t tail;
+
+  if (!ring) {
+    __atomic_add_fetch(&L.dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  tail = ring->tail;
+  if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == L.ring_size) {
+    __atomic_add_fetch(&L.dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  Record *r = &ring->records[tail & (L.ring_size - 1)];
+  r->time = time(NULL);
+  r->file = file;
+  r->line = line;
+  r->level = level;
+  vsnprintf(r->text, sizeof(r->text), fmt, ap);
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+
+int log_start_async(size_t records) {
+  static bool initialized;
+
+  if (L.async) { return 0; }
+
+  /* Rings are kept for the life of the process, so their size is fixed by
+   * the first call */
+  if (!initialized) {
+    L.ring_size = 2;
+    while (L.ring_size < records) { L.ring_size <<= 1; }
+    if (pthread_key_create(&L.ring_key, release_ring) != 0) { return -1; }
+    atexit(log_stop_async);
+    initialized = true;
+  }
+
+  L.stopping = false;
+  if (pthread_create(&L.writer, NULL, writer_main, NULL) != 0) { return -1; }
+  __atomic_store_n(&L.async, true, __ATOMIC_RELEASE);
+  return 0;
+}
+
+
+void log_stop_async(void) {
+  if (!L.async) { return; }
+
+  __atomic_store_n(&L.async, false, __ATOMIC_RELEASE);
+  __atomic_store_n(&L.stopping, true, __ATOMIC_RELEASE);
+  pthread_join(L.writer, NULL);
+
+  /* Records logged while the writer was exiting */
+  drain();
+}
+
+
+unsigned long log_dropped(void) {
+  return __atomic_load_n(&L.dropped, __ATOMIC_RELAXED);
+}
+
+
 void log_log(int level, const char *file, int line, const char *fmt, ...) {
   log_Event ev = {
     .fmt   = fmt,
@@ -145,6 +381,15 @@ void log_log(int level, const char *file, int line, const char *fmt, ...) {
     .level = level,
   };
 
+  if (level < log_threshold) { return; }
+
+  if (__atomic_load_n(&L.async, __ATOMIC_ACQUIRE)) {
+    va_start(ev.ap, fmt);
+    log_async(level, file, line, fmt, ev.ap);
+    va_end(ev.ap);
+    return;
+  }
+
   lock();
 
   if (!L.quiet && level >= L.level) {
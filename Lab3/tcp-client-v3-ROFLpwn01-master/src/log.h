@@ -14,6 +14,7 @@
 #include <time.h>
 
 #define LOG_VERSION "0.1.0"
+#define LOG_ASYNC_DEFAULT_RECORDS 1024
 
 typedef struct {
   va_list ap;
@@ -28,22 +29,59 @@ typedef struct {
 typedef void (*log_LogFn)(log_Event *ev);
 typedef void (*log_LockFn)(bool lock, void *udata);
 
-enum { LOG_TRACE, LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR, LOG_FATAL };
+/* Plain macros rather than an enum so LOG_MIN_LEVEL can be compared by the
+ * preprocessor, e.g. -DLOG_MIN_LEVEL=LOG_WARN */
+#define LOG_TRACE 0
+#define LOG_DEBUG 1
+#define LOG_INFO  2
+#define LOG_WARN  3
+#define LOG_ERROR 4
+#define LOG_FATAL 5
 
-#define log_trace(...) log_log(LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__)
-#define log_debug(...) log_log(LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
-#define log_info(...)  log_log(LOG_INFO,  __FILE__, __LINE__, __VA_ARGS__)
-#define log_warn(...)  log_log(LOG_WARN,  __FILE__, __LINE__, __VA_ARGS__)
-#define log_error(...) log_log(LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
-#define log_fatal(...) log_log(LOG_FATAL, __FILE__, __LINE__, __VA_ARGS__)
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_TRACE
+#endif
+
+#if defined(__GNUC__)
+#define LOG_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define LOG_UNLIKELY(x) (x)
+#endif
+
+/* Lowest level any sink accepts; kept up to date by the setters below */
+extern int log_threshold;
+
+/* The level test runs before any argument is evaluated. Calls below
+ * LOG_MIN_LEVEL stay type checked but compile to nothing. */
+#define log_at(level, ...) \
+  do { \
+    if ((level) >= LOG_MIN_LEVEL && LOG_UNLIKELY((level) >= log_threshold)) { \
+      log_log(level, __FILE__, __LINE__, __VA_ARGS__); \
+    } \
+  } while (0)
+
+#define log_trace(...) log_at(LOG_TRACE, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...)  log_at(LOG_INFO,  __VA_ARGS__)
+#define log_warn(...)  log_at(LOG_WARN,  __VA_ARGS__)
+#define log_error(...) log_at(LOG_ERROR, __VA_ARGS__)
+#define log_fatal(...) log_at(LOG_FATAL, __VA_ARGS__)
 
 const char* log_level_string(int level);
 void log_set_lock(log_LockFn fn, void *udata);
+void log_get_lock(log_LockFn *fn, void **udata);
 void log_set_level(int level);
 void log_set_quiet(bool enable);
 int log_add_callback(log_LogFn fn, void *udata, int level);
 int log_add_fp(FILE *fp, int level);
 
+/* Asynchronous mode: each thread formats records into its own ring and a
+ * writer thread passes them to the sinks in batches. Records are dropped
+ * (and counted) when a ring is full. */
+int log_start_async(size_t records);
+void log_stop_async(void);
+unsigned long log_dropped(void);
+
 void log_log(int level, const char *file, int line, const char *fmt, ...);
 
 #endif
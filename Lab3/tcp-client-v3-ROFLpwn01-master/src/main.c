@@ -1,57 +1,226 @@
 #include <stdio.h>
 
+#include "balancer.h"
+#include "fanout.h"
+#include "hedge.h"
+#include "loadgen.h"
 #include "log.h"
+#include "replay.h"
+#include "stream.h"
 #include "tcp_client.h"
+#include "v4.h"
 
-static size_t messagesSent = 0;
-static size_t messagesReceived = 0;
-
-void printInfoMenuMain() {
-    fprintf(stderr, "\nUsage: tcp_client [--help] [-v] [-h HOST] [-p PORT] ACTION MESSAGE\n\n"
-                    "Arguments:\n"
-                    "ACTION   Must be uppercase, lowercase, rreverse,\n"
-                    "\t   shuffle, or random.\n"
-                    "MESSAGE  Message to send to the server\n\n"
-                    "Options:\n"
-                    "  --help\n"
-                    "  -v, --verbose\n"
-                    "  --host HOSTNAME, -h HOSTNAME\n"
-                    "  --port PORT, -p PORT\n");
+int handle_response(TcpClientSession *session, const char *response, size_t length) {
+    FILE *out = session->userData;
+    fwrite(response, 1, length, out);
+    putc('\n', out);
+    return 0;
 }
 
-int handle_response(char *response) {
-    printf("%s\n", response);
-    messagesReceived++;
-    if (messagesSent > messagesReceived)
-        return 0;
-    else
+static int streamBegin(uint64_t length, void *context) {
+    (void)length;
+    (void)context;
+    return 0;
+}
+
+static int streamChunk(const char *data, size_t length, void *context) {
+    TcpClientSession *session = context;
+    return fwrite(data, 1, length, session->userData) != length;
+}
+
+static int streamEnd(void *context) {
+    TcpClientSession *session = context;
+    putc('\n', session->userData);
+    return 0;
+}
+
+/*
+A mode of the client: the function that sends the file, whether the session is connected before it
+runs, and whether it leaves config.ioUring to the mode instead of turning the backend off.
+*/
+typedef struct Mode {
+    const char *name;
+    int (*run)(TcpClientSession *session, FILE *file);
+    int connect;
+    int ioUring;
+} Mode;
+
+static int runReplay(TcpClientSession *session, FILE *file) {
+    // The file holds compiled frames, which are sent straight from the page cache
+    (void)file;
+    return replay_run(session, session->config.file);
+}
+
+static int runStream(TcpClientSession *session, FILE *file) {
+    // Messages of any size, one at a time, without holding a whole one in memory
+    StreamHandler handler = {streamBegin, streamChunk, streamEnd, session};
+    return stream_run(session, file, &handler);
+}
+
+static int runBalancer(TcpClientSession *session, FILE *file) {
+    // Requests are spread across several servers, each with its own connection
+    return balancer_run(session, file, stderr);
+}
+
+static int runHedge(TcpClientSession *session, FILE *file) {
+    // Slow idempotent requests race a duplicate on a second connection
+    HedgeStats stats;
+    if (hedge_run(session, file, &stats))
+        return 1;
+    fprintf(stderr,
+            "Hedged %zu of %zu requests (%.2f%%) after %.1f us: %zu hedges won, %zu late "
+            "responses dropped, %zu connections reopened\n",
+            stats.hedged, stats.requests,
+            stats.requests > 0 ? 100.0 * stats.hedged / stats.requests : 0.0, stats.delayNs / 1e3,
+            stats.hedgesWon, stats.dropped, stats.reconnects);
+    return 0;
+}
+
+static int runPipeline(TcpClientSession *session, FILE *file) {
+    // Sends and receives at the same time so large files cannot fill both directions
+    if (tcp_client_session_pipeline(session, file))
+        return 1;
+    if (session->messagesSent == 0) {
+        log_warn("No messages were sent.");
+    }
+    return 0;
+}
+
+static int runPlain(TcpClientSession *session, FILE *file) {
+    InputReader reader;
+    InputLine line;
+    uint32_t header;
+    int c;
+
+    if (input_reader_open(&reader, file)) {
+        log_warn("Unable to read the file");
+        return 1;
+    }
+
+    // Sends data to server while there is still data
+    while ((c = tcp_client_next_request(&reader, &header, &line)) == 1) {
+
+        log_trace("Attempting to send a new send message with action: %.*s, and message: %.*s.",
+                  (int)line.actionLength, line.action, (int)line.messageLength, line.message);
+        if (tcp_client_session_send(session, header, line.message, line.messageLength)) {
+            log_warn("Message was not sent successfully to the server");
+            input_reader_close(&reader);
+            return 1;
+        }
+    }
+    input_reader_close(&reader);
+    if (c == -1) {
+        log_warn("Unable to read the file");
+        return 1;
+    }
+    if (session->messagesSent == 0) {
+        log_warn("No messages were sent.");
+    }
+    tcp_client_session_receive(session);
+    return 0;
+}
+
+static const Mode replayMode = {"replay", runReplay, 1, 0};
+static const Mode v4Mode = {"v4", v4_pipeline, 1, 0};
+static const Mode streamMode = {"stream", runStream, 1, 0};
+static const Mode balancerMode = {"endpoints", runBalancer, 0, 1};
+static const Mode hedgeMode = {"hedge", runHedge, 1, 0};
+static const Mode fanoutMode = {"connections", fanout_run, 0, 1};
+static const Mode pipelineMode = {"pipeline", runPipeline, 1, 1};
+static const Mode plainMode = {"plain", runPlain, 1, 1};
+
+/*
+Checks that the options pick at most one mode and only options that mode uses. --rate and
+--connections count as one mode, since the load generator spreads its rate over the connections.
+*/
+static int checkModes(const Config *config) {
+    int shm = strncmp(config->host, TCP_CLIENT_SHM_PREFIX, strlen(TCP_CLIENT_SHM_PREFIX)) == 0;
+    int hedge = config->hedgePercentile > 0;
+    int modes = config->replay + config->v4 + config->stream + (config->endpoints != NULL) + hedge +
+                (config->rate > 0 || config->connections > 1);
+
+    if (modes > 1) {
+        log_error("Only one of --replay, --v4, --stream, --endpoints, --hedge and --rate or "
+                  "--connections can be used at once");
+        return 1;
+    }
+    if (shm && (config->replay || config->v4 || config->stream || hedge)) {
+        log_error("Replaying, protocol v4, streaming and hedging need a socket, not shared memory");
+        return 1;
+    }
+    if (config->batchEnvelope && modes > 0) {
+        log_error("Batch frames are only sent by the single connection pipeline");
+        return 1;
+    }
+    if (config->pipeline && (config->stream || hedge)) {
+        log_error("Streaming and hedging send one request at a time, without --pipeline");
         return 1;
+    }
+    if (config->hedgeHost != NULL && !hedge) {
+        log_error("A hedge host is only used with --hedge");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Connects the session if the mode needs it, runs the mode, closes the file and the session and exits.
+*/
+static void runMode(TcpClientSession *session, FILE *file, const Mode *mode) {
+    if (session->config.ioUring && !mode->ioUring) {
+        log_warn("The io_uring backend is not used in %s mode", mode->name);
+        session->config.ioUring = 0;
+    }
+    if (mode->connect) {
+        if (tcp_client_session_connect(session)) {
+            log_warn("Unable to connect to socket");
+            exit(EXIT_FAILURE);
+        }
+        log_trace("Connected to socket.");
+    }
+    if (mode->run(session, file)) {
+        log_warn("The %s mode did not complete successfully", mode->name);
+        exit(EXIT_FAILURE);
+    }
+    log_info("Messages sent: %zu, messages received: %zu.", session->messagesSent,
+             session->messagesReceived);
+
+    if (file != NULL && tcp_client_close_file(file))
+        log_error("Error closing file");
+    else
+        log_trace("File closed");
+
+    if (tcp_client_session_close(session)) {
+        log_warn("Unable to disconnect");
+        exit(EXIT_FAILURE);
+    }
+
+    log_info("Program executed successfully");
+    exit(EXIT_SUCCESS);
 }
 
 int main(int argc, char *argv[]) {
 
-    Config defaultValues = {TCP_CLIENT_DEFAULT_PORT, TCP_CLIENT_DEFAULT_HOST, ""};
-    int socket;
+    Config defaultValues = {.port = TCP_CLIENT_DEFAULT_PORT, .host = TCP_CLIENT_DEFAULT_HOST,
+                            .file = ""};
+    TcpClientSession session;
 
     log_set_level(LOG_ERROR);
 
     int result = tcp_client_parse_arguments(argc, argv, &defaultValues);
     if (result != 0) {
         log_warn("Incorrect arguments provided");
-        printInfoMenuMain();
+        printInfoMenu();
         exit(EXIT_FAILURE);
     }
 
-    log_info("host: %s, port: %s", defaultValues.host, defaultValues.port);
-
-    socket = tcp_client_connect(defaultValues);
-    if (socket == -1) {
-        log_warn("Unable to connect to socket");
+    if (checkModes(&defaultValues)) {
+        printInfoMenu();
         exit(EXIT_FAILURE);
-    } else {
-        log_trace("Connected to socket.");
     }
 
+    log_info("host: %s, port: %s", defaultValues.host, defaultValues.port);
+
     FILE *file = tcp_client_open_file(defaultValues.file);
     log_info("Contents of file descriptor %d.", file);
 
@@ -61,41 +230,44 @@ int main(int argc, char *argv[]) {
         log_error("There was an error trying to open the file.");
     }
 
-    char *action;
-    char *message;
-    ssize_t c;
-
-    // Sends data to server while there is still data
-    while ((c = tcp_client_get_line(file, &action, &message)) != -1) {
-
-        log_trace("Attempting to send a new send message with action: %s, and message: %s.", action,
-                  message);
-        if (tcp_client_send_request(socket, action, message)) {
-            log_warn("Message was not sent successfully to the server");
+    if (defaultValues.compile != NULL) {
+        // Encodes the requests once so later runs can --replay them
+        if (file == NULL || replay_compile(file, defaultValues.compile)) {
+            log_warn("Unable to compile the requests");
             exit(EXIT_FAILURE);
-        } else {
-            messagesSent++;
         }
-        free(action);
-        free(message);
-    }
-    if ((c == -1) && (messagesSent == 0)) {
-        log_warn("No messages were sent.");
+        if (tcp_client_close_file(file))
+            log_error("Error closing file");
+        exit(EXIT_SUCCESS);
     }
 
-    log_info("Messages sent: %d, messages received: %d.", messagesSent, messagesReceived);
-    tcp_client_receive_response(socket, handle_response);
-
-    if (tcp_client_close_file(file))
-        log_error("Error closing file");
-    else
-        log_trace("File closed");
+    if (defaultValues.rate > 0) {
+        // Load generator: responses are timed, not printed
+        if (loadgen_run(defaultValues, file)) {
+            log_warn("Load test did not complete successfully");
+            exit(EXIT_FAILURE);
+        }
+        if (tcp_client_close_file(file))
+            log_error("Error closing file");
+        exit(EXIT_SUCCESS);
+    }
 
-    if (tcp_client_close(socket)) {
-        log_warn("Unable to disconnect");
+    if (tcp_client_session_init(&session, defaultValues, handle_response, stdout)) {
+        log_warn("Unable to set up the session");
         exit(EXIT_FAILURE);
     }
 
-    log_info("Program executed successfully");
-    exit(EXIT_SUCCESS);
+    if (defaultValues.replay)
+        runMode(&session, file, &replayMode);
+    if (defaultValues.v4)
+        runMode(&session, file, &v4Mode);
+    if (defaultValues.stream)
+        runMode(&session, file, &streamMode);
+    if (defaultValues.endpoints != NULL)
+        runMode(&session, file, &balancerMode);
+    if (defaultValues.hedgePercentile > 0)
+        runMode(&session, file, &hedgeMode);
+    if (defaultValues.connections > 1)
+        runMode(&session, file, &fanoutMode);
+    runMode(&session, file, defaultValues.pipeline ? &pipelineMode : &plainMode);
 }
@@ -0,0 +1,103 @@
+#include "reorder_buffer.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Description:
+    Allocates a reorder buffer that delivers to a session.
+Arguments:
+    ReorderBuffer *reorder: The reorder buffer to initialize
+    TcpClientSession *session: The session the responses are handed to
+    size_t window: The most responses that can be waiting, counting the one that is next
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int reorder_buffer_init(ReorderBuffer *reorder, TcpClientSession *session, size_t window) {
+    memset(reorder, 0, sizeof(ReorderBuffer));
+    reorder->session = session;
+    reorder->window = window;
+    reorder->entries = calloc(window, sizeof(ReorderBufferEntry));
+    if (reorder->entries == NULL) {
+        log_error("Unable to allocate the reorder buffer");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Frees a reorder buffer and any responses it still holds. A zeroed buffer can be freed too.
+Arguments:
+    ReorderBuffer *reorder: The reorder buffer to free
+Return value:
+    None.
+*/
+void reorder_buffer_free(ReorderBuffer *reorder) {
+    if (reorder->entries != NULL)
+        for (size_t i = 0; i < reorder->window; i++)
+            free(reorder->entries[i].response);
+    free(reorder->entries);
+    reorder->entries = NULL;
+}
+
+/*
+Description:
+    Returns whether the response to a request with a sequence number would have a slot, that is,
+    whether the request can be sent.
+Arguments:
+    const ReorderBuffer *reorder: The reorder buffer
+    uint64_t sequence: The sequence number of the request
+Return value:
+    Returns 1 if it fits, 0 if not.
+*/
+int reorder_buffer_has_room(const ReorderBuffer *reorder, uint64_t sequence) {
+    return sequence - reorder->nextDeliver < reorder->window;
+}
+
+/*
+Description:
+    Hands a response to the session if it is next, followed by the held responses that were
+    waiting on it, or holds a copy of it if it is early.
+Arguments:
+    ReorderBuffer *reorder: The reorder buffer
+    uint64_t sequence: The sequence number of the request being answered
+    const char *response: The response
+    size_t length: The length of the response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int reorder_buffer_deliver(ReorderBuffer *reorder, uint64_t sequence, const char *response,
+                           size_t length) {
+    if (sequence != reorder->nextDeliver) {
+        ReorderBufferEntry *entry = &reorder->entries[sequence % reorder->window];
+        entry->response = malloc(length > 0 ? length : 1);
+        if (entry->response == NULL) {
+            log_error("Unable to hold a %zu byte response", length);
+            return 1;
+        }
+        memcpy(entry->response, response, length);
+        entry->sequence = sequence;
+        entry->length = length;
+        entry->done = 1;
+        return 0;
+    }
+
+    if (tcp_client_session_deliver(reorder->session, response, length))
+        return 1;
+    reorder->nextDeliver++;
+    while (1) {
+        ReorderBufferEntry *next = &reorder->entries[reorder->nextDeliver % reorder->window];
+        if (!next->done || next->sequence != reorder->nextDeliver)
+            break;
+        int failed = tcp_client_session_deliver(reorder->session, next->response, next->length);
+        free(next->response);
+        next->response = NULL;
+        next->done = 0;
+        reorder->nextDeliver++;
+        if (failed)
+            return 1;
+    }
+    return 0;
+}
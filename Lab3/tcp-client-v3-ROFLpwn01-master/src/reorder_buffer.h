@@ -0,0 +1,82 @@
+#ifndef REORDER_BUFFER_H_
+#define REORDER_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tcp_client.h"
+
+/*
+A response that arrived before the ones ahead of it, indexed by sequence number modulo the window.
+*/
+typedef struct ReorderBufferEntry {
+    uint64_t sequence;
+    char *response;
+    size_t length;
+    int done;
+} ReorderBufferEntry;
+
+/*
+Hands responses that arrive in any order to a session in the order of their requests, numbered
+from 0. The response for nextDeliver is handed over at once, along with any held responses that
+were waiting on it; an early one is copied and held until its turn comes. Only the sequence numbers
+from nextDeliver up to nextDeliver + window - 1 can be held, so a request must not be sent before
+reorder_buffer_has_room says its response has a slot.
+*/
+typedef struct ReorderBuffer {
+    TcpClientSession *session;
+    ReorderBufferEntry *entries;
+    size_t window;
+    uint64_t nextDeliver;
+} ReorderBuffer;
+
+/*
+Description:
+    Allocates a reorder buffer that delivers to a session.
+Arguments:
+    ReorderBuffer *reorder: The reorder buffer to initialize
+    TcpClientSession *session: The session the responses are handed to
+    size_t window: The most responses that can be waiting, counting the one that is next
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int reorder_buffer_init(ReorderBuffer *reorder, TcpClientSession *session, size_t window);
+
+/*
+Description:
+    Frees a reorder buffer and any responses it still holds. A zeroed buffer can be freed too.
+Arguments:
+    ReorderBuffer *reorder: The reorder buffer to free
+Return value:
+    None.
+*/
+void reorder_buffer_free(ReorderBuffer *reorder);
+
+/*
+Description:
+    Returns whether the response to a request with a sequence number would have a slot, that is,
+    whether the request can be sent.
+Arguments:
+    const ReorderBuffer *reorder: The reorder buffer
+    uint64_t sequence: The sequence number of the request
+Return value:
+    Returns 1 if it fits, 0 if not.
+*/
+int reorder_buffer_has_room(const ReorderBuffer *reorder, uint64_t sequence);
+
+/*
+Description:
+    Hands a response to the session if it is next, followed by the held responses that were
+    waiting on it, or holds a copy of it if it is early.
+Arguments:
+    ReorderBuffer *reorder: The reorder buffer
+    uint64_t sequence: The sequence number of the request being answered
+    const char *response: The response
+    size_t length: The length of the response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int reorder_buffer_deliver(ReorderBuffer *reorder, uint64_t sequence, const char *response,
+                           size_t length);
+
+#endif
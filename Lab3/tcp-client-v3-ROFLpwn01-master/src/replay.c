@@ -0,0 +1,319 @@
+#define _GNU_SOURCE
+#include "replay.h"
+#include "clock.h"
+#include "input_reader.h"
+#include "log.h"
+#include "ring_buffer.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define REPLAY_MAGIC 0x49523356
+#define REPLAY_VERSION 1
+#define MIN_FRAMES 1024
+
+/*
+Start of an index file, in host byte order. The end offset of every frame follows as a uint64_t.
+*/
+typedef struct ReplayIndex {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t frameCount;
+    uint64_t dataLength;
+} ReplayIndex;
+
+/*
+Description:
+    Returns the path of the index of a frame file.
+Arguments:
+    const char *path: The path of the frame file
+Return value:
+    Returns the newly allocated path, or NULL on failure.
+*/
+static char *indexPath(const char *path) {
+    char *index = malloc(strlen(path) + strlen(REPLAY_INDEX_SUFFIX) + 1);
+    if (index == NULL) {
+        log_error("Unable to allocate the index path");
+        return NULL;
+    }
+    strcpy(index, path);
+    strcat(index, REPLAY_INDEX_SUFFIX);
+    return index;
+}
+
+/*
+Description:
+    Compiles a request file into a frame file and its index. Lines with an unknown action are
+    skipped.
+Arguments:
+    FILE *fd: The file pointer to read requests from
+    const char *path: The path of the frame file to write; the index is written next to it
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int replay_compile(FILE *fd, const char *path) {
+    InputReader reader;
+    FILE *data = NULL;
+    FILE *index = NULL;
+    uint64_t *ends = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    uint64_t offset = 0;
+    int found;
+    int result = 1;
+    char *idxPath = indexPath(path);
+
+    if (idxPath == NULL)
+        return 1;
+    if (input_reader_open(&reader, fd)) {
+        free(idxPath);
+        return 1;
+    }
+    if ((data = fopen(path, "wb")) == NULL) {
+        log_error("Unable to create %s: %s", path, strerror(errno));
+        goto done;
+    }
+
+    uint32_t header;
+    InputLine line;
+    while ((found = tcp_client_next_request(&reader, &header, &line)) == 1) {
+        if (count == capacity) {
+            size_t grown = capacity > 0 ? capacity * 2 : MIN_FRAMES;
+            uint64_t *resized = realloc(ends, grown * sizeof(uint64_t));
+            if (resized == NULL) {
+                log_error("Unable to grow the index to %zu frames", grown);
+                goto done;
+            }
+            ends = resized;
+            capacity = grown;
+        }
+        if (fwrite(&header, sizeof(header), 1, data) != 1 ||
+            fwrite(line.message, 1, line.messageLength, data) != line.messageLength) {
+            log_error("Unable to write %s: %s", path, strerror(errno));
+            goto done;
+        }
+        offset += sizeof(header) + line.messageLength;
+        ends[count++] = offset;
+    }
+    if (found == -1)
+        goto done;
+    int closeFailed = fclose(data);
+    data = NULL;
+    if (closeFailed) {
+        log_error("Unable to write %s: %s", path, strerror(errno));
+        goto done;
+    }
+
+    ReplayIndex indexHeader = {REPLAY_MAGIC, REPLAY_VERSION, count, offset};
+    if ((index = fopen(idxPath, "wb")) == NULL ||
+        fwrite(&indexHeader, sizeof(indexHeader), 1, index) != 1 ||
+        fwrite(ends, sizeof(uint64_t), count, index) != count) {
+        log_error("Unable to write %s: %s", idxPath, strerror(errno));
+        goto done;
+    }
+    closeFailed = fclose(index);
+    index = NULL;
+    if (closeFailed) {
+        log_error("Unable to write %s: %s", idxPath, strerror(errno));
+        goto done;
+    }
+    log_info("Compiled %zu requests (%llu bytes) into %s", count, (unsigned long long)offset, path);
+    result = 0;
+
+done:
+    if (data != NULL)
+        fclose(data);
+    if (index != NULL)
+        fclose(index);
+    free(ends);
+    free(idxPath);
+    input_reader_close(&reader);
+    return result;
+}
+
+/*
+Description:
+    Maps the index of a frame file and checks that it matches the frame file.
+Arguments:
+    const char *path: The path of the frame file
+    int dataFd: The open frame file
+    size_t *length: Set to the length of the mapping
+Return value:
+    Returns the mapped index, or NULL on failure.
+*/
+static const ReplayIndex *mapIndex(const char *path, int dataFd, size_t *length) {
+    char *idxPath = indexPath(path);
+    struct stat status;
+    struct stat dataStatus;
+    const ReplayIndex *index = NULL;
+
+    if (idxPath == NULL)
+        return NULL;
+    int fd = open(idxPath, O_RDONLY);
+    if (fd == -1 || fstat(fd, &status) == -1 || fstat(dataFd, &dataStatus) == -1) {
+        log_error("Unable to open %s: %s", idxPath, strerror(errno));
+        goto done;
+    }
+    if ((size_t)status.st_size < sizeof(ReplayIndex)) {
+        log_error("%s is not a replay index", idxPath);
+        goto done;
+    }
+    void *mapped = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        log_error("Unable to map %s: %s", idxPath, strerror(errno));
+        goto done;
+    }
+    index = mapped;
+    if (index->magic != REPLAY_MAGIC || index->version != REPLAY_VERSION ||
+        (uint64_t)status.st_size != sizeof(ReplayIndex) + index->frameCount * sizeof(uint64_t) ||
+        (uint64_t)dataStatus.st_size != index->dataLength) {
+        log_error("%s does not match %s; compile the requests again", idxPath, path);
+        munmap(mapped, status.st_size);
+        index = NULL;
+        goto done;
+    }
+    *length = status.st_size;
+
+done:
+    if (fd != -1)
+        close(fd);
+    free(idxPath);
+    return index;
+}
+
+/*
+Description:
+    Streams a compiled frame file to the server and receives the responses at the same time. At
+    most config.maxInFlight requests are left unanswered at once. If config.rate is set, requests
+    are released at that many per second instead of as fast as the window allows. The session's
+    messagesSent counts requests fully written to the socket.
+Arguments:
+    TcpClientSession *session: The session, connected with a plain socket
+    const char *path: The path of the frame file
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int replay_run(TcpClientSession *session, const char *path) {
+    Config config = session->config;
+    int sockfd = session->sockfd;
+    RingBuffer *ring = &session->ring;
+    size_t indexLength;
+    int result = 1;
+
+    int dataFd = open(path, O_RDONLY);
+    if (dataFd == -1) {
+        log_error("Unable to open %s: %s", path, strerror(errno));
+        return 1;
+    }
+    const ReplayIndex *index = mapIndex(path, dataFd, &indexLength);
+    if (index == NULL) {
+        close(dataFd);
+        return 1;
+    }
+    const uint64_t *ends = (const uint64_t *)(index + 1);
+    uint64_t frames = index->frameCount;
+
+    int flags = fcntl(sockfd, F_GETFL);
+    if (flags == -1 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        log_error("Unable to set up the replay");
+        goto unmap;
+    }
+
+    log_info("Replaying %llu requests from %s", (unsigned long long)frames, path);
+    off_t offset = 0;
+    uint64_t written = 0;
+    uint64_t responses = 0;
+    uint64_t start = clock_now_ns();
+    while (responses < frames) {
+        // Requests released so far, limited by the window and, with a rate, by the schedule
+        uint64_t windowEnd = responses + config.maxInFlight < frames ? responses + config.maxInFlight
+                                                                      : frames;
+        uint64_t released = windowEnd;
+        if (config.rate > 0) {
+            uint64_t due = (clock_now_ns() - start) * config.rate / CLOCK_NS_PER_SEC + 1;
+            if (due < released)
+                released = due;
+        }
+
+        uint64_t target = ends[released - 1];
+        if ((uint64_t)offset < target) {
+            if (tcp_client_cork(sockfd, session->profile))
+                goto done;
+            ssize_t sent = sendfile(sockfd, dataFd, &offset, target - offset);
+            if (sent == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                log_error("sendfile failed: %s", strerror(errno));
+                goto done;
+            }
+            while (written < frames && ends[written] <= (uint64_t)offset) {
+                written++;
+                session->messagesSent++;
+            }
+            if ((uint64_t)offset == target && tcp_client_push(sockfd, session->profile))
+                goto done;
+        }
+
+        // Waits for responses, for room in the socket, or until the next request is due
+        struct pollfd pfd = {.fd = sockfd, .events = POLLIN};
+        struct timespec wait;
+        struct timespec *timeout = NULL;
+        if ((uint64_t)offset < target) {
+            pfd.events |= POLLOUT;
+        } else if (released < windowEnd) {
+            uint64_t nextDue = start + released * CLOCK_NS_PER_SEC / config.rate;
+            uint64_t now = clock_now_ns();
+            uint64_t delay = nextDue > now ? nextDue - now : 0;
+            wait.tv_sec = delay / CLOCK_NS_PER_SEC;
+            wait.tv_nsec = delay % CLOCK_NS_PER_SEC;
+            timeout = &wait;
+        }
+        if (ppoll(&pfd, 1, timeout, NULL) == -1) {
+            if (errno == EINTR)
+                continue;
+            log_error("poll failed: %s", strerror(errno));
+            goto done;
+        }
+
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t bytesReceived = ring_buffer_recv(ring, sockfd, 0);
+            if (bytesReceived == 0) {
+                log_error("Server closed the connection with %llu requests in flight",
+                          (unsigned long long)(written - responses));
+                goto done;
+            }
+            if (bytesReceived == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    continue;
+                log_error("Error receiving data: %s", strerror(errno));
+                goto done;
+            }
+
+            char *response;
+            size_t length;
+            int found;
+            while ((found = tcp_client_next_response(ring, session->batchAccepted, &response,
+                                                     &length)) == 1) {
+                if (responses == written) {
+                    log_error("Received a response with no request in flight");
+                    goto done;
+                }
+                responses++;
+                if (tcp_client_session_deliver(session, response, length))
+                    goto done;
+            }
+            if (found == -1)
+                goto done;
+        }
+    }
+    log_info("Replay finished in %.3f seconds", (clock_now_ns() - start) / 1e9);
+    result = 0;
+
+done:
+    fcntl(sockfd, F_SETFL, flags);
+unmap:
+    munmap((void *)index, indexLength);
+    close(dataFd);
+    return result;
+}
@@ -0,0 +1,44 @@
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+#include <stdio.h>
+
+#include "tcp_client.h"
+
+#define REPLAY_INDEX_SUFFIX ".idx"
+
+/*
+Pre-encoded replay files. A request file is compiled once into a file of ready-to-send v3 frames
+(header and message, back to back) and an index next to it (the same path plus REPLAY_INDEX_SUFFIX)
+holding the number of frames and where each one ends. Replaying streams the frame file straight
+from the page cache to the socket with sendfile, so no line is parsed, no header is encoded and no
+byte is copied through user space on the send side.
+*/
+
+/*
+Description:
+    Compiles a request file into a frame file and its index. Lines with an unknown action are
+    skipped.
+Arguments:
+    FILE *fd: The file pointer to read requests from
+    const char *path: The path of the frame file to write; the index is written next to it
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int replay_compile(FILE *fd, const char *path);
+
+/*
+Description:
+    Streams a compiled frame file to the server and receives the responses at the same time. At
+    most config.maxInFlight requests are left unanswered at once. If config.rate is set, requests
+    are released at that many per second instead of as fast as the window allows. The session's
+    messagesSent counts requests fully written to the socket.
+Arguments:
+    TcpClientSession *session: The session, connected with a plain socket
+    const char *path: The path of the frame file
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int replay_run(TcpClientSession *session, const char *path);
+
+#endif
@@ -0,0 +1,221 @@
+#include "resolver.h"
+#include "log.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+The start of a cache file. It is followed by count ResolvedAddress entries.
+*/
+typedef struct ResolverCacheHeader {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t expires;
+} ResolverCacheHeader;
+
+/*
+Description:
+    Returns whether a host is a numeric IPv4 or IPv6 address.
+Arguments:
+    const char *host: The host
+Return value:
+    Returns true if the host is numeric.
+*/
+static int isNumeric(const char *host) {
+    unsigned char address[sizeof(struct in6_addr)];
+    return inet_pton(AF_INET, host, address) == 1 || inet_pton(AF_INET6, host, address) == 1;
+}
+
+/*
+Description:
+    Builds the path of the cache file of a host and port, creating the cache directory if needed.
+    Characters other than letters, digits, '.' and '-' are replaced in the file name. A directory
+    that already exists is only used if it is a real directory owned by the user with mode 0700,
+    since under /tmp anyone could have created it first.
+Arguments:
+    const char *host: The host name
+    const char *port: The port
+    char *path: Filled in with the path
+    size_t size: The size of path
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int cachePath(const char *host, const char *port, char *path, size_t size) {
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char directory[PATH_MAX];
+
+    if (base != NULL && base[0] != '\0') {
+        snprintf(directory, sizeof(directory), "%s/%s", base, RESOLVER_CACHE_DIRECTORY);
+    } else if (home != NULL && home[0] != '\0') {
+        snprintf(directory, sizeof(directory), "%s/.cache", home);
+        mkdir(directory, 0700);
+        snprintf(directory, sizeof(directory), "%s/.cache/%s", home, RESOLVER_CACHE_DIRECTORY);
+    } else {
+        snprintf(directory, sizeof(directory), "/tmp/%s-%u", RESOLVER_CACHE_DIRECTORY, getuid());
+    }
+    if (mkdir(directory, 0700) == -1) {
+        struct stat status;
+        if (errno != EEXIST || lstat(directory, &status) == -1)
+            return 1;
+        if (!S_ISDIR(status.st_mode) || status.st_uid != getuid() ||
+            (status.st_mode & 0777) != 0700) {
+            log_warn("Not caching addresses in %s, it is not a private directory", directory);
+            return 1;
+        }
+    }
+
+    int length = snprintf(path, size, "%s/%s_%s", directory, host, port);
+    if (length < 0 || (size_t)length >= size)
+        return 1;
+    for (char *c = path + strlen(directory) + 1; *c != '\0'; c++) {
+        if (!((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') ||
+              *c == '.' || *c == '-'))
+            *c = '_';
+    }
+    return 0;
+}
+
+/*
+Description:
+    Reads the cached addresses of a host and port if they have not expired.
+Arguments:
+    const char *path: The path of the cache file
+    ResolvedAddress *addresses: Filled in with the addresses
+    size_t *count: Set to the number of addresses
+Return value:
+    Returns true if the cache had a live entry.
+*/
+static int readCache(const char *path, ResolvedAddress *addresses, size_t *count) {
+    ResolverCacheHeader header;
+    int found = 0;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return 0;
+    if (read(fd, &header, sizeof(header)) == sizeof(header) &&
+        header.magic == RESOLVER_CACHE_MAGIC && header.count > 0 &&
+        header.count <= RESOLVER_MAX_ADDRESSES && header.expires > (uint64_t)time(NULL)) {
+        ssize_t length = header.count * sizeof(ResolvedAddress);
+        if (read(fd, addresses, length) == length) {
+            *count = header.count;
+            found = 1;
+        }
+    }
+    close(fd);
+    return found;
+}
+
+/*
+Description:
+    Writes the addresses of a host and port to its cache file. The file is written under a
+    temporary name and renamed into place.
+Arguments:
+    const char *path: The path of the cache file
+    const ResolvedAddress *addresses: The addresses
+    size_t count: The number of addresses
+Return value:
+    None.
+*/
+static void writeCache(const char *path, const ResolvedAddress *addresses, size_t count) {
+    ResolverCacheHeader header = {RESOLVER_CACHE_MAGIC, count,
+                                  (uint64_t)time(NULL) + RESOLVER_TTL_SECONDS};
+    char temporary[PATH_MAX];
+
+    if (snprintf(temporary, sizeof(temporary), "%s.%d", path, (int)getpid()) >=
+        (int)sizeof(temporary))
+        return;
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return;
+    ssize_t length = count * sizeof(ResolvedAddress);
+    int written = write(fd, &header, sizeof(header)) == sizeof(header) &&
+                  write(fd, addresses, length) == length;
+    close(fd);
+    if (!written || rename(temporary, path) == -1) {
+        log_warn("Unable to cache the addresses in %s", path);
+        unlink(temporary);
+    }
+}
+
+/*
+Description:
+    Resolves a host and port into the addresses to connect to, in the order getaddrinfo prefers.
+Arguments:
+    const char *host: The host name or numeric address
+    const char *port: The port number or service name
+    int useCache: Whether to read and write the on-disk cache
+    ResolvedAddress *addresses: Filled in with up to RESOLVER_MAX_ADDRESSES addresses
+    size_t *count: Set to the number of addresses
+    int *cached: Set to true if the addresses came from the cache
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int resolver_lookup(const char *host, const char *port, int useCache, ResolvedAddress *addresses,
+                    size_t *count, int *cached) {
+    char path[PATH_MAX];
+    struct addrinfo hints, *res;
+
+    useCache = useCache && !isNumeric(host) && cachePath(host, port, path, sizeof(path)) == 0;
+    *cached = useCache && readCache(path, addresses, count);
+    if (*cached) {
+        log_info("Using %zu cached addresses for %s", *count, host);
+        return 0;
+    }
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;     // IPv4 or IPv6
+    hints.ai_socktype = SOCK_STREAM; // TCP
+
+    int returnValue;
+    if ((returnValue = getaddrinfo(host, port, &hints, &res)) != 0) {
+        log_error("getaddrinfo failed. %s", gai_strerror(returnValue));
+        return 1;
+    }
+    *count = 0;
+    for (struct addrinfo *ai = res; ai != NULL && *count < RESOLVER_MAX_ADDRESSES;
+         ai = ai->ai_next) {
+        if (ai->ai_addrlen > sizeof(struct sockaddr_storage))
+            continue;
+        ResolvedAddress *resolved = &addresses[(*count)++];
+        memset(resolved, 0, sizeof(ResolvedAddress));
+        resolved->family = ai->ai_family;
+        resolved->length = ai->ai_addrlen;
+        memcpy(&resolved->address, ai->ai_addr, ai->ai_addrlen);
+    }
+    freeaddrinfo(res);
+    if (*count == 0) {
+        log_error("No usable addresses for %s", host);
+        return 1;
+    }
+
+    if (useCache)
+        writeCache(path, addresses, *count);
+    return 0;
+}
+
+/*
+Description:
+    Drops the cached addresses of a host and port, for when none of them could be connected to.
+Arguments:
+    const char *host: The host name
+    const char *port: The port
+Return value:
+    None.
+*/
+void resolver_forget(const char *host, const char *port) {
+    char path[PATH_MAX];
+
+    if (!isNumeric(host) && cachePath(host, port, path, sizeof(path)) == 0)
+        unlink(path);
+}
@@ -0,0 +1,53 @@
+#ifndef RESOLVER_H_
+#define RESOLVER_H_
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+#define RESOLVER_MAX_ADDRESSES 16
+#define RESOLVER_TTL_SECONDS 60
+#define RESOLVER_CACHE_MAGIC 0x54435243u
+#define RESOLVER_CACHE_DIRECTORY "tcp_client"
+
+/*
+Host name resolution with an on-disk cache. getaddrinfo gives no TTL, so a looked up name is cached
+for RESOLVER_TTL_SECONDS in one small file per host and port under $XDG_CACHE_HOME/tcp_client (or
+~/.cache/tcp_client, or /tmp when there is no home). A cache directory that is not the user's own
+with mode 0700 is not used. Files are replaced with a rename, so clients running at the same time
+always see a whole entry. Numeric addresses are never cached since
+resolving them costs nothing.
+*/
+typedef struct ResolvedAddress {
+    int family;
+    socklen_t length;
+    struct sockaddr_storage address;
+} ResolvedAddress;
+
+/*
+Description:
+    Resolves a host and port into the addresses to connect to, in the order getaddrinfo prefers.
+Arguments:
+    const char *host: The host name or numeric address
+    const char *port: The port number or service name
+    int useCache: Whether to read and write the on-disk cache
+    ResolvedAddress *addresses: Filled in with up to RESOLVER_MAX_ADDRESSES addresses
+    size_t *count: Set to the number of addresses
+    int *cached: Set to true if the addresses came from the cache
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int resolver_lookup(const char *host, const char *port, int useCache, ResolvedAddress *addresses,
+                    size_t *count, int *cached);
+
+/*
+Description:
+    Drops the cached addresses of a host and port, for when none of them could be connected to.
+Arguments:
+    const char *host: The host name
+    const char *port: The port
+Return value:
+    None.
+*/
+void resolver_forget(const char *host, const char *port);
+
+#endif
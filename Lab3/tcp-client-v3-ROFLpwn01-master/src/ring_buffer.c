@@ -0,0 +1,131 @@
+#include "ring_buffer.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/*
+Description:
+    Allocates the buffer.
+Arguments:
+    RingBuffer *ring: The ring buffer to initialize
+    size_t capacity: The starting capacity in bytes
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int ring_buffer_init(RingBuffer *ring, size_t capacity) {
+    ring->data = malloc(capacity);
+    ring->capacity = capacity;
+    ring->head = 0;
+    ring->tail = 0;
+    if (ring->data == NULL) {
+        log_error("Unable to allocate the ring buffer");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Frees the buffer.
+Arguments:
+    RingBuffer *ring: The ring buffer to free
+Return value:
+    None.
+*/
+void ring_buffer_free(RingBuffer *ring) {
+    free(ring->data);
+    ring->data = NULL;
+    ring->capacity = 0;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+/*
+Description:
+    Returns the number of received bytes that have not been consumed.
+Arguments:
+    const RingBuffer *ring: The ring buffer
+Return value:
+    The number of unconsumed bytes.
+*/
+size_t ring_buffer_length(const RingBuffer *ring) { return ring->tail - ring->head; }
+
+/*
+Description:
+    Makes sure that the unconsumed bytes plus at least needed more bytes (and the spare byte) fit
+    contiguously from head, moving the unconsumed bytes to the start or growing the buffer if not.
+Arguments:
+    RingBuffer *ring: The ring buffer
+    size_t needed: The number of contiguous bytes needed from head
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int ring_buffer_reserve(RingBuffer *ring, size_t needed) {
+    if (ring->head + needed + 1 <= ring->capacity)
+        return 0;
+
+    size_t length = ring_buffer_length(ring);
+    if (needed + 1 > ring->capacity) {
+        size_t capacity = ring->capacity * 2;
+        while (capacity < needed + 1)
+            capacity *= 2;
+        char *data = malloc(capacity);
+        if (data == NULL) {
+            log_error("Unable to grow the ring buffer to %zu bytes", capacity);
+            return 1;
+        }
+        memcpy(data, ring->data + ring->head, length);
+        free(ring->data);
+        ring->data = data;
+        ring->capacity = capacity;
+    } else {
+        // Wraps around, carrying the partial frame back to the start
+        memmove(ring->data, ring->data + ring->head, length);
+    }
+    ring->head = 0;
+    ring->tail = length;
+    return 0;
+}
+
+/*
+Description:
+    Receives directly into the free space after tail.
+Arguments:
+    RingBuffer *ring: The ring buffer
+    int sockfd: Socket file descriptor
+    int flags: Flags passed to recv
+Return value:
+    Returns what recv returns: the number of bytes received, 0 on orderly shutdown, -1 on error.
+*/
+ssize_t ring_buffer_recv(RingBuffer *ring, int sockfd, int flags) {
+    // Always leaves room for at least half of the buffer so reads stay large
+    if (ring->capacity - ring->tail - 1 < ring->capacity / 2 &&
+        ring_buffer_reserve(ring, ring_buffer_length(ring) + ring->capacity / 2))
+        return -1;
+
+    ssize_t bytesReceived =
+        recv(sockfd, ring->data + ring->tail, ring->capacity - ring->tail - 1, flags);
+    if (bytesReceived > 0)
+        ring->tail += bytesReceived;
+    return bytesReceived;
+}
+
+/*
+Description:
+    Marks bytes at head as consumed. Pointers into the consumed bytes stay valid until the next call
+    to ring_buffer_reserve or ring_buffer_recv.
+Arguments:
+    RingBuffer *ring: The ring buffer
+    size_t length: The number of bytes to consume
+Return value:
+    None.
+*/
+void ring_buffer_consume(RingBuffer *ring, size_t length) {
+    ring->head += length;
+    if (ring->head == ring->tail) {
+        ring->head = 0;
+        ring->tail = 0;
+    }
+}
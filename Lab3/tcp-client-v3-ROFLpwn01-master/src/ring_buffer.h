@@ -0,0 +1,90 @@
+#ifndef RING_BUFFER_H_
+#define RING_BUFFER_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define RING_BUFFER_DEFAULT_CAPACITY 65536
+
+/*
+Receive buffer that the socket reads directly into. Bytes between head and tail have been received
+but not consumed yet. Frames are parsed in place, so a response is only ever copied when a partial
+frame is left behind at the end of the buffer and has to be moved back to the start (at most once
+per trip around the buffer). The buffer grows when a single frame does not fit. One byte past tail
+is always kept free so a frame can be null terminated in place.
+*/
+typedef struct RingBuffer {
+    char *data;
+    size_t capacity;
+    size_t head;
+    size_t tail;
+} RingBuffer;
+
+/*
+Description:
+    Allocates the buffer.
+Arguments:
+    RingBuffer *ring: The ring buffer to initialize
+    size_t capacity: The starting capacity in bytes
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int ring_buffer_init(RingBuffer *ring, size_t capacity);
+
+/*
+Description:
+    Frees the buffer.
+Arguments:
+    RingBuffer *ring: The ring buffer to free
+Return value:
+    None.
+*/
+void ring_buffer_free(RingBuffer *ring);
+
+/*
+Description:
+    Returns the number of received bytes that have not been consumed.
+Arguments:
+    const RingBuffer *ring: The ring buffer
+Return value:
+    The number of unconsumed bytes.
+*/
+size_t ring_buffer_length(const RingBuffer *ring);
+
+/*
+Description:
+    Makes sure that the unconsumed bytes plus at least needed more bytes (and the spare byte) fit
+    contiguously from head, moving the unconsumed bytes to the start or growing the buffer if not.
+Arguments:
+    RingBuffer *ring: The ring buffer
+    size_t needed: The number of contiguous bytes needed from head
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int ring_buffer_reserve(RingBuffer *ring, size_t needed);
+
+/*
+Description:
+    Receives directly into the free space after tail.
+Arguments:
+    RingBuffer *ring: The ring buffer
+    int sockfd: Socket file descriptor
+    int flags: Flags passed to recv
+Return value:
+    Returns what recv returns: the number of bytes received, 0 on orderly shutdown, -1 on error.
+*/
+ssize_t ring_buffer_recv(RingBuffer *ring, int sockfd, int flags);
+
+/*
+Description:
+    Marks bytes at head as consumed. Pointers into the consumed bytes stay valid until the next call
+    to ring_buffer_reserve or ring_buffer_recv.
+Arguments:
+    RingBuffer *ring: The ring buffer
+    size_t length: The number of bytes to consume
+Return value:
+    None.
+*/
+void ring_buffer_consume(RingBuffer *ring, size_t length);
+
+#endif
@@ -0,0 +1,315 @@
+#include "send_batch.h"
+#include "log.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#define HEADER_SIZE 4
+#define TAG_SIZE 4
+#define MAX_IOV 1024 // UIO_MAXIOV, the most iovecs one sendmsg accepts on Linux
+#define FRAME_LENGTH_MASK ((1u << 27) - 1)
+
+/*
+Description:
+    Allocates a batch.
+Arguments:
+    SendBatch *batch: The batch to initialize
+    size_t maxFrames: Flush once this many frames are queued
+    size_t maxBytes: Flush once this many bytes are queued
+    unsigned maxDelayUs: Flush once the oldest frame has waited this long (0 means no deadline)
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int send_batch_init(SendBatch *batch, size_t maxFrames, size_t maxBytes, unsigned maxDelayUs) {
+    memset(batch, 0, sizeof(SendBatch));
+    batch->maxFrames = maxFrames > 0 ? maxFrames : 1;
+    batch->maxBytes = maxBytes > 0 ? maxBytes : 1;
+    batch->maxDelayUs = maxDelayUs;
+    // Room for the envelope and a header and message per frame
+    batch->iov = malloc((batch->maxFrames * 2 + 1) * sizeof(struct iovec));
+    // Room for a header and a tag per frame
+    batch->headers = malloc(batch->maxFrames * 2 * sizeof(uint32_t));
+    batch->copyCapacity = batch->maxBytes;
+    batch->copyBuf = malloc(batch->copyCapacity);
+    if (batch->iov == NULL || batch->headers == NULL || batch->copyBuf == NULL) {
+        log_error("Unable to allocate the send batch");
+        send_batch_free(batch);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Frees a batch. Unsent frames are dropped.
+Arguments:
+    SendBatch *batch: The batch to free
+Return value:
+    None.
+*/
+void send_batch_free(SendBatch *batch) {
+    free(batch->iov);
+    free(batch->headers);
+    free(batch->copyBuf);
+    memset(batch, 0, sizeof(SendBatch));
+}
+
+/*
+Description:
+    Wraps every later batch in an outer frame with the given action code (0 turns it off). Must be
+    called while the batch is empty.
+Arguments:
+    SendBatch *batch: The batch
+    uint32_t action: The action code of the outer frame
+Return value:
+    None.
+*/
+void send_batch_set_envelope(SendBatch *batch, uint32_t action) { batch->envelopeAction = action; }
+
+/*
+Description:
+    Returns whether a frame with a message of the given length can be added. A message that does
+    not fit in the copy buffer only fits in an empty batch (the buffer is grown for it), and an
+    enveloped batch has no room once it is partly written or its envelope would be full.
+Arguments:
+    const SendBatch *batch: The batch
+    size_t length: The length of the message
+    int copy: Whether the message would be copied
+Return value:
+    Returns true if the frame can be added.
+*/
+int send_batch_has_room(const SendBatch *batch, size_t length, int copy) {
+    if (batch->iovCount == 0)
+        return 1;
+    if (batch->frames >= batch->maxFrames || batch->sealed)
+        return 0;
+    if (batch->envelopeAction != 0 && batch->bytes + HEADER_SIZE + length > FRAME_LENGTH_MASK)
+        return 0;
+    return !copy || batch->copyUsed + length <= batch->copyCapacity;
+}
+
+/*
+Description:
+    Adds a frame, with or without a tag after its header.
+Arguments:
+    SendBatch *batch: The batch
+    uint32_t header: The request header in network byte order
+    uint32_t tag: The tag in network byte order
+    size_t tagSize: TAG_SIZE to send the tag, 0 to leave it out
+    const char *message: The message
+    size_t length: The length of the message
+    int copy: If true the message is copied, otherwise it must stay valid until the batch is flushed
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int addFrame(SendBatch *batch, uint32_t header, uint32_t tag, size_t tagSize,
+                    const char *message, size_t length, int copy) {
+    if (batch->iovCount == 0) {
+        batch->iovHead = 0;
+        batch->frames = 0;
+        batch->bytes = 0;
+        batch->copyUsed = 0;
+        if (batch->maxDelayUs > 0)
+            clock_gettime(CLOCK_MONOTONIC, &batch->firstQueued);
+        if (batch->envelopeAction != 0) {
+            // Filled in by send_batch_flush once the batch's length is known
+            batch->iov[0].iov_base = &batch->envelopeHeader;
+            batch->iov[0].iov_len = HEADER_SIZE;
+            batch->iovCount = 1;
+        }
+    }
+
+    if (copy && length > batch->copyCapacity) {
+        // Only reached with an empty batch, so nothing points into the old buffer
+        char *copyBuf = realloc(batch->copyBuf, length);
+        if (copyBuf == NULL) {
+            log_error("Unable to grow the send batch to %zu bytes", length);
+            return 1;
+        }
+        batch->copyBuf = copyBuf;
+        batch->copyCapacity = length;
+    }
+
+    batch->headers[2 * batch->frames] = header;
+    batch->headers[2 * batch->frames + 1] = tag;
+    batch->iov[batch->iovCount].iov_base = &batch->headers[2 * batch->frames];
+    batch->iov[batch->iovCount].iov_len = HEADER_SIZE + tagSize;
+    batch->iovCount++;
+
+    if (length > 0) {
+        if (copy) {
+            memcpy(batch->copyBuf + batch->copyUsed, message, length);
+            message = batch->copyBuf + batch->copyUsed;
+            batch->copyUsed += length;
+        }
+        batch->iov[batch->iovCount].iov_base = (char *)message;
+        batch->iov[batch->iovCount].iov_len = length;
+        batch->iovCount++;
+    }
+
+    batch->frames++;
+    batch->bytes += HEADER_SIZE + tagSize + length;
+    return 0;
+}
+
+/*
+Description:
+    Adds a frame. The caller must check send_batch_has_room first.
+Arguments:
+    SendBatch *batch: The batch
+    uint32_t header: The request header in network byte order
+    const char *message: The message
+    size_t length: The length of the message
+    int copy: If true the message is copied, otherwise it must stay valid until the batch is flushed
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int send_batch_add(SendBatch *batch, uint32_t header, const char *message, size_t length,
+                   int copy) {
+    return addFrame(batch, header, 0, 0, message, length, copy);
+}
+
+/*
+Description:
+    Adds a frame with a 4-byte tag (a v4 request ID) between the header and the message. The caller
+    must check send_batch_has_room first.
+Arguments:
+    SendBatch *batch: The batch
+    uint32_t header: The request header in network byte order
+    uint32_t tag: The tag in network byte order
+    const char *message: The message
+    size_t length: The length of the message
+    int copy: If true the message is copied, otherwise it must stay valid until the batch is flushed
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int send_batch_add_tagged(SendBatch *batch, uint32_t header, uint32_t tag, const char *message,
+                          size_t length, int copy) {
+    return addFrame(batch, header, tag, TAG_SIZE, message, length, copy);
+}
+
+/*
+Description:
+    Returns whether the batch has reached its frame count, size or time limit.
+Arguments:
+    const SendBatch *batch: The batch
+Return value:
+    Returns true if the batch should be flushed.
+*/
+int send_batch_should_flush(const SendBatch *batch) {
+    if (batch->iovCount == 0)
+        return 0;
+    if (batch->frames >= batch->maxFrames || batch->bytes >= batch->maxBytes)
+        return 1;
+    if (batch->maxDelayUs > 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long waited = (now.tv_sec - batch->firstQueued.tv_sec) * 1000000LL +
+                           (now.tv_nsec - batch->firstQueued.tv_nsec) / 1000;
+        return waited >= batch->maxDelayUs;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Returns how much longer the oldest queued frame may wait before the batch is due, for use as a
+    poll or read timeout.
+Arguments:
+    const SendBatch *batch: The batch
+    struct timespec *timeout: Set to the time left, or zero once the deadline has passed
+Return value:
+    Returns true if the batch has a deadline, false if it is empty or has no time limit.
+*/
+int send_batch_timeout(const SendBatch *batch, struct timespec *timeout) {
+    struct timespec now;
+
+    if (batch->iovCount == 0 || batch->maxDelayUs == 0)
+        return 0;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long left = batch->maxDelayUs * 1000LL -
+                     ((now.tv_sec - batch->firstQueued.tv_sec) * 1000000000LL +
+                      (now.tv_nsec - batch->firstQueued.tv_nsec));
+    if (left < 0)
+        left = 0;
+    timeout->tv_sec = left / 1000000000LL;
+    timeout->tv_nsec = left % 1000000000LL;
+    return 1;
+}
+
+/*
+Description:
+    Returns the number of bytes that have been added but not yet sent.
+Arguments:
+    const SendBatch *batch: The batch
+Return value:
+    The number of pending bytes.
+*/
+size_t send_batch_pending(const SendBatch *batch) {
+    size_t pending = 0;
+    for (int i = batch->iovHead; i < batch->iovCount; i++)
+        pending += batch->iov[i].iov_len;
+    return pending;
+}
+
+/*
+Description:
+    Writes the batch with sendmsg, picking up after any earlier partial write. With MSG_DONTWAIT
+    (or a non-blocking socket) it returns early when the socket is full; send_batch_pending then
+    tells how much is left. The batch is emptied once everything has been sent.
+Arguments:
+    SendBatch *batch: The batch
+    int sockfd: Socket file descriptor
+    int flags: Extra flags passed to sendmsg
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int send_batch_flush(SendBatch *batch, int sockfd, int flags) {
+    if (batch->envelopeAction != 0 && batch->iovCount > 0 && !batch->sealed) {
+        batch->envelopeHeader = htonl(batch->envelopeAction << 27 | (uint32_t)batch->bytes);
+        batch->sealed = 1;
+    }
+
+    while (batch->iovHead < batch->iovCount) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = batch->iov + batch->iovHead;
+        msg.msg_iovlen = batch->iovCount - batch->iovHead;
+        if (msg.msg_iovlen > MAX_IOV)
+            msg.msg_iovlen = MAX_IOV;
+
+        ssize_t bytesSent = sendmsg(sockfd, &msg, MSG_NOSIGNAL | flags);
+        if (bytesSent == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            log_error("Error with sending: %s", strerror(errno));
+            return 1;
+        }
+
+        // Skips the iovecs that were fully written and trims a partially written one
+        while (bytesSent > 0) {
+            struct iovec *iov = &batch->iov[batch->iovHead];
+            if ((size_t)bytesSent >= iov->iov_len) {
+                bytesSent -= iov->iov_len;
+                batch->iovHead++;
+            } else {
+                iov->iov_base = (char *)iov->iov_base + bytesSent;
+                iov->iov_len -= bytesSent;
+                bytesSent = 0;
+            }
+        }
+    }
+
+    batch->iovCount = 0;
+    batch->iovHead = 0;
+    batch->frames = 0;
+    batch->bytes = 0;
+    batch->copyUsed = 0;
+    batch->sealed = 0;
+    return 0;
+}
@@ -0,0 +1,170 @@
+#ifndef SEND_BATCH_H_
+#define SEND_BATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#define SEND_BATCH_DEFAULT_FRAMES 64
+#define SEND_BATCH_DEFAULT_BYTES 65536
+#define SEND_BATCH_DEFAULT_DELAY_US 1000
+
+/*
+Collects encoded request frames (header, optional tag and message) into an iovec array so that
+many frames are written with one sendmsg. Headers and tags are stored in the batch; messages are
+either copied into the batch's own buffer or referenced in place when the caller keeps them alive
+until the batch is flushed. A batch should be flushed once it holds maxFrames frames or maxBytes
+bytes, or once its oldest frame has waited maxDelayUs microseconds.
+
+With an envelope action set, the frames of each batch are sent inside one outer frame with that
+action and the total length of the frames. The envelope's length is fixed when the first byte is
+written, so a batch that is partly written takes no more frames until it has been sent.
+*/
+typedef struct SendBatch {
+    struct iovec *iov;
+    int iovCount;
+    int iovHead;
+    uint32_t *headers;
+    size_t frames;
+    size_t bytes;
+    char *copyBuf;
+    size_t copyUsed;
+    size_t copyCapacity;
+    size_t maxFrames;
+    size_t maxBytes;
+    unsigned maxDelayUs;
+    struct timespec firstQueued;
+    uint32_t envelopeAction;
+    uint32_t envelopeHeader;
+    int sealed;
+} SendBatch;
+
+/*
+Description:
+    Allocates a batch.
+Arguments:
+    SendBatch *batch: The batch to initialize
+    size_t maxFrames: Flush once this many frames are queued
+    size_t maxBytes: Flush once this many bytes are queued
+    unsigned maxDelayUs: Flush once the oldest frame has waited this long (0 means no deadline)
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int send_batch_init(SendBatch *batch, size_t maxFrames, size_t maxBytes, unsigned maxDelayUs);
+
+/*
+Description:
+    Frees a batch. Unsent frames are dropped.
+Arguments:
+    SendBatch *batch: The batch to free
+Return value:
+    None.
+*/
+void send_batch_free(SendBatch *batch);
+
+/*
+Description:
+    Wraps every later batch in an outer frame with the given action code (0 turns it off). Must be
+    called while the batch is empty.
+Arguments:
+    SendBatch *batch: The batch
+    uint32_t action: The action code of the outer frame
+Return value:
+    None.
+*/
+void send_batch_set_envelope(SendBatch *batch, uint32_t action);
+
+/*
+Description:
+    Returns whether a frame with a message of the given length can be added. A message that does
+    not fit in the copy buffer only fits in an empty batch (the buffer is grown for it), and an
+    enveloped batch has no room once it is partly written or its envelope would be full.
+Arguments:
+    const SendBatch *batch: The batch
+    size_t length: The length of the message
+    int copy: Whether the message would be copied
+Return value:
+    Returns true if the frame can be added.
+*/
+int send_batch_has_room(const SendBatch *batch, size_t length, int copy);
+
+/*
+Description:
+    Adds a frame. The caller must check send_batch_has_room first.
+Arguments:
+    SendBatch *batch: The batch
+    uint32_t header: The request header in network byte order
+    const char *message: The message
+    size_t length: The length of the message
+    int copy: If true the message is copied, otherwise it must stay valid until the batch is flushed
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int send_batch_add(SendBatch *batch, uint32_t header, const char *message, size_t length,
+                   int copy);
+
+/*
+Description:
+    Adds a frame with a 4-byte tag (a v4 request ID) between the header and the message. The caller
+    must check send_batch_has_room first.
+Arguments:
+    SendBatch *batch: The batch
+    uint32_t header: The request header in network byte order
+    uint32_t tag: The tag in network byte order
+    const char *message: The message
+    size_t length: The length of the message
+    int copy: If true the message is copied, otherwise it must stay valid until the batch is flushed
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int send_batch_add_tagged(SendBatch *batch, uint32_t header, uint32_t tag, const char *message,
+                          size_t length, int copy);
+
+/*
+Description:
+    Returns whether the batch has reached its frame count, size or time limit.
+Arguments:
+    const SendBatch *batch: The batch
+Return value:
+    Returns true if the batch should be flushed.
+*/
+int send_batch_should_flush(const SendBatch *batch);
+
+/*
+Description:
+    Returns how much longer the oldest queued frame may wait before the batch is due, for use as a
+    poll or read timeout.
+Arguments:
+    const SendBatch *batch: The batch
+    struct timespec *timeout: Set to the time left, or zero once the deadline has passed
+Return value:
+    Returns true if the batch has a deadline, false if it is empty or has no time limit.
+*/
+int send_batch_timeout(const SendBatch *batch, struct timespec *timeout);
+
+/*
+Description:
+    Returns the number of bytes that have been added but not yet sent.
+Arguments:
+    const SendBatch *batch: The batch
+Return value:
+    The number of pending bytes.
+*/
+size_t send_batch_pending(const SendBatch *batch);
+
+/*
+Description:
+    Writes the batch with sendmsg, picking up after any earlier partial write. With MSG_DONTWAIT
+    (or a non-blocking socket) it returns early when the socket is full; send_batch_pending then
+    tells how much is left. The batch is emptied once everything has been sent.
+Arguments:
+    SendBatch *batch: The batch
+    int sockfd: Socket file descriptor
+    int flags: Extra flags passed to sendmsg
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int send_batch_flush(SendBatch *batch, int sockfd, int flags);
+
+#endif
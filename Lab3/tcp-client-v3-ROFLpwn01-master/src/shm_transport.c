@@ -0,0 +1,655 @@
+#include "shm_transport.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SHM_MAGIC 0x33534d48
+#define SHM_VERSION 1
+#define CACHE_LINE 64
+#define MIN_CAPACITY 4096
+#define SPIN_ITERATIONS 2000
+#define WAIT_TIMEOUT_NS 100000000L
+#define CONNECT_RETRY_NS 1000000L
+#define CONNECT_RETRIES 1000
+#define MAX_NAME 256
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#else
+#define CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
+
+enum { CLIENT, SERVER };
+enum { REQUESTS, RESPONSES };
+enum { STATE_FREE, STATE_CONNECTED };
+
+/*
+One side's doorbell. The other side bumps bell and wakes the futex on it when sleeping is set.
+waitingForSpace is set while this side has bytes staged, so freeing space in its outgoing ring only
+rings the bell when it matters. closed is set once this side is done.
+*/
+typedef struct Side {
+    uint32_t bell;
+    uint32_t sleeping;
+    uint32_t waitingForSpace;
+    uint32_t closed;
+    char pad[CACHE_LINE - 4 * sizeof(uint32_t)];
+} Side;
+
+/*
+Positions in one ring, as total bytes written (head) and read (tail). Each is only written by one
+side and they live on separate cache lines.
+*/
+typedef struct Ring {
+    uint64_t head;
+    char headPad[CACHE_LINE - sizeof(uint64_t)];
+    uint64_t tail;
+    char tailPad[CACHE_LINE - sizeof(uint64_t)];
+} Ring;
+
+/*
+Start of the shared memory region. The request ring's data and then the response ring's data
+follow it.
+*/
+typedef struct Region {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    int32_t pids[2];
+    uint32_t state;
+    char pad[CACHE_LINE - 3 * sizeof(uint32_t) - sizeof(uint64_t) - 2 * sizeof(int32_t)];
+    Side sides[2];
+    Ring rings[2];
+} Region;
+
+struct ShmTransport {
+    int fd;
+    int side;
+    char name[MAX_NAME];
+    Region *region;
+    size_t mapLength;
+    uint64_t capacity;
+
+    Ring *rx;
+    char *rxData;
+    Ring *tx;
+    char *txData;
+    Side *self;
+    Side *peer;
+
+    // Bytes sent while the outgoing ring was full, oldest at stagedOffset
+    char *staged;
+    size_t stagedOffset;
+    size_t stagedLength;
+    size_t stagedCapacity;
+
+    RingBuffer ring;
+    int spin;
+    unsigned long syscalls;
+};
+
+/*
+Description:
+    Allocates a transport that is not attached to a region yet.
+Arguments:
+    const char *name: The name of the region, with or without the leading slash
+    int side: CLIENT or SERVER
+Return value:
+    Returns the transport, or NULL on failure.
+*/
+static ShmTransport *createTransport(const char *name, int side) {
+    ShmTransport *shm = calloc(1, sizeof(ShmTransport));
+    if (shm == NULL) {
+        log_error("Unable to allocate the shared memory transport");
+        return NULL;
+    }
+    int length = snprintf(shm->name, MAX_NAME, "%s%s", name[0] == '/' ? "" : "/", name);
+    if (length >= MAX_NAME || strchr(shm->name + 1, '/') != NULL) {
+        log_error("Invalid shared memory name: %s", name);
+        free(shm);
+        return NULL;
+    }
+    if (ring_buffer_init(&shm->ring, RING_BUFFER_DEFAULT_CAPACITY)) {
+        free(shm);
+        return NULL;
+    }
+    shm->fd = -1;
+    shm->side = side;
+    // Spinning only helps when the other side can run at the same time
+    shm->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_ITERATIONS : 0;
+    return shm;
+}
+
+/*
+Description:
+    Frees a transport, unmapping its region if it has one. The file descriptor is not closed.
+Arguments:
+    ShmTransport *shm: The transport
+Return value:
+    None.
+*/
+static void freeTransport(ShmTransport *shm) {
+    if (shm->region != NULL)
+        munmap(shm->region, shm->mapLength);
+    ring_buffer_free(&shm->ring);
+    free(shm->staged);
+    free(shm);
+}
+
+/*
+Description:
+    Points the transport at its rings and doorbells in the mapped region.
+Arguments:
+    ShmTransport *shm: The transport
+Return value:
+    None.
+*/
+static void attach(ShmTransport *shm) {
+    char *data = (char *)shm->region + sizeof(Region);
+    int txRing = shm->side == CLIENT ? REQUESTS : RESPONSES;
+    int rxRing = shm->side == CLIENT ? RESPONSES : REQUESTS;
+
+    shm->capacity = shm->region->capacity;
+    shm->tx = &shm->region->rings[txRing];
+    shm->txData = data + txRing * shm->capacity;
+    shm->rx = &shm->region->rings[rxRing];
+    shm->rxData = data + rxRing * shm->capacity;
+    shm->self = &shm->region->sides[shm->side];
+    shm->peer = &shm->region->sides[!shm->side];
+}
+
+/*
+Description:
+    Wakes the other side if it is asleep. Must follow the store that published the change it is
+    waiting for; both are sequentially consistent so the other side either sees the change before
+    sleeping or is seen to be sleeping here.
+Arguments:
+    ShmTransport *shm: The transport
+Return value:
+    None.
+*/
+static void wakePeer(ShmTransport *shm) {
+    // Clearing the flag here means one wakeup per sleep, however many sends come before it runs
+    if (__atomic_exchange_n(&shm->peer->sleeping, 0, __ATOMIC_SEQ_CST)) {
+        __atomic_add_fetch(&shm->peer->bell, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &shm->peer->bell, FUTEX_WAKE, 1, NULL, NULL, 0);
+        shm->syscalls++;
+    }
+}
+
+/*
+Description:
+    Waits until a condition holds, spinning briefly before sleeping on this side's doorbell. Sleeps
+    time out so a side that died without closing is noticed.
+Arguments:
+    ShmTransport *shm: The transport
+    int (*ready)(ShmTransport *): Returns a true value once there is something to do
+Return value:
+    Returns 1 if the condition holds, 0 if it does not yet or -1 if a signal interrupted the wait.
+*/
+static int waitFor(ShmTransport *shm, int (*ready)(ShmTransport *)) {
+    for (int i = 0; i < shm->spin; i++) {
+        if (ready(shm))
+            return 1;
+        CPU_RELAX();
+    }
+
+    int interrupted = 0;
+    uint32_t bell = __atomic_load_n(&shm->self->bell, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&shm->self->sleeping, 1, __ATOMIC_SEQ_CST);
+    if (!ready(shm)) {
+        struct timespec timeout = {0, WAIT_TIMEOUT_NS};
+        long result = syscall(SYS_futex, &shm->self->bell, FUTEX_WAIT, bell, &timeout, NULL, 0);
+        interrupted = result == -1 && errno == EINTR;
+        shm->syscalls++;
+    }
+    __atomic_store_n(&shm->self->sleeping, 0, __ATOMIC_SEQ_CST);
+    if (ready(shm))
+        return 1;
+    return interrupted ? -1 : 0;
+}
+
+/*
+Description:
+    Checks whether the other side has closed, or has exited without closing.
+Arguments:
+    ShmTransport *shm: The transport
+Return value:
+    Returns a true value if the other side is gone.
+*/
+static int peerGone(ShmTransport *shm) {
+    if (__atomic_load_n(&shm->peer->closed, __ATOMIC_SEQ_CST))
+        return 1;
+    pid_t pid = __atomic_load_n(&shm->region->pids[!shm->side], __ATOMIC_RELAXED);
+    return pid != 0 && kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+static size_t rxAvailable(ShmTransport *shm) {
+    return __atomic_load_n(&shm->rx->head, __ATOMIC_SEQ_CST) - shm->rx->tail;
+}
+
+static size_t txSpace(ShmTransport *shm) {
+    return shm->capacity - (shm->tx->head - __atomic_load_n(&shm->tx->tail, __ATOMIC_SEQ_CST));
+}
+
+static int stagedPending(ShmTransport *shm) { return shm->stagedOffset < shm->stagedLength; }
+
+/*
+Description:
+    Copies bytes into the outgoing ring, which must have room for them, and publishes them.
+Arguments:
+    ShmTransport *shm: The transport
+    const char *buf: The bytes
+    size_t length: The number of bytes
+Return value:
+    None.
+*/
+static void copyOut(ShmTransport *shm, const char *buf, size_t length) {
+    uint64_t head = shm->tx->head;
+    size_t offset = head & (shm->capacity - 1);
+    size_t first = shm->capacity - offset < length ? shm->capacity - offset : length;
+
+    memcpy(shm->txData + offset, buf, first);
+    memcpy(shm->txData, buf + first, length - first);
+    __atomic_store_n(&shm->tx->head, head + length, __ATOMIC_SEQ_CST);
+    wakePeer(shm);
+}
+
+/*
+Description:
+    Moves as many staged bytes into the outgoing ring as fit.
+Arguments:
+    ShmTransport *shm: The transport
+Return value:
+    None.
+*/
+static void pushStaged(ShmTransport *shm) {
+    size_t length = shm->stagedLength - shm->stagedOffset;
+    size_t space = txSpace(shm);
+
+    if (length > space)
+        length = space;
+    if (length == 0)
+        return;
+    copyOut(shm, shm->staged + shm->stagedOffset, length);
+    shm->stagedOffset += length;
+    if (shm->stagedOffset == shm->stagedLength) {
+        shm->stagedOffset = 0;
+        shm->stagedLength = 0;
+        __atomic_store_n(&shm->self->waitingForSpace, 0, __ATOMIC_SEQ_CST);
+    }
+}
+
+/*
+Description:
+    Appends bytes to the staging buffer, growing it as needed.
+Arguments:
+    ShmTransport *shm: The transport
+    const char *buf: The bytes
+    size_t length: The number of bytes
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int stage(ShmTransport *shm, const char *buf, size_t length) {
+    if (shm->stagedLength + length > shm->stagedCapacity) {
+        size_t capacity = shm->stagedCapacity > 0 ? shm->stagedCapacity : shm->capacity;
+        while (capacity < shm->stagedLength + length)
+            capacity *= 2;
+        char *staged = realloc(shm->staged, capacity);
+        if (staged == NULL) {
+            log_error("Unable to grow the shared memory staging buffer to %zu bytes", capacity);
+            return 1;
+        }
+        shm->staged = staged;
+        shm->stagedCapacity = capacity;
+    }
+    memcpy(shm->staged + shm->stagedLength, buf, length);
+    shm->stagedLength += length;
+    __atomic_store_n(&shm->self->waitingForSpace, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+/*
+Description:
+    Moves everything in the incoming ring into the receive ring buffer and frees the space.
+Arguments:
+    ShmTransport *shm: The transport
+Return value:
+    Returns the number of bytes moved, or -1 on failure.
+*/
+static ssize_t takeReceived(ShmTransport *shm) {
+    size_t length = rxAvailable(shm);
+    RingBuffer *ring = &shm->ring;
+
+    if (length == 0)
+        return 0;
+    if (ring_buffer_reserve(ring, ring_buffer_length(ring) + length))
+        return -1;
+
+    uint64_t tail = shm->rx->tail;
+    size_t offset = tail & (shm->capacity - 1);
+    size_t first = shm->capacity - offset < length ? shm->capacity - offset : length;
+    memcpy(ring->data + ring->tail, shm->rxData + offset, first);
+    memcpy(ring->data + ring->tail + first, shm->rxData, length - first);
+    ring->tail += length;
+
+    __atomic_store_n(&shm->rx->tail, tail + length, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shm->peer->waitingForSpace, __ATOMIC_SEQ_CST))
+        wakePeer(shm);
+    return length;
+}
+
+static int recvReady(ShmTransport *shm) {
+    return rxAvailable(shm) > 0 || (stagedPending(shm) && txSpace(shm) > 0) ||
+           __atomic_load_n(&shm->peer->closed, __ATOMIC_SEQ_CST);
+}
+
+static int connectedReady(ShmTransport *shm) {
+    return __atomic_load_n(&shm->region->state, __ATOMIC_SEQ_CST) == STATE_CONNECTED;
+}
+
+/*
+Description:
+    Creates the shared memory region and waits for clients (server side). A region left behind with
+    the same name is replaced.
+Arguments:
+    const char *name: The name of the region, with or without the leading slash
+    size_t capacity: The size of each ring in bytes, rounded up to a power of two
+Return value:
+    Returns the transport, or NULL on failure.
+*/
+ShmTransport *shm_transport_listen(const char *name, size_t capacity) {
+    ShmTransport *shm = createTransport(name, SERVER);
+    size_t ringCapacity = MIN_CAPACITY;
+
+    if (shm == NULL)
+        return NULL;
+    while (ringCapacity < capacity)
+        ringCapacity *= 2;
+    shm->mapLength = sizeof(Region) + 2 * ringCapacity;
+
+    shm_unlink(shm->name);
+    shm->fd = shm_open(shm->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (shm->fd == -1 || ftruncate(shm->fd, shm->mapLength) == -1) {
+        log_error("Unable to create shared memory %s: %s", shm->name, strerror(errno));
+        goto fail;
+    }
+    shm->region = mmap(NULL, shm->mapLength, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+    if (shm->region == MAP_FAILED) {
+        shm->region = NULL;
+        log_error("Unable to map shared memory %s: %s", shm->name, strerror(errno));
+        goto fail;
+    }
+
+    // ftruncate filled the region with zeros, so the rings start out empty
+    shm->region->capacity = ringCapacity;
+    shm->region->version = SHM_VERSION;
+    shm->region->pids[SERVER] = getpid();
+    shm->region->state = STATE_CONNECTED;
+    __atomic_store_n(&shm->region->magic, SHM_MAGIC, __ATOMIC_SEQ_CST);
+    attach(shm);
+    log_info("Listening on shared memory %s with %zu byte rings", shm->name, (size_t)ringCapacity);
+    return shm;
+
+fail:
+    if (shm->fd != -1) {
+        close(shm->fd);
+        shm_unlink(shm->name);
+    }
+    freeTransport(shm);
+    return NULL;
+}
+
+/*
+Description:
+    Waits for a client to connect (server side). The rings are reset for the new client first.
+Arguments:
+    ShmTransport *shm: The transport returned by shm_transport_listen
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int shm_transport_accept(ShmTransport *shm) {
+    Region *region = shm->region;
+
+    for (int i = 0; i < 2; i++) {
+        region->rings[i].head = 0;
+        region->rings[i].tail = 0;
+        region->sides[i].waitingForSpace = 0;
+        region->sides[i].closed = 0;
+    }
+    region->pids[CLIENT] = 0;
+    shm->stagedOffset = 0;
+    shm->stagedLength = 0;
+    shm->ring.head = 0;
+    shm->ring.tail = 0;
+    __atomic_store_n(&region->state, STATE_FREE, __ATOMIC_SEQ_CST);
+
+    int connected;
+    while ((connected = waitFor(shm, connectedReady)) == 0)
+        ;
+    if (connected == -1) {
+        log_info("Interrupted while waiting for a client on shared memory %s", shm->name);
+        return 1;
+    }
+    log_info("Client connected to shared memory %s", shm->name);
+    return 0;
+}
+
+/*
+Description:
+    Connects to the region a server created (client side). Waits up to a second for the server to
+    finish with a previous client.
+Arguments:
+    const char *name: The name of the region, with or without the leading slash
+Return value:
+    Returns the transport, or NULL on failure.
+*/
+ShmTransport *shm_transport_connect(const char *name) {
+    ShmTransport *shm = createTransport(name, CLIENT);
+    struct stat status;
+
+    if (shm == NULL)
+        return NULL;
+    shm->fd = shm_open(shm->name, O_RDWR, 0);
+    if (shm->fd == -1 || fstat(shm->fd, &status) == -1) {
+        log_error("Unable to open shared memory %s: %s", shm->name, strerror(errno));
+        goto fail;
+    }
+    shm->mapLength = status.st_size;
+    if (shm->mapLength < sizeof(Region)) {
+        log_error("Shared memory %s is not a transport", shm->name);
+        goto fail;
+    }
+    shm->region = mmap(NULL, shm->mapLength, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+    if (shm->region == MAP_FAILED) {
+        shm->region = NULL;
+        log_error("Unable to map shared memory %s: %s", shm->name, strerror(errno));
+        goto fail;
+    }
+    if (__atomic_load_n(&shm->region->magic, __ATOMIC_SEQ_CST) != SHM_MAGIC ||
+        shm->region->version != SHM_VERSION ||
+        shm->mapLength != sizeof(Region) + 2 * shm->region->capacity) {
+        log_error("Shared memory %s is not a transport this client understands", shm->name);
+        goto fail;
+    }
+    attach(shm);
+
+    // Gives the server a moment to finish with the previous client
+    uint32_t expected = STATE_FREE;
+    int retries = 0;
+    while (!__atomic_compare_exchange_n(&shm->region->state, &expected, STATE_CONNECTED, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        if (++retries > CONNECT_RETRIES || peerGone(shm)) {
+            log_error("Shared memory %s is busy with another client", shm->name);
+            goto fail;
+        }
+        struct timespec delay = {0, CONNECT_RETRY_NS};
+        nanosleep(&delay, NULL);
+        expected = STATE_FREE;
+    }
+    __atomic_store_n(&shm->region->pids[CLIENT], getpid(), __ATOMIC_RELAXED);
+    wakePeer(shm);
+    return shm;
+
+fail:
+    if (shm->fd != -1)
+        close(shm->fd);
+    freeTransport(shm);
+    return NULL;
+}
+
+/*
+Description:
+    Tells the other side that this side is done, then unmaps the region. A server also removes the
+    region's name. The file descriptor is not closed.
+Arguments:
+    ShmTransport *shm: The transport to close
+Return value:
+    None.
+*/
+void shm_transport_close(ShmTransport *shm) {
+    if (stagedPending(shm))
+        log_warn("Closing shared memory %s with %zu bytes unsent", shm->name,
+                 shm->stagedLength - shm->stagedOffset);
+    __atomic_store_n(&shm->self->closed, 1, __ATOMIC_SEQ_CST);
+    wakePeer(shm);
+    if (shm->side == SERVER)
+        shm_unlink(shm->name);
+    freeTransport(shm);
+}
+
+/*
+Description:
+    Returns the file descriptor of the shared memory region, which identifies the transport.
+Arguments:
+    ShmTransport *shm: The transport
+Return value:
+    The file descriptor.
+*/
+int shm_transport_fd(ShmTransport *shm) { return shm->fd; }
+
+/*
+Description:
+    Copies the bytes into the outgoing ring, staging whatever does not fit.
+Arguments:
+    ShmTransport *shm: The transport
+    const char *buf: The bytes to send
+    size_t length: The number of bytes to send
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int shm_transport_send(ShmTransport *shm, const char *buf, size_t length) {
+    if (__atomic_load_n(&shm->peer->closed, __ATOMIC_SEQ_CST)) {
+        log_error("The other side closed shared memory %s", shm->name);
+        return 1;
+    }
+
+    // Staged bytes go first so the stream stays in order
+    if (stagedPending(shm))
+        pushStaged(shm);
+    if (!stagedPending(shm)) {
+        size_t chunk = txSpace(shm);
+        if (chunk > length)
+            chunk = length;
+        if (chunk > 0)
+            copyOut(shm, buf, chunk);
+        buf += chunk;
+        length -= chunk;
+    }
+    return length > 0 ? stage(shm, buf, length) : 0;
+}
+
+static int flushReady(ShmTransport *shm) {
+    return txSpace(shm) > 0 || rxAvailable(shm) > 0 ||
+           __atomic_load_n(&shm->peer->closed, __ATOMIC_SEQ_CST);
+}
+
+/*
+Description:
+    Waits until every staged byte is in the outgoing ring. Data received meanwhile is kept in the
+    ring buffer returned by shm_transport_ring.
+Arguments:
+    ShmTransport *shm: The transport
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int shm_transport_flush(ShmTransport *shm) {
+    while (1) {
+        pushStaged(shm);
+        if (!stagedPending(shm))
+            return 0;
+        // Keeps reading so the other side is never stuck waiting for room for its responses
+        if (takeReceived(shm) == -1)
+            return 1;
+        int woken = 0;
+        if (!__atomic_load_n(&shm->peer->closed, __ATOMIC_SEQ_CST))
+            woken = waitFor(shm, flushReady);
+        if (woken == -1) {
+            log_error("Interrupted while flushing shared memory %s", shm->name);
+            return 1;
+        }
+        if (woken == 0 && peerGone(shm)) {
+            log_error("The other side closed shared memory %s", shm->name);
+            return 1;
+        }
+    }
+}
+
+/*
+Description:
+    Pushes staged bytes and waits until more data has been received into the ring buffer returned
+    by shm_transport_ring.
+Arguments:
+    ShmTransport *shm: The transport
+Return value:
+    Returns the number of bytes received, 0 if the other side closed, -1 on error.
+*/
+ssize_t shm_transport_recv(ShmTransport *shm) {
+    while (1) {
+        pushStaged(shm);
+        ssize_t received = takeReceived(shm);
+        if (received != 0)
+            return received;
+        // Only reported once everything the other side sent has been taken
+        if (__atomic_load_n(&shm->peer->closed, __ATOMIC_SEQ_CST))
+            return 0;
+        int woken = waitFor(shm, recvReady);
+        if (woken == -1)
+            return -1;
+        // A wait that timed out may mean the other side exited without closing
+        if (woken == 0 && peerGone(shm))
+            return 0;
+    }
+}
+
+/*
+Description:
+    Returns the buffer that received data is appended to.
+Arguments:
+    ShmTransport *shm: The transport
+Return value:
+    The receive ring buffer.
+*/
+RingBuffer *shm_transport_ring(ShmTransport *shm) { return &shm->ring; }
+
+/*
+Description:
+    Returns the number of futex system calls made so far.
+Arguments:
+    ShmTransport *shm: The transport
+Return value:
+    The number of system calls.
+*/
+unsigned long shm_transport_syscalls(ShmTransport *shm) { return shm->syscalls; }
@@ -0,0 +1,133 @@
+#ifndef SHM_TRANSPORT_H_
+#define SHM_TRANSPORT_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "ring_buffer.h"
+
+#define SHM_TRANSPORT_DEFAULT_CAPACITY (1 << 20)
+
+/*
+Shared-memory transport for a client and server on the same host. The server creates a named POSIX
+shared memory region (shm_open) holding two single-producer single-consumer byte rings, one for
+requests and one for responses, that carry the same v3 frames as a socket. Each side copies bytes
+straight into the other's ring, and only makes a system call to wake the other side up when it is
+asleep on its futex (or to sleep itself when there is nothing to do). One client is served at a
+time.
+
+Sends never block: bytes that do not fit in the ring are staged and pushed as space frees up during
+the next receive or flush, so a pipelining client cannot deadlock against a server that is waiting
+for its responses to be read. Received data is appended to a RingBuffer for parsing.
+*/
+typedef struct ShmTransport ShmTransport;
+
+/*
+Description:
+    Creates the shared memory region and waits for clients (server side). A region left behind with
+    the same name is replaced.
+Arguments:
+    const char *name: The name of the region, with or without the leading slash
+    size_t capacity: The size of each ring in bytes, rounded up to a power of two
+Return value:
+    Returns the transport, or NULL on failure.
+*/
+ShmTransport *shm_transport_listen(const char *name, size_t capacity);
+
+/*
+Description:
+    Waits for a client to connect (server side). The rings are reset for the new client first.
+Arguments:
+    ShmTransport *shm: The transport returned by shm_transport_listen
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int shm_transport_accept(ShmTransport *shm);
+
+/*
+Description:
+    Connects to the region a server created (client side). Waits up to a second for the server to
+    finish with a previous client.
+Arguments:
+    const char *name: The name of the region, with or without the leading slash
+Return value:
+    Returns the transport, or NULL on failure.
+*/
+ShmTransport *shm_transport_connect(const char *name);
+
+/*
+Description:
+    Tells the other side that this side is done, then unmaps the region. A server also removes the
+    region's name. The file descriptor is not closed.
+Arguments:
+    ShmTransport *shm: The transport to close
+Return value:
+    None.
+*/
+void shm_transport_close(ShmTransport *shm);
+
+/*
+Description:
+    Returns the file descriptor of the shared memory region, which identifies the transport.
+Arguments:
+    ShmTransport *shm: The transport
+Return value:
+    The file descriptor.
+*/
+int shm_transport_fd(ShmTransport *shm);
+
+/*
+Description:
+    Copies the bytes into the outgoing ring, staging whatever does not fit.
+Arguments:
+    ShmTransport *shm: The transport
+    const char *buf: The bytes to send
+    size_t length: The number of bytes to send
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int shm_transport_send(ShmTransport *shm, const char *buf, size_t length);
+
+/*
+Description:
+    Waits until every staged byte is in the outgoing ring. Data received meanwhile is kept in the
+    ring buffer returned by shm_transport_ring.
+Arguments:
+    ShmTransport *shm: The transport
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int shm_transport_flush(ShmTransport *shm);
+
+/*
+Description:
+    Pushes staged bytes and waits until more data has been received into the ring buffer returned
+    by shm_transport_ring.
+Arguments:
+    ShmTransport *shm: The transport
+Return value:
+    Returns the number of bytes received, 0 if the other side closed, -1 on error.
+*/
+ssize_t shm_transport_recv(ShmTransport *shm);
+
+/*
+Description:
+    Returns the buffer that received data is appended to.
+Arguments:
+    ShmTransport *shm: The transport
+Return value:
+    The receive ring buffer.
+*/
+RingBuffer *shm_transport_ring(ShmTransport *shm);
+
+/*
+Description:
+    Returns the number of futex system calls made so far.
+Arguments:
+    ShmTransport *shm: The transport
+Return value:
+    The number of system calls.
+*/
+unsigned long shm_transport_syscalls(ShmTransport *shm);
+
+#endif
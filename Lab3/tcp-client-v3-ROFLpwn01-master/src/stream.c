@@ -0,0 +1,248 @@
+#include "stream.h"
+#include "input_reader.h"
+#include "log.h"
+
+#include <endian.h>
+
+/*
+Description:
+    Receives exactly length bytes.
+Arguments:
+    int sockfd: Socket file descriptor
+    char *buf: The buffer to fill
+    size_t length: The number of bytes to receive
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int recvExactly(int sockfd, char *buf, size_t length) {
+    while (length > 0) {
+        ssize_t bytesReceived = recv(sockfd, buf, length, 0);
+        if (bytesReceived == -1 && errno == EINTR)
+            continue;
+        if (bytesReceived <= 0) {
+            log_error("Error receiving data: %s",
+                      bytesReceived == 0 ? "connection closed" : strerror(errno));
+            return 1;
+        }
+        buf += bytesReceived;
+        length -= bytesReceived;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Sends the writer's held back header, if any, followed by data, with one system call.
+Arguments:
+    StreamWriter *writer: The writer
+    const char *data: The bytes that follow the header
+    size_t length: The number of bytes
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int sendWithHeader(StreamWriter *writer, const char *data, size_t length) {
+    struct iovec iov[2] = {{writer->header, writer->headerLength}, {(char *)data, length}};
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 2};
+
+    writer->headerLength = 0;
+    while (iov[0].iov_len + iov[1].iov_len > 0) {
+        ssize_t bytesSent = sendmsg(writer->sockfd, &msg, MSG_NOSIGNAL);
+        if (bytesSent == -1) {
+            if (errno == EINTR)
+                continue;
+            log_error("Error with sending: %s", strerror(errno));
+            return 1;
+        }
+        for (int i = 0; i < 2; i++) {
+            size_t used = (size_t)bytesSent < iov[i].iov_len ? (size_t)bytesSent : iov[i].iov_len;
+            iov[i].iov_base = (char *)iov[i].iov_base + used;
+            iov[i].iov_len -= used;
+            bytesSent -= used;
+        }
+    }
+    return 0;
+}
+
+/*
+Description:
+    Starts a request whose message will follow in chunks, corking the socket with tcp_client_cork
+    until the request ends.
+Arguments:
+    StreamWriter *writer: The writer
+    uint32_t action: The action code
+    uint64_t length: The length of the whole message
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int stream_send_begin(StreamWriter *writer, uint32_t action, uint64_t length) {
+    if (length <= TCP_CLIENT_MAX_MESSAGE_LENGTH) {
+        uint32_t header = htonl(action << 27 | (uint32_t)length);
+        memcpy(writer->header, &header, sizeof(header));
+        writer->headerLength = TCP_CLIENT_REQUEST_HEADER_SIZE;
+    } else if (writer->extended) {
+        uint32_t header = htonl(STREAM_EXTENDED_ACTION << 27 | action);
+        uint64_t extendedLength = htobe64(length);
+        memcpy(writer->header, &header, sizeof(header));
+        memcpy(writer->header + sizeof(header), &extendedLength, sizeof(extendedLength));
+        writer->headerLength = STREAM_EXTENDED_HEADER_SIZE;
+    } else {
+        log_error("A %llu byte message needs extended frames, which the server did not accept",
+                  (unsigned long long)length);
+        return 1;
+    }
+    writer->remaining = length;
+    return tcp_client_cork(writer->sockfd, writer->profile);
+}
+
+/*
+Description:
+    Sends the next piece of the message.
+Arguments:
+    StreamWriter *writer: The writer
+    const char *data: The piece
+    size_t length: The length of the piece
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int stream_send_chunk(StreamWriter *writer, const char *data, size_t length) {
+    if (length > writer->remaining) {
+        log_error("The message is longer than its header said");
+        return 1;
+    }
+    writer->remaining -= length;
+    return sendWithHeader(writer, data, length);
+}
+
+/*
+Description:
+    Finishes a request, checking that the whole message was sent, sending the header of an empty
+    one and pushing the request out with tcp_client_push.
+Arguments:
+    StreamWriter *writer: The writer
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int stream_send_end(StreamWriter *writer) {
+    if (writer->remaining > 0) {
+        log_error("The message ended %llu bytes short of its header",
+                  (unsigned long long)writer->remaining);
+        return 1;
+    }
+    if (writer->headerLength > 0 && sendWithHeader(writer, NULL, 0))
+        return 1;
+    return tcp_client_push(writer->sockfd, writer->profile);
+}
+
+/*
+Description:
+    Receives one response, handing it to the handler chunk by chunk as it arrives.
+Arguments:
+    int sockfd: Socket file descriptor of a plain socket
+    int extended: Whether the server may send extended responses
+    const StreamHandler *handler: The callbacks
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int stream_receive(int sockfd, int extended, const StreamHandler *handler) {
+    char buf[STREAM_CHUNK_SIZE];
+    uint32_t header;
+    uint64_t length;
+
+    if (recvExactly(sockfd, (char *)&header, sizeof(header)))
+        return 1;
+    header = ntohl(header);
+    if (extended && header == STREAM_EXTENDED_RESPONSE) {
+        if (recvExactly(sockfd, (char *)&length, sizeof(length)))
+            return 1;
+        length = be64toh(length);
+    } else {
+        length = header;
+    }
+
+    if (handler->begin(length, handler->context))
+        return 1;
+    while (length > 0) {
+        size_t wanted = length < sizeof(buf) ? length : sizeof(buf);
+        ssize_t bytesReceived = recv(sockfd, buf, wanted, 0);
+        if (bytesReceived == -1 && errno == EINTR)
+            continue;
+        if (bytesReceived <= 0) {
+            log_error("Error receiving data: %s",
+                      bytesReceived == 0 ? "connection closed" : strerror(errno));
+            return 1;
+        }
+        if (handler->chunk(buf, bytesReceived, handler->context))
+            return 1;
+        length -= bytesReceived;
+    }
+    return handler->end(handler->context);
+}
+
+/*
+Description:
+    Sends every line of the file as a streamed request and streams its response to the handler
+    before sending the next one. Extended frames are negotiated first; if the server does not take
+    them, or drops the connection on the hello, ordinary-length lines are still sent and only the
+    lines that need extended frames are skipped, failing the run. Responses go to the handler
+    rather than to the session's own, which only gets whole responses; the session counts both
+    directions.
+Arguments:
+    TcpClientSession *session: The session, connected with a plain socket
+    FILE *fd: The file pointer to read requests from
+    const StreamHandler *handler: The callbacks for each response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int stream_run(TcpClientSession *session, FILE *fd, const StreamHandler *handler) {
+    int sockfd = session->sockfd;
+    char accepted[TCP_CLIENT_MAX_HELLO];
+    StreamWriter writer = {.sockfd = sockfd, .profile = session->profile};
+    InputReader reader;
+    InputLine line;
+    int skipped = 0;
+    int found;
+
+    if (tcp_client_session_hello(session, STREAM_FEATURE, accepted, sizeof(accepted)))
+        return 1;
+    writer.extended = tcp_client_has_feature(accepted, STREAM_FEATURE);
+    if (!writer.extended)
+        log_warn("The server does not accept extended frames");
+    if (input_reader_open(&reader, fd))
+        return 1;
+
+    while ((found = input_reader_next(&reader, &line)) == 1) {
+        uint32_t header;
+        if (tcp_client_encode_header(line.action, line.actionLength, 0, &header)) {
+            log_error("Invalid action received, skipping line: %.*s", (int)line.actionLength,
+                      line.action);
+            continue;
+        }
+        if (!writer.extended && line.messageLength > TCP_CLIENT_MAX_MESSAGE_LENGTH) {
+            log_error("Skipping a %zu byte message, it needs extended frames", line.messageLength);
+            skipped = 1;
+            continue;
+        }
+
+        // Sent straight from the reader's memory, a chunk at a time
+        if (stream_send_begin(&writer, ntohl(header) >> 27, line.messageLength))
+            break;
+        size_t offset = 0;
+        while (offset < line.messageLength) {
+            size_t length = line.messageLength - offset;
+            if (length > STREAM_CHUNK_SIZE)
+                length = STREAM_CHUNK_SIZE;
+            if (stream_send_chunk(&writer, line.message + offset, length))
+                break;
+            offset += length;
+        }
+        if (stream_send_end(&writer))
+            break;
+        session->messagesSent++;
+
+        if (stream_receive(sockfd, writer.extended, handler))
+            break;
+        session->messagesReceived++;
+    }
+    input_reader_close(&reader);
+    return found != 0 || skipped;
+}
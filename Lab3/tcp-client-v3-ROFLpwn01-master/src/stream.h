@@ -0,0 +1,119 @@
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tcp_client.h"
+
+#define STREAM_FEATURE "extended"
+#define STREAM_EXTENDED_ACTION 30
+#define STREAM_EXTENDED_RESPONSE 0x40000000u
+#define STREAM_EXTENDED_HEADER_SIZE 12
+#define STREAM_CHUNK_SIZE 65536
+
+/*
+Streaming of messages too large to buffer. Frames are sent and received in chunks of at most
+STREAM_CHUNK_SIZE bytes, so memory use does not depend on the size of a message.
+
+Messages longer than the 27-bit length field holds use extended frames, which are turned on per
+connection with tcp_client_hello("extended"):
+
+    request:  STREAM_EXTENDED_ACTION << 27 | action, 64-bit length, message
+    response: STREAM_EXTENDED_RESPONSE, 64-bit length, response
+
+Lengths are in network byte order. Shorter messages keep the ordinary v3 frames.
+*/
+
+/*
+Called with a response as it arrives: begin once with its length, chunk for each piece in order,
+and end once it is complete. Each returns 0 on success, nonzero to stop.
+*/
+typedef struct StreamHandler {
+    int (*begin)(uint64_t length, void *context);
+    int (*chunk)(const char *data, size_t length, void *context);
+    int (*end)(void *context);
+    void *context;
+} StreamHandler;
+
+/*
+A request being sent. extended is set when the server accepted extended frames, and profile is the
+socket's profile, for tcp_client_cork. The header is held back and sent with the first chunk, so a
+short request does not go out as two packets.
+*/
+typedef struct StreamWriter {
+    int sockfd;
+    int profile;
+    int extended;
+    uint64_t remaining;
+    char header[STREAM_EXTENDED_HEADER_SIZE];
+    size_t headerLength;
+} StreamWriter;
+
+/*
+Description:
+    Starts a request whose message will follow in chunks, corking the socket with tcp_client_cork
+    until the request ends.
+Arguments:
+    StreamWriter *writer: The writer
+    uint32_t action: The action code
+    uint64_t length: The length of the whole message
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int stream_send_begin(StreamWriter *writer, uint32_t action, uint64_t length);
+
+/*
+Description:
+    Sends the next piece of the message.
+Arguments:
+    StreamWriter *writer: The writer
+    const char *data: The piece
+    size_t length: The length of the piece
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int stream_send_chunk(StreamWriter *writer, const char *data, size_t length);
+
+/*
+Description:
+    Finishes a request, checking that the whole message was sent, sending the header of an empty
+    one and pushing the request out with tcp_client_push.
+Arguments:
+    StreamWriter *writer: The writer
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int stream_send_end(StreamWriter *writer);
+
+/*
+Description:
+    Receives one response, handing it to the handler chunk by chunk as it arrives.
+Arguments:
+    int sockfd: Socket file descriptor of a plain socket
+    int extended: Whether the server may send extended responses
+    const StreamHandler *handler: The callbacks
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int stream_receive(int sockfd, int extended, const StreamHandler *handler);
+
+/*
+Description:
+    Sends every line of the file as a streamed request and streams its response to the handler
+    before sending the next one. Extended frames are negotiated first; if the server does not take
+    them, or drops the connection on the hello, ordinary-length lines are still sent and only the
+    lines that need extended frames are skipped, failing the run. Responses go to the handler
+    rather than to the session's own, which only gets whole responses; the session counts both
+    directions.
+Arguments:
+    TcpClientSession *session: The session, connected with a plain socket
+    FILE *fd: The file pointer to read requests from
+    const StreamHandler *handler: The callbacks for each response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int stream_run(TcpClientSession *session, FILE *fd, const StreamHandler *handler);
+
+#endif
@@ -1,6 +1,16 @@
 #include "tcp_client.h"
+#include "fanout.h"
+#include "input_reader.h"
+#include "loadgen.h"
 #include "log.h"
+#include "resolver.h"
+#include "ring_buffer.h"
+#include "send_batch.h"
+#include "shm_transport.h"
+#include "uring.h"
 #include <ctype.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
 
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -8,8 +18,6 @@
 #define ARG_ERROR 1
 #define MAX_PORT_NUMBER 65535
 #define ARGUMENTS 2
-#define LINE_ASCII_LIMIT 1024
-#define BUFFER_SIZE 500
 #define ACTION_LENGTH_BYTES 4
 
 #define UPPERCASE 0x01
@@ -18,6 +26,8 @@
 #define SHUFFLE 0x08
 #define RANDOM 0x10
 
+#define CONNECT_ATTEMPT_DELAY_MS 250
+
 /*
 Description:
     Prints the info menu.
@@ -35,8 +45,33 @@ void printInfoMenu() {
                     "Options:\n"
                     "  --help\n"
                     "  -v, --verbose\n"
-                    "  --host HOSTNAME, -h HOSTNAME\n"
-                    "  --port PORT, -p PORT\n");
+                    "  --host HOSTNAME, -h HOSTNAME   (unix:PATH for a Unix socket,\n"
+                    "                                 shm:NAME for shared memory)\n"
+                    "  --port PORT, -p PORT\n"
+                    "  --pipeline, -P\n"
+                    "  --max-in-flight COUNT, -m COUNT\n"
+                    "  --connections COUNT, -c COUNT\n"
+                    "  --pin-cpus\n"
+                    "  --io-uring\n"
+                    "  --batch-count COUNT\n"
+                    "  --batch-bytes BYTES\n"
+                    "  --batch-delay USEC\n"
+                    "  --async-log\n"
+                    "  --rate RATE, -R RATE\n"
+                    "  --duration SECONDS, -d SECONDS\n"
+                    "  --compile FRAMES\n"
+                    "  --replay\n"
+                    "  --v4\n"
+                    "  --ordered\n"
+                    "  --batch-frames\n"
+                    "  --stream\n"
+                    "  --no-dns-cache\n"
+                    "  --fast-open\n"
+                    "  --profile latency|throughput\n"
+                    "  --hedge PERCENTILE\n"
+                    "  --hedge-host HOSTNAME\n"
+                    "  --endpoints HOST:PORT,...\n"
+                    "  --balance least|ewma\n");
 }
 
 /*
@@ -61,9 +96,33 @@ int tcp_client_parse_arguments(int argc, char *argv[], Config *config) {
                                                {"port", required_argument, 0, 'p'},
                                                {"host", required_argument, 0, 'h'},
                                                {"verbose", no_argument, 0, 'v'},
+                                               {"pipeline", no_argument, 0, 'P'},
+                                               {"max-in-flight", required_argument, 0, 'm'},
+                                               {"connections", required_argument, 0, 'c'},
+                                               {"pin-cpus", no_argument, 0, 'C'},
+                                               {"io-uring", no_argument, 0, 'U'},
+                                               {"batch-count", required_argument, 0, 'F'},
+                                               {"batch-bytes", required_argument, 0, 'Y'},
+                                               {"batch-delay", required_argument, 0, 'D'},
+                                               {"async-log", no_argument, 0, 'L'},
+                                               {"rate", required_argument, 0, 'R'},
+                                               {"duration", required_argument, 0, 'd'},
+                                               {"compile", required_argument, 0, 'O'},
+                                               {"replay", no_argument, 0, 'X'},
+                                               {"v4", no_argument, 0, '4'},
+                                               {"ordered", no_argument, 0, 'o'},
+                                               {"batch-frames", no_argument, 0, 'B'},
+                                               {"stream", no_argument, 0, 'S'},
+                                               {"no-dns-cache", no_argument, 0, 'N'},
+                                               {"fast-open", no_argument, 0, 'T'},
+                                               {"profile", required_argument, 0, 'Q'},
+                                               {"hedge", required_argument, 0, 'E'},
+                                               {"hedge-host", required_argument, 0, 'G'},
+                                               {"endpoints", required_argument, 0, 'A'},
+                                               {"balance", required_argument, 0, 'W'},
                                                {0, 0, 0, 0}};
 
-        opt = getopt_long(argc, argv, ":vp:h:", long_options, &option_index);
+        opt = getopt_long(argc, argv, ":vp:h:Pm:c:R:d:", long_options, &option_index);
         if (opt == -1)
             break;
 
@@ -97,6 +156,162 @@ int tcp_client_parse_arguments(int argc, char *argv[], Config *config) {
             config->port = optarg;
             portSet = 1;
             break;
+        case 'P':
+            config->pipeline = 1;
+            break;
+        case 'm':
+            for (int i = 0; optarg[i] != 0; i++) {
+                if (!isdigit(optarg[i])) {
+                    log_error("Incorrect in-flight count");
+                    printInfoMenu();
+                    return ARG_ERROR;
+                }
+            }
+            if (atoi(optarg) < 1) {
+                log_error("In-flight count must be at least 1");
+                printInfoMenu();
+                return ARG_ERROR;
+            }
+            config->maxInFlight = atoi(optarg);
+            config->pipeline = 1;
+            break;
+        case 'c':
+            for (int i = 0; optarg[i] != 0; i++) {
+                if (!isdigit(optarg[i])) {
+                    log_error("Incorrect connection count");
+                    printInfoMenu();
+                    return ARG_ERROR;
+                }
+            }
+            if (atoi(optarg) < 1 || atoi(optarg) > FANOUT_MAX_CONNECTIONS) {
+                log_error("Connection count must be between 1 and %d", FANOUT_MAX_CONNECTIONS);
+                printInfoMenu();
+                return ARG_ERROR;
+            }
+            config->connections = atoi(optarg);
+            config->pipeline = 1;
+            break;
+        case 'C':
+            config->pinCpus = 1;
+            break;
+        case 'U':
+            config->ioUring = TCP_CLIENT_URING_MULTISHOT;
+            break;
+        case 'O':
+            config->compile = optarg;
+            break;
+        case 'X':
+            config->replay = 1;
+            break;
+        case '4':
+            config->v4 = 1;
+            config->pipeline = 1;
+            break;
+        case 'o':
+            config->ordered = 1;
+            break;
+        case 'B':
+            config->batchEnvelope = 1;
+            config->pipeline = 1;
+            break;
+        case 'S':
+            config->stream = 1;
+            break;
+        case 'N':
+            config->noDnsCache = 1;
+            break;
+        case 'T':
+            config->fastOpen = 1;
+            break;
+        case 'Q':
+            if (strcmp(optarg, "latency") == 0) {
+                config->profile = TCP_CLIENT_PROFILE_LATENCY;
+            } else if (strcmp(optarg, "throughput") == 0) {
+                config->profile = TCP_CLIENT_PROFILE_THROUGHPUT;
+            } else {
+                log_error("The profile must be latency or throughput");
+                printInfoMenu();
+                return ARG_ERROR;
+            }
+            break;
+        case 'E':
+            for (int i = 0; optarg[i] != 0; i++) {
+                if (!isdigit(optarg[i])) {
+                    log_error("Incorrect hedge percentile");
+                    printInfoMenu();
+                    return ARG_ERROR;
+                }
+            }
+            if (atoi(optarg) < 1 || atoi(optarg) > 99) {
+                log_error("The hedge percentile must be between 1 and 99");
+                printInfoMenu();
+                return ARG_ERROR;
+            }
+            config->hedgePercentile = atoi(optarg);
+            break;
+        case 'G':
+            config->hedgeHost = optarg;
+            break;
+        case 'A':
+            config->endpoints = optarg;
+            break;
+        case 'W':
+            if (strcmp(optarg, "least") == 0) {
+                config->balance = TCP_CLIENT_BALANCE_LEAST;
+            } else if (strcmp(optarg, "ewma") == 0) {
+                config->balance = TCP_CLIENT_BALANCE_EWMA;
+            } else {
+                log_error("The balancing policy must be least or ewma");
+                printInfoMenu();
+                return ARG_ERROR;
+            }
+            break;
+        case 'L':
+            // Moves formatting and writing of log records off the calling threads
+            if (log_start_async(LOG_ASYNC_DEFAULT_RECORDS))
+                log_warn("Unable to start asynchronous logging");
+            break;
+        case 'R':
+        case 'd':
+            for (int i = 0; optarg[i] != 0; i++) {
+                if (!isdigit(optarg[i])) {
+                    log_error("Incorrect %s", opt == 'R' ? "rate" : "duration");
+                    printInfoMenu();
+                    return ARG_ERROR;
+                }
+            }
+            if (atoi(optarg) < 1) {
+                log_error("The %s must be at least 1", opt == 'R' ? "rate" : "duration");
+                printInfoMenu();
+                return ARG_ERROR;
+            }
+            if (opt == 'R')
+                config->rate = atoi(optarg);
+            else
+                config->duration = atoi(optarg);
+            break;
+        case 'F':
+        case 'Y':
+        case 'D':
+            for (int i = 0; optarg[i] != 0; i++) {
+                if (!isdigit(optarg[i])) {
+                    log_error("Incorrect batch limit");
+                    printInfoMenu();
+                    return ARG_ERROR;
+                }
+            }
+            if (opt != 'D' && atoi(optarg) < 1) {
+                log_error("Batch limits must be at least 1");
+                printInfoMenu();
+                return ARG_ERROR;
+            }
+            if (opt == 'F')
+                config->batchFrames = atoi(optarg);
+            else if (opt == 'Y')
+                config->batchBytes = atoi(optarg);
+            else
+                config->batchDelayUs = atoi(optarg);
+            break;
 
         case ':': // Missing option argument
             log_error("Missing option argument\n\n");
@@ -132,6 +347,18 @@ int tcp_client_parse_arguments(int argc, char *argv[], Config *config) {
         config->port = TCP_CLIENT_DEFAULT_PORT;
     if (hostSet == 0)
         config->host = TCP_CLIENT_DEFAULT_HOST;
+    if (config->maxInFlight == 0)
+        config->maxInFlight = TCP_CLIENT_DEFAULT_MAX_IN_FLIGHT;
+    if (config->connections == 0)
+        config->connections = 1;
+    if (config->batchFrames == 0)
+        config->batchFrames = SEND_BATCH_DEFAULT_FRAMES;
+    if (config->batchBytes == 0)
+        config->batchBytes = SEND_BATCH_DEFAULT_BYTES;
+    if (config->batchDelayUs == 0)
+        config->batchDelayUs = SEND_BATCH_DEFAULT_DELAY_US;
+    if (config->duration == 0)
+        config->duration = LOADGEN_DEFAULT_DURATION;
 
     return 0;
 }
@@ -142,249 +369,1621 @@ int tcp_client_parse_arguments(int argc, char *argv[], Config *config) {
 
 /*
 Description:
-    Creates a TCP socket and connects it to the specified host and port.
+    Connects a stream socket to a Unix socket path.
 Arguments:
-    Config config: A config struct with the necessary information.
+    const char *path: The path of the server's socket
 Return value:
     Returns the socket file descriptor or -1 if an error occurs.
 */
-int tcp_client_connect(Config config) {
-
-    struct addrinfo hints, *res;
+static int connectUnix(const char *path) {
+    struct sockaddr_un address;
     int sockfd;
 
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_UNSPEC;     // IPv4 or IPv6
-    hints.ai_socktype = SOCK_STREAM; // TCP
-    hints.ai_flags = AI_PASSIVE;     // Gets IP
-
-    int returnValue;
-    if ((returnValue = getaddrinfo(config.host, config.port, &hints, &res)) != 0) {
-        log_error("getaddrinfo failed. %s\n", gai_strerror(returnValue));
-        return 1;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        log_error("Unix socket path is too long: %s", path);
+        return TCP_CLIENT_BAD_SOCKET;
     }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
 
-    log_info("Creating socket...");
-    if ((sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) ==
-        TCP_CLIENT_BAD_SOCKET) {
+    log_info("Creating Unix socket...");
+    if ((sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) == TCP_CLIENT_BAD_SOCKET) {
         log_error("client: socket failed to create");
         return TCP_CLIENT_BAD_SOCKET;
     }
 
-    log_info("Connecting socket...");
-    if (connect(sockfd, res->ai_addr, res->ai_addrlen) == TCP_CLIENT_BAD_SOCKET) {
+    log_info("Connecting socket to %s...", path);
+    if (connect(sockfd, (struct sockaddr *)&address, sizeof(address)) == TCP_CLIENT_BAD_SOCKET) {
         close(sockfd);
         log_error("client: failed to connect");
         return TCP_CLIENT_BAD_SOCKET;
     }
+    return sockfd;
+}
 
-    if (res == NULL) {
-        log_error("client: failed to connect");
-        return TCP_CLIENT_BAD_SOCKET;
+/*
+Description:
+    Connects a session to a server's shared memory region. The region's file descriptor stands in
+    for the session's socket.
+Arguments:
+    TcpClientSession *session: The session
+    const char *name: The name of the region
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int connectShm(TcpClientSession *session, const char *name) {
+    log_info("Connecting to shared memory %s...", name);
+    session->shm = shm_transport_connect(name);
+    if (session->shm == NULL)
+        return 1;
+    session->sockfd = shm_transport_fd(session->shm);
+    return 0;
+}
+
+/*
+Description:
+    Puts addresses in Happy Eyeballs order: the families take turns, starting with the family of
+    the first address, and each family keeps the order getaddrinfo gave it.
+Arguments:
+    ResolvedAddress *addresses: The addresses
+    size_t count: The number of addresses
+Return value:
+    None.
+*/
+static void interleaveFamilies(ResolvedAddress *addresses, size_t count) {
+    ResolvedAddress ordered[RESOLVER_MAX_ADDRESSES];
+    int used[RESOLVER_MAX_ADDRESSES] = {0};
+    int family = addresses[0].family;
+
+    for (size_t taken = 0; taken < count; taken++) {
+        size_t pick = count;
+        for (size_t i = 0; i < count && pick == count; i++) {
+            if (!used[i] && addresses[i].family == family)
+                pick = i;
+        }
+        for (size_t i = 0; i < count && pick == count; i++) {
+            if (!used[i])
+                pick = i;
+        }
+        used[pick] = 1;
+        ordered[taken] = addresses[pick];
+        family = addresses[pick].family == AF_INET6 ? AF_INET : AF_INET6;
     }
-    freeaddrinfo(res);
+    memcpy(addresses, ordered, count * sizeof(ResolvedAddress));
+}
 
-    log_info("Returning sockfd...");
-    return sockfd;
+/*
+Description:
+    Formats an address for log messages.
+Arguments:
+    const ResolvedAddress *address: The address
+    char *buf: Filled in with the address
+    size_t size: The size of buf
+Return value:
+    buf
+*/
+static const char *describeAddress(const ResolvedAddress *address, char *buf, size_t size) {
+    if (getnameinfo((const struct sockaddr *)&address->address, address->length, buf, size, NULL, 0,
+                    NI_NUMERICHOST) != 0)
+        snprintf(buf, size, "an address of family %d", address->family);
+    return buf;
 }
 
 /*
 Description:
-    Creates and sends request to server using the socket and configuration.
+    Sets the socket options of a profile on a TCP socket before it connects: the window scale is
+    agreed in the handshake from the receive buffer size, so the buffers have to be sized before
+    the SYN goes out. An option the kernel refuses is logged and skipped, since the connection
+    works without it.
 Arguments:
     int sockfd: Socket file descriptor
+    int profile: The profile, one of the TCP_CLIENT_PROFILE_ values
+Return value:
+    None.
+*/
+static void applyProfile(int sockfd, int profile) {
+    int one = 1;
+    int busyPoll = TCP_CLIENT_BUSY_POLL_US;
+    int buffer = TCP_CLIENT_THROUGHPUT_BUFFER_BYTES;
+
+    if (profile == TCP_CLIENT_PROFILE_LATENCY) {
+        if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1)
+            log_warn("Unable to set TCP_NODELAY: %s", strerror(errno));
+        if (setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &busyPoll, sizeof(busyPoll)) == -1)
+            log_warn("Unable to set SO_BUSY_POLL: %s", strerror(errno));
+    } else if (profile == TCP_CLIENT_PROFILE_THROUGHPUT) {
+        if (setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer)) == -1 ||
+            setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer)) == -1)
+            log_warn("Unable to size the socket buffers: %s", strerror(errno));
+    }
+}
+
+/*
+Description:
+    Connects to the first of the addresses that answers, Happy Eyeballs style: an attempt is
+    started on the next address whenever CONNECT_ATTEMPT_DELAY_MS pass without one succeeding, or
+    right away when one fails, and earlier attempts keep going meanwhile. The first to connect is
+    kept and the others are closed. With fastOpen, a connect to a server whose Fast Open cookie is
+    known returns at once and the handshake is left to the first write, which carries the data in
+    the SYN; an unreachable server then only shows up as an error on that write. Every attempt is
+    tuned for the profile before it connects.
+Arguments:
+    const ResolvedAddress *addresses: The addresses in the order to try them
+    size_t count: The number of addresses
+    int fastOpen: Whether to use TCP Fast Open
+    int profile: The profile, one of the TCP_CLIENT_PROFILE_ values
+Return value:
+    Returns the socket file descriptor or -1 if no address could be connected to.
+*/
+static int connectFirst(const ResolvedAddress *addresses, size_t count, int fastOpen,
+                        int profile) {
+    struct pollfd attempts[RESOLVER_MAX_ADDRESSES];
+    size_t addressOf[RESOLVER_MAX_ADDRESSES];
+    char name[INET6_ADDRSTRLEN];
+    size_t started = 0;
+    size_t pending = 0;
+    int sockfd = TCP_CLIENT_BAD_SOCKET;
+
+    while (sockfd == TCP_CLIENT_BAD_SOCKET && (started < count || pending > 0)) {
+        if (started < count) {
+            const ResolvedAddress *address = &addresses[started++];
+            log_info("Connecting socket to %s...", describeAddress(address, name, sizeof(name)));
+            int fd = socket(address->family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            if (fd == TCP_CLIENT_BAD_SOCKET) {
+                log_info("client: socket failed to create: %s", strerror(errno));
+                continue;
+            }
+            int one = 1;
+            if (fastOpen &&
+                setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one, sizeof(one)) == -1)
+                log_warn("TCP Fast Open is not available: %s", strerror(errno));
+            applyProfile(fd, profile);
+            if (connect(fd, (const struct sockaddr *)&address->address, address->length) == 0) {
+                sockfd = fd;
+                break;
+            }
+            if (errno != EINPROGRESS) {
+                log_info("Connecting to %s failed: %s", name, strerror(errno));
+                close(fd);
+                continue;
+            }
+            attempts[pending].fd = fd;
+            attempts[pending].events = POLLOUT;
+            addressOf[pending++] = started - 1;
+        }
+        if (pending == 0)
+            continue;
+
+        int ready = poll(attempts, pending, started < count ? CONNECT_ATTEMPT_DELAY_MS : -1);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            log_error("poll failed: %s", strerror(errno));
+            break;
+        }
+        for (size_t i = 0; i < pending;) {
+            if (attempts[i].revents == 0) {
+                i++;
+                continue;
+            }
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1)
+                error = errno;
+            if (error == 0 && sockfd == TCP_CLIENT_BAD_SOCKET) {
+                sockfd = attempts[i].fd;
+            } else {
+                log_info("Connecting to %s failed: %s",
+                         describeAddress(&addresses[addressOf[i]], name, sizeof(name)),
+                         strerror(error));
+                close(attempts[i].fd);
+            }
+            pending--;
+            attempts[i] = attempts[pending];
+            addressOf[i] = addressOf[pending];
+        }
+    }
+
+    // Attempts still under way lost the race
+    for (size_t i = 0; i < pending; i++)
+        close(attempts[i].fd);
+    if (sockfd != TCP_CLIENT_BAD_SOCKET &&
+        fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) & ~O_NONBLOCK) == -1) {
+        close(sockfd);
+        return TCP_CLIENT_BAD_SOCKET;
+    }
+    return sockfd;
+}
+
+/*
+Description:
+    Resolves the host and port, through the on-disk cache unless config.noDnsCache is set, and
+    connects a TCP socket to the first address that answers. If every cached address fails the
+    name is resolved again once, in case the cache is stale.
+Arguments:
     Config config: A config struct with the necessary information.
 Return value:
-    Returns a 1 on failure, 0 on success
+    Returns the socket file descriptor or -1 if an error occurs.
 */
-int tcp_client_send_request(int sockfd, char *action, char *message) {
+static int connectTcp(Config config) {
+    ResolvedAddress addresses[RESOLVER_MAX_ADDRESSES];
+    size_t count;
+    int cached;
 
-    uint32_t binaryMessage;
-
-    if (strcmp("uppercase", action) == 0) {
-        binaryMessage = UPPERCASE;
-    } else if (strcmp("lowercase", action) == 0) {
-        binaryMessage = LOWERCASE;
-    } else if (strcmp("reverse", action) == 0) {
-        binaryMessage = REVERSE;
-    } else if (strcmp("shuffle", action) == 0) {
-        binaryMessage = SHUFFLE;
-    } else if (strcmp("random", action) == 0) {
-        binaryMessage = RANDOM;
-    } else {
-        log_error("Invalid action received.\n");
+    if (resolver_lookup(config.host, config.port, !config.noDnsCache, addresses, &count, &cached))
+        return TCP_CLIENT_BAD_SOCKET;
+    interleaveFamilies(addresses, count);
+    int sockfd = connectFirst(addresses, count, config.fastOpen, config.profile);
+
+    if (sockfd == TCP_CLIENT_BAD_SOCKET && cached) {
+        log_info("No cached address for %s answered, resolving it again", config.host);
+        resolver_forget(config.host, config.port);
+        if (resolver_lookup(config.host, config.port, 1, addresses, &count, &cached))
+            return TCP_CLIENT_BAD_SOCKET;
+        interleaveFamilies(addresses, count);
+        sockfd = connectFirst(addresses, count, config.fastOpen, config.profile);
     }
-    binaryMessage = binaryMessage << 27;
-    binaryMessage = binaryMessage | ((uint32_t)strlen(message));
+    if (sockfd == TCP_CLIENT_BAD_SOCKET)
+        log_error("client: failed to connect");
+    return sockfd;
+}
+
+/*
+Description:
+    Returns the socket profile a connection made with a config is tuned for: config.profile for
+    TCP hosts and TCP_CLIENT_PROFILE_DEFAULT for Unix sockets and shared memory, which profiles do
+    not apply to.
+Arguments:
+    Config config: The config the connection is made with
+Return value:
+    The profile, one of the TCP_CLIENT_PROFILE_ values.
+*/
+int tcp_client_profile(Config config) {
+    if (strncmp(config.host, TCP_CLIENT_UNIX_PREFIX, strlen(TCP_CLIENT_UNIX_PREFIX)) == 0 ||
+        strncmp(config.host, TCP_CLIENT_SHM_PREFIX, strlen(TCP_CLIENT_SHM_PREFIX)) == 0)
+        return TCP_CLIENT_PROFILE_DEFAULT;
+    return config.profile;
+}
 
-    uint32_t network_binaryMessage = htonl(binaryMessage);
+/*
+Description:
+    Creates a TCP socket and connects it to the specified host and port. A host of the form
+    unix:PATH connects to the Unix stream socket at PATH instead and ignores the port. If
+    config.fastOpen is set, TCP connections use TCP Fast Open, so once a server has handed out its
+    cookie the first request goes out in the SYN. TCP connections are tuned for config.profile.
+    The io_uring and shared memory transports keep state beside the socket, so they are only
+    available to sessions (see tcp_client_session_connect).
+Arguments:
+    Config config: A config struct with the necessary information.
+Return value:
+    Returns the socket file descriptor or -1 if an error occurs.
+*/
+int tcp_client_connect(Config config) {
+    size_t prefixLength = strlen(TCP_CLIENT_UNIX_PREFIX);
+    int sockfd;
 
-    if (send(sockfd, &network_binaryMessage, 4, 0) < 4) {
-        log_error("Failed to send header");
-        return 1;
+    if (strncmp(config.host, TCP_CLIENT_SHM_PREFIX, strlen(TCP_CLIENT_SHM_PREFIX)) == 0) {
+        log_error("Shared memory needs a session, connect with tcp_client_session_connect");
+        return TCP_CLIENT_BAD_SOCKET;
     }
-    if (send(sockfd, message, strlen(message), 0) < (ssize_t)strlen(message)) {
-        log_error("Error with sending.");
-        return 1;
+    if (strncmp(config.host, TCP_CLIENT_UNIX_PREFIX, prefixLength) == 0) {
+        if (config.profile != TCP_CLIENT_PROFILE_DEFAULT)
+            log_warn("Socket profiles only apply to TCP, ignoring --profile");
+        sockfd = connectUnix(config.host + prefixLength);
+    } else {
+        sockfd = connectTcp(config);
     }
+    if (sockfd == TCP_CLIENT_BAD_SOCKET)
+        return TCP_CLIENT_BAD_SOCKET;
 
-    return 0;
+    log_info("Returning sockfd...");
+    return sockfd;
 }
 
 /*
 Description:
-    Returns the total message length from the server if successfully received.
+    Converts an action name into its 5-bit action code.
 Arguments:
-    char *message: Message received from the server.
-    int totalBytes: Total bytes in message.
+    const char *action: The action name (not necessarily null terminated)
+    size_t actionLength: The length of the action name
 Return value:
-    Returns the message length if found or 0 if no message was received.
+    Returns the action code, or 0 if the action is unknown.
 */
-int getMessageLength(char *message, uint32_t totalBytes) {
-    if (totalBytes >= 4) {
-        log_info("Checking message length...");
-        uint32_t messageLength = 0;
-        messageLength = (int)(message[0] << 24 | message[1] << 16 | message[2] << 8 | message[3]);
-        if (totalBytes >= (ACTION_LENGTH_BYTES + messageLength)) {
-            return messageLength + ACTION_LENGTH_BYTES;
-        }
-        return 0;
+static uint32_t getActionCode(const char *action, size_t actionLength) {
+    static const struct {
+        const char *name;
+        size_t length;
+        uint32_t code;
+    } actions[] = {{"uppercase", 9, UPPERCASE},
+                   {"lowercase", 9, LOWERCASE},
+                   {"reverse", 7, REVERSE},
+                   {"shuffle", 7, SHUFFLE},
+                   {"random", 6, RANDOM}};
+
+    for (size_t i = 0; i < sizeof(actions) / sizeof(actions[0]); i++) {
+        if (actionLength == actions[i].length && memcmp(action, actions[i].name, actionLength) == 0)
+            return actions[i].code;
     }
     return 0;
 }
 
 /*
 Description:
-    Receives the response from the server. The caller must provide a function pointer that handles
-the response and returns a true value if all responses have been handled, otherwise it returns a
-    false value. After the response is handled by the handle_response function pointer, the response
-    data can be safely deleted. The string passed to the function pointer must be null terminated.
+    Returns whether an action gives the same response every time it is sent the same message, so a
+    duplicate of the request is harmless: uppercase, lowercase and reverse are, shuffle and random
+    are not.
 Arguments:
-    int sockfd: Socket file descriptor
-    int (*handle_response)(char *): A callback function that handles a response
+    const char *action: The action name (not necessarily null terminated)
+    size_t actionLength: The length of the action name
 Return value:
-    Returns a 1 on failure, 0 on success
+    Returns true if the action is idempotent.
 */
-int tcp_client_receive_response(int sockfd, int (*handle_response)(char *)) {
+int tcp_client_action_is_idempotent(const char *action, size_t actionLength) {
+    uint32_t actionCode = getActionCode(action, actionLength);
+    return actionCode == UPPERCASE || actionCode == LOWERCASE || actionCode == REVERSE;
+}
 
-    int totalBytesRecevied = 0;
-    int bytesReceived = 0;
-    char *mainBuf;
-    mainBuf = (char *)malloc(BUFFER_SIZE * sizeof(char));
-    char *tempBuf;
-    tempBuf = (char *)malloc(BUFFER_SIZE * sizeof(char));
-    int movePointer;
+/*
+Description:
+    Builds the 4 byte request header (5-bit action, 27-bit length) in network byte order.
+Arguments:
+    const char *action: The action name (not necessarily null terminated)
+    size_t actionLength: The length of the action name
+    size_t messageLength: The length of the message
+    uint32_t *header: Set to the header in network byte order
+Return value:
+    Returns a 1 on failure (unknown action), 0 on success
+*/
+int tcp_client_encode_header(const char *action, size_t actionLength, size_t messageLength,
+                             uint32_t *header) {
+    uint32_t actionCode = getActionCode(action, actionLength);
+    *header = htonl(actionCode << 27 | (uint32_t)messageLength);
+    return actionCode == 0;
+}
 
-    log_info("Trying to receive message");
-    while (true) {
-        if ((bytesReceived = recv(sockfd, tempBuf, BUFFER_SIZE - totalBytesRecevied, 0)) == -1) {
-            log_error("Error receiving data");
+/*
+Description:
+    Sends every byte of the buffer, retrying on partial writes and interrupted calls.
+Arguments:
+    int sockfd: Socket file descriptor
+    const char *buf: The bytes to send
+    size_t length: The number of bytes to send
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_send_all(int sockfd, const char *buf, size_t length) {
+    while (length > 0) {
+        ssize_t bytesSent = send(sockfd, buf, length, MSG_NOSIGNAL);
+        if (bytesSent == -1) {
+            if (errno == EINTR)
+                continue;
+            log_error("Error with sending: %s", strerror(errno));
             return 1;
         }
-        memcpy(mainBuf + totalBytesRecevied, tempBuf, bytesReceived);
-        totalBytesRecevied += bytesReceived;
-        mainBuf[totalBytesRecevied] = '\0';
-        // Updates the main buffer
-        if (strlen(mainBuf) > (size_t)(BUFFER_SIZE / 2)) {
-            mainBuf = (char *)realloc(mainBuf, BUFFER_SIZE * 5 * sizeof(char));
-        }
-        log_info("Checking for message");
-        while ((movePointer = getMessageLength(mainBuf, totalBytesRecevied)) > 0) {
-            log_info("Receiving message");
-            char *handleString;
-            handleString = (char *)malloc((movePointer - 3) * sizeof(char));
-            int headerLength = ACTION_LENGTH_BYTES;
-            int messageLength = movePointer - headerLength;
-            memcpy(handleString, mainBuf + headerLength, messageLength);
-            handleString[messageLength] = '\0';
-
-            log_info("Freeing memory from buffers");
-            if (handle_response(handleString) == true) {
-                free(handleString);
-                free(mainBuf);
-                free(tempBuf);
-                return 0;
-            }
-
-            // Moves buffer in memory
-            memmove(mainBuf, mainBuf + movePointer, totalBytesRecevied - movePointer);
-            totalBytesRecevied -= movePointer;
-            free(handleString);
-        }
+        buf += bytesSent;
+        length -= bytesSent;
     }
-    log_error("No message received");
-    return 1;
+    return 0;
 }
 
 /*
 Description:
-    Closes the given socket.
+    Creates and sends request to server using the socket and configuration.
 Arguments:
     int sockfd: Socket file descriptor
+    char *action: The action that will be sent
+    char *message: The message that will be sent
 Return value:
     Returns a 1 on failure, 0 on success
 */
-int tcp_client_close(int sockfd) {
-    log_info("Closing socket...");
-    int returnValue;
-    if ((returnValue = close(sockfd)) != 0) {
-        log_debug("Close failed. returnValue: %d", returnValue);
+int tcp_client_send_request(int sockfd, char *action, char *message) {
+
+    uint32_t network_binaryMessage;
+    size_t messageLength = strlen(message);
+
+    if (tcp_client_encode_header(action, strlen(action), messageLength, &network_binaryMessage)) {
+        log_error("Invalid action received.\n");
         return 1;
     }
-    return 0;
+
+    return tcp_client_send_frame(sockfd, network_binaryMessage, message, messageLength);
 }
 
 /*
 Description:
-    Opens a file.
+    Sends one request frame, writing the header and the message with one system call.
 Arguments:
-    char *file_name: The name of the file to open
+    int sockfd: Socket file descriptor
+    uint32_t header: The request header in network byte order
+    const char *message: The message
+    size_t messageLength: The length of the message
 Return value:
-    Returns NULL on failure, a FILE pointer on success
+    Returns a 1 on failure, 0 on success
 */
-FILE *tcp_client_open_file(char *file_name) {
-    log_info("File name: %s", file_name);
-    if (strcmp(file_name, "-") == 0) {
-        return stdin;
+int tcp_client_send_frame(int sockfd, uint32_t header, const char *message,
+                          size_t messageLength) {
+    struct iovec iov[2] = {{&header, ACTION_LENGTH_BYTES}, {(char *)message, messageLength}};
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 2};
+    ssize_t bytesSent;
+    do {
+        bytesSent = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+    } while (bytesSent == -1 && errno == EINTR);
+    if (bytesSent == -1) {
+        log_error("Error with sending: %s", strerror(errno));
+        return 1;
     }
-    return fopen(file_name, "r");
+
+    // Finishes a partial write
+    if ((size_t)bytesSent < ACTION_LENGTH_BYTES) {
+        if (tcp_client_send_all(sockfd, (char *)&header + bytesSent,
+                                ACTION_LENGTH_BYTES - bytesSent)) {
+            log_error("Failed to send header");
+            return 1;
+        }
+        bytesSent = ACTION_LENGTH_BYTES;
+    }
+    if (tcp_client_send_all(sockfd, message + (bytesSent - ACTION_LENGTH_BYTES),
+                            messageLength - (bytesSent - ACTION_LENGTH_BYTES))) {
+        log_error("Error with sending.");
+        return 1;
+    }
+
+    return 0;
 }
 
 /*
 Description:
-    Gets the next line of a file, filling in action and message. This function should be similar
-    design to getline() (https://linux.die.net/man/3/getline). *action and message must be allocated
-    by the function and freed by the caller.* When this function is called, action must point to the
-    action string and the message must point to the message string.
+    Sets TCP_CORK on a socket with the throughput profile, so what is written next goes out in
+    full segments only, until tcp_client_push. Does nothing on other sockets.
 Arguments:
-    FILE *fd: The file pointer to read from
-    char **action: A pointer to the action that was read in
+    int sockfd: Socket file descriptor
+    int profile: The socket's profile, as returned by tcp_client_profile
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_cork(int sockfd, int profile) {
+    int one = 1;
+
+    if (profile != TCP_CLIENT_PROFILE_THROUGHPUT)
+        return 0;
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_CORK, &one, sizeof(one)) == -1) {
+        log_error("Unable to cork the socket: %s", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Clears TCP_CORK on a socket with the throughput profile, sending the partly filled segment it
+    held back. The socket is left uncorked, so a tail the window has no room for yet goes out as
+    soon as it opens instead of waiting for the cork timer. Does nothing on other sockets.
+Arguments:
+    int sockfd: Socket file descriptor
+    int profile: The socket's profile, as returned by tcp_client_profile
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_push(int sockfd, int profile) {
+    int zero = 0;
+
+    if (profile != TCP_CLIENT_PROFILE_THROUGHPUT)
+        return 0;
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_CORK, &zero, sizeof(zero)) == -1) {
+        log_error("Unable to uncork the socket: %s", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Flushes a batch with send_batch_flush, corked so its frames go out in full segments, and
+    pushes out the last segment once all of it has been written.
+Arguments:
+    SendBatch *batch: The batch
+    int sockfd: Socket file descriptor
+    int profile: The socket's profile, as returned by tcp_client_profile
+    int flags: Extra flags passed to sendmsg
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_flush_batch(SendBatch *batch, int sockfd, int profile, int flags) {
+    if (tcp_client_cork(sockfd, profile) || send_batch_flush(batch, sockfd, flags))
+        return 1;
+    return send_batch_pending(batch) == 0 ? tcp_client_push(sockfd, profile) : 0;
+}
+
+/*
+Description:
+    Receives exactly length bytes.
+Arguments:
+    int sockfd: Socket file descriptor
+    char *buf: The buffer to fill
+    size_t length: The number of bytes to receive
+Return value:
+    Returns a 1 on failure, 0 on success, or -1 if the peer closed or reset the connection
+*/
+static int recvAll(int sockfd, char *buf, size_t length) {
+    while (length > 0) {
+        ssize_t bytesReceived = recv(sockfd, buf, length, 0);
+        if (bytesReceived == -1 && errno == EINTR)
+            continue;
+        if (bytesReceived == 0 || (bytesReceived == -1 && errno == ECONNRESET))
+            return -1;
+        if (bytesReceived == -1) {
+            log_error("Error receiving data: %s", strerror(errno));
+            return 1;
+        }
+        buf += bytesReceived;
+        length -= bytesReceived;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Negotiates protocol extensions. Sends a hello frame (action code 0, which no v3 request uses)
+    listing the wanted features separated by spaces, and waits for the server to answer with the
+    ones it supports in an ordinary v3 response. Must be the first frame on a plain socket. Servers
+    that predate hello frames drop the connection on the unknown action instead of answering.
+Arguments:
+    int sockfd: Socket file descriptor
+    const char *features: The wanted features, such as "v4"
+    char *accepted: Filled in with the null terminated features the server accepted
+    size_t acceptedSize: The size of accepted
+Return value:
+    Returns a 1 on failure, 0 on success, or -1 if the server closed or reset the connection
+    instead of answering
+*/
+int tcp_client_hello(int sockfd, const char *features, char *accepted, size_t acceptedSize) {
+    uint32_t header = htonl(strlen(features));
+    uint32_t responseHeader;
+
+    if (tcp_client_send_frame(sockfd, header, features, strlen(features)))
+        return errno == EPIPE || errno == ECONNRESET ? -1 : 1;
+    int result = recvAll(sockfd, (char *)&responseHeader, sizeof(responseHeader));
+    if (result != 0)
+        return result;
+
+    size_t length = ntohl(responseHeader);
+    if (length >= acceptedSize) {
+        log_error("The server's hello is too long (%zu bytes)", length);
+        return 1;
+    }
+    if ((result = recvAll(sockfd, accepted, length)) != 0)
+        return result;
+    accepted[length] = '\0';
+    log_info("Server accepted features: %s", accepted);
+    return 0;
+}
+
+/*
+Description:
+    Checks whether a space separated feature list contains a feature.
+Arguments:
+    const char *features: The feature list
+    const char *feature: The feature to look for
+Return value:
+    Returns true if the feature is in the list.
+*/
+int tcp_client_has_feature(const char *features, const char *feature) {
+    size_t length = strlen(feature);
+
+    for (const char *found = strstr(features, feature); found != NULL;
+         found = strstr(found + 1, feature)) {
+        int starts = found == features || found[-1] == ' ';
+        int ends = found[length] == ' ' || found[length] == '\0';
+        if (starts && ends)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Returns the total message length from the server if successfully received.
+Arguments:
+    const char *message: Message received from the server.
+    size_t totalBytes: Total bytes in message.
+Return value:
+    Returns the message length if found or 0 if no message was received.
+*/
+size_t getMessageLength(const char *message, size_t totalBytes) {
+    if (totalBytes >= ACTION_LENGTH_BYTES) {
+        const unsigned char *header = (const unsigned char *)message;
+        size_t messageLength =
+            (uint32_t)header[0] << 24 | header[1] << 16 | header[2] << 8 | header[3];
+        if (totalBytes >= ACTION_LENGTH_BYTES + messageLength) {
+            return ACTION_LENGTH_BYTES + messageLength;
+        }
+        return 0;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Takes the next complete response out of the ring buffer without copying it. When no complete
+    response is buffered, the buffer is reserved so the rest of the partial frame will fit. On a
+    connection that negotiated batch frames, the headers of batch responses are skipped, so the
+    responses inside them come out one at a time. A frame longer than TCP_CLIENT_MAX_MESSAGE_LENGTH
+    is refused rather than buffered.
+Arguments:
+    RingBuffer *ring: The ring buffer holding received data
+    int batched: Whether the server accepted batch frames on the connection
+    char **response: Set to point at the response inside the ring buffer
+    size_t *length: Set to the length of the response
+Return value:
+    Returns 1 if a response was found, 0 if more data is needed, or -1 on failure
+*/
+int tcp_client_next_response(RingBuffer *ring, int batched, char **response, size_t *length) {
+    uint32_t header;
+
+    // The responses in a batch are framed like any others, so only its header needs handling
+    while (batched && ring_buffer_length(ring) >= ACTION_LENGTH_BYTES) {
+        memcpy(&header, ring->data + ring->head, ACTION_LENGTH_BYTES);
+        if (!(ntohl(header) & TCP_CLIENT_BATCH_RESPONSE))
+            break;
+        ring_buffer_consume(ring, ACTION_LENGTH_BYTES);
+    }
+    if (ring_buffer_length(ring) < ACTION_LENGTH_BYTES)
+        return 0;
+
+    // Responses are as long as the requests, so a longer header means the stream is corrupt
+    memcpy(&header, ring->data + ring->head, ACTION_LENGTH_BYTES);
+    if (ntohl(header) > TCP_CLIENT_MAX_MESSAGE_LENGTH) {
+        log_error("Response of %u bytes is longer than %u", ntohl(header),
+                  TCP_CLIENT_MAX_MESSAGE_LENGTH);
+        return -1;
+    }
+
+    size_t frameLength = getMessageLength(ring->data + ring->head, ring_buffer_length(ring));
+
+    if (frameLength > 0) {
+        *response = ring->data + ring->head + ACTION_LENGTH_BYTES;
+        *length = frameLength - ACTION_LENGTH_BYTES;
+        ring_buffer_consume(ring, frameLength);
+        return 1;
+    }
+
+    // Makes sure the rest of a partially received frame will fit
+    if (ring_buffer_reserve(ring, ACTION_LENGTH_BYTES + (size_t)ntohl(header)))
+        return -1;
+    return 0;
+}
+
+/*
+Description:
+    Hands every complete response in the ring buffer to the callback, parsing the frames in place.
+    If handleString is given the response is null terminated in place (using the byte after the
+    frame) and passed to it, otherwise handleView gets a pointer and length into the buffer.
+Arguments:
+    RingBuffer *ring: The ring buffer holding received data
+    int batched: Whether the server accepted batch frames on the connection
+    int (*handleView)(const char *, size_t, void *): A callback that gets a pointer and length
+    int (*handleString)(char *): A callback that gets a null terminated string
+    void *context: Passed to handleView
+    int *finished: Set to true if a callback returned a true value
+Return value:
+    Returns the number of responses handled, or -1 on failure
+*/
+static int handleResponses(RingBuffer *ring, int batched,
+                           int (*handleView)(const char *, size_t, void *),
+                           int (*handleString)(char *), void *context, int *finished) {
+    int handled = 0;
+    int found = 0;
+    char *response;
+    size_t messageLength;
+
+    while (!*finished &&
+           (found = tcp_client_next_response(ring, batched, &response, &messageLength)) > 0) {
+        if (handleString != NULL) {
+            char saved = response[messageLength];
+            response[messageLength] = '\0';
+            *finished = handleString(response);
+            response[messageLength] = saved;
+        } else {
+            *finished = handleView(response, messageLength, context);
+        }
+        handled++;
+    }
+    if (found == -1)
+        return -1;
+    return handled;
+}
+
+/*
+Description:
+    Stages bytes on whichever of the io_uring and shared memory transports a session uses. With
+    io_uring they are submitted with the next receive, and with shared memory they are copied into
+    the request ring (or staged until it has room).
+Arguments:
+    TcpClientSession *session: The session, which uses one of the transports
+    const char *buf: The bytes to send
+    size_t length: The number of bytes to send
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int stagedSend(TcpClientSession *session, const char *buf, size_t length) {
+    if (session->uring != NULL)
+        return uring_socket_send(session->uring, buf, length);
+    return shm_transport_send(session->shm, buf, length);
+}
+
+/*
+Description:
+    Submits staged bytes and receives more data on whichever of the io_uring and shared memory
+    transports a session uses.
+Arguments:
+    TcpClientSession *session: The session, which uses one of the transports
+Return value:
+    Returns the number of bytes received, 0 if the server closed the connection, -1 on error.
+*/
+static ssize_t stagedRecv(TcpClientSession *session) {
+    if (session->uring != NULL)
+        return uring_socket_recv(session->uring);
+    return shm_transport_recv(session->shm);
+}
+
+/*
+Description:
+    Returns the ring buffer the transport of a session receives into.
+Arguments:
+    TcpClientSession *session: The session, which uses one of the transports
+Return value:
+    The transport's ring buffer.
+*/
+static RingBuffer *stagedRing(TcpClientSession *session) {
+    if (session->uring != NULL)
+        return uring_socket_ring(session->uring);
+    return shm_transport_ring(session->shm);
+}
+
+/*
+Description:
+    Receives responses into a ring buffer until one of the callbacks returns a true value.
+Arguments:
+    int sockfd: Socket file descriptor
+    RingBuffer *ring: The ring buffer to receive into
+    int (*handleView)(const char *, size_t, void *): A callback that gets a pointer and length
+    int (*handleString)(char *): A callback that gets a null terminated string
+    void *context: Passed to handleView
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int receiveResponses(int sockfd, RingBuffer *ring,
+                            int (*handleView)(const char *, size_t, void *),
+                            int (*handleString)(char *), void *context) {
+    int finished = 0;
+
+    log_info("Trying to receive message");
+    while (!finished) {
+        ssize_t bytesReceived = ring_buffer_recv(ring, sockfd, 0);
+        if (bytesReceived == -1) {
+            if (errno == EINTR)
+                continue;
+            log_error("Error receiving data");
+            return 1;
+        }
+        if (bytesReceived == 0) {
+            log_error("Server closed the connection before all responses were received");
+            return 1;
+        }
+        if (handleResponses(ring, 0, handleView, handleString, context, &finished) == -1)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Adapts a callback that takes a pointer and length to the one handleResponses takes.
+Arguments:
+    const char *response: The response
+    size_t length: The length of the response
+    void *context: Points at the callback
+Return value:
+    What the callback returned.
+*/
+static int callView(const char *response, size_t length, void *context) {
+    int (**handle_response)(const char *, size_t) = context;
+    return (*handle_response)(response, length);
+}
+
+/*
+Description:
+    Receives responses with a ring buffer of its own for the callers that do not have a session.
+Arguments:
+    int sockfd: Socket file descriptor
+    int (*handleView)(const char *, size_t): A callback that gets a pointer and length
+    int (*handleString)(char *): A callback that gets a null terminated string
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int receiveWithoutSession(int sockfd, int (*handleView)(const char *, size_t),
+                                 int (*handleString)(char *)) {
+    RingBuffer ring;
+
+    if (ring_buffer_init(&ring, RING_BUFFER_DEFAULT_CAPACITY))
+        return 1;
+    int result = receiveResponses(sockfd, &ring, callView, handleString, &handleView);
+    ring_buffer_free(&ring);
+    return result;
+}
+
+/*
+Description:
+    Receives the response from the server. The caller must provide a function pointer that handles
+the response and returns a true value if all responses have been handled, otherwise it returns a
+    false value. After the response is handled by the handle_response function pointer, the response
+    data can be safely deleted. The string passed to the function pointer must be null terminated.
+Arguments:
+    int sockfd: Socket file descriptor
+    int (*handle_response)(char *): A callback function that handles a response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_receive_response(int sockfd, int (*handle_response)(char *)) {
+    return receiveWithoutSession(sockfd, NULL, handle_response);
+}
+
+/*
+Description:
+    Receives the response from the server without copying it. The callback gets a pointer into the
+    receive buffer and the length of the response, and returns a true value once all responses have
+    been handled. The response is not null terminated and is only valid during the callback.
+Arguments:
+    int sockfd: Socket file descriptor
+    int (*handle_response)(const char *, size_t): A callback function that handles a response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_receive_response_view(int sockfd, int (*handle_response)(const char *, size_t)) {
+    return receiveWithoutSession(sockfd, handle_response, NULL);
+}
+
+/*
+Description:
+    Reads the next line of the input and encodes its request header. Lines with an unknown action
+    or a message too long for the header are skipped.
+Arguments:
+    InputReader *reader: The reader to read from
+    uint32_t *header: Set to the request header in network byte order
+    InputLine *line: Filled in with views of the line
+Return value:
+    Returns 1 if a request was read, 0 at the end of the input or -1 on failure.
+*/
+int tcp_client_next_request(InputReader *reader, uint32_t *header, InputLine *line) {
+    int found;
+
+    while ((found = input_reader_next(reader, line)) == 1) {
+        if (line->messageLength > TCP_CLIENT_MAX_MESSAGE_LENGTH) {
+            log_error("Skipping a %zu byte message, which needs --stream", line->messageLength);
+            continue;
+        }
+        if (tcp_client_encode_header(line->action, line->actionLength, line->messageLength,
+                                     header) == 0)
+            return 1;
+        log_error("Invalid action received, skipping line: %.*s", (int)line->actionLength,
+                  line->action);
+    }
+    return found;
+}
+
+/*
+Description:
+    handleResponses callback for the pipelines: hands the response to the session.
+Arguments:
+    const char *response: The response
+    size_t length: The length of the response
+    void *context: The session
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int deliverToSession(const char *response, size_t length, void *context) {
+    return tcp_client_session_deliver(context, response, length);
+}
+
+/*
+Description:
+    Pipeline for the io_uring and shared memory backends. Requests are staged without blocking and
+    submitted together with each wait for responses, so there is no need to poll for writability.
+Arguments:
+    InputReader *reader: The reader to read requests from
+    TcpClientSession *session: The session the requests are sent for, which uses one of the
+                               transports
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int pipelineStaged(InputReader *reader, TcpClientSession *session) {
+    RingBuffer *staged = stagedRing(session);
+    size_t inFlight = 0;
+    int endOfFile = 0;
+
+    while (!endOfFile || inFlight > 0) {
+        while (!endOfFile && inFlight < session->config.maxInFlight) {
+            uint32_t header;
+            InputLine line;
+            int found = tcp_client_next_request(reader, &header, &line);
+            if (found == -1)
+                return 1;
+            if (found == 0) {
+                endOfFile = 1;
+                break;
+            }
+            if (stagedSend(session, (char *)&header, ACTION_LENGTH_BYTES) ||
+                stagedSend(session, line.message, line.messageLength))
+                return 1;
+            inFlight++;
+            session->messagesSent++;
+        }
+        if (inFlight == 0)
+            break;
+
+        ssize_t bytesReceived = stagedRecv(session);
+        if (bytesReceived == -1) {
+            log_error("Error receiving data");
+            return 1;
+        }
+        if (bytesReceived == 0) {
+            log_error("Server closed the connection with %zu requests in flight", inFlight);
+            return 1;
+        }
+
+        int finished = 0;
+        int handled = handleResponses(staged, 0, deliverToSession, NULL, session, &finished);
+        if (handled == -1 || finished)
+            return 1;
+        if ((size_t)handled > inFlight) {
+            log_error("Received a response with no request in flight");
+            return 1;
+        }
+        inFlight -= handled;
+    }
+    return 0;
+}
+
+/*
+Description:
+    tcp_client_pipeline on a session: sends every line of the file and receives the responses at
+    the same time, using the session's buffers and counters.
+Arguments:
+    TcpClientSession *session: The session
+    FILE *fd: The file pointer to read requests from
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_pipeline(TcpClientSession *session, FILE *fd) {
+    Config config = session->config;
+    int sockfd = session->sockfd;
+    SendBatch *batch = &session->batch;
+    RingBuffer *ring = &session->ring;
+    InputReader reader;
+    InputLine held;
+    uint32_t heldHeader = 0;
+    int holding = 0;
+    size_t inFlight = 0;
+    int endOfFile = 0;
+    int result = 1;
+
+    if (input_reader_open(&reader, fd))
+        return 1;
+
+    if (session->uring != NULL || session->shm != NULL) {
+        if (config.batchEnvelope)
+            log_warn("Batch frames need a plain socket, sending ordinary frames");
+        result = pipelineStaged(&reader, session);
+        input_reader_close(&reader);
+        return result;
+    }
+
+    int envelope = 0;
+    if (config.batchEnvelope) {
+        char accepted[TCP_CLIENT_MAX_HELLO];
+        if (tcp_client_session_hello(session, TCP_CLIENT_BATCH_FEATURE, accepted,
+                                     sizeof(accepted))) {
+            input_reader_close(&reader);
+            return 1;
+        }
+        envelope = tcp_client_has_feature(accepted, TCP_CLIENT_BATCH_FEATURE);
+        session->batchAccepted = envelope;
+        if (!envelope)
+            log_warn("The server does not accept batch frames, sending ordinary frames");
+    }
+    send_batch_set_envelope(batch, envelope ? TCP_CLIENT_BATCH_ACTION : 0);
+
+    // Mapped lines stay valid, so the batch can point at them instead of copying
+    int copy = !reader.mapped;
+
+    int flags = fcntl(sockfd, F_GETFL);
+    if (flags == -1 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        log_error("Unable to set up the pipeline");
+        input_reader_close(&reader);
+        return 1;
+    }
+
+    log_info("Starting pipeline with at most %zu requests in flight", config.maxInFlight);
+    while (1) {
+        // Fills the batch until a limit is reached or the window or the file runs out. A line that
+        // does not fit is held until the batch has been written.
+        while (!endOfFile && inFlight < config.maxInFlight && !send_batch_should_flush(batch)) {
+            if (!holding) {
+                // A slow input must not hold the queued frames past the batch deadline
+                struct timespec timeout;
+                if (!reader.mapped && send_batch_timeout(batch, &timeout)) {
+                    int ready = input_reader_wait(&reader, &timeout);
+                    if (ready == -1)
+                        goto done;
+                    if (ready == 0)
+                        break;
+                }
+                int found = tcp_client_next_request(&reader, &heldHeader, &held);
+                if (found == -1)
+                    goto done;
+                if (found == 0) {
+                    endOfFile = 1;
+                    break;
+                }
+                holding = 1;
+            }
+            if (!send_batch_has_room(batch, held.messageLength, copy))
+                break;
+            if (send_batch_add(batch, heldHeader, held.message, held.messageLength, copy))
+                goto done;
+            holding = 0;
+            inFlight++;
+            session->messagesSent++;
+        }
+
+        // Writes as much as the socket takes right away; the rest waits for POLLOUT
+        if (send_batch_pending(batch) > 0 &&
+            tcp_client_flush_batch(batch, sockfd, session->profile, 0))
+            goto done;
+        if (endOfFile && inFlight == 0 && send_batch_pending(batch) == 0)
+            break;
+
+        struct pollfd pfd = {.fd = sockfd, .events = POLLIN};
+        if (send_batch_pending(batch) > 0)
+            pfd.events |= POLLOUT;
+        if (poll(&pfd, 1, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            log_error("poll failed: %s", strerror(errno));
+            goto done;
+        }
+
+        if ((pfd.revents & POLLOUT) && tcp_client_flush_batch(batch, sockfd, session->profile, 0))
+            goto done;
+
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t bytesReceived = ring_buffer_recv(ring, sockfd, 0);
+            if (bytesReceived == 0) {
+                log_error("Server closed the connection with %zu requests in flight", inFlight);
+                goto done;
+            }
+            if (bytesReceived == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    continue;
+                log_error("Error receiving data: %s", strerror(errno));
+                goto done;
+            }
+
+            int finished = 0;
+            int handled = handleResponses(ring, session->batchAccepted, deliverToSession, NULL,
+                                          session, &finished);
+            if (handled == -1 || finished)
+                goto done;
+            if ((size_t)handled > inFlight) {
+                log_error("Received a response with no request in flight");
+                goto done;
+            }
+            inFlight -= handled;
+        }
+    }
+    result = 0;
+
+done:
+    fcntl(sockfd, F_SETFL, flags);
+    input_reader_close(&reader);
+    return result;
+}
+
+/*
+Description:
+    Session handler for tcp_client_pipeline, which hands responses to a plain callback and ignores
+    what it returns.
+Arguments:
+    TcpClientSession *session: The session, whose userData points at the callback
+    const char *response: The response
+    size_t length: The length of the response
+Return value:
+    Returns 0.
+*/
+static int handleWithoutSession(TcpClientSession *session, const char *response, size_t length) {
+    int (**handle_response)(const char *, size_t) = session->userData;
+    (*handle_response)(response, length);
+    return 0;
+}
+
+/*
+Description:
+    Sends every line of the file and receives the responses at the same time (full duplex). At most
+    maxInFlight requests are left unanswered at once, so memory use is bounded by the in-flight
+    window rather than by the size of the file. Lines with an unknown action are skipped. The
+    return value of handle_response is ignored; the pipeline ends once the file is exhausted and
+    every request has been answered. Requests are written in batches of up to config.batchFrames
+    frames or config.batchBytes bytes with one sendmsg each. If config.batchEnvelope is set and the
+    server accepts batch frames, each batch is sent as one batch frame.
+Arguments:
+    int sockfd: A plain socket, as returned by tcp_client_connect
+    FILE *fd: The file pointer to read requests from
+    Config config: A config struct with the in-flight and batch limits
+    int (*handle_response)(const char *, size_t): A callback function that handles a response
+    size_t *messagesSent: Incremented for every request queued to the server
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_pipeline(int sockfd, FILE *fd, Config config,
+                        int (*handle_response)(const char *, size_t), size_t *messagesSent) {
+    TcpClientSession session;
+
+    if (tcp_client_session_init(&session, config, handleWithoutSession, &handle_response))
+        return 1;
+    session.sockfd = sockfd;
+    int result = tcp_client_session_pipeline(&session, fd);
+    *messagesSent += session.messagesSent;
+    // The socket belongs to the caller
+    session.sockfd = TCP_CLIENT_BAD_SOCKET;
+    tcp_client_session_close(&session);
+    return result;
+}
+
+/*
+Description:
+    Sets up a session. It is not connected until tcp_client_session_connect is called.
+Arguments:
+    TcpClientSession *session: The session to initialize
+    Config config: The configuration used to connect and to size the buffers
+    TcpClientResponseHandler handle_response: Called with every response
+    void *userData: Stored in session->userData for the handler
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_init(TcpClientSession *session, Config config,
+                            TcpClientResponseHandler handle_response, void *userData) {
+    memset(session, 0, sizeof(TcpClientSession));
+    session->config = config;
+    session->sockfd = TCP_CLIENT_BAD_SOCKET;
+    session->profile = tcp_client_profile(config);
+    session->handle_response = handle_response;
+    session->userData = userData;
+    if (send_batch_init(&session->batch, config.batchFrames, config.batchBytes,
+                        config.batchDelayUs))
+        return 1;
+    if (ring_buffer_init(&session->ring, RING_BUFFER_DEFAULT_CAPACITY)) {
+        send_batch_free(&session->batch);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Connects a session to the server in its config with tcp_client_connect. A host of the form
+    shm:NAME connects to the shared memory region a co-located server created under NAME instead;
+    the framing is the same. If config.ioUring is set and io_uring is available, the session's
+    blocking calls use the io_uring backend, with single-shot recv if it is
+    TCP_CLIENT_URING_SINGLE_SHOT.
+Arguments:
+    TcpClientSession *session: The session
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_connect(TcpClientSession *session) {
+    Config config = session->config;
+    size_t shmPrefixLength = strlen(TCP_CLIENT_SHM_PREFIX);
+
+    if (strncmp(config.host, TCP_CLIENT_SHM_PREFIX, shmPrefixLength) == 0) {
+        if (config.ioUring)
+            log_warn("io_uring does not apply to shared memory, ignoring --io-uring");
+        if (config.profile != TCP_CLIENT_PROFILE_DEFAULT)
+            log_warn("Socket profiles only apply to TCP, ignoring --profile");
+        return connectShm(session, config.host + shmPrefixLength);
+    }
+
+    session->sockfd = tcp_client_connect(config);
+    if (session->sockfd == TCP_CLIENT_BAD_SOCKET)
+        return 1;
+    if (config.ioUring) {
+        int multishot = config.ioUring != TCP_CLIENT_URING_SINGLE_SHOT;
+        session->uring = uring_socket_create(session->sockfd, multishot);
+        if (session->uring == NULL)
+            log_warn("io_uring is not available, using blocking sockets");
+    }
+    return 0;
+}
+
+/*
+Description:
+    Negotiates protocol extensions on a session's connection with tcp_client_hello. If the server
+    drops the connection instead of answering, the session connects again and carries on with
+    plain v3 frames, as if no features were accepted. The new connection takes over the old file
+    descriptor, so a caller that lent the socket to the session still holds a working one.
+Arguments:
+    TcpClientSession *session: The session, connected with a plain socket
+    const char *features: The wanted features, such as "v4"
+    char *accepted: Filled in with the null terminated features the server accepted
+    size_t acceptedSize: The size of accepted
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_hello(TcpClientSession *session, const char *features, char *accepted,
+                             size_t acceptedSize) {
+    if (session->uring != NULL || session->shm != NULL) {
+        log_error("Protocol extensions need a plain socket");
+        return 1;
+    }
+    int result = tcp_client_hello(session->sockfd, features, accepted, acceptedSize);
+    if (result != -1)
+        return result;
+
+    log_warn("The server dropped the connection instead of answering the hello, reconnecting "
+             "without protocol extensions");
+    accepted[0] = '\0';
+    int sockfd = tcp_client_connect(session->config);
+    if (sockfd == TCP_CLIENT_BAD_SOCKET)
+        return 1;
+    if (dup2(sockfd, session->sockfd) == -1) {
+        log_error("Unable to replace the connection: %s", strerror(errno));
+        tcp_client_close(sockfd);
+        return 1;
+    }
+    tcp_client_close(sockfd);
+    return 0;
+}
+
+/*
+Description:
+    Sends one request frame on a session.
+Arguments:
+    TcpClientSession *session: The session
+    uint32_t header: The request header in network byte order
+    const char *message: The message
+    size_t messageLength: The length of the message
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_send(TcpClientSession *session, uint32_t header, const char *message,
+                            size_t messageLength) {
+    if (session->uring != NULL || session->shm != NULL) {
+        // These transports already stage both parts without a system call each
+        if (stagedSend(session, (char *)&header, ACTION_LENGTH_BYTES) ||
+            stagedSend(session, message, messageLength)) {
+            log_error("Error with sending.");
+            return 1;
+        }
+    } else if (tcp_client_send_frame(session->sockfd, header, message, messageLength)) {
+        return 1;
+    }
+    session->messagesSent++;
+    return 0;
+}
+
+/*
+Description:
+    Counts a response and hands it to the session's handler. Used by everything that receives on
+    behalf of a session.
+Arguments:
+    TcpClientSession *session: The session
+    const char *response: The response
+    size_t length: The length of the response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_deliver(TcpClientSession *session, const char *response, size_t length) {
+    session->messagesReceived++;
+    if (session->handle_response(session, response, length)) {
+        session->failed = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    handleResponses callback for tcp_client_session_receive.
+Arguments:
+    const char *response: The response
+    size_t length: The length of the response
+    void *context: The session
+Return value:
+    Returns a true value once every request is answered or the handler failed.
+*/
+static int receiveForSession(const char *response, size_t length, void *context) {
+    TcpClientSession *session = context;
+    if (tcp_client_session_deliver(session, response, length))
+        return 1;
+    return session->messagesReceived >= session->messagesSent;
+}
+
+/*
+Description:
+    Submits the requests staged on a session's io_uring or shared memory transport and receives
+    until every request sent on the session has been answered.
+Arguments:
+    TcpClientSession *session: The session, which uses one of the transports
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int receiveStaged(TcpClientSession *session) {
+    int finished = 0;
+
+    while (!finished) {
+        ssize_t bytesReceived = stagedRecv(session);
+        if (bytesReceived == -1) {
+            log_error("Error receiving data");
+            return 1;
+        }
+        if (bytesReceived == 0) {
+            log_error("Server closed the connection before all responses were received");
+            return 1;
+        }
+        if (handleResponses(stagedRing(session), 0, receiveForSession, NULL, session, &finished) ==
+            -1)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Receives responses until every request sent on the session has been answered.
+Arguments:
+    TcpClientSession *session: The session
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_receive(TcpClientSession *session) {
+    if (session->messagesReceived >= session->messagesSent)
+        return 0;
+    if (session->uring != NULL || session->shm != NULL) {
+        if (receiveStaged(session))
+            return 1;
+    } else if (receiveResponses(session->sockfd, &session->ring, receiveForSession, NULL,
+                                session)) {
+        return 1;
+    }
+    return session->failed;
+}
+
+/*
+Description:
+    Returns the socket an event loop should wait on for a session.
+Arguments:
+    const TcpClientSession *session: The session
+Return value:
+    The socket, or TCP_CLIENT_BAD_SOCKET if the session is not connected with a plain socket (the
+    io_uring and shared memory transports cannot be waited on).
+*/
+int tcp_client_session_fd(const TcpClientSession *session) {
+    if (session->sockfd == TCP_CLIENT_BAD_SOCKET || session->uring != NULL ||
+        session->shm != NULL) {
+        log_error("Only a session connected with a plain socket can be driven by an event loop");
+        return TCP_CLIENT_BAD_SOCKET;
+    }
+    return session->sockfd;
+}
+
+/*
+Description:
+    Returns the events a session is waiting for: POLLIN while requests are in flight and POLLOUT
+    while queued requests have not all been written. The values are the same for epoll (EPOLLIN,
+    EPOLLOUT). No events means the session is idle.
+Arguments:
+    const TcpClientSession *session: The session
+Return value:
+    The events.
+*/
+short tcp_client_session_events(const TcpClientSession *session) {
+    short events = 0;
+
+    if (session->messagesReceived < session->messagesSent)
+        events |= POLLIN;
+    if (send_batch_pending(&session->batch) > 0)
+        events |= POLLOUT;
+    return events;
+}
+
+/*
+Description:
+    Queues a request without blocking. The message is copied, so it need not outlive the call. The
+    request is written by tcp_client_session_on_writable, or right away if the queue is full.
+Arguments:
+    TcpClientSession *session: The session
+    uint32_t header: The request header in network byte order
+    const char *message: The message
+    size_t messageLength: The length of the message
+Return value:
+    Returns 1 if the request was queued, 0 if the queue is full until the socket is writable, or -1
+    on failure.
+*/
+int tcp_client_session_submit(TcpClientSession *session, uint32_t header, const char *message,
+                              size_t messageLength) {
+    if (!send_batch_has_room(&session->batch, messageLength, 1)) {
+        if (tcp_client_flush_batch(&session->batch, session->sockfd, session->profile,
+                                   MSG_DONTWAIT))
+            return -1;
+        if (!send_batch_has_room(&session->batch, messageLength, 1))
+            return 0;
+    }
+    if (send_batch_add(&session->batch, header, message, messageLength, 1))
+        return -1;
+    session->messagesSent++;
+    return 1;
+}
+
+/*
+Description:
+    Receives whatever the socket holds without blocking and hands every complete response to the
+    session's handler. A partial frame is kept until the rest of it arrives.
+Arguments:
+    TcpClientSession *session: The session
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_on_readable(TcpClientSession *session) {
+    while (1) {
+        ssize_t bytesReceived = ring_buffer_recv(&session->ring, session->sockfd, MSG_DONTWAIT);
+        if (bytesReceived == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            log_error("Error receiving data: %s", strerror(errno));
+            return 1;
+        }
+        if (bytesReceived == 0) {
+            log_error("Server closed the connection with %zu requests in flight",
+                      session->messagesSent - session->messagesReceived);
+            return 1;
+        }
+
+        int finished = 0;
+        if (handleResponses(&session->ring, session->batchAccepted, deliverToSession, NULL, session,
+                            &finished) == -1 ||
+            finished)
+            return 1;
+        if (session->messagesReceived > session->messagesSent) {
+            log_error("Received a response with no request in flight");
+            return 1;
+        }
+    }
+}
+
+/*
+Description:
+    Writes as much of the queued requests as the socket takes without blocking.
+Arguments:
+    TcpClientSession *session: The session
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_on_writable(TcpClientSession *session) {
+    if (send_batch_pending(&session->batch) == 0)
+        return 0;
+    return tcp_client_flush_batch(&session->batch, session->sockfd, session->profile,
+                                   MSG_DONTWAIT);
+}
+
+/*
+Description:
+    Closes a session's connection and transport, if it has them, and frees its buffers.
+Arguments:
+    TcpClientSession *session: The session
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_close(TcpClientSession *session) {
+    int result = 0;
+
+    if (session->uring != NULL)
+        uring_socket_destroy(session->uring);
+    session->uring = NULL;
+    if (session->shm != NULL)
+        shm_transport_close(session->shm);
+    session->shm = NULL;
+    if (session->sockfd != TCP_CLIENT_BAD_SOCKET)
+        result = tcp_client_close(session->sockfd);
+    session->sockfd = TCP_CLIENT_BAD_SOCKET;
+    send_batch_free(&session->batch);
+    ring_buffer_free(&session->ring);
+    return result;
+}
+
+/*
+Description:
+    Closes the given socket.
+Arguments:
+    int sockfd: Socket file descriptor
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_close(int sockfd) {
+    log_info("Closing socket...");
+    int returnValue;
+    if ((returnValue = close(sockfd)) != 0) {
+        log_debug("Close failed. returnValue: %d", returnValue);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Opens a file.
+Arguments:
+    char *file_name: The name of the file to open
+Return value:
+    Returns NULL on failure, a FILE pointer on success
+*/
+FILE *tcp_client_open_file(char *file_name) {
+    log_info("File name: %s", file_name);
+    if (strcmp(file_name, "-") == 0) {
+        return stdin;
+    }
+    return fopen(file_name, "r");
+}
+
+/*
+Description:
+    Gets the next line of a file, filling in action and message. This function should be similar
+    design to getline() (https://linux.die.net/man/3/getline). *action and message must be allocated
+    by the function and freed by the caller.* When this function is called, action must point to the
+    action string and the message must point to the message string.
+Arguments:
+    FILE *fd: The file pointer to read from
+    char **action: A pointer to the action that was read in
     char **message: A pointer to the message that was read in
 Return value:
     Returns -1 on failure, the number of characters read on success
 */
 int tcp_client_get_line(FILE *fd, char **action, char **message) {
 
-    *action = malloc(sizeof(char) * (LINE_ASCII_LIMIT));
-    *message = malloc(sizeof(char) * (LINE_ASCII_LIMIT));
     char *stringLine = NULL;
-    size_t readIn = LINE_ASCII_LIMIT;
+    size_t readIn = 0;
     ssize_t charCount;
+    InputLine line;
 
     if ((charCount = getline(&stringLine, &readIn, fd)) == -1) {
         log_info("No line was read from file or reached the end of file.");
+        free(stringLine);
+
+        return -1;
+    }
+    if (charCount > 0 && stringLine[charCount - 1] == '\n')
+        charCount--;
+    log_trace("String read from the file is: %.*s", (int)charCount, stringLine);
+    input_reader_split_line(stringLine, stringLine + charCount, &line);
+
+    // Sized to the line, so long lines cannot overflow them
+    *action = malloc(line.actionLength + 1);
+    *message = malloc(line.messageLength + 1);
+    if (*action == NULL || *message == NULL) {
+        log_error("Unable to allocate the line");
         free(*action);
         free(*message);
         free(stringLine);
-
         return -1;
     }
-    stringLine[charCount - 1] = '\0';
-    log_trace("String read from the file is: %s", stringLine);
-    int read = sscanf(stringLine, "%s %[^\n]", *action, *message);
+    memcpy(*action, line.action, line.actionLength);
+    (*action)[line.actionLength] = '\0';
+    memcpy(*message, line.message, line.messageLength);
+    (*message)[line.messageLength] = '\0';
     free(stringLine);
 
-    return read;
+    return (line.actionLength > 0) + (line.messageLength > 0);
 }
 
 /*
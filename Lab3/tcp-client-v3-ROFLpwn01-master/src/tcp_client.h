@@ -6,19 +6,60 @@
 #include <getopt.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include "input_reader.h"
+#include "ring_buffer.h"
+#include "send_batch.h"
+#include "shm_transport.h"
+#include "uring.h"
+
 #define TCP_CLIENT_BAD_SOCKET -1
 #define TCP_CLIENT_DEFAULT_PORT "8082"
 #define TCP_CLIENT_DEFAULT_HOST "localhost"
+#define TCP_CLIENT_UNIX_PREFIX "unix:"
+#define TCP_CLIENT_SHM_PREFIX "shm:"
 #define TCP_CLIENT_REQUEST_HEADER_SIZE 4
 #define TCP_CLIENT_RESPONSE_HEADER_SIZE 4
+#define TCP_CLIENT_DEFAULT_MAX_IN_FLIGHT 64
+#define TCP_CLIENT_MAX_HELLO 256
+#define TCP_CLIENT_MAX_MESSAGE_LENGTH ((1u << 27) - 1)
+#define TCP_CLIENT_BATCH_FEATURE "batch"
+#define TCP_CLIENT_BATCH_ACTION 31
+#define TCP_CLIENT_BATCH_RESPONSE 0x80000000u
+#define TCP_CLIENT_PROFILE_DEFAULT 0
+#define TCP_CLIENT_PROFILE_LATENCY 1
+#define TCP_CLIENT_PROFILE_THROUGHPUT 2
+#define TCP_CLIENT_BUSY_POLL_US 50
+#define TCP_CLIENT_THROUGHPUT_BUFFER_BYTES (4 << 20)
+#define TCP_CLIENT_BALANCE_LEAST 0
+#define TCP_CLIENT_BALANCE_EWMA 1
+#define TCP_CLIENT_URING_MULTISHOT 1
+#define TCP_CLIENT_URING_SINGLE_SHOT 2
+
+/*
+Batch frames are turned on per connection with tcp_client_hello("batch"). A batch request is one
+frame with action TCP_CLIENT_BATCH_ACTION whose message is any number of ordinary request frames,
+and the server answers it with one batch response: a 4-byte header holding
+TCP_CLIENT_BATCH_RESPONSE | length, followed by the ordinary responses to the enclosed requests,
+in order, filling length bytes. Responses are read the same way whether or not they are batched.
+*/
+
+/*
+Socket profiles tune TCP connections for one kind of workload; Unix sockets and shared memory ignore
+them. The latency profile turns off Nagle's algorithm and busy polls for TCP_CLIENT_BUSY_POLL_US
+microseconds on blocking receives. The throughput profile sizes both socket buffers to
+TCP_CLIENT_THROUGHPUT_BUFFER_BYTES and corks the socket while a batch is written (see
+tcp_client_cork), so its frames go out as full segments.
+*/
 
 /*
 Contains all of the information needed to create to connect to the server and send it a message.
@@ -27,8 +68,83 @@ typedef struct Config {
     char *port;
     char *host;
     char *file;
+    int pipeline;
+    size_t maxInFlight;
+    int connections;
+    int pinCpus;
+    int ioUring;
+    size_t batchFrames;
+    size_t batchBytes;
+    unsigned batchDelayUs;
+    unsigned rate;
+    unsigned duration;
+    char *compile;
+    int replay;
+    int v4;
+    int ordered;
+    int batchEnvelope;
+    int stream;
+    int noDnsCache;
+    int fastOpen;
+    int profile;
+    unsigned hedgePercentile;
+    char *hedgeHost;
+    char *endpoints;
+    int balance;
 } Config;
 
+typedef struct TcpClientSession TcpClientSession;
+
+/*
+Called with each response of a session. The response is not null terminated and is only valid
+during the call. Returns a 1 on failure, which ends the session's current run, 0 on success.
+*/
+typedef int (*TcpClientResponseHandler)(TcpClientSession *session, const char *response,
+                                        size_t length);
+
+/*
+One client session: its connection, its receive and send buffers, its counters and the handler
+that gets its responses, with a pointer for the handler's own data. Sessions share no state, so
+any number of them can run at once on different threads. Requests in flight are messagesSent
+minus messagesReceived. batchAccepted is set once the server has accepted batch frames on the
+connection; only then are its responses read as batches. uring and shm are the io_uring or shared
+memory transport the session was connected with, if any, and profile is the socket profile its
+connection is tuned for (see tcp_client_profile).
+
+Besides the blocking calls, a session on a plain socket can be driven by an event loop without ever
+blocking: register tcp_client_session_fd for tcp_client_session_events, queue requests with
+tcp_client_session_submit and call tcp_client_session_on_readable and
+tcp_client_session_on_writable when the socket is ready. Responses still arrive through
+handle_response, which may submit more requests. registered is left to the event loop that owns
+the session (see event_loop.h).
+*/
+struct TcpClientSession {
+    Config config;
+    int sockfd;
+    UringSocket *uring;
+    ShmTransport *shm;
+    int profile;
+    RingBuffer ring;
+    SendBatch batch;
+    size_t messagesSent;
+    size_t messagesReceived;
+    TcpClientResponseHandler handle_response;
+    void *userData;
+    int batchAccepted;
+    int failed;
+    short registered;
+};
+
+/*
+Description:
+    Prints the info menu.
+Arguments:
+    None.
+Return value:
+    None.
+*/
+void printInfoMenu();
+
 /*
 Description:
     Parses the commandline arguments and options given to the program.
@@ -47,7 +163,12 @@ int tcp_client_parse_arguments(int argc, char *argv[], Config *config);
 
 /*
 Description:
-    Creates a TCP socket and connects it to the specified host and port.
+    Creates a TCP socket and connects it to the specified host and port. A host of the form
+    unix:PATH connects to the Unix stream socket at PATH instead and ignores the port. If
+    config.fastOpen is set, TCP connections use TCP Fast Open, so once a server has handed out its
+    cookie the first request goes out in the SYN. TCP connections are tuned for config.profile.
+    The io_uring and shared memory transports keep state beside the socket, so they are only
+    available to sessions (see tcp_client_session_connect).
 Arguments:
     Config config: A config struct with the necessary information.
 Return value:
@@ -55,6 +176,18 @@ Return value:
 */
 int tcp_client_connect(Config config);
 
+/*
+Description:
+    Returns the socket profile a connection made with a config is tuned for: config.profile for
+    TCP hosts and TCP_CLIENT_PROFILE_DEFAULT for Unix sockets and shared memory, which profiles do
+    not apply to.
+Arguments:
+    Config config: The config the connection is made with
+Return value:
+    The profile, one of the TCP_CLIENT_PROFILE_ values.
+*/
+int tcp_client_profile(Config config);
+
 /*
 Description:
     Creates and sends request to server using the socket and configuration.
@@ -67,6 +200,138 @@ Return value:
 */
 int tcp_client_send_request(int sockfd, char *action, char *message);
 
+/*
+Description:
+    Sends one request frame, writing the header and the message with one system call.
+Arguments:
+    int sockfd: Socket file descriptor
+    uint32_t header: The request header in network byte order
+    const char *message: The message
+    size_t messageLength: The length of the message
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_send_frame(int sockfd, uint32_t header, const char *message, size_t messageLength);
+
+/*
+Description:
+    Sets TCP_CORK on a socket with the throughput profile, so what is written next goes out in
+    full segments only, until tcp_client_push. Does nothing on other sockets.
+Arguments:
+    int sockfd: Socket file descriptor
+    int profile: The socket's profile, as returned by tcp_client_profile
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_cork(int sockfd, int profile);
+
+/*
+Description:
+    Clears TCP_CORK on a socket with the throughput profile, sending the partly filled segment it
+    held back. The socket is left uncorked, so a tail the window has no room for yet goes out as
+    soon as it opens instead of waiting for the cork timer. Does nothing on other sockets.
+Arguments:
+    int sockfd: Socket file descriptor
+    int profile: The socket's profile, as returned by tcp_client_profile
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_push(int sockfd, int profile);
+
+/*
+Description:
+    Flushes a batch with send_batch_flush, corked so its frames go out in full segments, and
+    pushes out the last segment once all of it has been written.
+Arguments:
+    SendBatch *batch: The batch
+    int sockfd: Socket file descriptor
+    int profile: The socket's profile, as returned by tcp_client_profile
+    int flags: Extra flags passed to sendmsg
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_flush_batch(SendBatch *batch, int sockfd, int profile, int flags);
+
+/*
+Description:
+    Negotiates protocol extensions. Sends a hello frame (action code 0, which no v3 request uses)
+    listing the wanted features separated by spaces, and waits for the server to answer with the
+    ones it supports in an ordinary v3 response. Must be the first frame on a plain socket. Servers
+    that predate hello frames drop the connection on the unknown action instead of answering.
+Arguments:
+    int sockfd: Socket file descriptor
+    const char *features: The wanted features, such as "v4"
+    char *accepted: Filled in with the null terminated features the server accepted
+    size_t acceptedSize: The size of accepted
+Return value:
+    Returns a 1 on failure, 0 on success, or -1 if the server closed or reset the connection
+    instead of answering
+*/
+int tcp_client_hello(int sockfd, const char *features, char *accepted, size_t acceptedSize);
+
+/*
+Description:
+    Checks whether a space separated feature list contains a feature.
+Arguments:
+    const char *features: The feature list
+    const char *feature: The feature to look for
+Return value:
+    Returns true if the feature is in the list.
+*/
+int tcp_client_has_feature(const char *features, const char *feature);
+
+/*
+Description:
+    Builds the 4 byte request header (5-bit action, 27-bit length) in network byte order.
+Arguments:
+    const char *action: The action name (not necessarily null terminated)
+    size_t actionLength: The length of the action name
+    size_t messageLength: The length of the message
+    uint32_t *header: Set to the header in network byte order
+Return value:
+    Returns a 1 on failure (unknown action), 0 on success
+*/
+int tcp_client_encode_header(const char *action, size_t actionLength, size_t messageLength,
+                             uint32_t *header);
+
+/*
+Description:
+    Returns whether an action gives the same response every time it is sent the same message, so a
+    duplicate of the request is harmless: uppercase, lowercase and reverse are, shuffle and random
+    are not.
+Arguments:
+    const char *action: The action name (not necessarily null terminated)
+    size_t actionLength: The length of the action name
+Return value:
+    Returns true if the action is idempotent.
+*/
+int tcp_client_action_is_idempotent(const char *action, size_t actionLength);
+
+/*
+Description:
+    Reads the next line of the input and encodes its request header. Lines with an unknown action
+    or a message too long for the header are skipped.
+Arguments:
+    InputReader *reader: The reader to read from
+    uint32_t *header: Set to the request header in network byte order
+    InputLine *line: Filled in with views of the line
+Return value:
+    Returns 1 if a request was read, 0 at the end of the input or -1 on failure.
+*/
+int tcp_client_next_request(InputReader *reader, uint32_t *header, InputLine *line);
+
+/*
+Description:
+    Sends every byte of the buffer, retrying on partial writes and interrupted calls.
+Arguments:
+    int sockfd: Socket file descriptor
+    const char *buf: The bytes to send
+    size_t length: The number of bytes to send
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_send_all(int sockfd, const char *buf, size_t length);
+
 /*
 Description:
     Receives the response from the server. The caller must provide a function pointer that handles
@@ -81,6 +346,221 @@ Return value:
 */
 int tcp_client_receive_response(int sockfd, int (*handle_response)(char *));
 
+/*
+Description:
+    Receives the response from the server without copying it. The callback gets a pointer into the
+    receive buffer and the length of the response, and returns a true value once all responses have
+    been handled. The response is not null terminated and is only valid during the callback.
+Arguments:
+    int sockfd: Socket file descriptor
+    int (*handle_response)(const char *, size_t): A callback function that handles a response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_receive_response_view(int sockfd, int (*handle_response)(const char *, size_t));
+
+/*
+Description:
+    Takes the next complete response out of the ring buffer without copying it. When no complete
+    response is buffered, the buffer is reserved so the rest of the partial frame will fit. On a
+    connection that negotiated batch frames, the headers of batch responses are skipped, so the
+    responses inside them come out one at a time. A frame longer than TCP_CLIENT_MAX_MESSAGE_LENGTH
+    is refused rather than buffered.
+Arguments:
+    RingBuffer *ring: The ring buffer holding received data
+    int batched: Whether the server accepted batch frames on the connection
+    char **response: Set to point at the response inside the ring buffer
+    size_t *length: Set to the length of the response
+Return value:
+    Returns 1 if a response was found, 0 if more data is needed, or -1 on failure
+*/
+int tcp_client_next_response(RingBuffer *ring, int batched, char **response, size_t *length);
+
+/*
+Description:
+    Sends every line of the file and receives the responses at the same time (full duplex). At most
+    maxInFlight requests are left unanswered at once, so memory use is bounded by the in-flight
+    window rather than by the size of the file. Lines with an unknown action are skipped. The
+    return value of handle_response is ignored; the pipeline ends once the file is exhausted and
+    every request has been answered. Requests are written in batches of up to config.batchFrames
+    frames or config.batchBytes bytes with one sendmsg each. If config.batchEnvelope is set and the
+    server accepts batch frames, each batch is sent as one batch frame.
+Arguments:
+    int sockfd: A plain socket, as returned by tcp_client_connect
+    FILE *fd: The file pointer to read requests from
+    Config config: A config struct with the in-flight and batch limits
+    int (*handle_response)(const char *, size_t): A callback function that handles a response
+    size_t *messagesSent: Incremented for every request queued to the server
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_pipeline(int sockfd, FILE *fd, Config config,
+                        int (*handle_response)(const char *, size_t), size_t *messagesSent);
+
+/*
+Description:
+    Sets up a session. It is not connected until tcp_client_session_connect is called.
+Arguments:
+    TcpClientSession *session: The session to initialize
+    Config config: The configuration used to connect and to size the buffers
+    TcpClientResponseHandler handle_response: Called with every response
+    void *userData: Stored in session->userData for the handler
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_init(TcpClientSession *session, Config config,
+                            TcpClientResponseHandler handle_response, void *userData);
+
+/*
+Description:
+    Connects a session to the server in its config with tcp_client_connect. A host of the form
+    shm:NAME connects to the shared memory region a co-located server created under NAME instead;
+    the framing is the same. If config.ioUring is set and io_uring is available, the session's
+    blocking calls use the io_uring backend, with single-shot recv if it is
+    TCP_CLIENT_URING_SINGLE_SHOT.
+Arguments:
+    TcpClientSession *session: The session
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_connect(TcpClientSession *session);
+
+/*
+Description:
+    Negotiates protocol extensions on a session's connection with tcp_client_hello. If the server
+    drops the connection instead of answering, the session connects again and carries on with
+    plain v3 frames, as if no features were accepted. The new connection takes over the old file
+    descriptor, so a caller that lent the socket to the session still holds a working one.
+Arguments:
+    TcpClientSession *session: The session, connected with a plain socket
+    const char *features: The wanted features, such as "v4"
+    char *accepted: Filled in with the null terminated features the server accepted
+    size_t acceptedSize: The size of accepted
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_hello(TcpClientSession *session, const char *features, char *accepted,
+                             size_t acceptedSize);
+
+/*
+Description:
+    Sends one request frame on a session.
+Arguments:
+    TcpClientSession *session: The session
+    uint32_t header: The request header in network byte order
+    const char *message: The message
+    size_t messageLength: The length of the message
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_send(TcpClientSession *session, uint32_t header, const char *message,
+                            size_t messageLength);
+
+/*
+Description:
+    Counts a response and hands it to the session's handler. Used by everything that receives on
+    behalf of a session.
+Arguments:
+    TcpClientSession *session: The session
+    const char *response: The response
+    size_t length: The length of the response
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_deliver(TcpClientSession *session, const char *response, size_t length);
+
+/*
+Description:
+    Receives responses until every request sent on the session has been answered.
+Arguments:
+    TcpClientSession *session: The session
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_receive(TcpClientSession *session);
+
+/*
+Description:
+    tcp_client_pipeline on a session: sends every line of the file and receives the responses at
+    the same time, using the session's buffers and counters.
+Arguments:
+    TcpClientSession *session: The session
+    FILE *fd: The file pointer to read requests from
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_pipeline(TcpClientSession *session, FILE *fd);
+
+/*
+Description:
+    Returns the socket an event loop should wait on for a session.
+Arguments:
+    const TcpClientSession *session: The session
+Return value:
+    The socket, or TCP_CLIENT_BAD_SOCKET if the session is not connected with a plain socket (the
+    io_uring and shared memory transports cannot be waited on).
+*/
+int tcp_client_session_fd(const TcpClientSession *session);
+
+/*
+Description:
+    Returns the events a session is waiting for: POLLIN while requests are in flight and POLLOUT
+    while queued requests have not all been written. The values are the same for epoll (EPOLLIN,
+    EPOLLOUT). No events means the session is idle.
+Arguments:
+    const TcpClientSession *session: The session
+Return value:
+    The events.
+*/
+short tcp_client_session_events(const TcpClientSession *session);
+
+/*
+Description:
+    Queues a request without blocking. The message is copied, so it need not outlive the call. The
+    request is written by tcp_client_session_on_writable, or right away if the queue is full.
+Arguments:
+    TcpClientSession *session: The session
+    uint32_t header: The request header in network byte order
+    const char *message: The message
+    size_t messageLength: The length of the message
+Return value:
+    Returns 1 if the request was queued, 0 if the queue is full until the socket is writable, or -1
+    on failure.
+*/
+int tcp_client_session_submit(TcpClientSession *session, uint32_t header, const char *message,
+                              size_t messageLength);
+
+/*
+Description:
+    Receives whatever the socket holds without blocking and hands every complete response to the
+    session's handler. A partial frame is kept until the rest of it arrives.
+Arguments:
+    TcpClientSession *session: The session
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_on_readable(TcpClientSession *session);
+
+/*
+Description:
+    Writes as much of the queued requests as the socket takes without blocking.
+Arguments:
+    TcpClientSession *session: The session
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_on_writable(TcpClientSession *session);
+
+/*
+Description:
+    Closes a session's connection and transport, if it has them, and frees its buffers.
+Arguments:
+    TcpClientSession *session: The session
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int tcp_client_session_close(TcpClientSession *session);
+
 /*
 Description:
     Closes the given socket.
@@ -116,7 +596,7 @@ Arguments:
     char **action: A pointer to the action that was read in
     char **message: A pointer to the message that was read in
 Return value:
-    Returns -1 on failure, the number of characters read on success
+    Returns -1 on failure, the number of fields (action and message) found on success
 */
 int tcp_client_get_line(FILE *fd, char **action, char **message);
 
@@ -0,0 +1,572 @@
+#include "uring.h"
+#include "log.h"
+
+#ifdef TCP_CLIENT_HAVE_IO_URING
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define RECV_TAG 2
+#define BUFFER_GROUP 0
+
+struct UringSocket {
+    int sockfd;
+    int ringfd;
+
+    // Submission and completion queues shared with the kernel
+    void *sqMap;
+    size_t sqMapSize;
+    void *cqMap;
+    size_t cqMapSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqArray;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+    unsigned toSubmit;
+
+    // Receive buffers registered with the kernel as a provided buffer ring
+    struct io_uring_buf_ring *bufRing;
+    size_t bufRingSize;
+    char *recvBuffers;
+    unsigned short bufTail;
+    int recvArmed;
+    int multishot;
+    int peerClosed;
+    int failed;
+    size_t received;
+    RingBuffer ring;
+
+    // Two staging buffers: one is filled while the other is being sent. Only one send is in
+    // flight at a time (sends on the same socket are not ordered), alternating between the two.
+    char *sendBuffers[2];
+    size_t sendLength[2];
+    size_t sendOffset[2];
+    int sendBusy[2];
+    int fill;
+    int sendNext;
+    int sending;
+
+    unsigned long syscalls;
+};
+
+/*
+Description:
+    Enters the kernel to submit queued entries and optionally wait for completions.
+Arguments:
+    UringSocket *uring: The transport
+    unsigned minComplete: The number of completions to wait for
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int enter(UringSocket *uring, unsigned minComplete) {
+    unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int submitted =
+        syscall(__NR_io_uring_enter, uring->ringfd, uring->toSubmit, minComplete, flags, NULL, 0);
+
+    uring->syscalls++;
+    if (submitted == -1) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+            return 0;
+        log_error("io_uring_enter failed: %s", strerror(errno));
+        return 1;
+    }
+    uring->toSubmit -= submitted;
+    return 0;
+}
+
+/*
+Description:
+    Returns a cleared submission queue entry, submitting queued entries first if the queue is full.
+Arguments:
+    UringSocket *uring: The transport
+Return value:
+    Returns the entry, or NULL on failure
+*/
+static struct io_uring_sqe *getSqe(UringSocket *uring) {
+    unsigned tail = *uring->sqTail;
+
+    while (tail - __atomic_load_n(uring->sqHead, __ATOMIC_ACQUIRE) >= uring->sqEntries) {
+        if (enter(uring, 0))
+            return NULL;
+    }
+
+    unsigned index = tail & uring->sqMask;
+    struct io_uring_sqe *sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    uring->sqArray[index] = index;
+    __atomic_store_n(uring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    uring->toSubmit++;
+    return sqe;
+}
+
+/*
+Description:
+    Queues a recv that picks its buffer from the provided buffer ring.
+Arguments:
+    UringSocket *uring: The transport
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int armRecv(UringSocket *uring) {
+    struct io_uring_sqe *sqe = getSqe(uring);
+    if (sqe == NULL)
+        return 1;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = uring->sockfd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->ioprio = uring->multishot ? IORING_RECV_MULTISHOT : 0;
+    sqe->user_data = RECV_TAG;
+    uring->recvArmed = 1;
+    return 0;
+}
+
+/*
+Description:
+    Queues a send of the unsent part of a staging buffer.
+Arguments:
+    UringSocket *uring: The transport
+    int half: The staging buffer to send
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int queueSend(UringSocket *uring, int half) {
+    struct io_uring_sqe *sqe = getSqe(uring);
+    if (sqe == NULL)
+        return 1;
+    uring->sending = 1;
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = uring->sockfd;
+    sqe->addr = (uintptr_t)(uring->sendBuffers[half] + uring->sendOffset[half]);
+    sqe->len = uring->sendLength[half] - uring->sendOffset[half];
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = half;
+    return 0;
+}
+
+/*
+Description:
+    Starts sending the next staging buffer if it is ready and no other send is in flight.
+Arguments:
+    UringSocket *uring: The transport
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int startSend(UringSocket *uring) {
+    if (uring->sending || !uring->sendBusy[uring->sendNext])
+        return 0;
+    return queueSend(uring, uring->sendNext);
+}
+
+/*
+Description:
+    Gives a receive buffer back to the kernel.
+Arguments:
+    UringSocket *uring: The transport
+    unsigned short bid: The buffer ID
+Return value:
+    None.
+*/
+static void recycleBuffer(UringSocket *uring, unsigned short bid) {
+    struct io_uring_buf *buf = &uring->bufRing->bufs[uring->bufTail & (URING_RECV_BUFFER_COUNT - 1)];
+
+    buf->addr = (uintptr_t)(uring->recvBuffers + (size_t)bid * URING_RECV_BUFFER_SIZE);
+    buf->len = URING_RECV_BUFFER_SIZE;
+    buf->bid = bid;
+    uring->bufTail++;
+    __atomic_store_n(&uring->bufRing->tail, uring->bufTail, __ATOMIC_RELEASE);
+}
+
+/*
+Description:
+    Handles one recv completion, appending the data to the ring buffer.
+Arguments:
+    UringSocket *uring: The transport
+    struct io_uring_cqe *cqe: The completion
+Return value:
+    None.
+*/
+static void completeRecv(UringSocket *uring, struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        uring->recvArmed = 0;
+
+    if (cqe->res > 0) {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        RingBuffer *ring = &uring->ring;
+        if (ring_buffer_reserve(ring, ring_buffer_length(ring) + cqe->res)) {
+            uring->failed = 1;
+        } else {
+            memcpy(ring->data + ring->tail,
+                   uring->recvBuffers + (size_t)bid * URING_RECV_BUFFER_SIZE, cqe->res);
+            ring->tail += cqe->res;
+            uring->received += cqe->res;
+        }
+        recycleBuffer(uring, bid);
+    } else if (cqe->res == 0) {
+        uring->peerClosed = 1;
+    } else if (cqe->res == -EINVAL && uring->multishot) {
+        log_info("Multishot recv is not supported, using single-shot recv");
+        uring->multishot = 0;
+    } else if (cqe->res != -ENOBUFS && cqe->res != -EINTR && cqe->res != -EAGAIN) {
+        log_error("io_uring recv failed: %s", strerror(-cqe->res));
+        uring->failed = 1;
+    }
+}
+
+/*
+Description:
+    Handles one send completion, resending the rest of a short send.
+Arguments:
+    UringSocket *uring: The transport
+    struct io_uring_cqe *cqe: The completion
+Return value:
+    None.
+*/
+static void completeSend(UringSocket *uring, struct io_uring_cqe *cqe) {
+    int half = cqe->user_data;
+
+    if (cqe->res < 0 && cqe->res != -EINTR && cqe->res != -EAGAIN) {
+        log_error("io_uring send failed: %s", strerror(-cqe->res));
+        uring->failed = 1;
+        uring->sendBusy[half] = 0;
+        uring->sending = 0;
+        return;
+    }
+    if (cqe->res > 0)
+        uring->sendOffset[half] += cqe->res;
+    if (uring->sendOffset[half] < uring->sendLength[half]) {
+        if (queueSend(uring, half))
+            uring->failed = 1;
+        return;
+    }
+    uring->sendBusy[half] = 0;
+    uring->sendLength[half] = 0;
+    uring->sendOffset[half] = 0;
+    uring->sending = 0;
+    uring->sendNext ^= 1;
+    if (startSend(uring))
+        uring->failed = 1;
+}
+
+/*
+Description:
+    Submits queued entries, waits for at least one completion and handles every completion that is
+    ready. The recv is re-armed first so responses keep being read while waiting on a send.
+Arguments:
+    UringSocket *uring: The transport
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int pump(UringSocket *uring) {
+    if (!uring->recvArmed && !uring->peerClosed && armRecv(uring))
+        return 1;
+    if (enter(uring, 1))
+        return 1;
+
+    unsigned head = *uring->cqHead;
+    unsigned tail = __atomic_load_n(uring->cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &uring->cqes[head & uring->cqMask];
+        if (cqe->user_data == RECV_TAG)
+            completeRecv(uring, cqe);
+        else
+            completeSend(uring, cqe);
+        head++;
+    }
+    __atomic_store_n(uring->cqHead, head, __ATOMIC_RELEASE);
+    return uring->failed;
+}
+
+/*
+Description:
+    Queues the staging buffer being filled (if it holds anything) and switches to the other one.
+Arguments:
+    UringSocket *uring: The transport
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int queueFill(UringSocket *uring) {
+    if (uring->sendLength[uring->fill] == 0)
+        return 0;
+    uring->sendBusy[uring->fill] = 1;
+    uring->fill ^= 1;
+    return startSend(uring);
+}
+
+/*
+Description:
+    Sets up an io_uring instance for a connected socket.
+Arguments:
+    int sockfd: Socket file descriptor
+    int multishot: Whether to try multishot recv; single-shot recv is used when it is not set or
+                   the kernel rejects it
+Return value:
+    Returns the transport, or NULL if io_uring is not available (the caller should fall back to
+    the blocking socket functions).
+*/
+UringSocket *uring_socket_create(int sockfd, int multishot) {
+    struct io_uring_params params;
+    UringSocket *uring = calloc(1, sizeof(UringSocket));
+
+    if (uring == NULL)
+        return NULL;
+    uring->sockfd = sockfd;
+    uring->multishot = multishot;
+
+    memset(&params, 0, sizeof(params));
+    uring->ringfd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (uring->ringfd == -1) {
+        log_info("io_uring_setup failed: %s", strerror(errno));
+        free(uring);
+        return NULL;
+    }
+
+    uring->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring->cqMapSize > uring->sqMapSize)
+            uring->sqMapSize = uring->cqMapSize;
+    }
+    uring->sqMap = mmap(NULL, uring->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        uring->ringfd, IORING_OFF_SQ_RING);
+    if (uring->sqMap == MAP_FAILED)
+        goto fail;
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        uring->cqMap = uring->sqMap;
+    } else {
+        uring->cqMap = mmap(NULL, uring->cqMapSize, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, uring->ringfd, IORING_OFF_CQ_RING);
+        if (uring->cqMap == MAP_FAILED)
+            goto fail;
+    }
+    uring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       uring->ringfd, IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED)
+        goto fail;
+
+    char *sq = uring->sqMap;
+    char *cq = uring->cqMap;
+    uring->sqHead = (unsigned *)(sq + params.sq_off.head);
+    uring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    uring->sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    uring->sqEntries = *(unsigned *)(sq + params.sq_off.ring_entries);
+    uring->sqArray = (unsigned *)(sq + params.sq_off.array);
+    uring->cqHead = (unsigned *)(cq + params.cq_off.head);
+    uring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    uring->cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // Registers the receive buffers as a provided buffer ring (Linux 5.19+)
+    uring->bufRingSize = URING_RECV_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    uring->bufRing = mmap(NULL, uring->bufRingSize, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    uring->recvBuffers = malloc((size_t)URING_RECV_BUFFER_COUNT * URING_RECV_BUFFER_SIZE);
+    if (uring->bufRing == MAP_FAILED || uring->recvBuffers == NULL)
+        goto fail;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)uring->bufRing;
+    reg.ring_entries = URING_RECV_BUFFER_COUNT;
+    reg.bgid = BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, uring->ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        log_info("Provided buffer rings are not supported: %s", strerror(errno));
+        goto fail;
+    }
+    for (unsigned short bid = 0; bid < URING_RECV_BUFFER_COUNT; bid++)
+        recycleBuffer(uring, bid);
+
+    uring->sendBuffers[0] = malloc(URING_SEND_BUFFER_SIZE);
+    uring->sendBuffers[1] = malloc(URING_SEND_BUFFER_SIZE);
+    if (uring->sendBuffers[0] == NULL || uring->sendBuffers[1] == NULL ||
+        ring_buffer_init(&uring->ring, RING_BUFFER_DEFAULT_CAPACITY))
+        goto fail;
+
+    log_info("Using the io_uring backend");
+    return uring;
+
+fail:
+    uring_socket_destroy(uring);
+    return NULL;
+}
+
+/*
+Description:
+    Tears down the io_uring instance. The socket itself is not closed.
+Arguments:
+    UringSocket *uring: The transport to destroy
+Return value:
+    None.
+*/
+void uring_socket_destroy(UringSocket *uring) {
+    if (uring == NULL)
+        return;
+    if (uring->sqes != NULL && uring->sqes != MAP_FAILED)
+        munmap(uring->sqes, uring->sqesSize);
+    if (uring->cqMap != NULL && uring->cqMap != MAP_FAILED && uring->cqMap != uring->sqMap)
+        munmap(uring->cqMap, uring->cqMapSize);
+    if (uring->sqMap != NULL && uring->sqMap != MAP_FAILED)
+        munmap(uring->sqMap, uring->sqMapSize);
+    close(uring->ringfd);
+    if (uring->bufRing != NULL && uring->bufRing != MAP_FAILED)
+        munmap(uring->bufRing, uring->bufRingSize);
+    free(uring->recvBuffers);
+    free(uring->sendBuffers[0]);
+    free(uring->sendBuffers[1]);
+    ring_buffer_free(&uring->ring);
+    free(uring);
+}
+
+/*
+Description:
+    Copies the bytes into the staging buffer. A full staging buffer is queued for sending, but
+    nothing is submitted until the next flush or receive.
+Arguments:
+    UringSocket *uring: The transport
+    const char *buf: The bytes to send
+    size_t length: The number of bytes to send
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int uring_socket_send(UringSocket *uring, const char *buf, size_t length) {
+    while (length > 0) {
+        int half = uring->fill;
+        while (uring->sendBusy[half]) {
+            if (pump(uring))
+                return 1;
+        }
+
+        size_t chunk = URING_SEND_BUFFER_SIZE - uring->sendLength[half];
+        if (chunk > length)
+            chunk = length;
+        memcpy(uring->sendBuffers[half] + uring->sendLength[half], buf, chunk);
+        uring->sendLength[half] += chunk;
+        buf += chunk;
+        length -= chunk;
+
+        if (uring->sendLength[half] == URING_SEND_BUFFER_SIZE && queueFill(uring))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Submits every staged send and waits until the kernel has sent all of them.
+Arguments:
+    UringSocket *uring: The transport
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int uring_socket_flush(UringSocket *uring) {
+    if (queueFill(uring))
+        return 1;
+    while (uring->sendBusy[0] || uring->sendBusy[1]) {
+        if (pump(uring))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Submits any staged sends and waits until more data has been received into the ring buffer
+    returned by uring_socket_ring.
+Arguments:
+    UringSocket *uring: The transport
+Return value:
+    Returns the number of bytes received, 0 if the peer closed the connection, -1 on error.
+*/
+ssize_t uring_socket_recv(UringSocket *uring) {
+    if (!uring->sendBusy[uring->fill] && queueFill(uring))
+        return -1;
+
+    // Data may already have arrived while waiting for a send to finish
+    while (uring->received == 0 && !uring->peerClosed) {
+        if (pump(uring))
+            return -1;
+    }
+    if (uring->failed)
+        return -1;
+
+    ssize_t received = uring->received;
+    uring->received = 0;
+    return received;
+}
+
+/*
+Description:
+    Returns the buffer that received data is appended to.
+Arguments:
+    UringSocket *uring: The transport
+Return value:
+    The receive ring buffer.
+*/
+RingBuffer *uring_socket_ring(UringSocket *uring) { return &uring->ring; }
+
+/*
+Description:
+    Returns the number of io_uring_enter system calls made so far.
+Arguments:
+    UringSocket *uring: The transport
+Return value:
+    The number of system calls.
+*/
+unsigned long uring_socket_syscalls(UringSocket *uring) { return uring->syscalls; }
+
+#else
+
+UringSocket *uring_socket_create(int sockfd, int multishot) {
+    (void)sockfd;
+    (void)multishot;
+    log_info("Built without io_uring support");
+    return NULL;
+}
+
+void uring_socket_destroy(UringSocket *uring) { (void)uring; }
+
+int uring_socket_send(UringSocket *uring, const char *buf, size_t length) {
+    (void)uring;
+    (void)buf;
+    (void)length;
+    return 1;
+}
+
+int uring_socket_flush(UringSocket *uring) {
+    (void)uring;
+    return 1;
+}
+
+ssize_t uring_socket_recv(UringSocket *uring) {
+    (void)uring;
+    return -1;
+}
+
+RingBuffer *uring_socket_ring(UringSocket *uring) {
+    (void)uring;
+    return NULL;
+}
+
+unsigned long uring_socket_syscalls(UringSocket *uring) {
+    (void)uring;
+    return 0;
+}
+
+#endif
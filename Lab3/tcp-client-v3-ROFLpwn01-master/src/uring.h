@@ -0,0 +1,101 @@
+#ifndef URING_H_
+#define URING_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "ring_buffer.h"
+
+#define URING_ENTRIES 64
+#define URING_SEND_BUFFER_SIZE 65536
+#define URING_RECV_BUFFER_SIZE 16384
+#define URING_RECV_BUFFER_COUNT 16
+
+/*
+io_uring transport for one connected socket. Sends are copied into one of two staging buffers and
+submitted together with the next wait for completions, so many frames share one io_uring_enter.
+Data is received with a multishot recv (single-shot on kernels without it) into a ring of
+buffers registered with the kernel, then appended to a RingBuffer for parsing.
+Only built when the kernel headers provide multishot recv and provided buffer rings
+(TCP_CLIENT_HAVE_IO_URING); otherwise uring_socket_create always returns NULL.
+*/
+typedef struct UringSocket UringSocket;
+
+/*
+Description:
+    Sets up an io_uring instance for a connected socket.
+Arguments:
+    int sockfd: Socket file descriptor
+    int multishot: Whether to try multishot recv; single-shot recv is used when it is not set or
+                   the kernel rejects it
+Return value:
+    Returns the transport, or NULL if io_uring is not available (the caller should fall back to
+    the blocking socket functions).
+*/
+UringSocket *uring_socket_create(int sockfd, int multishot);
+
+/*
+Description:
+    Tears down the io_uring instance. The socket itself is not closed.
+Arguments:
+    UringSocket *uring: The transport to destroy
+Return value:
+    None.
+*/
+void uring_socket_destroy(UringSocket *uring);
+
+/*
+Description:
+    Copies the bytes into the staging buffer. A full staging buffer is queued for sending, but
+    nothing is submitted until the next flush or receive.
+Arguments:
+    UringSocket *uring: The transport
+    const char *buf: The bytes to send
+    size_t length: The number of bytes to send
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int uring_socket_send(UringSocket *uring, const char *buf, size_t length);
+
+/*
+Description:
+    Submits every staged send and waits until the kernel has sent all of them.
+Arguments:
+    UringSocket *uring: The transport
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int uring_socket_flush(UringSocket *uring);
+
+/*
+Description:
+    Submits any staged sends and waits until more data has been received into the ring buffer
+    returned by uring_socket_ring.
+Arguments:
+    UringSocket *uring: The transport
+Return value:
+    Returns the number of bytes received, 0 if the peer closed the connection, -1 on error.
+*/
+ssize_t uring_socket_recv(UringSocket *uring);
+
+/*
+Description:
+    Returns the buffer that received data is appended to.
+Arguments:
+    UringSocket *uring: The transport
+Return value:
+    The receive ring buffer.
+*/
+RingBuffer *uring_socket_ring(UringSocket *uring);
+
+/*
+Description:
+    Returns the number of io_uring_enter system calls made so far.
+Arguments:
+    UringSocket *uring: The transport
+Return value:
+    The number of system calls.
+*/
+unsigned long uring_socket_syscalls(UringSocket *uring);
+
+#endif
@@ -0,0 +1,334 @@
+#include "v4.h"
+#include "input_reader.h"
+#include "log.h"
+#include "reorder_buffer.h"
+#include "send_batch.h"
+
+#include <fcntl.h>
+
+/*
+State of one v4 pipeline. With ordered output, responses go through the reorder buffer, and pending
+(indexed by sequence number modulo the window) tells each request's callback its sequence number.
+*/
+typedef struct V4Pending V4Pending;
+
+typedef struct V4Pipeline {
+    TcpClientSession *session;
+    V4Pending *pending;
+    ReorderBuffer reorder;
+} V4Pipeline;
+
+struct V4Pending {
+    V4Pipeline *pipeline;
+    uint64_t sequence;
+};
+
+/*
+Description:
+    Allocates a table with room for at least twice maxInFlight requests.
+Arguments:
+    V4Table *table: The table to initialize
+    size_t maxInFlight: The most requests that will be in flight at once
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int v4_table_init(V4Table *table, size_t maxInFlight) {
+    memset(table, 0, sizeof(V4Table));
+    table->capacity = 16;
+    while (table->capacity < 2 * maxInFlight)
+        table->capacity *= 2;
+    table->slots = calloc(table->capacity, sizeof(V4Slot));
+    if (table->slots == NULL) {
+        log_error("Unable to allocate the in-flight table");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Frees a table. Requests still in flight are forgotten.
+Arguments:
+    V4Table *table: The table to free
+Return value:
+    None.
+*/
+void v4_table_free(V4Table *table) {
+    free(table->slots);
+    memset(table, 0, sizeof(V4Table));
+}
+
+/*
+Description:
+    Registers a request and picks its ID.
+Arguments:
+    V4Table *table: The table
+    V4Callback callback: Called with the response
+    void *context: Passed to the callback
+    uint32_t *id: Set to the request's ID
+Return value:
+    Returns a 1 on failure (the table is full), 0 on success
+*/
+int v4_table_add(V4Table *table, V4Callback callback, void *context, uint32_t *id) {
+    for (size_t tries = 0; tries < table->capacity; tries++) {
+        V4Slot *slot = &table->slots[table->nextId & (table->capacity - 1)];
+        uint32_t candidate = table->nextId++;
+        if (slot->active)
+            continue;
+        slot->id = candidate;
+        slot->active = 1;
+        slot->callback = callback;
+        slot->context = context;
+        table->active++;
+        *id = candidate;
+        return 0;
+    }
+    log_error("The in-flight table is full");
+    return 1;
+}
+
+/*
+Description:
+    Hands a response to the callback of the request with its ID and forgets the request.
+Arguments:
+    V4Table *table: The table
+    uint32_t id: The ID from the response
+    const char *response: The response
+    size_t length: The length of the response
+Return value:
+    Returns what the callback returns, or -1 if no request with the ID is in flight.
+*/
+int v4_table_complete(V4Table *table, uint32_t id, const char *response, size_t length) {
+    V4Slot *slot = &table->slots[id & (table->capacity - 1)];
+
+    if (!slot->active || slot->id != id) {
+        log_error("Received a response for request %u, which is not in flight", id);
+        return -1;
+    }
+    // Freed first so the callback can send another request
+    slot->active = 0;
+    table->active--;
+    return slot->callback(response, length, slot->context);
+}
+
+/*
+Description:
+    Takes the next complete v4 response out of the ring buffer without copying it. When no complete
+    response is buffered, the buffer is reserved so the rest of the partial frame will fit.
+Arguments:
+    RingBuffer *ring: The ring buffer holding received data
+    uint32_t *id: Set to the ID of the request being answered
+    char **response: Set to point at the response inside the ring buffer
+    size_t *length: Set to the length of the response
+Return value:
+    Returns 1 if a response was found, 0 if more data is needed, or -1 on failure
+*/
+int v4_next_response(RingBuffer *ring, uint32_t *id, char **response, size_t *length) {
+    uint32_t header[2];
+
+    if (ring_buffer_length(ring) < V4_RESPONSE_HEADER_SIZE)
+        return 0;
+    memcpy(header, ring->data + ring->head, V4_RESPONSE_HEADER_SIZE);
+    size_t frameLength = V4_RESPONSE_HEADER_SIZE + (size_t)ntohl(header[0]);
+    if (ring_buffer_length(ring) < frameLength)
+        return ring_buffer_reserve(ring, frameLength) ? -1 : 0;
+
+    *id = ntohl(header[1]);
+    *response = ring->data + ring->head + V4_RESPONSE_HEADER_SIZE;
+    *length = frameLength - V4_RESPONSE_HEADER_SIZE;
+    ring_buffer_consume(ring, frameLength);
+    return 1;
+}
+
+/*
+Description:
+    Callback for pipeline requests whose responses go straight to the caller.
+Arguments:
+    const char *response: The response
+    size_t length: The length of the response
+    void *context: The pipeline
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int deliverUnordered(const char *response, size_t length, void *context) {
+    V4Pipeline *pipeline = context;
+    return tcp_client_session_deliver(pipeline->session, response, length);
+}
+
+/*
+Description:
+    Callback for pipeline requests whose responses are handed over in input order, through the
+    pipeline's reorder buffer.
+Arguments:
+    const char *response: The response
+    size_t length: The length of the response
+    void *context: The request's V4Pending entry
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int deliverOrdered(const char *response, size_t length, void *context) {
+    V4Pending *entry = context;
+    return reorder_buffer_deliver(&entry->pipeline->reorder, entry->sequence, response, length);
+}
+
+/*
+Description:
+    v4 version of tcp_client_session_pipeline. Negotiates v4, then sends every line of the file and
+    hands the responses to the session as they arrive, in whatever order the server finishes them. If
+    config.ordered is set the responses are handed over in the order of the file instead, holding
+    early ones back until the requests before them are answered. At most config.maxInFlight
+    requests are unanswered (or, when ordered, not yet handed over) at once. A server without v4,
+    including one that drops the connection on the hello, gets the v3 pipeline instead.
+Arguments:
+    TcpClientSession *session: The session, connected with a plain socket
+    FILE *fd: The file pointer to read requests from
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int v4_pipeline(TcpClientSession *session, FILE *fd) {
+    Config config = session->config;
+    int sockfd = session->sockfd;
+    SendBatch *batch = &session->batch;
+    RingBuffer *ring = &session->ring;
+    char accepted[TCP_CLIENT_MAX_HELLO];
+    V4Pipeline pipeline = {session, NULL, {0}};
+    V4Table table = {0};
+    InputReader reader;
+    InputLine held;
+    uint32_t heldHeader = 0;
+    int holding = 0;
+    uint64_t sequence = 0;
+    int endOfFile = 0;
+    int result = 1;
+
+    if (tcp_client_session_hello(session, V4_FEATURE, accepted, sizeof(accepted)))
+        return 1;
+    if (!tcp_client_has_feature(accepted, V4_FEATURE)) {
+        // v3 answers in order, so the responses still come out in the order of the file
+        log_warn("The server does not support protocol v4, sending v3 frames");
+        return tcp_client_session_pipeline(session, fd);
+    }
+    if (input_reader_open(&reader, fd))
+        return 1;
+    int copy = !reader.mapped;
+
+    int flags = fcntl(sockfd, F_GETFL);
+    if (flags == -1 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        log_error("Unable to set up the pipeline");
+        input_reader_close(&reader);
+        return 1;
+    }
+    if (v4_table_init(&table, config.maxInFlight))
+        goto done;
+    if (config.ordered) {
+        if (reorder_buffer_init(&pipeline.reorder, session, config.maxInFlight))
+            goto done;
+        pipeline.pending = calloc(config.maxInFlight, sizeof(V4Pending));
+        if (pipeline.pending == NULL) {
+            log_error("Unable to allocate the reorder buffer");
+            goto done;
+        }
+    }
+
+    log_info("Starting v4 pipeline with at most %zu requests in flight%s", config.maxInFlight,
+             config.ordered ? ", in input order" : "");
+    while (1) {
+        // With ordered output, held responses count against the window too
+        while (!endOfFile && !send_batch_should_flush(batch) &&
+               (config.ordered ? reorder_buffer_has_room(&pipeline.reorder, sequence)
+                               : table.active < config.maxInFlight)) {
+            if (!holding) {
+                // A slow input must not hold the queued frames past the batch deadline
+                struct timespec timeout;
+                if (!reader.mapped && send_batch_timeout(batch, &timeout)) {
+                    int ready = input_reader_wait(&reader, &timeout);
+                    if (ready == -1)
+                        goto done;
+                    if (ready == 0)
+                        break;
+                }
+                int found = tcp_client_next_request(&reader, &heldHeader, &held);
+                if (found == -1)
+                    goto done;
+                if (found == 0) {
+                    endOfFile = 1;
+                    break;
+                }
+                holding = 1;
+            }
+            if (!send_batch_has_room(batch, held.messageLength, copy))
+                break;
+
+            uint32_t id;
+            if (config.ordered) {
+                V4Pending *entry = &pipeline.pending[sequence % config.maxInFlight];
+                entry->pipeline = &pipeline;
+                entry->sequence = sequence;
+                if (v4_table_add(&table, deliverOrdered, entry, &id))
+                    goto done;
+            } else if (v4_table_add(&table, deliverUnordered, &pipeline, &id)) {
+                goto done;
+            }
+            if (send_batch_add_tagged(batch, heldHeader, htonl(id), held.message,
+                                     held.messageLength, copy))
+                goto done;
+            holding = 0;
+            sequence++;
+            session->messagesSent++;
+        }
+
+        // Writes as much as the socket takes right away; the rest waits for POLLOUT
+        if (send_batch_pending(batch) > 0 &&
+            tcp_client_flush_batch(batch, sockfd, session->profile, 0))
+            goto done;
+        if (endOfFile && table.active == 0 && send_batch_pending(batch) == 0)
+            break;
+
+        struct pollfd pfd = {.fd = sockfd, .events = POLLIN};
+        if (send_batch_pending(batch) > 0)
+            pfd.events |= POLLOUT;
+        if (poll(&pfd, 1, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            log_error("poll failed: %s", strerror(errno));
+            goto done;
+        }
+
+        if ((pfd.revents & POLLOUT) && tcp_client_flush_batch(batch, sockfd, session->profile, 0))
+            goto done;
+
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t bytesReceived = ring_buffer_recv(ring, sockfd, 0);
+            if (bytesReceived == 0) {
+                log_error("Server closed the connection with %zu requests in flight",
+                          table.active);
+                goto done;
+            }
+            if (bytesReceived == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    continue;
+                log_error("Error receiving data: %s", strerror(errno));
+                goto done;
+            }
+
+            uint32_t id;
+            char *response;
+            size_t length;
+            int found;
+            while ((found = v4_next_response(ring, &id, &response, &length)) == 1)
+                if (v4_table_complete(&table, id, response, length))
+                    goto done;
+            if (found == -1)
+                goto done;
+        }
+    }
+    result = 0;
+
+done:
+    reorder_buffer_free(&pipeline.reorder);
+    free(pipeline.pending);
+    fcntl(sockfd, F_SETFL, flags);
+    v4_table_free(&table);
+    input_reader_close(&reader);
+    return result;
+}
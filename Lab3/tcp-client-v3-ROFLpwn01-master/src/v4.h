@@ -0,0 +1,127 @@
+#ifndef V4_H_
+#define V4_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ring_buffer.h"
+#include "tcp_client.h"
+
+#define V4_FEATURE "v4"
+#define V4_REQUEST_HEADER_SIZE 8
+#define V4_RESPONSE_HEADER_SIZE 8
+
+/*
+Protocol v4 adds a 32-bit request ID (network byte order) after the header of every request and
+after the length of every response, so the server may finish requests in any order. It is turned
+on per connection with tcp_client_hello("v4"); after that the frames are
+
+    request:  action << 27 | length, ID, message
+    response: length, ID, response
+
+The client keeps the requests it is waiting for in a V4Table keyed by ID, and each response is
+handed to the callback its request was sent with.
+*/
+
+/*
+Called with a response to a request. Returns 0 on success, nonzero on failure.
+*/
+typedef int (*V4Callback)(const char *response, size_t length, void *context);
+
+typedef struct V4Slot {
+    uint32_t id;
+    int active;
+    V4Callback callback;
+    void *context;
+} V4Slot;
+
+/*
+Requests in flight, in a power-of-two array indexed by the low bits of their ID. IDs are handed out
+in sequence, skipping any whose slot is still held by a slow request.
+*/
+typedef struct V4Table {
+    V4Slot *slots;
+    size_t capacity;
+    size_t active;
+    uint32_t nextId;
+} V4Table;
+
+/*
+Description:
+    Allocates a table with room for at least twice maxInFlight requests.
+Arguments:
+    V4Table *table: The table to initialize
+    size_t maxInFlight: The most requests that will be in flight at once
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int v4_table_init(V4Table *table, size_t maxInFlight);
+
+/*
+Description:
+    Frees a table. Requests still in flight are forgotten.
+Arguments:
+    V4Table *table: The table to free
+Return value:
+    None.
+*/
+void v4_table_free(V4Table *table);
+
+/*
+Description:
+    Registers a request and picks its ID.
+Arguments:
+    V4Table *table: The table
+    V4Callback callback: Called with the response
+    void *context: Passed to the callback
+    uint32_t *id: Set to the request's ID
+Return value:
+    Returns a 1 on failure (the table is full), 0 on success
+*/
+int v4_table_add(V4Table *table, V4Callback callback, void *context, uint32_t *id);
+
+/*
+Description:
+    Hands a response to the callback of the request with its ID and forgets the request.
+Arguments:
+    V4Table *table: The table
+    uint32_t id: The ID from the response
+    const char *response: The response
+    size_t length: The length of the response
+Return value:
+    Returns what the callback returns, or -1 if no request with the ID is in flight.
+*/
+int v4_table_complete(V4Table *table, uint32_t id, const char *response, size_t length);
+
+/*
+Description:
+    Takes the next complete v4 response out of the ring buffer without copying it. When no complete
+    response is buffered, the buffer is reserved so the rest of the partial frame will fit.
+Arguments:
+    RingBuffer *ring: The ring buffer holding received data
+    uint32_t *id: Set to the ID of the request being answered
+    char **response: Set to point at the response inside the ring buffer
+    size_t *length: Set to the length of the response
+Return value:
+    Returns 1 if a response was found, 0 if more data is needed, or -1 on failure
+*/
+int v4_next_response(RingBuffer *ring, uint32_t *id, char **response, size_t *length);
+
+/*
+Description:
+    v4 version of tcp_client_session_pipeline. Negotiates v4, then sends every line of the file and
+    hands the responses to the session as they arrive, in whatever order the server finishes them. If
+    config.ordered is set the responses are handed over in the order of the file instead, holding
+    early ones back until the requests before them are answered. At most config.maxInFlight
+    requests are unanswered (or, when ordered, not yet handed over) at once. A server without v4,
+    including one that drops the connection on the hello, gets the v3 pipeline instead.
+Arguments:
+    TcpClientSession *session: The session, connected with a plain socket
+    FILE *fd: The file pointer to read requests from
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+int v4_pipeline(TcpClientSession *session, FILE *fd);
+
+#endif
@@ -0,0 +1,60 @@
+#include "actions.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Description:
+    Applies an action to a message.
+Arguments:
+    uint32_t action: The action code
+    const char *message: The message
+    size_t length: The length of the message
+    char *out: A buffer of at least 2 * length bytes for the result
+    unsigned *seed: State of the random number generator
+Return value:
+    The length of the result.
+*/
+size_t actions_apply(uint32_t action, const char *message, size_t length, char *out,
+                     unsigned *seed) {
+    size_t outLength = 0;
+
+    switch (action) {
+    case ACTIONS_UPPERCASE:
+        for (size_t i = 0; i < length; i++)
+            out[i] = toupper((unsigned char)message[i]);
+        return length;
+    case ACTIONS_LOWERCASE:
+        for (size_t i = 0; i < length; i++)
+            out[i] = tolower((unsigned char)message[i]);
+        return length;
+    case ACTIONS_REVERSE:
+        for (size_t i = 0; i < length; i++)
+            out[i] = message[length - 1 - i];
+        return length;
+    case ACTIONS_SHUFFLE:
+        memcpy(out, message, length);
+        for (size_t i = length; i > 1; i--) {
+            size_t j = rand_r(seed) % i;
+            char swap = out[i - 1];
+            out[i - 1] = out[j];
+            out[j] = swap;
+        }
+        return length;
+    case ACTIONS_RANDOM:
+        // Drops about one character in six and doubles about one in six
+        for (size_t i = 0; i < length; i++) {
+            unsigned pick = rand_r(seed) % 6;
+            if (pick == 0)
+                continue;
+            out[outLength++] = message[i];
+            if (pick == 1)
+                out[outLength++] = message[i];
+        }
+        return outLength;
+    default:
+        memcpy(out, message, length);
+        return length;
+    }
+}
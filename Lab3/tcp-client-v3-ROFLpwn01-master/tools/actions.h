@@ -0,0 +1,28 @@
+#ifndef ACTIONS_H_
+#define ACTIONS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ACTIONS_UPPERCASE 0x01
+#define ACTIONS_LOWERCASE 0x02
+#define ACTIONS_REVERSE 0x04
+#define ACTIONS_SHUFFLE 0x08
+#define ACTIONS_RANDOM 0x10
+
+/*
+Description:
+    Applies an action to a message.
+Arguments:
+    uint32_t action: The action code
+    const char *message: The message
+    size_t length: The length of the message
+    char *out: A buffer of at least 2 * length bytes for the result
+    unsigned *seed: State of the random number generator
+Return value:
+    The length of the result.
+*/
+size_t actions_apply(uint32_t action, const char *message, size_t length, char *out,
+                     unsigned *seed);
+
+#endif
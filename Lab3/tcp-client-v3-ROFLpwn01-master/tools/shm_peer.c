@@ -0,0 +1,118 @@
+/*
+Reference server for the shared memory transport (--host shm:NAME). Creates the region NAME and
+answers v3 request frames from one client at a time with the same actions as the socket server:
+uppercase, lowercase, reverse, shuffle and random.
+
+Usage: shm_peer [-v] [-s BYTES] NAME
+*/
+#include <arpa/inet.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "actions.h"
+#include "log.h"
+#include "shm_transport.h"
+#include "tcp_client.h"
+
+#define FRAME_LENGTH_MASK ((1u << 27) - 1)
+
+static volatile sig_atomic_t stopping = 0;
+
+static void handleSignal(int signal) {
+    (void)signal;
+    stopping = 1;
+}
+
+/*
+Description:
+    Answers every complete request frame in the ring buffer.
+Arguments:
+    ShmTransport *shm: The transport
+    char **out: A scratch buffer for results, grown as needed
+    size_t *outCapacity: The size of *out
+    unsigned *seed: State of the random number generator
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int answerRequests(ShmTransport *shm, char **out, size_t *outCapacity, unsigned *seed) {
+    RingBuffer *ring = shm_transport_ring(shm);
+
+    while (ring_buffer_length(ring) >= TCP_CLIENT_REQUEST_HEADER_SIZE) {
+        uint32_t header;
+        memcpy(&header, ring->data + ring->head, sizeof(header));
+        header = ntohl(header);
+        uint32_t length = header & FRAME_LENGTH_MASK;
+        if (ring_buffer_length(ring) - sizeof(header) < length)
+            return 0;
+
+        if (*outCapacity < 2 * (size_t)length) {
+            char *grown = realloc(*out, 2 * (size_t)length);
+            if (grown == NULL) {
+                log_error("Unable to allocate %u bytes for a response", 2 * length);
+                return 1;
+            }
+            *out = grown;
+            *outCapacity = 2 * (size_t)length;
+        }
+        size_t outLength = actions_apply(header >> 27, ring->data + ring->head + sizeof(header),
+                                         length, *out, seed);
+        log_debug("Action %u, %u bytes in, %zu bytes out", header >> 27, length, outLength);
+
+        uint32_t responseHeader = htonl(outLength);
+        if (shm_transport_send(shm, (char *)&responseHeader, sizeof(responseHeader)) ||
+            shm_transport_send(shm, *out, outLength))
+            return 1;
+        ring_buffer_consume(ring, sizeof(header) + length);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    size_t capacity = SHM_TRANSPORT_DEFAULT_CAPACITY;
+    unsigned seed = time(NULL);
+    char *out = NULL;
+    size_t outCapacity = 0;
+    int option;
+
+    log_set_level(LOG_INFO);
+    while ((option = getopt(argc, argv, "vs:")) != -1) {
+        if (option == 'v') {
+            log_set_level(LOG_DEBUG);
+        } else if (option == 's') {
+            capacity = strtoul(optarg, NULL, 10);
+        } else {
+            fprintf(stderr, "Usage: shm_peer [-v] [-s BYTES] NAME\n");
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: shm_peer [-v] [-s BYTES] NAME\n");
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction action = {.sa_handler = handleSignal};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    ShmTransport *shm = shm_transport_listen(argv[optind], capacity);
+    if (shm == NULL)
+        return EXIT_FAILURE;
+    int fd = shm_transport_fd(shm);
+
+    while (!stopping && shm_transport_accept(shm) == 0) {
+        ssize_t received;
+        while (!stopping && (received = shm_transport_recv(shm)) > 0)
+            if (answerRequests(shm, &out, &outCapacity, &seed))
+                break;
+        log_info("Client disconnected after %lu futex calls", shm_transport_syscalls(shm));
+    }
+
+    shm_transport_close(shm);
+    close(fd);
+    free(out);
+    return EXIT_SUCCESS;
+}
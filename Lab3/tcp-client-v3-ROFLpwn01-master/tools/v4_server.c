@@ -0,0 +1,519 @@
+/*
+Reference server for protocol v4 (--v4), batch frames (--batch-frames) and extended frames
+(--stream). Answers v3 requests in order and, on connections that negotiate v4 with a hello frame,
+hands requests to a pool of worker threads that answer them as they finish, so a slow request does
+not hold back the ones behind it. With -D, shuffle and random requests take an extra USEC
+microseconds, which makes the reordering easy to see. On connections that negotiate batch frames,
+each batch is answered with one write, and on ones that negotiate extended frames, messages and
+responses may be longer than the 27-bit length field holds.
+
+Usage: v4_server [-v] [-w WORKERS] [-D USEC] (-p PORT | -u PATH)
+*/
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "actions.h"
+#include "log.h"
+#include "stream.h"
+#include "tcp_client.h"
+#include "v4.h"
+
+#define FRAME_LENGTH_MASK ((1u << 27) - 1)
+#define DEFAULT_WORKERS 4
+
+// Features a connection can negotiate
+#define FEATURE_V4 0x01
+#define FEATURE_BATCH 0x02
+#define FEATURE_EXTENDED 0x04
+#define USAGE "Usage: v4_server [-v] [-w WORKERS] [-D USEC] (-p PORT | -u PATH)\n"
+
+/*
+A client connection. Workers share it, so responses are written under writeLock and the last one
+to let go of it closes the socket.
+*/
+typedef struct Connection {
+    int fd;
+    pthread_mutex_t writeLock;
+    int refs;
+} Connection;
+
+/*
+A v4 request waiting for a worker.
+*/
+typedef struct Job {
+    Connection *connection;
+    uint32_t action;
+    uint32_t id;
+    char *message;
+    size_t length;
+    struct Job *next;
+} Job;
+
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueReady = PTHREAD_COND_INITIALIZER;
+static Job *queueHead;
+static Job *queueTail;
+static unsigned slowDelayUs;
+
+/*
+Description:
+    Receives exactly length bytes.
+Arguments:
+    int fd: The connection
+    void *buf: The buffer to fill
+    size_t length: The number of bytes to receive
+Return value:
+    Returns a 1 on failure or end of stream, 0 on success
+*/
+static int recvExactly(int fd, void *buf, size_t length) {
+    char *next = buf;
+    while (length > 0) {
+        ssize_t received = recv(fd, next, length, 0);
+        if (received == -1 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return 1;
+        next += received;
+        length -= received;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Sends every byte of a buffer.
+Arguments:
+    int fd: The connection
+    const char *buf: The bytes to send
+    size_t length: The number of bytes
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int sendAll(int fd, const char *buf, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, buf, length, MSG_NOSIGNAL);
+        if (sent == -1 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return 1;
+        buf += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+/*
+Description:
+    Drops a reference to a connection, closing it when it was the last.
+Arguments:
+    Connection *connection: The connection
+Return value:
+    None.
+*/
+static void releaseConnection(Connection *connection) {
+    if (__atomic_sub_fetch(&connection->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+    close(connection->fd);
+    pthread_mutex_destroy(&connection->writeLock);
+    free(connection);
+}
+
+/*
+Description:
+    Applies the action of a request and sends the response with the prefix the connection's
+    features call for: the v4 length and ID, the extended header for a response too long for the
+    27-bit length field, or the v3 length.
+Arguments:
+    Connection *connection: The connection
+    unsigned features: The features the connection negotiated
+    uint32_t action: The action code
+    uint32_t id: The request ID
+    const char *message: The message
+    size_t length: The length of the message
+    unsigned *seed: State of the random number generator
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int answer(Connection *connection, unsigned features, uint32_t action, uint32_t id,
+                  const char *message, size_t length, unsigned *seed) {
+    // The response goes after room for the longest prefix, which is then written just before it
+    char *out = malloc(STREAM_EXTENDED_HEADER_SIZE + 2 * length);
+    char *response = out + STREAM_EXTENDED_HEADER_SIZE;
+    char prefix[STREAM_EXTENDED_HEADER_SIZE];
+    size_t prefixLength;
+    if (out == NULL) {
+        log_error("Unable to allocate a %zu byte response", 2 * length);
+        return 1;
+    }
+
+    if (slowDelayUs > 0 && (action == ACTIONS_SHUFFLE || action == ACTIONS_RANDOM))
+        usleep(slowDelayUs);
+    size_t outLength = actions_apply(action, message, length, response, seed);
+    if (features & FEATURE_V4) {
+        uint32_t header[2] = {htonl(outLength), htonl(id)};
+        prefixLength = V4_RESPONSE_HEADER_SIZE;
+        memcpy(prefix, header, prefixLength);
+    } else if ((features & FEATURE_EXTENDED) && outLength > TCP_CLIENT_MAX_MESSAGE_LENGTH) {
+        uint32_t header = htonl(STREAM_EXTENDED_RESPONSE);
+        uint64_t extendedLength = htobe64(outLength);
+        prefixLength = STREAM_EXTENDED_HEADER_SIZE;
+        memcpy(prefix, &header, sizeof(header));
+        memcpy(prefix + sizeof(header), &extendedLength, sizeof(extendedLength));
+    } else {
+        uint32_t header = htonl(outLength);
+        prefixLength = TCP_CLIENT_RESPONSE_HEADER_SIZE;
+        memcpy(prefix, &header, prefixLength);
+    }
+    memcpy(response - prefixLength, prefix, prefixLength);
+
+    pthread_mutex_lock(&connection->writeLock);
+    int failed = sendAll(connection->fd, response - prefixLength, prefixLength + outLength);
+    pthread_mutex_unlock(&connection->writeLock);
+    free(out);
+    return failed;
+}
+
+/*
+Description:
+    Worker thread. Answers queued v4 requests until the process exits.
+Arguments:
+    void *arg: Unused
+Return value:
+    NULL
+*/
+static void *workerMain(void *arg) {
+    unsigned seed = time(NULL) ^ (uintptr_t)&seed;
+    (void)arg;
+
+    while (1) {
+        pthread_mutex_lock(&queueLock);
+        while (queueHead == NULL)
+            pthread_cond_wait(&queueReady, &queueLock);
+        Job *job = queueHead;
+        queueHead = job->next;
+        if (queueHead == NULL)
+            queueTail = NULL;
+        pthread_mutex_unlock(&queueLock);
+
+        log_debug("Request %u: action %u, %zu bytes", job->id, job->action, job->length);
+        answer(job->connection, FEATURE_V4, job->action, job->id, job->message, job->length,
+               &seed);
+        releaseConnection(job->connection);
+        free(job->message);
+        free(job);
+    }
+    return NULL;
+}
+
+/*
+Description:
+    Queues a v4 request for the workers.
+Arguments:
+    Job *job: The request
+Return value:
+    None.
+*/
+static void enqueue(Job *job) {
+    job->next = NULL;
+    pthread_mutex_lock(&queueLock);
+    if (queueTail != NULL)
+        queueTail->next = job;
+    else
+        queueHead = job;
+    queueTail = job;
+    pthread_cond_signal(&queueReady);
+    pthread_mutex_unlock(&queueLock);
+}
+
+/*
+Description:
+    Answers a hello frame, accepting every feature the client asked for that this server knows.
+Arguments:
+    Connection *connection: The connection
+    size_t length: The length of the hello's payload
+    unsigned *features: Set to the accepted features
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int answerHello(Connection *connection, size_t length, unsigned *features) {
+    static const struct {
+        const char *name;
+        unsigned flag;
+    } known[] = {{V4_FEATURE, FEATURE_V4},
+                 {TCP_CLIENT_BATCH_FEATURE, FEATURE_BATCH},
+                 {STREAM_FEATURE, FEATURE_EXTENDED}};
+    char wanted[TCP_CLIENT_MAX_HELLO];
+    char accepted[TCP_CLIENT_MAX_HELLO] = "";
+    if (length >= sizeof(wanted) || recvExactly(connection->fd, wanted, length))
+        return 1;
+    wanted[length] = '\0';
+
+    *features = 0;
+    for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+        if (!tcp_client_has_feature(wanted, known[i].name))
+            continue;
+        *features |= known[i].flag;
+        if (accepted[0] != '\0')
+            strcat(accepted, " ");
+        strcat(accepted, known[i].name);
+    }
+    uint32_t header = htonl(strlen(accepted));
+    log_info("Hello asking for \"%s\", accepting \"%s\"", wanted, accepted);
+    return sendAll(connection->fd, (char *)&header, sizeof(header)) ||
+           sendAll(connection->fd, accepted, strlen(accepted));
+}
+
+/*
+Description:
+    Answers the requests in a batch frame with one batch response, sent with one write.
+Arguments:
+    Connection *connection: The connection
+    const char *frames: The request frames inside the batch
+    size_t length: The length of the frames
+    unsigned *seed: State of the random number generator
+Return value:
+    Returns a 1 on failure, 0 on success
+*/
+static int answerBatch(Connection *connection, const char *frames, size_t length,
+                       unsigned *seed) {
+    // Every response is at most twice its message, and headers map one to one
+    char *out = malloc(TCP_CLIENT_RESPONSE_HEADER_SIZE + 2 * length);
+    size_t outLength = TCP_CLIENT_RESPONSE_HEADER_SIZE;
+    size_t offset = 0;
+    size_t count = 0;
+    if (out == NULL) {
+        log_error("Unable to allocate a %zu byte batch response", 2 * length);
+        return 1;
+    }
+
+    while (offset < length) {
+        uint32_t header;
+        if (length - offset < sizeof(header))
+            break;
+        memcpy(&header, frames + offset, sizeof(header));
+        header = ntohl(header);
+        size_t messageLength = header & FRAME_LENGTH_MASK;
+        if (length - offset - sizeof(header) < messageLength)
+            break;
+        size_t responseLength =
+            actions_apply(header >> 27, frames + offset + sizeof(header), messageLength,
+                          out + outLength + TCP_CLIENT_RESPONSE_HEADER_SIZE, seed);
+        uint32_t responseHeader = htonl(responseLength);
+        memcpy(out + outLength, &responseHeader, sizeof(responseHeader));
+        outLength += sizeof(responseHeader) + responseLength;
+        offset += sizeof(header) + messageLength;
+        count++;
+    }
+    if (offset != length) {
+        log_error("Batch frame ends in the middle of a request");
+        free(out);
+        return 1;
+    }
+
+    uint32_t batchHeader =
+        htonl(TCP_CLIENT_BATCH_RESPONSE | (uint32_t)(outLength - TCP_CLIENT_RESPONSE_HEADER_SIZE));
+    memcpy(out, &batchHeader, sizeof(batchHeader));
+    log_debug("Batch of %zu requests, %zu bytes in, %zu bytes out", count, length, outLength);
+    pthread_mutex_lock(&connection->writeLock);
+    int failed = sendAll(connection->fd, out, outLength);
+    pthread_mutex_unlock(&connection->writeLock);
+    free(out);
+    return failed;
+}
+
+/*
+Description:
+    Connection thread. Reads requests until the client closes the connection; v3 requests are
+    answered right away, batches of them with one write, and v4 requests are handed to the
+    workers. Extended frames are read into one buffer, since the actions need whole messages.
+Arguments:
+    void *arg: The connection
+Return value:
+    NULL
+*/
+static void *connectionMain(void *arg) {
+    Connection *connection = arg;
+    unsigned seed = time(NULL) ^ (uintptr_t)&seed;
+    unsigned features = 0;
+
+    while (1) {
+        uint32_t header;
+        uint32_t id = 0;
+        if (recvExactly(connection->fd, &header, sizeof(header)))
+            break;
+        header = ntohl(header);
+        uint32_t action = header >> 27;
+        size_t length = header & FRAME_LENGTH_MASK;
+
+        if (action == 0) {
+            if (answerHello(connection, length, &features))
+                break;
+            continue;
+        }
+        int batch = (features & FEATURE_BATCH) && action == TCP_CLIENT_BATCH_ACTION;
+        int extended = (features & FEATURE_EXTENDED) && action == STREAM_EXTENDED_ACTION;
+        if ((batch || extended) && (features & FEATURE_V4)) {
+            log_error("Batch and extended frames hold v3 requests, not v4 ones");
+            break;
+        }
+        if (extended) {
+            uint64_t extendedLength;
+            if (recvExactly(connection->fd, &extendedLength, sizeof(extendedLength)))
+                break;
+            action = header & FRAME_LENGTH_MASK;
+            length = be64toh(extendedLength);
+        }
+        if ((features & FEATURE_V4) && recvExactly(connection->fd, &id, sizeof(id)))
+            break;
+        char *message = malloc(length > 0 ? length : 1);
+        if (message == NULL || recvExactly(connection->fd, message, length)) {
+            if (message == NULL)
+                log_error("Unable to allocate a %zu byte message", length);
+            free(message);
+            break;
+        }
+
+        if (!(features & FEATURE_V4)) {
+            int failed = batch ? answerBatch(connection, message, length, &seed)
+                               : answer(connection, features, action, 0, message, length, &seed);
+            free(message);
+            if (failed)
+                break;
+            continue;
+        }
+        Job *job = malloc(sizeof(Job));
+        if (job == NULL) {
+            free(message);
+            break;
+        }
+        *job = (Job){connection, action, ntohl(id), message, length, NULL};
+        __atomic_add_fetch(&connection->refs, 1, __ATOMIC_ACQ_REL);
+        enqueue(job);
+    }
+    releaseConnection(connection);
+    return NULL;
+}
+
+/*
+Description:
+    Creates the listening socket.
+Arguments:
+    const char *port: The TCP port, or NULL
+    const char *path: The Unix socket path, or NULL
+Return value:
+    Returns the socket, or -1 on failure.
+*/
+static int listenOn(const char *port, const char *path) {
+    int fd;
+    if (path != NULL) {
+        struct sockaddr_un address = {.sun_family = AF_UNIX};
+        if (strlen(path) >= sizeof(address.sun_path))
+            return -1;
+        strcpy(address.sun_path, path);
+        unlink(path);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1 || bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1)
+            return -1;
+    } else {
+        struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(atoi(port))};
+        int one = 1;
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd == -1 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1 ||
+            bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1)
+            return -1;
+    }
+    return listen(fd, SOMAXCONN) == -1 ? -1 : fd;
+}
+
+int main(int argc, char *argv[]) {
+    const char *port = NULL;
+    const char *path = NULL;
+    int workers = DEFAULT_WORKERS;
+    int option;
+
+    log_set_level(LOG_INFO);
+    while ((option = getopt(argc, argv, "vw:D:p:u:")) != -1) {
+        switch (option) {
+        case 'v':
+            log_set_level(LOG_DEBUG);
+            break;
+        case 'w':
+            workers = atoi(optarg);
+            break;
+        case 'D':
+            slowDelayUs = strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            port = optarg;
+            break;
+        case 'u':
+            path = optarg;
+            break;
+        default:
+            fprintf(stderr, USAGE);
+            return EXIT_FAILURE;
+        }
+    }
+    if ((port == NULL) == (path == NULL) || workers < 1) {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    int listenfd = listenOn(port, path);
+    if (listenfd == -1) {
+        log_error("Unable to listen on %s: %s", path != NULL ? path : port, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < workers; i++) {
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, workerMain, NULL) != 0) {
+            log_error("Unable to start worker %d", i);
+            return EXIT_FAILURE;
+        }
+        pthread_detach(worker);
+    }
+    log_info("Listening on %s with %d workers", path != NULL ? path : port, workers);
+
+    while (1) {
+        int fd = accept(listenfd, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR)
+                continue;
+            log_error("accept failed: %s", strerror(errno));
+            break;
+        }
+        // Responses are written one at a time; Nagle would hold each back for the last one's ACK
+        int one = 1;
+        if (path == NULL && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1)
+            log_warn("Unable to set TCP_NODELAY: %s", strerror(errno));
+        Connection *connection = malloc(sizeof(Connection));
+        pthread_t thread;
+        if (connection == NULL) {
+            close(fd);
+            continue;
+        }
+        connection->fd = fd;
+        connection->refs = 1;
+        pthread_mutex_init(&connection->writeLock, NULL);
+        if (pthread_create(&thread, NULL, connectionMain, connection) != 0) {
+            releaseConnection(connection);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    close(listenfd);
+    return EXIT_FAILURE;
+}
@@ -5,6 +5,7 @@ import logging
 import argparse
 import methods
 import struct
+import os
 
 
 host = ""
@@ -22,6 +23,9 @@ parser.add_argument(
     "-v", "--verbose", help="increase output verbosity", action="store_true"
 )
 parser.add_argument("--port", "-p", type=int, default=port)
+parser.add_argument(
+    "--unix", "-u", metavar="PATH", help="listen on a Unix socket at PATH instead of TCP"
+)
 args = parser.parse_args()
 
 # Sets config for logger
@@ -35,14 +39,37 @@ logger.addHandler(ch)
 if args.verbose:
     logger.setLevel(logging.INFO)
 
+
+def recv_exactly(conn, length):
+    """Receives exactly length bytes, or fewer if the client disconnects"""
+    chunks = []
+    while length > 0:
+        chunk = conn.recv(length)
+        if not chunk:
+            break
+        chunks.append(chunk)
+        length -= len(chunk)
+    return b"".join(chunks)
+
+
 # Creates the socket and listens etc.
-server_socket = socket.socket()
-server_socket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
-server_socket.bind((host, port))
+if args.unix:
+    # A socket file left behind by an earlier run would make bind fail
+    if os.path.exists(args.unix):
+        os.unlink(args.unix)
+    server_socket = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    server_socket.bind(args.unix)
+else:
+    server_socket = socket.socket()
+    server_socket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server_socket.bind((host, args.port))
 server_socket.listen()
 
 logger.info("Config:")
-logger.info(f"     port: {port}")
+if args.unix:
+    logger.info(f"     unix: {args.unix}")
+else:
+    logger.info(f"     port: {args.port}")
 logger.info("Creating socket...")
 logger.info("Listening on socket...")
 
@@ -55,12 +82,15 @@ try:
         conn, address = server_socket.accept()
         logger.info("Got a new client!")
         logger.info(f"Connection from: {address}")
+        # Each response is written on its own, so Nagle would hold it for the last one's ACK
+        if not args.unix:
+            conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
         receiving_header = True
 
         while True:
             logger.info("Receiving header")
-            data = conn.recv(4)
-            if not data:
+            data = recv_exactly(conn, 4)
+            if len(data) < 4:
                 logger.info("Client disconnected...")
                 break
             unpacked = struct.unpack("!i", data)
@@ -68,7 +98,7 @@ try:
             message_length = unpacked[0] & FIELD2
 
             logger.info("Receiving message data")
-            msg = conn.recv(message_length).decode("cp437")
+            msg = recv_exactly(conn, message_length).decode("cp437")
             if len(msg) < message_length:
                 logger.error("Message not fully received")
                 conn.close()
@@ -119,8 +149,10 @@ try:
                 logger.info("Client disconnected...")
                 break
 
-            conn.send(struct.pack("!i", len(response_msg)))
-            conn.send(response_msg.encode())
+            # Case mapping can leave cp437 (e.g. 'â' upper-cases to 'Â'), so replace
+            # what cannot be encoded and prefix the length of the encoded reply
+            response_bytes = response_msg.encode("cp437", errors="replace")
+            conn.sendall(struct.pack("!i", len(response_bytes)) + response_bytes)
 
         conn.close()
 
@@ -0,0 +1,22 @@
+#!/usr/bin/env python3
+
+import socket
+import struct
+
+client = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+client.connect(("localhost", 8083))
+
+# Upper-casing 0x83 ('â') gives a character cp437 has no code for
+sending = b"\x08\x00\x00\x05h\x83llo"
+
+client.sendall(sending)
+
+received = b""
+while len(received) < 4:
+    received += client.recv(1024)
+(length,) = struct.unpack("!i", received[:4])
+while len(received) < 4 + length:
+    received += client.recv(1024)
+print(received)
+
+client.close()